@@ -7,11 +7,20 @@
 #pragma once
 
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include <kithare/file.hpp>
 #include <kithare/string.hpp>
 #include <kithare/token.hpp>
 
+/* Size of the blocks an `AstArena` carves its nodes out of. Its first blocks are smaller, from
+ * `KH_AST_ARENA_FIRST_BLOCK_SIZE` on they double in size up to this, so small trees such as a lazily
+ * parsed function body don't take up a whole block */
+#define KH_AST_ARENA_BLOCK_SIZE (64 << 10)
+#define KH_AST_ARENA_FIRST_BLOCK_SIZE (1 << 10)
 
 namespace kh {
     class AstModule;
@@ -44,23 +53,100 @@ namespace kh {
     class AstList;
     class AstDict;
 
+    /* Only filled in by a skeleton parse, see `parseLazyBody` in parser.hpp */
+    struct LazyBody;
+    struct LazyBodySource;
+    struct ParseSpans;
+
     std::u32string strfy(const AstModule& module_ast, size_t indent = 0);
     std::u32string strfy(const AstImport& import_ast, size_t indent = 0);
     std::u32string strfy(const AstUserType& type_ast, size_t indent = 0);
     std::u32string strfy(const AstEnumType& enum_ast, size_t indent = 0);
     std::u32string strfy(const AstBody& body_ast, size_t indent = 0);
 
+    /* Owns the nodes of a tree, which point at each other without owning. Nodes are bump allocated
+     * out of big blocks which are all freed together with the arena, only the nodes holding strings
+     * or vectors have their destructors run before that. Moving an arena doesn't move its nodes */
+    class AstArena {
+    public:
+        AstArena() = default;
+        AstArena(const AstArena&) = delete;
+        AstArena& operator=(const AstArena&) = delete;
+        ~AstArena();
+
+        inline AstArena(AstArena&& other) noexcept {
+            this->swap(other);
+        }
+
+        /* The nodes this arena had are freed along with `other` */
+        inline AstArena& operator=(AstArena&& other) noexcept {
+            this->swap(other);
+            return *this;
+        }
+
+        template <typename T, typename... Args>
+        T* make(Args&&... args) {
+            T* node = new (this->allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            if (!std::is_trivially_destructible<T>::value) {
+                this->finalizers.push_back({node, [](void* ptr) { static_cast<T*>(ptr)->~T(); }});
+            }
+            return node;
+        }
+
+        /* Takes over the nodes of `other`, which is left empty. They're freed along with this arena
+         * from then on, while new nodes still come from the block this arena was allocating from */
+        void adopt(AstArena&& other);
+
+        /* Bytes of the blocks allocated so far */
+        inline size_t size() const {
+            return this->allocated;
+        }
+
+    private:
+        struct Finalizer {
+            void* node;
+            void (*destroy)(void*);
+        };
+
+        std::vector<char*> blocks;
+        std::vector<Finalizer> finalizers;
+        char* cursor = nullptr;
+        char* limit = nullptr;
+        size_t allocated = 0;
+
+        inline void* allocate(size_t size, size_t alignment) {
+            uintptr_t address = ((uintptr_t)this->cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+            if (address + size > (uintptr_t)this->limit) {
+                return this->grow(size, alignment);
+            }
+            this->cursor = (char*)(address + size);
+            return (void*)address;
+        }
+
+        void* grow(size_t size, size_t alignment);
+        void swap(AstArena& other) noexcept;
+    };
+
     class AstModule {
     public:
+        /* Where every expression and statement of the module lives */
+        AstArena arena;
+
         std::vector<AstImport> imports;
         std::vector<AstFunction> functions;
         std::vector<AstUserType> user_types;
         std::vector<AstEnumType> enums;
         std::vector<AstDeclaration> variables;
 
-        AstModule(const std::vector<AstImport>& _imports, const std::vector<AstFunction>& _functions,
-                  const std::vector<AstUserType>& _user_types, const std::vector<AstEnumType>& _enums,
-                  const std::vector<AstDeclaration>& _variables);
+        /* What the function bodies skipped by a skeleton parse get parsed with */
+        LazyBodySource* lazy_source = nullptr;
+
+        /* Where the declarations and statements were parsed from, if it was parsed to be reparsed */
+        std::shared_ptr<ParseSpans> spans;
+
+        AstModule(std::vector<AstImport> _imports, std::vector<AstFunction> _functions,
+                  std::vector<AstUserType> _user_types, std::vector<AstEnumType> _enums,
+                  std::vector<AstDeclaration> _variables);
     };
 
     class AstImport {
@@ -73,15 +159,15 @@ namespace kh {
 
         bool is_public = true;
 
-        AstImport(size_t _index, const std::vector<std::string>& _path, bool _is_include,
-                  bool _is_relative, const std::string& _identifier);
+        AstImport(size_t _index, std::vector<std::string> _path, bool _is_include, bool _is_relative,
+                  std::string _identifier);
     };
 
     class AstUserType {
     public:
         size_t index;
         std::vector<std::string> identifiers;
-        std::shared_ptr<AstIdentifiers> base;
+        AstIdentifiers* base = nullptr;
         std::vector<std::string> generic_args;
         std::vector<AstDeclaration> members;
         std::vector<AstFunction> methods;
@@ -89,11 +175,9 @@ namespace kh {
 
         bool is_public = true;
 
-        AstUserType(size_t _index, const std::vector<std::string>& _identifiers,
-                    const std::shared_ptr<AstIdentifiers>& _base,
-                    const std::vector<std::string>& _generic_args,
-                    const std::vector<AstDeclaration>& _members,
-                    const std::vector<AstFunction>& _methods, bool _is_class);
+        AstUserType(size_t _index, std::vector<std::string> _identifiers, AstIdentifiers* _base,
+                    std::vector<std::string> _generic_args, std::vector<AstDeclaration> _members,
+                    std::vector<AstFunction> _methods, bool _is_class);
     };
 
     class AstEnumType {
@@ -105,8 +189,8 @@ namespace kh {
 
         bool is_public = true;
 
-        AstEnumType(size_t _index, const std::vector<std::string>& _identifiers,
-                    const std::vector<std::string>& _members, const std::vector<uint64_t>& _values);
+        AstEnumType(size_t _index, std::vector<std::string> _identifiers,
+                    std::vector<std::string> _members, std::vector<uint64_t> _values);
     };
 
     class AstBody {
@@ -123,7 +207,6 @@ namespace kh {
             STATEMENT
         } type = AstBody::NONE;
 
-        virtual ~AstBody() {}
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
@@ -149,7 +232,6 @@ namespace kh {
             DICT
         } expression_type = AstExpression::NONE;
 
-        virtual ~AstExpression() {}
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
@@ -161,11 +243,9 @@ namespace kh {
         std::vector<size_t> generics_refs;
         std::vector<std::vector<uint64_t>> generics_array;
 
-        AstIdentifiers(size_t _index, const std::vector<std::string>& _identifiers,
-                       const std::vector<AstIdentifiers>& _generics,
-                       const std::vector<size_t>& _generics_refs,
-                       const std::vector<std::vector<uint64_t>>& _generics_array);
-        virtual ~AstIdentifiers() {}
+        AstIdentifiers(size_t _index, std::vector<std::string> _identifiers,
+                       std::vector<AstIdentifiers> _generics, std::vector<size_t> _generics_refs,
+                       std::vector<std::vector<uint64_t>> _generics_array);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
@@ -175,16 +255,14 @@ namespace kh {
         AstIdentifiers var_type;
         std::vector<uint64_t> var_array;
         std::string var_name;
-        std::shared_ptr<AstExpression> expression;
+        AstExpression* expression = nullptr;
         size_t refs;
 
         bool is_public = true;
         bool is_static = false;
 
-        AstDeclaration(size_t _index, const AstIdentifiers& _var_type,
-                       const std::vector<uint64_t>& _var_array, const std::string& _var_name,
-                       std::shared_ptr<AstExpression>& _expression, size_t _refs);
-        virtual ~AstDeclaration() {}
+        AstDeclaration(size_t _index, AstIdentifiers _var_type, std::vector<uint64_t> _var_array,
+                       std::string _var_name, AstExpression* _expression, size_t _refs);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
@@ -200,19 +278,20 @@ namespace kh {
         size_t return_refs;
 
         std::vector<AstDeclaration> arguments;
-        std::vector<std::shared_ptr<AstBody>> body;
+        std::vector<AstBody*> body;
         bool is_conditional;
 
+        /* Set instead of `body` when a skeleton parse skipped over it, `parseLazyBody` gets either */
+        LazyBody* lazy_body = nullptr;
+
         bool is_public = true;
         bool is_static = false;
 
-        AstFunction(size_t _index, const std::vector<std::string>& _identifiers,
-                    const std::vector<std::string>& _generic_args,
-                    const std::vector<uint64_t>& _id_array, const std::vector<uint64_t>& _return_array,
-                    const AstIdentifiers& _return_type, size_t _return_refs,
-                    const std::vector<AstDeclaration>& _arguments,
-                    const std::vector<std::shared_ptr<AstBody>>& _body, bool _is_conditional);
-        virtual ~AstFunction() {}
+        AstFunction(size_t _index, std::vector<std::string> _identifiers,
+                    std::vector<std::string> _generic_args, std::vector<uint64_t> _id_array,
+                    std::vector<uint64_t> _return_array, AstIdentifiers _return_type,
+                    size_t _return_refs, std::vector<AstDeclaration> _arguments,
+                    std::vector<AstBody*> _body, bool _is_conditional);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
@@ -220,10 +299,9 @@ namespace kh {
     class AstUnaryOperation : public AstExpression {
     public:
         Operator operation;
-        std::shared_ptr<AstExpression> rvalue;
+        AstExpression* rvalue = nullptr;
 
-        AstUnaryOperation(size_t _index, Operator _operation, std::shared_ptr<AstExpression>& _rvalue);
-        virtual ~AstUnaryOperation() {}
+        AstUnaryOperation(size_t _index, Operator _operation, AstExpression* _rvalue);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
@@ -231,11 +309,9 @@ namespace kh {
     class AstRevUnaryOperation : public AstExpression {
     public:
         Operator operation;
-        std::shared_ptr<AstExpression> rvalue;
+        AstExpression* rvalue = nullptr;
 
-        AstRevUnaryOperation(size_t _index, Operator _operation,
-                             std::shared_ptr<AstExpression>& _rvalue);
-        virtual ~AstRevUnaryOperation() {}
+        AstRevUnaryOperation(size_t _index, Operator _operation, AstExpression* _rvalue);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
@@ -243,26 +319,23 @@ namespace kh {
     class AstBinaryOperation : public AstExpression {
     public:
         Operator operation;
-        std::shared_ptr<AstExpression> lvalue;
-        std::shared_ptr<AstExpression> rvalue;
+        AstExpression* lvalue = nullptr;
+        AstExpression* rvalue = nullptr;
 
-        AstBinaryOperation(size_t _index, Operator _operation, std::shared_ptr<AstExpression>& _lvalue,
-                           std::shared_ptr<AstExpression>& _rvalue);
-        virtual ~AstBinaryOperation() {}
+        AstBinaryOperation(size_t _index, Operator _operation, AstExpression* _lvalue,
+                           AstExpression* _rvalue);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstTernaryOperation : public AstExpression {
     public:
-        std::shared_ptr<AstExpression> condition;
-        std::shared_ptr<AstExpression> value;
-        std::shared_ptr<AstExpression> otherwise;
+        AstExpression* condition = nullptr;
+        AstExpression* value = nullptr;
+        AstExpression* otherwise = nullptr;
 
-        AstTernaryOperation(size_t _index, std::shared_ptr<AstExpression>& _condition,
-                            std::shared_ptr<AstExpression>& _value,
-                            std::shared_ptr<AstExpression>& _otherwise);
-        virtual ~AstTernaryOperation() {}
+        AstTernaryOperation(size_t _index, AstExpression* _condition, AstExpression* _value,
+                            AstExpression* _otherwise);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
@@ -270,47 +343,42 @@ namespace kh {
     class AstComparisonExpression : public AstExpression {
     public:
         std::vector<Operator> operations;
-        std::vector<std::shared_ptr<AstExpression>> values;
+        std::vector<AstExpression*> values;
 
-        AstComparisonExpression(size_t _index, const std::vector<Operator>& _operations,
-                                const std::vector<std::shared_ptr<AstExpression>>& _values);
-        virtual ~AstComparisonExpression() {}
+        AstComparisonExpression(size_t _index, std::vector<Operator> _operations,
+                                std::vector<AstExpression*> _values);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstSubscriptExpression : public AstExpression {
     public:
-        std::shared_ptr<AstExpression> expression;
-        std::vector<std::shared_ptr<AstExpression>> arguments;
+        AstExpression* expression = nullptr;
+        std::vector<AstExpression*> arguments;
 
-        AstSubscriptExpression(size_t _index, std::shared_ptr<AstExpression>& _expression,
-                               const std::vector<std::shared_ptr<AstExpression>>& _arguments);
-        virtual ~AstSubscriptExpression() {}
+        AstSubscriptExpression(size_t _index, AstExpression* _expression,
+                               std::vector<AstExpression*> _arguments);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstCallExpression : public AstExpression {
     public:
-        std::shared_ptr<AstExpression> expression;
-        std::vector<std::shared_ptr<AstExpression>> arguments;
+        AstExpression* expression = nullptr;
+        std::vector<AstExpression*> arguments;
 
-        AstCallExpression(size_t _index, std::shared_ptr<AstExpression>& _expression,
-                          const std::vector<std::shared_ptr<AstExpression>>& _arguments);
-        virtual ~AstCallExpression() {}
+        AstCallExpression(size_t _index, AstExpression* _expression,
+                          std::vector<AstExpression*> _arguments);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstScoping : public AstExpression {
     public:
-        std::shared_ptr<AstExpression> expression;
+        AstExpression* expression = nullptr;
         std::vector<std::string> identifiers;
 
-        AstScoping(size_t _index, std::shared_ptr<AstExpression>& _expression,
-                   const std::vector<std::string>& _identifiers);
-        virtual ~AstScoping() {}
+        AstScoping(size_t _index, AstExpression* _expression, std::vector<std::string> _identifiers);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
@@ -330,6 +398,9 @@ namespace kh {
         std::string buffer = "";
         std::u32string string = U"";
 
+        /* The contents of an embedded file, which are left mapped rather than copied into `buffer` */
+        std::shared_ptr<MappedFile> embedded;
+
         AstValue(size_t _index, char32_t _character,
                  AstValue::ValueType _value_type = AstValue::ValueType::CHARACTER);
         AstValue(size_t _index, uint64_t _uinteger,
@@ -338,110 +409,105 @@ namespace kh {
                  AstValue::ValueType _value_type = AstValue::ValueType::INTEGER);
         AstValue(size_t _index, double _floating,
                  AstValue::ValueType _value_type = AstValue::ValueType::FLOATING);
-        AstValue(size_t _index, const std::string& _buffer,
+        AstValue(size_t _index, std::string _buffer,
                  AstValue::ValueType _value_type = AstValue::ValueType::BUFFER);
-        AstValue(size_t _index, const std::u32string& _string,
+        AstValue(size_t _index, std::u32string _string,
                  AstValue::ValueType _value_type = AstValue::ValueType::STRING);
-        virtual ~AstValue() {}
+        AstValue(size_t _index, std::shared_ptr<MappedFile> _embedded);
+
+        /* Bytes of a buffer, whether it's embedded or not */
+        inline const char* bufferData() const {
+            return this->embedded ? this->embedded->data : this->buffer.data();
+        }
+
+        inline size_t bufferSize() const {
+            return this->embedded ? this->embedded->size : this->buffer.size();
+        }
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstTuple : public AstExpression {
     public:
-        std::vector<std::shared_ptr<AstExpression>> elements;
+        std::vector<AstExpression*> elements;
 
-        AstTuple(size_t _index, const std::vector<std::shared_ptr<AstExpression>>& _elements);
-        virtual ~AstTuple() {}
+        AstTuple(size_t _index, std::vector<AstExpression*> _elements);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstList : public AstExpression {
     public:
-        std::vector<std::shared_ptr<AstExpression>> elements;
+        std::vector<AstExpression*> elements;
 
-        AstList(size_t _index, const std::vector<std::shared_ptr<AstExpression>>& _elements);
-        virtual ~AstList() {}
+        AstList(size_t _index, std::vector<AstExpression*> _elements);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstDict : public AstExpression {
     public:
-        std::vector<std::shared_ptr<AstExpression>> keys;
-        std::vector<std::shared_ptr<AstExpression>> items;
+        std::vector<AstExpression*> keys;
+        std::vector<AstExpression*> items;
 
-        AstDict(size_t _index, const std::vector<std::shared_ptr<AstExpression>>& _keys,
-                const std::vector<std::shared_ptr<AstExpression>>& _items);
-        virtual ~AstDict() {}
+        AstDict(size_t _index, std::vector<AstExpression*> _keys, std::vector<AstExpression*> _items);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstIf : public AstBody {
     public:
-        std::vector<std::shared_ptr<AstExpression>> conditions; /* Including the else if conditions */
-        std::vector<std::vector<std::shared_ptr<AstBody>>> bodies;
-        std::vector<std::shared_ptr<AstBody>> else_body;
+        std::vector<AstExpression*> conditions; /* Including the else if conditions */
+        std::vector<std::vector<AstBody*>> bodies;
+        std::vector<AstBody*> else_body;
 
-        AstIf(size_t _index, const std::vector<std::shared_ptr<AstExpression>>& _conditions,
-              const std::vector<std::vector<std::shared_ptr<AstBody>>>& _bodies,
-              const std::vector<std::shared_ptr<AstBody>>& _else_body);
-        virtual ~AstIf() {}
+        AstIf(size_t _index, std::vector<AstExpression*> _conditions,
+              std::vector<std::vector<AstBody*>> _bodies, std::vector<AstBody*> _else_body);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstWhile : public AstBody {
     public:
-        std::shared_ptr<AstExpression> condition;
-        std::vector<std::shared_ptr<AstBody>> body;
+        AstExpression* condition = nullptr;
+        std::vector<AstBody*> body;
 
-        AstWhile(size_t _index, std::shared_ptr<AstExpression>& _condition,
-                 const std::vector<std::shared_ptr<AstBody>>& _body);
-        virtual ~AstWhile() {}
+        AstWhile(size_t _index, AstExpression* _condition, std::vector<AstBody*> _body);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstDoWhile : public AstBody {
     public:
-        std::shared_ptr<AstExpression> condition;
-        std::vector<std::shared_ptr<AstBody>> body;
+        AstExpression* condition = nullptr;
+        std::vector<AstBody*> body;
 
-        AstDoWhile(size_t _index, std::shared_ptr<AstExpression>& _condition,
-                   const std::vector<std::shared_ptr<AstBody>>& _body);
-        virtual ~AstDoWhile() {}
+        AstDoWhile(size_t _index, AstExpression* _condition, std::vector<AstBody*> _body);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstFor : public AstBody {
     public:
-        std::shared_ptr<AstExpression> initialize;
-        std::shared_ptr<AstExpression> condition;
-        std::shared_ptr<AstExpression> step;
-        std::vector<std::shared_ptr<AstBody>> body;
+        AstExpression* initialize = nullptr;
+        AstExpression* condition = nullptr;
+        AstExpression* step = nullptr;
+        std::vector<AstBody*> body;
 
-        AstFor(size_t _index, std::shared_ptr<AstExpression>& initialize,
-               std::shared_ptr<AstExpression>& condition, std::shared_ptr<AstExpression>& step,
-               const std::vector<std::shared_ptr<AstBody>>& _body);
-        virtual ~AstFor() {}
+        AstFor(size_t _index, AstExpression* initialize, AstExpression* condition, AstExpression* step,
+               std::vector<AstBody*> _body);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
 
     class AstForEach : public AstBody {
     public:
-        std::shared_ptr<AstExpression> target;
-        std::shared_ptr<AstExpression> iterator;
-        std::vector<std::shared_ptr<AstBody>> body;
+        AstExpression* target = nullptr;
+        AstExpression* iterator = nullptr;
+        std::vector<AstBody*> body;
 
-        AstForEach(size_t _index, std::shared_ptr<AstExpression>& _target,
-                   std::shared_ptr<AstExpression>& _iterator,
-                   const std::vector<std::shared_ptr<AstBody>>& _body);
-        virtual ~AstForEach() {}
+        AstForEach(size_t _index, AstExpression* _target, AstExpression* _iterator,
+                   std::vector<AstBody*> _body);
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
@@ -450,13 +516,11 @@ namespace kh {
     public:
         enum class Type { CONTINUE, BREAK, RETURN } statement_type;
 
-        std::shared_ptr<AstExpression> expression;
+        AstExpression* expression = nullptr;
         size_t loop_count;
 
-        AstStatement(size_t _index, AstStatement::Type _statement_type,
-                     std::shared_ptr<AstExpression>& _expression);
+        AstStatement(size_t _index, AstStatement::Type _statement_type, AstExpression* _expression);
         AstStatement(size_t _index, AstStatement::Type _statement_type, size_t _loop_count);
-        virtual ~AstStatement() {}
 
         virtual std::u32string strfy(size_t indent = 0) const;
     };
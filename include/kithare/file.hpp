@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <cstdio>
 #include <string>
 
 #include <kithare/exception.hpp>
@@ -14,11 +15,40 @@
 namespace kh {
     class FileError : public Exception {
     public:
-        FileError() {}
+        std::string what;
+
+        FileError(std::string _what = "unable to read file") : what(std::move(_what)) {}
         virtual ~FileError() {}
         virtual std::string format() const;
     };
 
+    /* Opens a file for reading bytes, for when it's read bit by bit rather than as a whole */
+    std::FILE* openFileBinary(const std::u32string& path);
+
+    /* Directory part of a path, empty if it's only a file name */
+    std::u32string parentDirectory(const std::u32string& path);
+
+    /* Resolves `path` relative to `directory`, unless it's absolute or there's no directory */
+    std::u32string resolvePath(const std::u32string& directory, const std::u32string& path);
+
+    /* Files bigger than `KH_SOURCE_MAX_SIZE` aren't read, as token offsets couldn't point into them */
     std::u32string readFile(const std::u32string& path);
     std::string readFileBinary(const std::u32string& path);
+
+    /* A whole file mapped read-only into memory, so big files can be used without reading them in.
+     * Files which can't be mapped, like empty ones, are read into `fallback` instead */
+    class MappedFile {
+    public:
+        const char* data = nullptr;
+        size_t size = 0;
+
+        MappedFile(const std::u32string& path);
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile();
+
+    private:
+        void* mapping = nullptr;
+        std::string fallback;
+    };
 }
@@ -0,0 +1,143 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <kithare/ast.hpp>
+
+
+namespace kh {
+    /* Nodes of a `FlatAst` refer to each other by their 32-bit index in its node table */
+    typedef uint32_t FlatId;
+    constexpr FlatId FLAT_NONE = (FlatId)-1;
+
+    /* The expression kinds are in the same order as `AstExpression::ExType` */
+    enum class FlatKind : uint8_t {
+        NONE, /* A missing expression or statement, such as one which failed to parse */
+        IDENTIFIER,
+        DECLARE,
+        FUNCTION,
+        UNARY,
+        REV_UNARY,
+        BINARY,
+        TERNARY,
+        COMPARISON,
+        SUBSCRIPT,
+        CALL,
+        SCOPE,
+        CONSTANT,
+        TUPLE,
+        LIST,
+        DICT,
+
+        BLOCK, /* The statements of a body */
+        IF,
+        WHILE,
+        DO_WHILE,
+        FOR,
+        FOREACH,
+        STATEMENT
+    };
+
+    enum FlatFlag : uint8_t {
+        FLAT_EMBEDDED = 1 << 0 /* A buffer constant which is in `FlatAst::embedded` */
+    };
+
+    /* The children of a node are linked in order, from `first_child` through `next_sibling`:
+     *
+     * - DECLARE: the initializer, if there's one
+     * - FUNCTION: the arguments as DECLARE nodes, then the BLOCK of the body
+     * - UNARY, REV_UNARY: the operand
+     * - BINARY: the left and right operands
+     * - TERNARY: the condition, the value and the otherwise value
+     * - COMPARISON: the compared values, there's one operator less in `FlatAst::operators`
+     * - SUBSCRIPT, CALL: the expression, then the arguments
+     * - SCOPE: the expression which is scoped into
+     * - TUPLE, LIST: the elements
+     * - DICT: every key followed by its item
+     * - BLOCK: the statements
+     * - IF: every condition followed by its BLOCK, then the BLOCK of `else`
+     * - WHILE, DO_WHILE: the condition, then the BLOCK
+     * - FOR: the initializer, the condition, the step, then the BLOCK
+     * - FOREACH: the target, the iterator, then the BLOCK
+     * - STATEMENT: the value of a `return`, if there's one
+     *
+     * Missing expressions in a fixed position, such as the operand of an operator which failed to
+     * parse, are NONE nodes */
+    struct FlatNode {
+        FlatKind kind;
+        uint8_t op; /* The operator, the value type of a constant or the type of a statement */
+        uint8_t flags;
+        FlatId first_child;
+        FlatId next_sibling;
+
+        /* Index into the side array of the node's payload, which depends on the kind:
+         *
+         * - IDENTIFIER: `identifiers`
+         * - DECLARE: `declarations`
+         * - FUNCTION: `functions`
+         * - COMPARISON: the first of its `operators`
+         * - SCOPE: `scopes`
+         * - CONSTANT: `numbers`, `strings`, `buffers` or `embedded`, by its value type
+         * - STATEMENT: the loop count of a `continue` or `break` in `numbers` */
+        uint32_t payload;
+
+        size_t index; /* Byte offset in the source */
+    };
+
+    /* An AST stored as one table of small fixed-size nodes, which are laid out in the order a tree
+     * walk visits them, instead of a class hierarchy of nodes pointing at each other. The parser
+     * still builds the class based AST, passes can be moved over to this one by converting it */
+    class FlatAst {
+    public:
+        std::vector<FlatNode> nodes;
+
+        /* Payloads of the nodes, declarations and functions are held without their initializers,
+         * arguments and bodies, which are their children instead */
+        std::vector<AstIdentifiers> identifiers;
+        std::vector<AstDeclaration> declarations;
+        std::vector<AstFunction> functions;
+        std::vector<std::vector<std::string>> scopes;
+        std::vector<Operator> operators;
+        std::vector<uint64_t> numbers; /* Floating point values are stored bitwise */
+        std::vector<std::u32string> strings;
+        std::vector<std::string> buffers;
+        std::vector<std::shared_ptr<MappedFile>> embedded;
+
+        /* Adds a tree, including everything under it, and returns the id of its root. A null tree
+         * is added as a NONE node */
+        FlatId add(const AstBody* body);
+        FlatId addBlock(const std::vector<AstBody*>& body, size_t index);
+
+        /* Rebuilds a tree added to this one, with its nodes allocated from `arena`. NONE nodes come
+         * back as null pointers */
+        AstBody* toAst(FlatId id, AstArena& arena) const;
+        std::vector<AstBody*> toBlock(FlatId id, AstArena& arena) const;
+
+        inline AstExpression* toExpression(FlatId id, AstArena& arena) const {
+            return static_cast<AstExpression*>(this->toAst(id, arena));
+        }
+
+        inline FlatId child(FlatId id, size_t nth) const {
+            FlatId child = this->nodes[id].first_child;
+            for (; nth > 0 && child != FLAT_NONE; nth--) {
+                child = this->nodes[child].next_sibling;
+            }
+            return child;
+        }
+
+        size_t childCount(FlatId id) const;
+
+    private:
+        FlatId push(FlatKind kind, size_t index, uint8_t op = 0, size_t payload = 0);
+
+        /* Links `child` after `last`, the last child added to `parent` so far */
+        void append(FlatId parent, FlatId& last, FlatId child);
+    };
+}
@@ -0,0 +1,78 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace kh {
+    /* Identifiers which are pre-interned by every `Interner`, so their symbol ids are fixed. The
+     * reserved keywords come first, making `isReservedKeyword` a single integer compare */
+    enum class Keyword : uint32_t {
+        PUBLIC,
+        PRIVATE,
+        STATIC,
+        TRY,
+        DEF,
+        CLASS,
+        STRUCT,
+        ENUM,
+        IMPORT,
+        INCLUDE,
+        IF,
+        ELIF,
+        ELSE,
+        FOR,
+        WHILE,
+        DO,
+        BREAK,
+        CONTINUE,
+        RETURN,
+        REF,
+
+        /* Contextual keywords, these can still be used as a name */
+        AS,
+        AND,
+        OR,
+        EMBED
+    };
+
+    const uint32_t RESERVED_KEYWORD_COUNT = (uint32_t)Keyword::REF + 1;
+    const uint32_t KEYWORD_COUNT = (uint32_t)Keyword::EMBED + 1;
+
+    /* Maps every distinct identifier to a dense 32-bit symbol id. Looking up an already interned
+     * identifier doesn't allocate, as it's probed straight from the source bytes */
+    class Interner {
+    public:
+        Interner();
+
+        uint32_t intern(const char* str, size_t length);
+
+        inline uint32_t intern(const std::string& str) {
+            return this->intern(str.data(), str.size());
+        }
+
+        inline const std::string& operator[](uint32_t id) const {
+            return this->names[id];
+        }
+
+        inline size_t size() const {
+            return this->names.size();
+        }
+
+    private:
+        std::vector<std::string> names;
+
+        /* Open addressing hash table of `id + 1`, with 0 marking an empty slot. Its size is always a
+         * power of two and kept at most half full */
+        std::vector<uint32_t> slots;
+
+        void grow();
+    };
+}
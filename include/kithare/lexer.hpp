@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <cstdio>
 #include <vector>
 
 #include <kithare/exception.hpp>
@@ -14,6 +15,16 @@
 
 #define KH_LEX_CTX LexerContext& context
 
+/* How many bytes past where it is the lexer may look at, such as the third quote of `""` or the `=`
+ * after a `+`. Errors may also be reported that much ahead, such as a bad digit of a `\x` escape */
+#define KH_LEX_LOOKAHEAD 8
+
+/* Sources from this size on get lexed in parallel chunks by `lex` */
+#define KH_LEX_PARALLEL_SIZE (16 << 20)
+
+/* Parallel lexing doesn't make chunks any smaller than this, as each of them has some fixed cost */
+#define KH_LEX_MIN_CHUNK_SIZE (256 << 10)
+
 
 namespace kh {
     class LexException : public Exception {
@@ -30,36 +41,203 @@ namespace kh {
     };
 
     struct LexerContext {
-        const std::u32string& source;
+        /* UTF-8 encoded source, it gets scanned byte by byte and multi-byte characters are only
+         * decoded where they're needed, such as in identifiers and strings. The tokens point to it, so
+         * it has to outlive them. It can't be any bigger than `KH_SOURCE_MAX_SIZE` */
+        const std::string& source;
         std::vector<LexException>& exceptions;
 
-        /* Character iterator */
+        /* Byte iterator */
         size_t ci = 0;
 
-        /* Gets character of the current iterator index */
+        /* Where `source` starts in the whole source, if it's only a window of a streamed one */
+        size_t base = 0;
+
+        /* Whether `source` goes on to the end of the whole source. If it doesn't, a token which runs
+         * into its end is left to be lexed once more of the source has come in */
+        bool is_final = true;
+
+        /* Lexing stops once it's in between tokens at or after this byte, for lexing in chunks */
+        size_t end = (size_t)-1;
+
+        /* Once `exceptions` holds this many, the rest of the errors aren't added, only a note saying
+         * so in place of the first one of them. Lexing goes on, so the parse still gets every token.
+         * Zero adds all of them */
+        size_t max_errors = 0;
+
+        /* Gets the byte of the current iterator index */
         inline char32_t chr() const {
-            return this->source[this->ci];
+            return (uint8_t)this->source[this->ci];
         }
     };
 
+    /* Bit flags of `char_classes`, a byte may be in multiple classes */
+    enum CharClass : uint8_t {
+        CHAR_SPACE = 1 << 0,
+        CHAR_ALPHA = 1 << 1, /* ASCII letters and the underscore, which can start an identifier */
+        CHAR_DEC = 1 << 2,
+        CHAR_HEX = 1 << 3,
+        CHAR_OCT = 1 << 4,
+        CHAR_BIN = 1 << 5,
+        CHAR_NON_ASCII = 1 << 6 /* Lead and continuation bytes of multi-byte UTF-8 characters */
+    };
+
+    /* Precomputed character classes of every byte, so the lexer doesn't go through the C locale for
+     * plain ASCII */
+    extern const uint8_t char_classes[256];
+
     inline bool isDec(char32_t chr) {
-        return U'0' <= chr && chr <= U'9';
+        return chr < 256 && (char_classes[chr] & CHAR_DEC);
     }
 
     inline bool isBin(char32_t chr) {
-        return chr == U'0' || chr == U'1';
+        return chr < 256 && (char_classes[chr] & CHAR_BIN);
     }
 
     inline bool isOct(char32_t chr) {
-        return U'0' <= chr && chr <= U'7';
+        return chr < 256 && (char_classes[chr] & CHAR_OCT);
     }
 
     inline bool isHex(char32_t chr) {
-        return (U'0' <= chr && chr <= U'9') || (U'a' <= chr && chr <= U'f') ||
-               (U'A' <= chr && chr <= U'F');
+        return chr < 256 && (char_classes[chr] & CHAR_HEX);
+    }
+
+    /* Two-level bitmaps of the Unicode XID_Start and XID_Continue properties, generated into
+     * `src/parser/xid.cpp` by `xidtables.py`. A code point's block of 256 picks one of the shared
+     * 256-bit bitmaps, which has the code point's bit */
+    constexpr size_t XID_BLOCK_COUNT = 0x110000 / 256;
+    extern const uint8_t xid_start_blocks[XID_BLOCK_COUNT];
+    extern const uint8_t xid_continue_blocks[XID_BLOCK_COUNT];
+    extern const uint32_t xid_bitmaps[][8];
+
+    inline bool testXid(const uint8_t* blocks, char32_t chr) {
+        return chr < 0x110000 && (xid_bitmaps[blocks[chr >> 8]][(chr >> 5) & 7] >> (chr & 31) & 1);
+    }
+
+    /* Identifier characters don't depend on the C locale, ASCII is looked up from `char_classes` */
+    inline bool isIdentifierStart(char32_t chr) {
+        return chr < 128 ? (char_classes[chr] & CHAR_ALPHA) != 0 : testXid(xid_start_blocks, chr);
+    }
+
+    inline bool isIdentifierContinue(char32_t chr) {
+        return chr < 128 ? (char_classes[chr] & (CHAR_ALPHA | CHAR_DEC)) != 0
+                         : testXid(xid_continue_blocks, chr);
+    }
+
+    /* Non-ASCII characters with the Unicode White_Space property */
+    inline bool isUnicodeSpace(char32_t chr) {
+        return chr == 0x85 || chr == 0xA0 || chr == 0x1680 || (chr >= 0x2000 && chr <= 0x200A) ||
+               chr == 0x2028 || chr == 0x2029 || chr == 0x202F || chr == 0x205F || chr == 0x3000;
+    }
+
+    /* Value of a hexadecimal digit */
+    inline uint32_t hexValue(char32_t chr) {
+        return chr <= '9' ? chr - '0' : (chr | 0x20) - 'a' + 10;
     }
 
-    std::vector<Token> lex(const std::u32string& source);
+    /* Tokens and errors of lexing a whole source, returned together so the errors can be checked
+     * without having to catch them */
+    struct LexResult {
+        TokenStream tokens;
+        std::vector<LexException> exceptions;
 
-    std::vector<Token> lex(KH_LEX_CTX);
+        inline bool ok() const {
+            return this->exceptions.empty();
+        }
+    };
+
+    /* The tokens only point to `source`, which has to outlive them for their lines, columns and
+     * string contents to be looked up, so lexing a temporary isn't allowed */
+    LexResult lex(const std::string& source);
+    LexResult lex(std::string&& source) = delete;
+
+    /* Sources of at least `KH_LEX_PARALLEL_SIZE` bytes are lexed with `lexParallel` on every hardware
+     * thread */
+    TokenStream lex(KH_LEX_CTX);
+
+    /* Lexes from `context.ci` into `tokens`, until the end of the source or until `tokens` holds
+     * `token_limit` tokens, and leaves `ci` where it stopped. Returns true if it stopped because a
+     * source which isn't final ran out. Lines and columns of errors are only looked up if `tokens` has
+     * its source set */
+    bool lexPart(KH_LEX_CTX, TokenStream& tokens, size_t token_limit);
+
+    /* Lexes the whole source like `lex`, but splits it into chunks of at least `min_chunk_size` bytes
+     * at line starts and lexes them on `thread_count` threads. Every chunk gets lexed for each state
+     * the lexer could be in at its start, which is in between tokens, inside a multiple line comment
+     * or inside a multiple line string. Once the real state at each chunk start is known, the
+     * matching results are stitched together, so the tokens and errors are exactly the same as
+     * lexing serially */
+    TokenStream lexParallel(KH_LEX_CTX, size_t thread_count,
+                            size_t min_chunk_size = KH_LEX_MIN_CHUNK_SIZE);
+
+    /* Checks that no error is reported right at or after `index` by the lexer being somewhere before
+     * it, which makes `index` a clean point to split the errors of two lexer runs at */
+    bool isClearOfErrors(const std::vector<LexException>& exceptions, size_t index);
+
+    /* Replaces `removed` bytes at the byte `index` of a source with `inserted` */
+    struct SourceEdit {
+        size_t index;
+        size_t removed;
+        std::string inserted;
+    };
+
+    /* Which tokens an edit replaced: `removed` tokens from the token `index` on were replaced by
+     * `inserted` new ones, and the tokens after them were moved by `shift` bytes */
+    struct TokenEdit {
+        size_t index;
+        size_t removed;
+        size_t inserted;
+        ptrdiff_t shift;
+    };
+
+    /* Applies an edit to a lexed source and updates its tokens and lexer errors to match. Only the
+     * part from the last token which ends safely before the edit up to where the tokens line up with
+     * the old ones again gets lexed, the offsets of the rest of the tokens are just moved. Returns
+     * which tokens were lexed again, some of them can still be the same as before */
+    TokenEdit relex(std::string& source, TokenStream& tokens, std::vector<LexException>& exceptions,
+                    const SourceEdit& edit);
+
+    /* Lexes a source as it's read from a file or pipe in chunks. Only a window of the source and the
+     * tokens is held, the parser pulls tokens into it and releases the ones it won't backtrack to
+     * anymore, so memory is bound by the lookahead and the nesting of the code rather than the
+     * source size */
+    class StreamLexer {
+    public:
+        /* Tokens which were pulled and not released yet, the first one is `tokens.base` */
+        TokenStream tokens;
+        std::vector<LexException>& exceptions;
+
+        /* See `LexerContext::max_errors` */
+        size_t max_errors = 0;
+
+        StreamLexer(std::FILE* file, std::vector<LexException>& exceptions, size_t lookahead = 256,
+                    size_t chunk_size = 65536);
+        StreamLexer(const StreamLexer&) = delete;
+        StreamLexer& operator=(const StreamLexer&) = delete;
+
+        /* Lexes until the token `ti` of the whole stream is in the window, along with up to
+         * `lookahead` tokens after it. Returns false if the source ended before it */
+        bool pull(size_t ti);
+
+        /* Lets go of the tokens before `ti` of the whole stream, and of the source they came from */
+        void release(size_t ti);
+
+    private:
+        std::FILE* file;
+        size_t lookahead;
+        size_t chunk_size;
+
+        /* Source window, which starts at the byte `offset` of the whole source */
+        std::string buffer;
+        size_t offset = 0;
+
+        /* Where in the whole source lexing goes on from */
+        size_t resume = 0;
+
+        bool is_eof = false;
+        bool is_done = false;
+
+        void read();
+        void trim();
+    };
 }
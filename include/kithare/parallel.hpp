@@ -0,0 +1,37 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+namespace kh {
+    /* Runs `work(index)` for every index below `count` on up to `thread_count` threads, the calling
+     * thread being one of them. Indexes are handed out in order as the threads get free */
+    template <typename Work>
+    void runParallel(size_t count, size_t thread_count, Work work) {
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            for (size_t index = next++; index < count; index = next++) {
+                work(index);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t thread = 1; thread < std::min(thread_count, count); thread++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+}
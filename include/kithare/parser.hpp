@@ -6,89 +6,355 @@
 
 #pragma once
 
+#include <mutex>
+
 #include <kithare/ast.hpp>
 #include <kithare/exception.hpp>
+#include <kithare/lexer.hpp>
 #include <kithare/string.hpp>
 #include <kithare/token.hpp>
 
 #define KH_PARSE_GUARD()                                                                    \
     do {                                                                                    \
-        if (context.ti >= context.tokens.size()) {                                          \
+        if (context.eof()) {                                                                \
             context.exceptions.emplace_back("expected a token but reached the end of file", \
-                                            context.tokens.back());                         \
+                                            context.last());                                \
             goto end;                                                                       \
         }                                                                                   \
     } while (false)
 
 #define KH_PARSE_CTX ParserContext& context
 
+/* Modules from this many tokens on get their top level declarations parsed in parallel by
+ * `parseWhole` */
+#define KH_PARSE_PARALLEL_SIZE (1 << 20)
+
+/* Parallel parsing doesn't make chunks of any less tokens than this, as each of them has some fixed
+ * cost */
+#define KH_PARSE_MIN_CHUNK_SIZE (1 << 14)
+
+/* Expressions, types and bodies can't be nested any deeper than this by default, see
+ * `ParserContext::max_depth` */
+#define KH_PARSE_MAX_DEPTH 256
+
+/* The parse stops once it raised this many exceptions by default, see `ParserContext::max_errors` */
+#define KH_PARSE_MAX_ERRORS 100
+
 
 namespace kh {
     class ParseException : public Exception {
     public:
         std::string what;
-        Token token;
+        size_t index; /* Byte offset of the token it's at */
+
+        /* Only looked up from the index once the parsing is done, see `resolveExceptions` */
+        size_t column = 0;
+        size_t line = 0;
 
-        ParseException(const std::string _what, const Token& _token) : what(_what), token(_token) {}
+        ParseException(std::string _what, const Token& _token)
+            : what(std::move(_what)), index(_token.index) {}
         virtual ~ParseException() {}
         virtual std::string format() const;
     };
 
+    /* Shared by the function bodies which a skeleton parse of a module skipped. The tokens have to
+     * outlive the module for its bodies to be parsed */
+    struct LazyBodySource {
+        const TokenStream& tokens;
+        std::u32string directory;
+        size_t max_depth = KH_PARSE_MAX_DEPTH;
+        size_t max_errors = KH_PARSE_MAX_ERRORS;
+
+        /* Guards the nodes and the exceptions of the bodies which were parsed so far */
+        std::mutex mutex;
+        AstArena arena;
+        std::vector<ParseException> exceptions;
+
+        LazyBodySource(const TokenStream& _tokens, std::u32string _directory)
+            : tokens(_tokens), directory(std::move(_directory)) {}
+    };
+
+    /* A function body which a skeleton parse skipped, from its opening curly bracket at the token
+     * `begin` to the token `end` right after the matching closing one */
+    struct LazyBody {
+        LazyBodySource* source;
+        size_t begin;
+        size_t end;
+
+        std::once_flag parsed;
+        std::vector<AstBody*> body;
+
+        LazyBody(LazyBodySource* _source, size_t _begin, size_t _end)
+            : source(_source), begin(_begin), end(_end) {}
+    };
+
+    /* Where a top level declaration, or a statement right in the body of a function or method which
+     * isn't a lambda, was parsed from. The parse only looked at the tokens from `begin` up to and
+     * including `end`, where it stopped, so it comes out the same wherever those tokens are the same */
+    struct ParseSpan {
+        enum class Kind : uint8_t { NONE, IMPORT, FUNCTION, USER_TYPE, ENUM, VARIABLE, STATEMENT };
+
+        size_t begin;
+        size_t end = (size_t)-1; /* Left like this if it ran into the end of the file */
+
+        /* The exceptions it raised, in `ParseSpans::exceptions` */
+        size_t exceptions_begin;
+        size_t exceptions_end = 0;
+
+        /* What it was added to the module or to the body as, if anything. The statement can be
+         * null if its expression failed to parse */
+        Kind kind = Kind::NONE;
+        AstBody* statement = nullptr;
+
+        /* How many bytes the offsets of a declaration are still to be moved by, its statements'
+         * included. `reparse` only adds to this, rather than walking the declaration, see
+         * `settleOffsets` */
+        ptrdiff_t shift = 0;
+
+        ParseSpan(size_t _begin, size_t _exceptions_begin)
+            : begin(_begin), exceptions_begin(_exceptions_begin) {}
+    };
+
+    /* Recorded by parsing with `ParserContext::incremental`, for `reparse` to tell which parts of a
+     * module an edit didn't touch. The spans are in the order they start in */
+    struct ParseSpans {
+        std::vector<ParseSpan> declarations;
+        std::vector<ParseSpan> statements;
+
+        /* Every exception raised while parsing, before the repeated ones were dropped */
+        std::vector<ParseException> exceptions;
+    };
+
     struct ParserContext {
-        const std::vector<Token>& tokens;
+        const TokenStream& tokens;
         std::vector<ParseException>& exceptions;
 
         /* Token iterator */
         size_t ti = 0;
 
-        /* Gets token of the current iterator index */
-        inline Token& tok() const {
-            return *(Token*)(size_t) & this->tokens[this->ti];
+        /* Tokens from this one on are taken as past the end, so a lazily parsed function body stays
+         * within the curly brackets which the skeleton parse matched, even if it's broken */
+        size_t end_ti = (size_t)-1;
+
+        /* Where the tokens get pulled from as they're needed, if they're streamed rather than all
+         * lexed beforehand. `tokens` is then the stream's window */
+        StreamLexer* stream = nullptr;
+
+        /* Where the nodes get allocated, it's set by `parseWhole` to the arena of the module */
+        AstArena* arena = nullptr;
+
+        /* Where the paths of embedded files are relative to, the working directory if it's empty */
+        std::u32string directory = U"";
+
+        /* Makes `parseWhole` skip over function bodies by matching their curly brackets, so parsing
+         * a module only takes as long as its declarations. A body is parsed the first time it's
+         * needed, see `parseLazyBody`. Only in broken code, where the statements don't end with the
+         * curly brackets, can that come out differently than parsing the bodies right away. A
+         * streamed module is always parsed as a whole, as its tokens don't stay around */
+        bool skeleton = false;
+
+        /* Where the skipped bodies are parsed from, it's set by `parseWhole` in skeleton mode */
+        LazyBodySource* lazy_source = nullptr;
+
+        /* Makes `parseWhole` record the `ParseSpans` of the module, so it can be reparsed after an
+         * edit. It's parsed serially and as a whole, not in parallel nor as a skeleton */
+        bool incremental = false;
+
+        /* Where the spans get recorded, and where `reparse` takes the statements of the previous
+         * parse over from, with the edit which was made to the tokens since */
+        ParseSpans* spans = nullptr;
+        const ParseSpans* previous_spans = nullptr;
+        TokenEdit previous_edit{0, 0, 0, 0};
+
+        /* How many expressions, types and bodies the parse is in. The parser recurses through each
+         * of them, so a construct nested deeper than `max_depth` is reported and skipped instead of
+         * being parsed, see `skipNested`. That keeps pathological code from overflowing the native
+         * stack, here as well as in everything which walks the AST afterwards */
+        size_t depth = 0;
+        size_t max_depth = KH_PARSE_MAX_DEPTH;
+
+        /* Once the parse raised this many exceptions, it stops at the next statement or declaration,
+         * see `stopAtErrorLimit`. Zero lets it go on, as does an incremental parse, since `reparse`
+         * needs every declaration of the module */
+        size_t max_errors = KH_PARSE_MAX_ERRORS;
+        bool is_stopped = false;
+
+        /* Exceptions before this one already have their lines and columns */
+        size_t resolved_exceptions = 0;
+
+        /* Checks if the iterator went past the last token, or if there's no token `offset` tokens
+         * ahead of it when looking ahead */
+        inline bool eof(size_t offset = 0) const {
+            return this->ti + offset >= this->end_ti ||
+                   (this->ti + offset - this->tokens.base >= this->tokens.size() &&
+                    (!this->stream || !this->stream->pull(this->ti + offset)));
+        }
+
+        /* Gets token of the current iterator index, or `offset` tokens ahead of it, or the last
+         * token past the end */
+        inline Token tok(size_t offset = 0) const {
+            if (this->eof(offset)) {
+                return this->last();
+            }
+            return this->tokens[this->ti + offset - this->tokens.base];
+        }
+
+        /* Gets the last token before the end, which is `end_ti` if it's set */
+        inline Token last() const {
+            if (this->end_ti - this->tokens.base < this->tokens.size()) {
+                return this->tokens[this->end_ti - 1 - this->tokens.base];
+            }
+            return this->tokens.back();
         }
+
+        /* Lets a stream drop the tokens before the iterator, nothing backtracks past it anymore. The
+         * exceptions get their lines and columns first, while their part of the source is still held */
+        inline void release() {
+            if (this->stream) {
+                this->resolveExceptions();
+                this->stream->release(this->ti);
+            }
+        }
+
+        /* Looks up the lines and columns of the exceptions which don't have them yet */
+        void resolveExceptions();
+
+        /* Checks if the parse ran out of errors. If it did, every token from the iterator on is taken
+         * as past the end, so whatever is being parsed unwinds without looking any further */
+        bool stopAtErrorLimit();
+
+        /* Once the parsing is done, drops the exceptions which are at the same token as the one right
+         * before them, as they mostly follow from it, and looks up where the rest of them are. If the
+         * parse stopped, or there are more than `max_errors` of them anyway, the ones past the limit
+         * are replaced with a note saying so */
+        void finishExceptions();
     };
 
-    inline bool isReservedKeyword(const std::string& identifier) {
-        return identifier == "public" || identifier == "private" || identifier == "static" ||
-               identifier == "try" || identifier == "def" || identifier == "class" ||
-               identifier == "struct" || identifier == "enum" || identifier == "import" ||
-               identifier == "include" || identifier == "if" || identifier == "elif" ||
-               identifier == "else" || identifier == "for" || identifier == "while" ||
-               identifier == "do" || identifier == "break" || identifier == "continue" ||
-               identifier == "return" || identifier == "ref";
-    }
+    /* Counts `levels` more levels of nesting for as long as it's around. It's made at the start of
+     * each parse which can be nested, before anything jumps to its end */
+    class ParseNesting {
+    public:
+        ParserContext& context;
+        size_t levels;
 
-    AstModule parse(const std::vector<Token>& tokens);
-    AstExpression* parseExpression(const std::vector<Token>& tokens);
+        ParseNesting(ParserContext& _context, size_t _levels = 1)
+            : context(_context), levels(_levels) {
+            this->context.depth += this->levels;
+        }
+        ~ParseNesting() {
+            this->context.depth -= this->levels;
+        }
+
+        /* Reports that the construct at the iterator is nested too deeply and skips it, if it is */
+        bool tooDeep();
+
+        /* Counts one more level for a link of a chain which is parsed in a loop rather than by
+         * recursing, such as `a + b + c` or `a[0](1)`, as each link nests the ones before it in the
+         * tree. The operands of the link are yet another level deeper, so if they would be too deep,
+         * the rest of the chain is reported and skipped */
+        bool deeper();
+
+    private:
+        void skip(bool is_rest);
+    };
+
+    /* Skips the tokens of a construct which is nested too deeply to be parsed, along with every
+     * bracket in it. It ends after the brackets it starts with if it starts with one, or else right
+     * before a `;`, a `,`, an opening curly bracket or a closing bracket of the brackets it's in.
+     * With `is_rest`, it always skips up until the latter, for the rest of a chain such as
+     * `[0][0]` */
+    void skipNested(KH_PARSE_CTX, bool is_rest = false);
+
+    /* Recovers from a statement, or a top level declaration, which started at the token `begin` and
+     * raised an exception. Unless it ended with a `;` or a `}`, the rest of it is skipped up until
+     * the `;` it ends with or right before the `}` of the body it's in, or a keyword which only starts
+     * another statement or declaration. That way its mistake is only reported once, rather than for
+     * each token which is left of it */
+    void synchronize(KH_PARSE_CTX, size_t begin, bool is_top_scope);
+
+    AstModule parse(const TokenStream& tokens);
+    /* The expression's nodes are allocated from `arena`, which has to outlive them */
+    AstExpression* parseExpression(const TokenStream& tokens, AstArena& arena);
 
     /* Most of these parses stuff such as imports, includes, classes, structs, enums, functions at the
-     * top level scope */
+     * top level scope. Modules of at least `KH_PARSE_PARALLEL_SIZE` tokens which aren't streamed are
+     * parsed with `parseParallel` on every hardware thread */
     AstModule parseWhole(KH_PARSE_CTX);
+
+    /* Parses the top level declarations from `context.ti` on into `ast`, until the first one which
+     * starts at or after the token `end_ti`, or until the end. Nothing is carried over from one top
+     * level declaration to the next, so where this stops only depends on the tokens and where it
+     * started */
+    void parseTopScope(KH_PARSE_CTX, AstModule& ast, size_t end_ti = (size_t)-1);
+
+    /* Parses the whole module like `parseWhole`, but first looks for where top level declarations
+     * start, outside of any brackets and right after a `;` or `}`, to split the tokens into chunks of
+     * at least `min_chunk_size` tokens there. The chunks are parsed on `thread_count` threads and
+     * merged in order. A chunk which didn't stop right where the next one starts, as can happen with
+     * broken code, is followed by parsing serially until they line up again, so the module and the
+     * exceptions are exactly the same as parsing serially */
+    AstModule parseParallel(KH_PARSE_CTX, size_t thread_count,
+                            size_t min_chunk_size = KH_PARSE_MIN_CHUNK_SIZE);
+
+    /* Parses a module again after its tokens were edited as `edit` tells, see `relex`. The top level
+     * declarations, and the statements right in function bodies, whose tokens the edit didn't touch
+     * are taken over from `old` rather than parsed. The module and the exceptions come out the same
+     * as parsing the edited tokens from scratch, but the offsets of the declarations after the edit
+     * are only moved once `settleOffsets` is called, so a reparse doesn't take longer the more of
+     * them there are. `old` has to be parsed with `incremental` set, or else it's all parsed again.
+     * The nodes which were replaced stay in the arena of the module until it's freed */
+    AstModule reparse(KH_PARSE_CTX, AstModule old, const TokenEdit& edit);
+
+    /* Moves the offsets of the declarations of a reparsed module which are still to be moved, after
+     * any number of reparses. It has to be called before looking at the offsets */
+    void settleOffsets(AstModule& module_ast);
+
+    /* Takes over the statement of the previous parse which started at `context.ti`, if the edit
+     * didn't touch its tokens, see `reparse` */
+    bool reuseStatement(KH_PARSE_CTX, std::vector<AstBody*>& body);
     void parseAccessAttribs(KH_PARSE_CTX, bool& is_public, bool& is_static);
     AstImport parseImport(KH_PARSE_CTX, bool is_include);
+    AstDeclaration parseEmbed(KH_PARSE_CTX);
     AstFunction parseFunction(KH_PARSE_CTX, bool is_conditional);
+
+    /* Gets the body of a function, first parsing it if a skeleton parse skipped it and it's the first
+     * time it's needed. It can be called from many threads at once, a body is still only parsed
+     * once. The exceptions of the body go to the `LazyBodySource` of the module */
+    const std::vector<AstBody*>& parseLazyBody(const AstFunction& function);
     AstDeclaration parseDeclaration(KH_PARSE_CTX);
+    /* Parses the rest of a declaration whose type was already parsed, starting from its array
+     * dimension. `index` is where the declaration started */
+    AstDeclaration parseDeclaration(KH_PARSE_CTX, size_t index, AstIdentifiers var_type, size_t refs);
     AstUserType parseUserType(KH_PARSE_CTX, bool is_class);
     AstEnumType parseEnum(KH_PARSE_CTX);
-    std::vector<std::shared_ptr<AstBody>> parseBody(KH_PARSE_CTX, size_t loop_count = 0);
+    std::vector<AstBody*> parseBody(KH_PARSE_CTX, size_t loop_count = 0);
     void parseTopScopeIdentifiersAndGenericArgs(KH_PARSE_CTX, std::vector<std::string>& identifiers,
                                                 std::vector<std::string>& generic_args);
 
-    /* These parse expressions below are ordered based from their precedence from lowest to
-     * highest */
+    /* Operators bind from the loosest to the tightest in this order. `!` and the other prefix
+     * operators take on everything binding tighter than themselves */
+    enum Precedence : uint8_t {
+        PRECEDENCE_NONE,
+        PRECEDENCE_ASSIGN,
+        PRECEDENCE_TERNARY,
+        PRECEDENCE_OR,
+        PRECEDENCE_AND,
+        PRECEDENCE_NOT,
+        PRECEDENCE_COMPARISON,
+        PRECEDENCE_BIT_OR,
+        PRECEDENCE_BIT_AND,
+        PRECEDENCE_BIT_SHIFT,
+        PRECEDENCE_ADD_SUB,
+        PRECEDENCE_MUL_DIV_MOD,
+        PRECEDENCE_UNARY,
+        PRECEDENCE_POW
+    };
+
+    /* Expressions are parsed by precedence climbing, `parseBinary` parses an operand and then every
+     * operator after it which binds at least as tight as `min_precedence`. Postfix operators and
+     * the operands themselves are parsed by `parseRevUnary` and `parseOthers` */
     AstExpression* parseExpression(KH_PARSE_CTX);
-    AstExpression* parseAssignOps(KH_PARSE_CTX);
-    AstExpression* parseTernary(KH_PARSE_CTX);
-    AstExpression* parseOr(KH_PARSE_CTX);
-    AstExpression* parseAnd(KH_PARSE_CTX);
-    AstExpression* parseNot(KH_PARSE_CTX);
-    AstExpression* parseComparison(KH_PARSE_CTX);
-    AstExpression* parseBitwiseOr(KH_PARSE_CTX);
-    AstExpression* parseBitwiseAnd(KH_PARSE_CTX);
-    AstExpression* parseBitwiseShift(KH_PARSE_CTX);
-    AstExpression* parseAddSub(KH_PARSE_CTX);
-    AstExpression* parseMulDivMod(KH_PARSE_CTX);
-    AstExpression* parseUnary(KH_PARSE_CTX);
-    AstExpression* parseExponentiation(KH_PARSE_CTX);
+    AstExpression* parseBinary(KH_PARSE_CTX, uint8_t min_precedence);
     AstExpression* parseRevUnary(KH_PARSE_CTX);
     AstExpression* parseOthers(KH_PARSE_CTX);
     AstIdentifiers parseIdentifiers(KH_PARSE_CTX);
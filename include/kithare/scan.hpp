@@ -0,0 +1,70 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KH_SCAN_SSE2
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define KH_SCAN_AVX2
+#endif
+#endif
+
+
+namespace kh {
+    /* Instruction sets the skip routines can be running with, from the slowest to the fastest */
+    enum class SimdLevel { SCALAR, SSE2, AVX2 };
+
+    /* A skip routine returns the index of the first byte from `index` which it doesn't skip over, or
+     * `size` if it reached the end */
+    typedef size_t (*SkipRoutine)(const char* str, size_t index, size_t size);
+
+    struct SkipRoutines {
+        SkipRoutine spaces;
+        SkipRoutine identifier;
+        SkipRoutine line;
+        SkipRoutine comment;
+        SkipRoutine string;
+    };
+
+    /* Routines of the currently selected `SimdLevel`, it's picked on startup by checking the CPU */
+    extern const SkipRoutines* skip_routines;
+
+    /* The best level supported by the CPU the program is running on */
+    SimdLevel detectSimdLevel();
+    SimdLevel getSimdLevel();
+
+    /* Overrides the level, a level which isn't supported falls back to the best supported one */
+    void setSimdLevel(SimdLevel level);
+
+    /* Skips over ASCII whitespace and newlines */
+    inline size_t skipSpaces(const char* str, size_t index, size_t size) {
+        return skip_routines->spaces(str, index, size);
+    }
+
+    /* Skips over ASCII identifier characters, non-ASCII characters are left for the caller to decode */
+    inline size_t skipIdentifier(const char* str, size_t index, size_t size) {
+        return skip_routines->identifier(str, index, size);
+    }
+
+    /* Skips to the next newline */
+    inline size_t skipLine(const char* str, size_t index, size_t size) {
+        return skip_routines->line(str, index, size);
+    }
+
+    /* Skips to the next `*`, which might be closing a multiple line comment */
+    inline size_t skipComment(const char* str, size_t index, size_t size) {
+        return skip_routines->comment(str, index, size);
+    }
+
+    /* Skips over plain ASCII string characters, stopping at `"`, `\`, a newline or a non-ASCII byte */
+    inline size_t skipString(const char* str, size_t index, size_t size) {
+        return skip_routines->string(str, index, size);
+    }
+}
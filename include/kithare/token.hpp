@@ -6,15 +6,22 @@
 
 #pragma once
 
+#include <vector>
+
+#include <kithare/interner.hpp>
 #include <kithare/string.hpp>
 
+/* Byte offsets into a source are kept in 32 bits, in `TokenStream::indexes` and
+ * `LineMap::line_starts`, so a source can't be any bigger than this */
+#define KH_SOURCE_MAX_SIZE ((size_t)UINT32_MAX)
+
 
 namespace kh {
+    class TokenStream;
     struct Token;
-    struct TokenValue;
     enum class Operator;
     enum class Symbol;
-    enum class TokenType;
+    enum class TokenType : uint8_t;
 
     std::u32string strfy(const Token& token, bool show_token_type = false);
     std::u32string strfy(TokenType type);
@@ -74,7 +81,7 @@ namespace kh {
         SQUARE_CLOSE
     };
 
-    enum class TokenType {
+    enum class TokenType : uint8_t {
         IDENTIFIER,
         OPERATOR,
         SYMBOL,
@@ -87,34 +94,223 @@ namespace kh {
         IMAGINARY
     };
 
-    struct TokenValue {
-        union {
-            Operator operator_type;
-            Symbol symbol_type;
+    /* Byte offsets where every line of a source starts, built once while lexing. Tokens and errors
+     * only carry their byte offset, and lines/columns are looked up from here when they're needed */
+    class LineMap {
+    public:
+        /* The first line always starts at 0, unless the map got trimmed */
+        std::vector<uint32_t> line_starts;
+
+        /* Line and column of `line_starts[0]` */
+        size_t first_line = 1;
+        size_t first_column = 1;
+
+        LineMap();
+        LineMap(const std::string& source);
+
+        /* Both start from 1, columns count UTF-8 characters rather than bytes. The source may be a
+         * window which starts at the byte `offset` of the whole source */
+        size_t line(size_t index) const;
+        size_t column(const std::string& source, size_t index, size_t offset = 0) const;
+        void getLineColumn(const std::string& source, size_t index, size_t& column, size_t& line,
+                           size_t offset = 0) const;
+
+        /* Looks up the lines and columns of the exceptions from `begin` on. Each one which is further
+         * along the same line as the one before it is counted on from there, rather than from the
+         * start of its line, so many of them on one line don't take quadratic time */
+        template <typename T>
+        void resolve(const std::string& source, std::vector<T>& exceptions, size_t begin = 0,
+                     size_t offset = 0) const {
+            size_t line = 0;
+            size_t counted = 0;
+            size_t column = 0;
+
+            for (size_t i = begin; i < exceptions.size(); i++) {
+                T& exc = exceptions[i];
+                exc.line = this->line(exc.index);
+
+                if (exc.line != line || exc.index + 1 < counted) {
+                    line = exc.line;
+                    counted = this->line_starts[line - this->first_line];
+                    column = line == this->first_line ? this->first_column - 1 : 0;
+                }
+                if (exc.index + 1 > counted) {
+                    column += this->countColumns(source, counted, exc.index + 1, offset);
+                    counted = exc.index + 1;
+                }
+                exc.column = column;
+            }
+        }
+
+        /* Adds the lines starting in `source` from the byte `from` on, for sources which come in
+         * bit by bit */
+        void extend(const std::string& source, size_t from, size_t offset = 0);
+
+        /* Forgets everything before `index`, so the source before it can be dropped. Lines and columns
+         * at or after it are kept intact */
+        void trim(const std::string& source, size_t index, size_t offset = 0);
+
+    private:
+        /* How many columns there are from the byte `from` up to `to` */
+        size_t countColumns(const std::string& source, size_t from, size_t to, size_t offset) const;
+    };
+
+    /* Bit flags in the value of a string or buffer token, their contents are left in the source */
+    enum LiteralFlags : uint32_t {
+        /* The contents have escapes, or non-ASCII characters in a buffer, so they have to be decoded
+         * rather than taken as they are */
+        LITERAL_ESCAPED = 1 << 0,
+
+        /* Quoted with `"""` rather than `"` */
+        LITERAL_MULTILINE = 1 << 1
+    };
+
+    /* Compact structure-of-arrays storage of a lexed source. The hot per-token arrays only hold the
+     * type, byte offset, byte length and a 32-bit value, which is either the operator/symbol/character
+     * itself, an interned identifier's symbol id, the `LiteralFlags` of a string or buffer, or an index
+     * into one of the side tables below. Literal payloads are only stored for the tokens that need
+     * them, strings and buffers are decoded from the source when they're asked for */
+    class TokenStream {
+    public:
+        std::vector<TokenType> types;
+        std::vector<uint32_t> indexes;
+        std::vector<uint32_t> lengths;
+        std::vector<uint32_t> values;
+
+        /* The lexed source and its line starts, only used when diagnostics need a line/column. The
+         * source is only pointed to, so it has to outlive the stream for those to be looked up */
+        const std::string* source = nullptr;
+        LineMap line_map;
+
+        /* A streamed source is only held as a window, these are where the window's tokens and
+         * `source` start in the whole token stream and source */
+        size_t base = 0;
+        size_t source_offset = 0;
+
+        /* Side tables */
+        std::vector<uint64_t> integers;
+        std::vector<double> floatings;
+        Interner identifiers;
+
+        inline size_t size() const {
+            return this->types.size();
+        }
+
+        inline bool empty() const {
+            return this->types.empty();
+        }
 
-            uint64_t uinteger;
-            int64_t integer;
-            char32_t character;
+        Token operator[](size_t ti) const;
+        Token back() const;
 
-            double floating;
-            double imaginary;
-        };
+        void reserve(size_t count);
+        void push(size_t index, size_t end, TokenType type, uint32_t value);
+        void pushInteger(size_t index, size_t end, TokenType type, uint64_t integer);
+        void pushFloating(size_t index, size_t end, TokenType type, double floating);
 
-        std::u32string string;
+        /* Drops the first `count` tokens and their literal payloads, moving `base` forward */
+        void dropFront(size_t count);
 
-        std::string identifier;
-        std::string buffer;
+        /* Replaces the tokens [begin, end) with the tokens of `other`, which get moved out of it, and
+         * moves the offsets of the tokens after them by `shift`. Identifiers are copied as symbol ids,
+         * so both streams have to share the same ids */
+        void splice(size_t begin, size_t end, TokenStream& other, ptrdiff_t shift);
     };
 
+    /* A lightweight handle to a single token of a `TokenStream`, it's cheap to copy around as the
+     * literal payloads are looked up from the stream's side tables */
     struct Token {
-        size_t column;
-        size_t line;
-        size_t index;
-        size_t length;
+        const TokenStream* stream;
+        size_t ti;
+
         TokenType type;
-        TokenValue value;
+        size_t index; /* Byte offset in the UTF-8 source */
+        size_t length;
+        uint32_t value;
 
         Token();
-        Token(size_t _index, size_t _end, TokenType _type, const TokenValue& _value);
+        Token(const TokenStream& _stream, size_t _ti);
+
+        inline Operator operatorType() const {
+            return (Operator)this->value;
+        }
+
+        inline Symbol symbolType() const {
+            return (Symbol)this->value;
+        }
+
+        inline char32_t character() const {
+            return this->value;
+        }
+
+        /* Both integer kinds share the same side table, just like a union */
+        inline uint64_t uinteger() const {
+            return this->stream->integers[this->value];
+        }
+
+        inline int64_t integer() const {
+            return this->stream->integers[this->value];
+        }
+
+        inline double floating() const {
+            return this->stream->floatings[this->value];
+        }
+
+        inline double imaginary() const {
+            return this->stream->floatings[this->value];
+        }
+
+        /* Symbol ids of keywords are fixed, so any identifier can be switched on with this */
+        inline Keyword keyword() const {
+            return (Keyword)this->value;
+        }
+
+        inline const std::string& identifier() const {
+            return this->stream->identifiers[this->value];
+        }
+
+        /* Byte offset and length of a string or buffer's contents in the source, without its quotes */
+        inline size_t contentIndex() const {
+            return this->index + (this->type == TokenType::BUFFER) +
+                   (this->value & LITERAL_MULTILINE ? 3 : 1);
+        }
+
+        inline size_t contentLength() const {
+            return this->index + this->length - (this->value & LITERAL_MULTILINE ? 3 : 1) -
+                   this->contentIndex();
+        }
+
+        inline bool hasEscapes() const {
+            return this->value & LITERAL_ESCAPED;
+        }
+
+        /* Decodes the contents of a string or buffer from the source onto the end of `str` */
+        void appendString(std::u32string& str) const;
+        void appendBuffer(std::string& buffer) const;
+
+        inline std::u32string string() const {
+            std::u32string str;
+            this->appendString(str);
+            return str;
+        }
+
+        inline std::string buffer() const {
+            std::string buffer;
+            this->appendBuffer(buffer);
+            return buffer;
+        }
+
+        inline size_t line() const {
+            return this->stream->line_map.line(this->index);
+        }
+
+        inline size_t column() const {
+            return this->stream->line_map.column(*this->stream->source, this->index,
+                                                 this->stream->source_offset);
+        }
     };
+
+    inline bool isReservedKeyword(const Token& token) {
+        return token.type == TokenType::IDENTIFIER && token.value < RESERVED_KEYWORD_COUNT;
+    }
 }
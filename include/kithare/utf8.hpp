@@ -24,4 +24,13 @@ namespace kh {
 
     std::string encodeUtf8(const std::u32string& str);
     std::u32string decodeUtf8(const std::string& str);
+
+    /* Decodes a single UTF-8 encoded character which starts at the given byte index, and stores the
+     * amount of bytes it took in `length` */
+    char32_t decodeUtf8Char(const std::string& str, size_t index, size_t& length);
+
+    /* Same as above, but a broken character sets `error` to what's wrong with it and `error_index` to
+     * where, rather than throwing, and returns 0 */
+    char32_t decodeUtf8Char(const std::string& str, size_t index, size_t& length, const char*& error,
+                            size_t& error_index);
 }
@@ -10,13 +10,17 @@
 #include <codecvt>
 #endif
 
+#include <algorithm>
 #include <chrono>
 #include <clocale>
+#include <cstdlib>
 #include <iostream>
+#include <thread>
 #include <vector>
 
 #include <kithare/ansi.hpp>
 #include <kithare/file.hpp>
+#include <kithare/flat_ast.hpp>
 #include <kithare/info.hpp>
 #include <kithare/lexer.hpp>
 #include <kithare/parser.hpp>
@@ -37,15 +41,28 @@ using namespace kh;
 
 static std::vector<std::u32string> args;
 static bool nocolor = false, help = false, show_tokens = false, show_ast = false, show_timer = false,
-            silent = false, test_mode = false, version = false;
+            silent = false, test_mode = false, version = false, stream_mode = false, lex_bench = false,
+            parse_bench = false, fuzz_mode = false, decls_mode = false;
 static std::vector<std::u32string> excess_args;
 
+/* Set with `--max-depth=<levels>` */
+static size_t max_depth = KH_PARSE_MAX_DEPTH;
+
+/* Set with `--max-errors=<count>`, for the lexer and the parser each. Zero lets them go on however
+ * many errors they raise */
+static size_t max_errors = KH_PARSE_MAX_ERRORS;
+
 static void handleArgs() {
     for (std::u32string& _arg : args) {
         std::u32string arg;
 
+        /* A lone `-` stands for the standard input rather than a flag */
+        if (_arg == U"-") {
+            excess_args.push_back(_arg);
+            continue;
+        }
         /* Indicates that it is a flag argument (which starts with `-`. `--`, or `/`) */
-        if (_arg.size() > 1 && _arg[0] == '-' && _arg[1] == '-') {
+        else if (_arg.size() > 1 && _arg[0] == '-' && _arg[1] == '-') {
             arg = std::u32string(_arg.begin() + 2, _arg.end());
         }
         else if (_arg.size() > 0 && (_arg[0] == '-' || _arg[0] == '/')) {
@@ -76,12 +93,55 @@ static void handleArgs() {
         else if (arg == U"s" || arg == U"silent") {
             silent = true;
         }
+        else if (arg == U"stream") {
+            stream_mode = true;
+        }
+        else if (arg == U"lexbench") {
+            lex_bench = true;
+        }
+        else if (arg == U"parsebench") {
+            parse_bench = true;
+        }
+        else if (arg == U"fuzz") {
+            fuzz_mode = true;
+        }
+        else if (arg == U"decls") {
+            decls_mode = true;
+        }
         else if (arg == U"test") {
             test_mode = true;
         }
         else if (arg == U"v" || arg == U"version") {
             version = true;
         }
+        else if (arg.compare(0, 10, U"max-depth=") == 0) {
+            std::string value = encodeUtf8(arg.substr(10));
+            char* value_end = nullptr;
+            max_depth = std::strtoull(value.c_str(), &value_end, 10);
+
+            if (value.empty() || *value_end || !max_depth) {
+                if (!silent) {
+                    CLI_ERROR_BEGIN();
+                    std::cout << "Expected a positive number of levels: " << encodeUtf8(arg) << '\n';
+                    CLI_ERROR_END();
+                }
+                std::exit(1);
+            }
+        }
+        else if (arg.compare(0, 11, U"max-errors=") == 0) {
+            std::string value = encodeUtf8(arg.substr(11));
+            char* value_end = nullptr;
+            max_errors = std::strtoull(value.c_str(), &value_end, 10);
+
+            if (value.empty() || *value_end) {
+                if (!silent) {
+                    CLI_ERROR_BEGIN();
+                    std::cout << "Expected a number of errors: " << encodeUtf8(arg) << '\n';
+                    CLI_ERROR_END();
+                }
+                std::exit(1);
+            }
+        }
         else {
             if (!silent) {
                 CLI_ERROR_BEGIN();
@@ -93,6 +153,397 @@ static void handleArgs() {
     }
 }
 
+/* Lexes and parses the source while it's being read, so only a window of it is held at once. Used for
+ * the standard input, and for files with `--stream` */
+static int executeStreamed(const std::u32string& path) {
+    int code = 0;
+    std::FILE* file = stdin;
+
+    if (path != U"-") {
+        try {
+            file = openFileBinary(path);
+        }
+        catch (Exception& exc) {
+            if (!silent) {
+                CLI_ERROR_BEGIN();
+                std::cerr << exc.format() << '\n';
+                CLI_ERROR_END();
+            }
+            std::exit(1);
+        }
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<LexException> lex_exceptions;
+    std::vector<ParseException> parse_exceptions;
+    StreamLexer stream(file, lex_exceptions);
+    stream.max_errors = max_errors;
+    ParserContext parser_context{stream.tokens, parse_exceptions};
+    parser_context.stream = &stream;
+    parser_context.directory = parentDirectory(path);
+    parser_context.max_depth = max_depth;
+    parser_context.max_errors = max_errors;
+
+    /* Tokens are dropped as soon as they're parsed, so showing them is done instead of parsing */
+    AstModule ast({}, {}, {}, {}, {});
+    if (show_tokens) {
+        if (!silent) {
+            std::cout << "tokens:\n";
+        }
+        for (size_t ti = 0; stream.pull(ti); ti++) {
+            Token token = stream.tokens[ti - stream.tokens.base];
+            if (!silent) {
+                std::cout << '\t' << token.line() << ':' << token.column() << '\t'
+                          << encodeUtf8(strfy(token, true)) << '\n';
+            }
+            stream.release(ti);
+        }
+    }
+    else {
+        ast = parseWhole(parser_context);
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+
+    if (file != stdin) {
+        fclose(file);
+    }
+
+    if (show_timer && !silent) {
+        std::cout << "Finished lexing and parsing in " << elapsed.count() << "s\n";
+    }
+    if (!lex_exceptions.empty()) {
+        if (!silent) {
+            CLI_ERROR_BEGIN();
+            for (LexException& exc : lex_exceptions) {
+                std::cerr << "LexException: " << exc.format() << '\n';
+            }
+            CLI_ERROR_END();
+        }
+
+        code += lex_exceptions.size();
+    }
+    if (!parse_exceptions.empty()) {
+        if (!silent) {
+            CLI_ERROR_BEGIN();
+            for (ParseException& exc : parse_exceptions) {
+                std::cerr << "ParseException: " << exc.format() << '\n';
+            }
+            CLI_ERROR_END();
+        }
+
+        code += parse_exceptions.size();
+    }
+    if (show_ast && !code && !silent) {
+        std::cout << encodeUtf8(strfy(ast)) << '\n';
+    }
+
+    return code;
+}
+
+/* Makes an error-dense variant of a source by putting a broken literal or character into about every
+ * other line, for benchmarking the lexer's error path. The seed is fixed, so runs can be compared */
+static std::string fuzzSource(const std::string& source) {
+    const char* broken[] = {"0x", "0b2", "'", "b'", "\"\\q\"", "\"\\x", "\xff", "@", "1.", "`"};
+    const size_t broken_count = sizeof(broken) / sizeof(broken[0]);
+
+    uint32_t seed = 12345;
+    auto random = [&](size_t range) -> size_t {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % range;
+    };
+
+    std::string fuzzed;
+    fuzzed.reserve(source.size() + source.size() / 8);
+    for (size_t line = 0; line < source.size();) {
+        size_t line_end = std::min(source.find('\n', line), source.size() - 1) + 1;
+        size_t split = line + random(line_end - line);
+
+        fuzzed.append(source, line, split - line);
+        if (random(2)) {
+            fuzzed += broken[random(broken_count)];
+        }
+        fuzzed.append(source, split, line_end - split);
+        line = line_end;
+    }
+    return fuzzed;
+}
+
+/* Makes a source of functions whose bodies are mostly declarations, with array types and generics,
+ * mixed with subscripts which start out looking like array types. The seed is fixed, so runs can be
+ * compared */
+static std::string declarationSource() {
+    const char* statements[] = {"int a = 1;",
+                                "float[3] position;",
+                                "list!(int)[] items = [1, 2];",
+                                "Foo.Bar[2][4] matrix(1, 2);",
+                                "ref int r = a;",
+                                "dict!(str, float[2]) table;",
+                                "position[1] = a;",
+                                "matrix[1][2] += 3;",
+                                "items[0] if a else b;",
+                                "str name = \"name\";"};
+    const size_t statement_count = sizeof(statements) / sizeof(statements[0]);
+
+    uint32_t seed = 12345;
+    auto random = [&](size_t range) -> size_t {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % range;
+    };
+
+    std::string source;
+    for (size_t function = 0; function < 20000; function++) {
+        source += "def f" + std::to_string(function) + "() {\n";
+        for (size_t statement = 0; statement < 16; statement++) {
+            source += "    ";
+            source += statements[random(statement_count)];
+            source += '\n';
+        }
+        source += "}\n";
+    }
+    return source;
+}
+
+/* Times lexing the file on every thread count up to the hardware threads, taking the best of a few runs
+ * each, to see how parallel lexing scales. With `--fuzz`, a fuzzed variant of the file is lexed */
+static int benchmarkLexer(const std::u32string& path) {
+    std::string source;
+    try {
+        source = readFileBinary(path);
+    }
+    catch (Exception& exc) {
+        if (!silent) {
+            CLI_ERROR_BEGIN();
+            std::cerr << exc.format() << '\n';
+            CLI_ERROR_END();
+        }
+        return 1;
+    }
+
+    if (fuzz_mode) {
+        source = fuzzSource(source);
+    }
+
+    size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    double single_elapsed = 0;
+
+    for (size_t thread_count = 1; thread_count <= max_threads; thread_count++) {
+        double best = 0;
+        size_t error_count = 0;
+        for (size_t run = 0; run < 3; run++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<LexException> lex_exceptions;
+            LexerContext lexer_context{source, lex_exceptions};
+            TokenStream tokens = lexParallel(lexer_context, thread_count);
+            auto end = std::chrono::high_resolution_clock::now();
+            error_count = lex_exceptions.size();
+
+            std::chrono::duration<double> elapsed = end - start;
+            if (run == 0 || elapsed.count() < best) {
+                best = elapsed.count();
+            }
+        }
+
+        if (thread_count == 1) {
+            single_elapsed = best;
+        }
+        if (!silent) {
+            std::cout << thread_count << " thread(s): " << best << "s, "
+                      << source.size() / best / (1 << 20) << " MiB/s, " << single_elapsed / best
+                      << "x, " << error_count << " error(s)\n";
+        }
+    }
+
+    return 0;
+}
+
+/* Times parsing the already lexed tokens serially, taking the best of a few runs. Returns the best
+ * time, which the other parser benchmarks are compared to */
+static double benchmarkSerialParse(const TokenStream& tokens) {
+    double best = 0;
+    size_t error_count = 0;
+    for (size_t run = 0; run < 3; run++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<ParseException> parse_exceptions;
+        ParserContext parser_context{tokens, parse_exceptions};
+        AstModule ast = parseWhole(parser_context);
+        auto end = std::chrono::high_resolution_clock::now();
+        error_count = parse_exceptions.size();
+
+        std::chrono::duration<double> elapsed = end - start;
+        if (run == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+
+    if (!silent) {
+        std::cout << tokens.size() << " token(s): " << best << "s, " << tokens.size() / best / 1e6
+                  << "M tokens/s, " << error_count << " error(s)\n";
+    }
+    return best;
+}
+
+/* Times parsing the top level declarations in parallel on every thread count up to the hardware
+ * threads, against the serial parse which took `serial_best` */
+static void benchmarkParallelParse(const TokenStream& tokens, double serial_best) {
+    size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    for (size_t thread_count = 1; thread_count <= max_threads; thread_count++) {
+        double best = 0;
+        for (size_t run = 0; run < 3; run++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<ParseException> parse_exceptions;
+            ParserContext parser_context{tokens, parse_exceptions};
+            AstModule ast = parseParallel(parser_context, thread_count);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            std::chrono::duration<double> elapsed = end - start;
+            if (run == 0 || elapsed.count() < best) {
+                best = elapsed.count();
+            }
+        }
+
+        if (!silent) {
+            std::cout << "parallel, " << thread_count << " thread(s): " << best << "s, "
+                      << serial_best / best << "x\n";
+        }
+    }
+}
+
+/* Times a skeleton parse, which skips the function bodies, and parsing all of them afterwards */
+static void benchmarkSkeletonParse(const TokenStream& tokens) {
+    auto skeleton_start = std::chrono::high_resolution_clock::now();
+    std::vector<ParseException> skeleton_exceptions;
+    ParserContext skeleton_context{tokens, skeleton_exceptions};
+    skeleton_context.skeleton = true;
+    AstModule skeleton = parseWhole(skeleton_context);
+    auto skeleton_end = std::chrono::high_resolution_clock::now();
+
+    for (const AstFunction& function : skeleton.functions) {
+        parseLazyBody(function);
+    }
+    for (const AstUserType& user_type : skeleton.user_types) {
+        for (const AstFunction& method : user_type.methods) {
+            parseLazyBody(method);
+        }
+    }
+    auto bodies_end = std::chrono::high_resolution_clock::now();
+
+    if (!silent) {
+        std::chrono::duration<double> skeleton_elapsed = skeleton_end - skeleton_start;
+        std::chrono::duration<double> bodies_elapsed = bodies_end - skeleton_end;
+        std::cout << "skeleton: " << skeleton_elapsed.count() << "s, then the bodies: "
+                  << bodies_elapsed.count() << "s\n";
+    }
+}
+
+/* Times converting the module's functions and declarations to a flat AST and back, which passes
+ * moving over to it would pay for */
+static void benchmarkFlatAst(const TokenStream& tokens) {
+    std::vector<ParseException> parse_exceptions;
+    ParserContext parser_context{tokens, parse_exceptions};
+    AstModule ast = parseWhole(parser_context);
+
+    auto flat_start = std::chrono::high_resolution_clock::now();
+    FlatAst flat;
+    std::vector<FlatId> roots;
+    for (const AstFunction& function : ast.functions) {
+        roots.push_back(flat.add(&function));
+    }
+    for (const AstUserType& user_type : ast.user_types) {
+        for (const AstDeclaration& member : user_type.members) {
+            roots.push_back(flat.add(&member));
+        }
+        for (const AstFunction& method : user_type.methods) {
+            roots.push_back(flat.add(&method));
+        }
+    }
+    for (const AstDeclaration& variable : ast.variables) {
+        roots.push_back(flat.add(&variable));
+    }
+    auto flat_end = std::chrono::high_resolution_clock::now();
+
+    AstArena arena;
+    for (FlatId root : roots) {
+        flat.toAst(root, arena);
+    }
+    auto back_end = std::chrono::high_resolution_clock::now();
+
+    if (!silent) {
+        std::chrono::duration<double> flat_elapsed = flat_end - flat_start;
+        std::chrono::duration<double> back_elapsed = back_end - flat_end;
+        std::cout << flat.nodes.size() << " flat node(s) of " << sizeof(FlatNode)
+                  << " bytes: flattened in " << flat_elapsed.count() << "s, converted back in "
+                  << back_elapsed.count() << "s\n";
+    }
+}
+
+/* Times reparsing after a single line edit in the middle of the source, relexing included, and then
+ * settling the offsets it left to be moved. The edit is made to a copy of the source, which gets lexed
+ * on its own */
+static void benchmarkReparse(std::string source) {
+    LexResult result = lex(source);
+    std::vector<ParseException> incremental_exceptions;
+    ParserContext incremental_context{result.tokens, incremental_exceptions};
+    incremental_context.incremental = true;
+    AstModule incremental = parseWhole(incremental_context);
+
+    SourceEdit edit;
+    edit.index = source.find('\n', source.size() / 2) + 1;
+    edit.index = edit.index ? edit.index : source.size();
+    edit.removed = 0;
+    edit.inserted = " ";
+
+    auto reparse_start = std::chrono::high_resolution_clock::now();
+    TokenEdit token_edit = relex(source, result.tokens, result.exceptions, edit);
+    incremental = reparse(incremental_context, std::move(incremental), token_edit);
+    auto reparse_end = std::chrono::high_resolution_clock::now();
+    settleOffsets(incremental);
+    auto settle_end = std::chrono::high_resolution_clock::now();
+
+    if (!silent) {
+        std::chrono::duration<double> reparse_elapsed = reparse_end - reparse_start;
+        std::chrono::duration<double> settle_elapsed = settle_end - reparse_end;
+        std::cout << "reparse after a single line edit: " << reparse_elapsed.count()
+                  << "s, settling the offsets after it: " << settle_elapsed.count() << "s\n";
+    }
+}
+
+/* Times parsing the already lexed file in every way the parser can, to see how the parser alone does
+ * on expression heavy code. With `--fuzz`, a fuzzed variant of the file is parsed. With `--decls`,
+ * declaration heavy code is made up instead of reading a file */
+static int benchmarkParser(const std::u32string& path) {
+    std::string source;
+    if (decls_mode) {
+        source = declarationSource();
+    }
+    else {
+        try {
+            source = readFileBinary(path);
+        }
+        catch (Exception& exc) {
+            if (!silent) {
+                CLI_ERROR_BEGIN();
+                std::cerr << exc.format() << '\n';
+                CLI_ERROR_END();
+            }
+            return 1;
+        }
+    }
+
+    if (fuzz_mode) {
+        source = fuzzSource(source);
+    }
+
+    LexResult result = lex(source);
+    double serial_best = benchmarkSerialParse(result.tokens);
+    benchmarkParallelParse(result.tokens, serial_best);
+    benchmarkSkeletonParse(result.tokens);
+    benchmarkFlatAst(result.tokens);
+    benchmarkReparse(source);
+    return 0;
+}
+
 static int execute() {
     int code = 0;
 
@@ -122,15 +573,25 @@ static int execute() {
             CLI_ERROR_END();
         }
 
-        std::exit(errors.size());
+        std::exit(errors.empty() ? 0 : 1);
     }
 
     /* Compilation */
-    if (!excess_args.empty()) {
-        std::u32string source;
+    if (!excess_args.empty() && lex_bench) {
+        code += benchmarkLexer(excess_args[0]);
+    }
+    else if ((!excess_args.empty() || decls_mode) && parse_bench) {
+        code += benchmarkParser(excess_args.empty() ? U"" : excess_args[0]);
+    }
+    else if (!excess_args.empty() && (stream_mode || excess_args[0] == U"-")) {
+        code += executeStreamed(excess_args[0]);
+    }
+    else if (!excess_args.empty()) {
+        std::string source;
 
         try {
-            source = readFile(excess_args[0]);
+            /* The lexer works on the raw UTF-8 bytes, so the source doesn't get decoded here */
+            source = readFileBinary(excess_args[0]);
         }
         catch (Exception& exc) {
             if (!silent) {
@@ -144,7 +605,8 @@ static int execute() {
         auto lex_start = std::chrono::high_resolution_clock::now();
         std::vector<LexException> lex_exceptions;
         LexerContext lexer_context{source, lex_exceptions};
-        std::vector<Token> tokens = lex(lexer_context);
+        lexer_context.max_errors = max_errors;
+        TokenStream tokens = lex(lexer_context);
         auto lex_end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> lex_elapsed = lex_end - lex_start;
 
@@ -164,14 +626,19 @@ static int execute() {
         }
         if (show_tokens && !silent) {
             std::cout << "tokens:\n";
-            for (Token& token : tokens) {
-                std::cout << '\t' << encodeUtf8(strfy(token, true)) << '\n';
+            for (size_t ti = 0; ti < tokens.size(); ti++) {
+                Token token = tokens[ti];
+                std::cout << '\t' << token.line() << ':' << token.column() << '\t'
+                          << encodeUtf8(strfy(token, true)) << '\n';
             }
         }
 
         auto parse_start = std::chrono::high_resolution_clock::now();
         std::vector<ParseException> parse_exceptions;
         ParserContext parser_context{tokens, parse_exceptions};
+        parser_context.directory = parentDirectory(excess_args[0]);
+        parser_context.max_depth = max_depth;
+        parser_context.max_errors = max_errors;
         AstModule ast = parseWhole(parser_context);
         auto parse_end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> parse_elapsed = parse_end - parse_start;
@@ -205,7 +672,7 @@ int wmain(const int argc, wchar_t* argv[])
 int main(const int argc, char* argv[])
 #endif
 {
-    /* Sets the locale to using UTF-8 */
+    /* Sets the locale to using UTF-8, for the console. Lexing doesn't depend on the locale */
     std::setlocale(LC_ALL, "en_US.utf8");
 #ifdef _WIN32
     /* Sets up std::wcout and std::wcin on Windows */
@@ -228,5 +695,7 @@ int main(const int argc, char* argv[])
 #endif
 
     handleArgs();
-    return execute();
+
+    /* The error count would get truncated as an exit code, so it only tells if there were any */
+    return execute() ? 1 : 0;
 }
@@ -4,25 +4,52 @@
  * Copyright (C) 2021 Kithare Organization
  */
 
+#if _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <kithare/file.hpp>
 #include <kithare/string.hpp>
+#include <kithare/token.hpp>
 #include <kithare/utf8.hpp>
 
 
 using namespace kh;
 
 std::string kh::FileError::format() const {
-    return "unable to read file";
+    return this->what;
+}
+
+std::u32string kh::parentDirectory(const std::u32string& path) {
+    size_t separator = path.find_last_of(U"/\\");
+    return separator == std::u32string::npos ? U"" : path.substr(0, separator + 1);
+}
+
+std::u32string kh::resolvePath(const std::u32string& directory, const std::u32string& path) {
+    bool is_absolute = (!path.empty() && (path[0] == '/' || path[0] == '\\')) ||
+                       (path.size() > 1 && path[1] == ':');
+    if (is_absolute || directory.empty()) {
+        return path;
+    }
+
+    if (directory.back() == '/' || directory.back() == '\\') {
+        return directory + path;
+    }
+    return directory + U"/" + path;
 }
 
 std::u32string kh::readFile(const std::u32string& path) {
     return decodeUtf8(readFileBinary(path));
 }
 
-std::string kh::readFileBinary(const std::u32string& path) {
+std::FILE* kh::openFileBinary(const std::u32string& path) {
     /* Use C style file handling, because it's "superior" (as @ankith26 would say it -.-), and also
      * handles UTF-8 file paths on MinGW correctly */
-    std::string ret;
     FILE* file;
 #if _WIN32
     std::wstring u16path;
@@ -40,9 +67,23 @@ std::string kh::readFileBinary(const std::u32string& path) {
         throw FileError();
     }
 
-    int c; /* Note: int, not char, required to handle EOF */
-    while ((c = fgetc(file)) != EOF) {
-        ret += (char)c;
+    return file;
+}
+
+std::string kh::readFileBinary(const std::u32string& path) {
+    std::string ret;
+    FILE* file = openFileBinary(path);
+
+    /* Reads the file in blocks rather than by characters, as sources could be multiple megabytes */
+    char block[65536];
+    size_t count;
+    while ((count = fread(block, 1, sizeof(block), file)) > 0) {
+        if (ret.size() + count > KH_SOURCE_MAX_SIZE) {
+            fclose(file);
+            throw FileError("file is too big, it can't be any bigger than " +
+                            std::to_string(KH_SOURCE_MAX_SIZE) + " bytes");
+        }
+        ret.append(block, count);
     }
 
     if (ferror(file)) {
@@ -52,3 +93,65 @@ std::string kh::readFileBinary(const std::u32string& path) {
     fclose(file);
     return ret;
 }
+
+kh::MappedFile::MappedFile(const std::u32string& path) {
+#if _WIN32
+    std::wstring u16path;
+    u16path.reserve(path.size());
+    for (char32_t ch : path) {
+        u16path += (wchar_t)ch;
+    }
+
+    HANDLE file = CreateFileW(u16path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw FileError();
+    }
+
+    LARGE_INTEGER file_size;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+        /* The view stays valid after both of the handles are closed */
+        HANDLE file_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (file_mapping) {
+            this->mapping = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(file_mapping);
+        }
+        this->size = (size_t)file_size.QuadPart;
+    }
+    CloseHandle(file);
+#else
+    int file = open(encodeUtf8(path).c_str(), O_RDONLY);
+    if (file < 0) {
+        throw FileError();
+    }
+
+    struct stat file_stat;
+    if (fstat(file, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+        this->mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (this->mapping == MAP_FAILED) {
+            this->mapping = nullptr;
+        }
+        this->size = file_stat.st_size;
+    }
+    close(file);
+#endif
+
+    if (this->mapping) {
+        this->data = (const char*)this->mapping;
+    }
+    else {
+        this->fallback = readFileBinary(path);
+        this->data = this->fallback.data();
+        this->size = this->fallback.size();
+    }
+}
+
+kh::MappedFile::~MappedFile() {
+    if (this->mapping) {
+#if _WIN32
+        UnmapViewOfFile(this->mapping);
+#else
+        munmap(this->mapping, this->size);
+#endif
+    }
+}
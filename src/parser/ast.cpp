@@ -4,76 +4,133 @@
  * Copyright (C) 2021 Kithare Organization
  */
 
+#include <algorithm>
+#include <cstdlib>
+
 #include <kithare/ast.hpp>
 
 
 using namespace kh;
 
-kh::AstModule::AstModule(const std::vector<AstImport>& _imports,
-                         const std::vector<AstFunction>& _functions,
-                         const std::vector<AstUserType>& _user_types,
-                         const std::vector<AstEnumType>& _enums,
-                         const std::vector<AstDeclaration>& _variables)
-    : variables(_variables), imports(_imports), functions(_functions), user_types(_user_types),
-      enums(_enums) {}
-
-kh::AstImport::AstImport(size_t _index, const std::vector<std::string>& _path, bool _is_include,
-                         bool _is_relative, const std::string& _identifier)
-    : index(_index), path(_path), is_include(_is_include), is_relative(_is_relative),
-      identifier(_identifier) {}
-
-kh::AstUserType::AstUserType(size_t _index, const std::vector<std::string>& _identifiers,
-                             const std::shared_ptr<AstIdentifiers>& _base,
-                             const std::vector<std::string>& _generic_args,
-                             const std::vector<AstDeclaration>& _members,
-                             const std::vector<AstFunction>& _methods, bool _is_class)
-    : index(_index), identifiers(_identifiers), base(_base), generic_args(_generic_args),
-      members(_members), methods(_methods), is_class(_is_class) {}
-
-kh::AstEnumType::AstEnumType(size_t _index, const std::vector<std::string>& _identifiers,
-                             const std::vector<std::string>& _members,
-                             const std::vector<uint64_t>& _values)
-    : index(_index), identifiers(_identifiers), members(_members), values(_values) {}
-
-kh::AstIdentifiers::AstIdentifiers(size_t _index, const std::vector<std::string>& _identifiers,
-                                   const std::vector<AstIdentifiers>& _generics,
-                                   const std::vector<size_t>& _generics_refs,
-                                   const std::vector<std::vector<uint64_t>>& _generics_array)
-    : identifiers(_identifiers), generics(_generics), generics_refs(_generics_refs),
-      generics_array(_generics_array) {
+kh::AstArena::~AstArena() {
+    for (size_t i = this->finalizers.size(); i > 0; i--) {
+        this->finalizers[i - 1].destroy(this->finalizers[i - 1].node);
+    }
+    for (char* block : this->blocks) {
+        std::free(block);
+    }
+}
+
+void* kh::AstArena::grow(size_t size, size_t alignment) {
+    /* The first blocks double in size, up to the full block size */
+    size_t block_size = KH_AST_ARENA_BLOCK_SIZE;
+    if (this->blocks.size() < 16) {
+        block_size = std::min(block_size, (size_t)KH_AST_ARENA_FIRST_BLOCK_SIZE << this->blocks.size());
+    }
+    block_size = std::max(block_size, size + alignment);
+    char* block = (char*)std::malloc(block_size);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+
+    this->blocks.push_back(block);
+    this->allocated += block_size;
+    this->cursor = block;
+    this->limit = block + block_size;
+    return this->allocate(size, alignment);
+}
+
+void kh::AstArena::adopt(AstArena&& other) {
+    /* Nothing is taken over before it's sure not to throw, so no block ends up in both arenas. The
+     * capacity still grows geometrically, as many small arenas may be adopted one by one */
+    if (this->blocks.capacity() < this->blocks.size() + other.blocks.size()) {
+        this->blocks.reserve(std::max(this->blocks.size() + other.blocks.size(),
+                                      2 * this->blocks.capacity()));
+    }
+    if (this->finalizers.capacity() < this->finalizers.size() + other.finalizers.size()) {
+        this->finalizers.reserve(std::max(this->finalizers.size() + other.finalizers.size(),
+                                          2 * this->finalizers.capacity()));
+    }
+
+    this->blocks.insert(this->blocks.end(), other.blocks.begin(), other.blocks.end());
+    this->finalizers.insert(this->finalizers.end(), other.finalizers.begin(), other.finalizers.end());
+    this->allocated += other.allocated;
+
+    other.blocks.clear();
+    other.finalizers.clear();
+    other.cursor = nullptr;
+    other.limit = nullptr;
+    other.allocated = 0;
+}
+
+void kh::AstArena::swap(AstArena& other) noexcept {
+    std::swap(this->blocks, other.blocks);
+    std::swap(this->finalizers, other.finalizers);
+    std::swap(this->cursor, other.cursor);
+    std::swap(this->limit, other.limit);
+    std::swap(this->allocated, other.allocated);
+}
+
+kh::AstModule::AstModule(std::vector<AstImport> _imports, std::vector<AstFunction> _functions,
+                         std::vector<AstUserType> _user_types, std::vector<AstEnumType> _enums,
+                         std::vector<AstDeclaration> _variables)
+    : variables(std::move(_variables)), imports(std::move(_imports)), functions(std::move(_functions)),
+      user_types(std::move(_user_types)), enums(std::move(_enums)) {}
+
+kh::AstImport::AstImport(size_t _index, std::vector<std::string> _path, bool _is_include,
+                         bool _is_relative, std::string _identifier)
+    : index(_index), path(std::move(_path)), is_include(_is_include), is_relative(_is_relative),
+      identifier(std::move(_identifier)) {}
+
+kh::AstUserType::AstUserType(size_t _index, std::vector<std::string> _identifiers,
+                             AstIdentifiers* _base, std::vector<std::string> _generic_args,
+                             std::vector<AstDeclaration> _members, std::vector<AstFunction> _methods,
+                             bool _is_class)
+    : index(_index), identifiers(std::move(_identifiers)), base(_base),
+      generic_args(std::move(_generic_args)), members(std::move(_members)),
+      methods(std::move(_methods)), is_class(_is_class) {}
+
+kh::AstEnumType::AstEnumType(size_t _index, std::vector<std::string> _identifiers,
+                             std::vector<std::string> _members, std::vector<uint64_t> _values)
+    : index(_index), identifiers(std::move(_identifiers)), members(std::move(_members)),
+      values(std::move(_values)) {}
+
+kh::AstIdentifiers::AstIdentifiers(size_t _index, std::vector<std::string> _identifiers,
+                                   std::vector<AstIdentifiers> _generics,
+                                   std::vector<size_t> _generics_refs,
+                                   std::vector<std::vector<uint64_t>> _generics_array)
+    : identifiers(std::move(_identifiers)), generics(std::move(_generics)),
+      generics_refs(std::move(_generics_refs)), generics_array(std::move(_generics_array)) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::IDENTIFIER;
 }
 
-kh::AstDeclaration::AstDeclaration(size_t _index, const AstIdentifiers& _var_type,
-                                   const std::vector<uint64_t>& _var_array,
-                                   const std::string& _var_name,
-                                   std::shared_ptr<AstExpression>& _expression, size_t _refs)
-    : var_type(_var_type), var_array(_var_array), var_name(_var_name), expression(_expression),
-      refs(_refs) {
+kh::AstDeclaration::AstDeclaration(size_t _index, AstIdentifiers _var_type,
+                                   std::vector<uint64_t> _var_array, std::string _var_name,
+                                   AstExpression* _expression, size_t _refs)
+    : var_type(std::move(_var_type)), var_array(std::move(_var_array)), var_name(std::move(_var_name)),
+      expression(_expression), refs(_refs) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::DECLARE;
 }
 
-kh::AstFunction::AstFunction(size_t _index, const std::vector<std::string>& _identifiers,
-                             const std::vector<std::string>& _generic_args,
-                             const std::vector<uint64_t>& _id_array,
-                             const std::vector<uint64_t>& _return_array,
-                             const AstIdentifiers& _return_type, size_t _return_refs,
-                             const std::vector<AstDeclaration>& _arguments,
-                             const std::vector<std::shared_ptr<AstBody>>& _body, bool _is_conditional)
-    : identifiers(_identifiers), generic_args(_generic_args), id_array(_id_array),
-      return_array(_return_array), return_type(_return_type), return_refs(_return_refs),
-      arguments(_arguments), body(_body), is_conditional(_is_conditional) {
+kh::AstFunction::AstFunction(size_t _index, std::vector<std::string> _identifiers,
+                             std::vector<std::string> _generic_args, std::vector<uint64_t> _id_array,
+                             std::vector<uint64_t> _return_array, AstIdentifiers _return_type,
+                             size_t _return_refs, std::vector<AstDeclaration> _arguments,
+                             std::vector<AstBody*> _body, bool _is_conditional)
+    : identifiers(std::move(_identifiers)), generic_args(std::move(_generic_args)),
+      id_array(std::move(_id_array)), return_array(std::move(_return_array)),
+      return_type(std::move(_return_type)), return_refs(_return_refs), arguments(std::move(_arguments)),
+      body(std::move(_body)), is_conditional(_is_conditional) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::FUNCTION;
 }
 
-kh::AstUnaryOperation::AstUnaryOperation(size_t _index, Operator _operation,
-                                         std::shared_ptr<AstExpression>& _rvalue)
+kh::AstUnaryOperation::AstUnaryOperation(size_t _index, Operator _operation, AstExpression* _rvalue)
     : operation(_operation), rvalue(_rvalue) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
@@ -81,60 +138,56 @@ kh::AstUnaryOperation::AstUnaryOperation(size_t _index, Operator _operation,
 }
 
 kh::AstRevUnaryOperation::AstRevUnaryOperation(size_t _index, Operator _operation,
-                                               std::shared_ptr<AstExpression>& _rvalue)
+                                               AstExpression* _rvalue)
     : operation(_operation), rvalue(_rvalue) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::REV_UNARY;
 }
 
-kh::AstBinaryOperation::AstBinaryOperation(size_t _index, Operator _operation,
-                                           std::shared_ptr<AstExpression>& _lvalue,
-                                           std::shared_ptr<AstExpression>& _rvalue)
+kh::AstBinaryOperation::AstBinaryOperation(size_t _index, Operator _operation, AstExpression* _lvalue,
+                                           AstExpression* _rvalue)
     : operation(_operation), lvalue(_lvalue), rvalue(_rvalue) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::BINARY;
 }
 
-kh::AstTernaryOperation::AstTernaryOperation(size_t _index, std::shared_ptr<AstExpression>& _condition,
-                                             std::shared_ptr<AstExpression>& _value,
-                                             std::shared_ptr<AstExpression>& _otherwise)
+kh::AstTernaryOperation::AstTernaryOperation(size_t _index, AstExpression* _condition,
+                                             AstExpression* _value, AstExpression* _otherwise)
     : condition(_condition), value(_value), otherwise(_otherwise) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::TERNARY;
 }
 
-kh::AstComparisonExpression::AstComparisonExpression(
-    size_t _index, const std::vector<Operator>& _operations,
-    const std::vector<std::shared_ptr<AstExpression>>& _values)
-    : operations(_operations), values(_values) {
+kh::AstComparisonExpression::AstComparisonExpression(size_t _index, std::vector<Operator> _operations,
+                                                     std::vector<AstExpression*> _values)
+    : operations(std::move(_operations)), values(std::move(_values)) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::COMPARISON;
 }
 
-kh::AstSubscriptExpression::AstSubscriptExpression(
-    size_t _index, std::shared_ptr<AstExpression>& _expression,
-    const std::vector<std::shared_ptr<AstExpression>>& _arguments)
-    : expression(_expression), arguments(_arguments) {
+kh::AstSubscriptExpression::AstSubscriptExpression(size_t _index, AstExpression* _expression,
+                                                   std::vector<AstExpression*> _arguments)
+    : expression(_expression), arguments(std::move(_arguments)) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::SUBSCRIPT;
 }
 
-kh::AstCallExpression::AstCallExpression(size_t _index, std::shared_ptr<AstExpression>& _expression,
-                                         const std::vector<std::shared_ptr<AstExpression>>& _arguments)
-    : expression(_expression), arguments(_arguments) {
+kh::AstCallExpression::AstCallExpression(size_t _index, AstExpression* _expression,
+                                         std::vector<AstExpression*> _arguments)
+    : expression(_expression), arguments(std::move(_arguments)) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::CALL;
 }
 
-kh::AstScoping::AstScoping(size_t _index, std::shared_ptr<AstExpression>& _expression,
-                           const std::vector<std::string>& _identifiers)
-    : expression(_expression), identifiers(_identifiers) {
+kh::AstScoping::AstScoping(size_t _index, AstExpression* _expression,
+                           std::vector<std::string> _identifiers)
+    : expression(_expression), identifiers(std::move(_identifiers)) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::SCOPE;
@@ -172,84 +225,86 @@ kh::AstValue::AstValue(size_t _index, double _floating, AstValue::ValueType _val
     this->expression_type = AstExpression::CONSTANT;
 }
 
-kh::AstValue::AstValue(size_t _index, const std::string& _buffer, AstValue::ValueType _value_type)
+kh::AstValue::AstValue(size_t _index, std::string _buffer, AstValue::ValueType _value_type)
     : value_type((ValueType)((size_t)_value_type)) {
     this->index = _index;
-    this->buffer = _buffer;
+    this->buffer = std::move(_buffer);
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::CONSTANT;
 }
 
-kh::AstValue::AstValue(size_t _index, const std::u32string& _string, AstValue::ValueType _value_type)
+kh::AstValue::AstValue(size_t _index, std::u32string _string, AstValue::ValueType _value_type)
     : value_type((ValueType)((size_t)_value_type)) {
     this->index = _index;
-    this->string = _string;
+    this->string = std::move(_string);
+    this->type = AstBody::EXPRESSION;
+    this->expression_type = AstExpression::CONSTANT;
+}
+
+kh::AstValue::AstValue(size_t _index, std::shared_ptr<MappedFile> _embedded)
+    : value_type(AstValue::ValueType::BUFFER), embedded(std::move(_embedded)) {
+    this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::CONSTANT;
 }
 
-kh::AstTuple::AstTuple(size_t _index, const std::vector<std::shared_ptr<AstExpression>>& _elements)
-    : elements(_elements) {
+kh::AstTuple::AstTuple(size_t _index, std::vector<AstExpression*> _elements)
+    : elements(std::move(_elements)) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::TUPLE;
 }
 
-kh::AstList::AstList(size_t _index, const std::vector<std::shared_ptr<AstExpression>>& _elements)
-    : elements(_elements) {
+kh::AstList::AstList(size_t _index, std::vector<AstExpression*> _elements)
+    : elements(std::move(_elements)) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::LIST;
 }
 
-kh::AstDict::AstDict(size_t _index, const std::vector<std::shared_ptr<AstExpression>>& _keys,
-                     const std::vector<std::shared_ptr<AstExpression>>& _items)
-    : keys(_keys), items(_items) {
+kh::AstDict::AstDict(size_t _index, std::vector<AstExpression*> _keys,
+                     std::vector<AstExpression*> _items)
+    : keys(std::move(_keys)), items(std::move(_items)) {
     this->index = _index;
     this->type = AstBody::EXPRESSION;
     this->expression_type = AstExpression::DICT;
 }
 
-kh::AstIf::AstIf(size_t _index, const std::vector<std::shared_ptr<AstExpression>>& _conditions,
-                 const std::vector<std::vector<std::shared_ptr<AstBody>>>& _bodies,
-                 const std::vector<std::shared_ptr<AstBody>>& _else_body)
-    : conditions(_conditions), bodies(_bodies), else_body(_else_body) {
+kh::AstIf::AstIf(size_t _index, std::vector<AstExpression*> _conditions,
+                 std::vector<std::vector<AstBody*>> _bodies, std::vector<AstBody*> _else_body)
+    : conditions(std::move(_conditions)), bodies(std::move(_bodies)), else_body(std::move(_else_body)) {
     this->index = _index;
     this->type = AstBody::IF;
 }
 
-kh::AstWhile::AstWhile(size_t _index, std::shared_ptr<AstExpression>& _condition,
-                       const std::vector<std::shared_ptr<AstBody>>& _body)
-    : condition(_condition), body(_body) {
+kh::AstWhile::AstWhile(size_t _index, AstExpression* _condition, std::vector<AstBody*> _body)
+    : condition(_condition), body(std::move(_body)) {
     this->index = _index;
     this->type = AstBody::WHILE;
 }
 
-kh::AstDoWhile::AstDoWhile(size_t _index, std::shared_ptr<AstExpression>& _condition,
-                           const std::vector<std::shared_ptr<AstBody>>& _body)
-    : condition(_condition), body(_body) {
+kh::AstDoWhile::AstDoWhile(size_t _index, AstExpression* _condition, std::vector<AstBody*> _body)
+    : condition(_condition), body(std::move(_body)) {
     this->index = _index;
     this->type = AstBody::DO_WHILE;
 }
 
-kh::AstFor::AstFor(size_t _index, std::shared_ptr<AstExpression>& _initialize,
-                   std::shared_ptr<AstExpression>& _condition, std::shared_ptr<AstExpression>& _step,
-                   const std::vector<std::shared_ptr<AstBody>>& _body)
-    : initialize(_initialize), condition(_condition), step(_step), body(_body) {
+kh::AstFor::AstFor(size_t _index, AstExpression* _initialize, AstExpression* _condition,
+                   AstExpression* _step, std::vector<AstBody*> _body)
+    : initialize(_initialize), condition(_condition), step(_step), body(std::move(_body)) {
     this->index = _index;
     this->type = AstBody::FOR;
 }
 
-kh::AstForEach::AstForEach(size_t _index, std::shared_ptr<AstExpression>& _target,
-                           std::shared_ptr<AstExpression>& _iterator,
-                           const std::vector<std::shared_ptr<AstBody>>& _body)
-    : target(_target), iterator(_iterator), body(_body) {
+kh::AstForEach::AstForEach(size_t _index, AstExpression* _target, AstExpression* _iterator,
+                           std::vector<AstBody*> _body)
+    : target(_target), iterator(_iterator), body(std::move(_body)) {
     this->index = _index;
     this->type = AstBody::FOREACH;
 }
 
 kh::AstStatement::AstStatement(size_t _index, AstStatement::Type _statement_type,
-                               std::shared_ptr<AstExpression>& _expression)
+                               AstExpression* _expression)
     : statement_type((Type)((size_t)_statement_type)), expression(_expression) {
     this->index = _index;
     this->type = AstBody::STATEMENT;
@@ -5,6 +5,7 @@
  */
 
 #include <kithare/ast.hpp>
+#include <kithare/parser.hpp>
 #include <kithare/utf8.hpp>
 
 
@@ -310,7 +311,7 @@ std::u32string kh::AstDeclaration::strfy(size_t indent) const {
     str += kh::strfy(this->var_type, indent + 1);
 
     for (uint64_t dimension : this->var_array) {
-        str += U'[' + strfy(dimension) + U']';
+        str += U'[' + kh::strfy(dimension) + U']';
     }
 
     str += U"\n\t" + ind + U"name: " + decodeUtf8(this->var_name);
@@ -348,7 +349,7 @@ std::u32string kh::AstFunction::strfy(size_t indent) const {
         if (!this->id_array.empty()) {
             str += U"\n\t" + ind + U"array type dimension: ";
             for (uint64_t size : this->id_array) {
-                str += U'[' + strfy(size) + U']';
+                str += U'[' + kh::strfy(size) + U']';
             }
         }
     }
@@ -361,7 +362,7 @@ std::u32string kh::AstFunction::strfy(size_t indent) const {
     str += kh::strfy(this->return_type, indent + 1);
 
     for (uint64_t dimension : this->return_array) {
-        str += U'[' + strfy(dimension) + U']';
+        str += U'[' + kh::strfy(dimension) + U']';
     }
 
     str += U"\n\t" + ind + U"argument(s):";
@@ -372,8 +373,9 @@ std::u32string kh::AstFunction::strfy(size_t indent) const {
         str += U"\n\t\t" + ind + kh::strfy(arg, indent + 2);
     }
 
+    /* A body which a skeleton parse skipped gets parsed to be shown */
     str += U"\n\t" + ind + U"body:";
-    for (auto& part : this->body) {
+    for (auto& part : parseLazyBody(*this)) {
         if (part) {
             str += U"\n\t\t" + ind + kh::strfy(*part, indent + 2);
         }
@@ -426,7 +428,13 @@ std::u32string kh::AstValue::strfy(size_t indent) const {
             break;
 
         case AstValue::ValueType::BUFFER:
-            str = U"buffer: " + quote(this->buffer);
+            /* An embedded file could be anything from an image to an entire archive */
+            if (this->embedded) {
+                str = U"embedded buffer: " + kh::strfy((uint64_t)this->bufferSize()) + U" bytes";
+            }
+            else {
+                str = U"buffer: " + quote(this->buffer);
+            }
             break;
 
         case AstValue::ValueType::STRING:
@@ -642,7 +650,7 @@ std::u32string kh::AstStatement::strfy(size_t indent) const {
         }
     }
     else {
-        str += U" " + strfy((uint64_t)this->loop_count);
+        str += U" " + kh::strfy((uint64_t)this->loop_count);
     }
     return str;
 }
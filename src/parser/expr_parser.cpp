@@ -10,265 +10,251 @@
 
 using namespace kh;
 
-#define RECURSIVE_DESCENT_SINGULAR_OP(lower)                                                   \
-    do {                                                                                       \
-        AstExpression* expr = lower(context);                                                  \
-        Token token;                                                                           \
-        size_t index;                                                                          \
-        KH_PARSE_GUARD();                                                                      \
-        token = context.tok();                                                                 \
-        index = token.index;                                                                   \
-        while (token.type == TokenType::OPERATOR) {                                            \
-            bool has_op = false;                                                               \
-            for (const Operator op : operators) {                                              \
-                if (token.value.operator_type == op) {                                         \
-                    has_op = true;                                                             \
-                    break;                                                                     \
-                }                                                                              \
-            }                                                                                  \
-            if (!has_op)                                                                       \
-                break;                                                                         \
-            context.ti++;                                                                      \
-            KH_PARSE_GUARD();                                                                  \
-            std::shared_ptr<AstExpression> lval(expr);                                         \
-            std::shared_ptr<AstExpression> rval(lower(context));                               \
-            expr = new AstBinaryOperation(token.index, token.value.operator_type, lval, rval); \
-            KH_PARSE_GUARD();                                                                  \
-            token = context.tok();                                                             \
-        }                                                                                      \
-        KH_PARSE_GUARD();                                                                      \
-        token = context.tok();                                                                 \
-    end:                                                                                       \
-        return expr;                                                                           \
-    } while (false)
-
-AstExpression* kh::parseExpression(const std::vector<Token>& tokens) {
-    std::vector<ParseException> exceptions;
-    ParserContext context{tokens, exceptions};
-    AstExpression* ast = parseExpression(context);
+/* Precedences of the binary operators, has to be kept in the same order as `kh::Operator`. The ones
+ * which aren't binary operators have none */
+static const uint8_t binary_precedences[] = {
+    /* ADD, SUB, MUL, DIV, MOD, POW */
+    PRECEDENCE_ADD_SUB, PRECEDENCE_ADD_SUB, PRECEDENCE_MUL_DIV_MOD, PRECEDENCE_MUL_DIV_MOD,
+    PRECEDENCE_MUL_DIV_MOD, PRECEDENCE_POW,
+
+    /* IADD, ISUB, IMUL, IDIV, IMOD, IPOW */
+    PRECEDENCE_ASSIGN, PRECEDENCE_ASSIGN, PRECEDENCE_ASSIGN, PRECEDENCE_ASSIGN, PRECEDENCE_ASSIGN,
+    PRECEDENCE_ASSIGN,
+
+    /* INCREMENT, DECREMENT */
+    PRECEDENCE_NONE, PRECEDENCE_NONE,
+
+    /* EQUAL, NOT_EQUAL, LESS, MORE, LESS_EQUAL, MORE_EQUAL */
+    PRECEDENCE_COMPARISON, PRECEDENCE_COMPARISON, PRECEDENCE_COMPARISON, PRECEDENCE_COMPARISON,
+    PRECEDENCE_COMPARISON, PRECEDENCE_COMPARISON,
+
+    /* BIT_AND, BIT_OR, BIT_NOT, BIT_LSHIFT, BIT_RSHIFT, AND, OR, NOT */
+    PRECEDENCE_BIT_AND, PRECEDENCE_BIT_OR, PRECEDENCE_NONE, PRECEDENCE_BIT_SHIFT, PRECEDENCE_BIT_SHIFT,
+    PRECEDENCE_AND, PRECEDENCE_OR, PRECEDENCE_NONE,
+
+    /* ASSIGN, SIZEOF, ADDRESS */
+    PRECEDENCE_ASSIGN, PRECEDENCE_NONE, PRECEDENCE_NONE};
+
+static_assert(sizeof(binary_precedences) == (size_t)Operator::ADDRESS + 1,
+              "every operator needs a binary precedence");
+
+static inline bool isPrefixOperator(Operator op) {
+    switch (op) {
+        case Operator::ADD:
+        case Operator::SUB:
+        case Operator::INCREMENT:
+        case Operator::DECREMENT:
+        case Operator::BIT_NOT:
+        case Operator::SIZEOF:
+        case Operator::ADDRESS:
+            return true;
 
-    if (exceptions.empty()) {
-        return ast;
-    }
-    else {
-        throw exceptions;
+        default:
+            return false;
     }
 }
 
-AstExpression* kh::parseExpression(KH_PARSE_CTX) {
-    Token token = context.tok();
-    size_t index = token.index;
-
-    return parseAssignOps(context);
-end:
-    return nullptr;
-}
-
-AstExpression* kh::parseAssignOps(KH_PARSE_CTX) {
-    static std::vector<Operator> operators = {Operator::ASSIGN, Operator::IADD, Operator::ISUB,
-                                              Operator::IMUL,   Operator::IDIV, Operator::IMOD,
-                                              Operator::IPOW};
-    RECURSIVE_DESCENT_SINGULAR_OP(parseTernary);
-}
-
-AstExpression* kh::parseTernary(KH_PARSE_CTX) {
-    AstExpression* expr = parseOr(context);
-    Token token;
-    size_t index;
+/* Looks ahead, without consuming anything, for what makes identifiers the type of a declaration: an
+ * array dimension made of only `[]` and `[<integer>]`, followed by the variable's name */
+static inline bool isDeclarationAhead(KH_PARSE_CTX) {
+    size_t offset = 0;
 
-    KH_PARSE_GUARD();
-    token = context.tok();
-    index = token.index;
+    while (!context.eof(offset)) {
+        Token token = context.tok(offset);
 
-    while (token.type == TokenType::IDENTIFIER && token.value.identifier == "if") {
-        index = token.index;
-
-        context.ti++;
-        KH_PARSE_GUARD();
-        std::shared_ptr<AstExpression> condition(parseOr(context));
+        if (token.type == TokenType::IDENTIFIER) {
+            return token.keyword() != Keyword::IF && token.keyword() != Keyword::ELSE;
+        }
+        if (!(token.type == TokenType::SYMBOL && token.symbolType() == Symbol::SQUARE_OPEN)) {
+            return false;
+        }
 
-        KH_PARSE_GUARD();
-        token = context.tok();
+        offset++;
+        token = context.tok(offset);
+        if (!context.eof(offset) &&
+            (token.type == TokenType::INTEGER || token.type == TokenType::UINTEGER)) {
+            offset++;
+            token = context.tok(offset);
+        }
 
-        if (!(token.type == TokenType::IDENTIFIER && token.value.identifier == "else")) {
-            context.exceptions.emplace_back(
-                "expected an `else` to specify the else case of the ternary expression", token);
-            goto end;
+        if (context.eof(offset) ||
+            !(token.type == TokenType::SYMBOL && token.symbolType() == Symbol::SQUARE_CLOSE)) {
+            return false;
         }
+        offset++;
+    }
 
-        context.ti++;
-        KH_PARSE_GUARD();
+    return false;
+}
 
-        std::shared_ptr<AstExpression> value(expr);
-        std::shared_ptr<AstExpression> otherwise(parseOr(context));
-        expr = new AstTernaryOperation(index, condition, value, otherwise);
+AstExpression* kh::parseExpression(const TokenStream& tokens, AstArena& arena) {
+    std::vector<ParseException> exceptions;
+    ParserContext context{tokens, exceptions};
+    context.arena = &arena;
+    AstExpression* ast = parseExpression(context);
+    context.resolveExceptions();
 
-        KH_PARSE_GUARD();
-        token = context.tok();
+    if (exceptions.empty()) {
+        return ast;
+    }
+    else {
+        throw exceptions;
     }
-end:
-    return expr;
-}
-
-AstExpression* kh::parseOr(KH_PARSE_CTX) {
-    static std::vector<Operator> operators = {Operator::OR};
-    RECURSIVE_DESCENT_SINGULAR_OP(parseAnd);
 }
 
-AstExpression* kh::parseAnd(KH_PARSE_CTX) {
-    static std::vector<Operator> operators = {Operator::AND};
-    RECURSIVE_DESCENT_SINGULAR_OP(parseNot);
+AstExpression* kh::parseExpression(KH_PARSE_CTX) {
+    return parseBinary(context, PRECEDENCE_ASSIGN);
 }
 
-AstExpression* kh::parseNot(KH_PARSE_CTX) {
+AstExpression* kh::parseBinary(KH_PARSE_CTX, uint8_t min_precedence) {
     AstExpression* expr = nullptr;
     Token token = context.tok();
     size_t index = token.index;
 
-    if (token.type == TokenType::OPERATOR && token.value.operator_type == Operator::NOT) {
+    /* Each operator nests the ones before it, such as in `1 + 1 + 1` */
+    ParseNesting chain(context, 0);
+
+    /* Once an operator is parsed, only the ones which bind at most as tight as it can follow, as the
+     * tighter ones went into its operand. A failed ternary expression lowers it further, to only let
+     * an assignment follow */
+    uint8_t max_precedence = PRECEDENCE_POW;
+
+    /* Prefix operators take on everything binding tighter than themselves. The right side of an
+     * exponentiation can't have any */
+    if (token.type == TokenType::OPERATOR && min_precedence <= PRECEDENCE_UNARY) {
+        Operator op = token.operatorType();
+        max_precedence = op == Operator::NOT && min_precedence <= PRECEDENCE_NOT ? PRECEDENCE_NOT
+                         : isPrefixOperator(op)                                ? PRECEDENCE_UNARY
+                                                                                : PRECEDENCE_NONE;
         context.ti++;
-        KH_PARSE_GUARD();
 
-        std::shared_ptr<AstExpression> rval(parseNot(context));
-        expr = new AstUnaryOperation(token.index, token.value.operator_type, rval);
+        if (max_precedence == PRECEDENCE_NONE) {
+            max_precedence = PRECEDENCE_UNARY;
+            context.exceptions.emplace_back(
+                "unexpected `" + encodeUtf8(strfy(token)) + "` in an expression", token);
+        }
+        else {
+            KH_PARSE_GUARD();
+
+            /* Prefix operators are the only ones which nest without brackets */
+            ParseNesting nesting(context);
+            AstExpression* rval = nesting.tooDeep() ? nullptr : parseBinary(context, max_precedence);
+            expr = context.arena->make<AstUnaryOperation>(token.index, op, rval);
+        }
     }
     else {
-        expr = parseComparison(context);
+        expr = parseRevUnary(context);
     }
-end:
-    return expr;
-}
 
-AstExpression* kh::parseComparison(KH_PARSE_CTX) {
-    union {
-        AstExpression* expr;
-        AstComparisonExpression* comparison_expr;
-    };
+    while (true) {
+        KH_PARSE_GUARD();
+        token = context.tok();
 
-    expr = parseBitwiseOr(context);
-    Token token;
-    size_t index;
+        /* Ternary expression `value if condition else otherwise` */
+        if (token.type == TokenType::IDENTIFIER && token.keyword() == Keyword::IF) {
+            if (min_precedence > PRECEDENCE_TERNARY || max_precedence < PRECEDENCE_TERNARY) {
+                break;
+            }
+            if (chain.deeper()) {
+                goto end;
+            }
+            index = token.index;
 
-    KH_PARSE_GUARD();
-    token = context.tok();
-    index = token.index;
-
-    if (token.type == TokenType::OPERATOR && (token.value.operator_type == Operator::EQUAL ||
-                                              token.value.operator_type == Operator::NOT_EQUAL ||
-                                              token.value.operator_type == Operator::LESS ||
-                                              token.value.operator_type == Operator::LESS_EQUAL ||
-                                              token.value.operator_type == Operator::MORE ||
-                                              token.value.operator_type == Operator::MORE_EQUAL)) {
-        comparison_expr =
-            new AstComparisonExpression(index, {}, {std::shared_ptr<AstExpression>(expr)});
-
-        while (token.type == TokenType::OPERATOR &&
-               (token.value.operator_type == Operator::EQUAL ||
-                token.value.operator_type == Operator::NOT_EQUAL ||
-                token.value.operator_type == Operator::LESS ||
-                token.value.operator_type == Operator::LESS_EQUAL ||
-                token.value.operator_type == Operator::MORE ||
-                token.value.operator_type == Operator::MORE_EQUAL)) {
             context.ti++;
             KH_PARSE_GUARD();
-            comparison_expr->operations.push_back(token.value.operator_type);
-            comparison_expr->values.emplace_back(parseBitwiseOr(context));
+            AstExpression* condition = parseBinary(context, PRECEDENCE_OR);
+
             KH_PARSE_GUARD();
             token = context.tok();
-        }
-    }
 
-end:
-    return expr;
-}
-
-AstExpression* kh::parseBitwiseOr(KH_PARSE_CTX) {
-    static std::vector<Operator> operators = {Operator::BIT_OR};
-    RECURSIVE_DESCENT_SINGULAR_OP(parseBitwiseAnd);
-}
+            if (!(token.type == TokenType::IDENTIFIER && token.keyword() == Keyword::ELSE)) {
+                context.exceptions.emplace_back(
+                    "expected an `else` to specify the else case of the ternary expression", token);
+                max_precedence = PRECEDENCE_ASSIGN;
+                continue;
+            }
 
-AstExpression* kh::parseBitwiseAnd(KH_PARSE_CTX) {
-    static std::vector<Operator> operators = {Operator::BIT_OR};
-    RECURSIVE_DESCENT_SINGULAR_OP(parseBitwiseShift);
-}
+            context.ti++;
+            KH_PARSE_GUARD();
 
-AstExpression* kh::parseBitwiseShift(KH_PARSE_CTX) {
-    static std::vector<Operator> operators = {Operator::BIT_LSHIFT, Operator::BIT_RSHIFT};
-    RECURSIVE_DESCENT_SINGULAR_OP(parseAddSub);
-}
+            AstExpression* otherwise = parseBinary(context, PRECEDENCE_OR);
+            expr = context.arena->make<AstTernaryOperation>(index, condition, expr, otherwise);
+            max_precedence = PRECEDENCE_TERNARY;
+            continue;
+        }
 
-AstExpression* kh::parseAddSub(KH_PARSE_CTX) {
-    static std::vector<Operator> operators = {Operator::ADD, Operator::SUB};
-    RECURSIVE_DESCENT_SINGULAR_OP(parseMulDivMod);
-}
+        if (token.type != TokenType::OPERATOR) {
+            break;
+        }
 
-AstExpression* kh::parseMulDivMod(KH_PARSE_CTX) {
-    static std::vector<Operator> operators = {Operator::MUL, Operator::DIV, Operator::MOD};
-    RECURSIVE_DESCENT_SINGULAR_OP(parseUnary);
-}
+        uint8_t precedence = binary_precedences[(size_t)token.operatorType()];
+        if (precedence == PRECEDENCE_NONE || precedence < min_precedence ||
+            precedence > max_precedence) {
+            break;
+        }
+        if (chain.deeper()) {
+            goto end;
+        }
+        max_precedence = precedence;
 
-AstExpression* kh::parseUnary(KH_PARSE_CTX) {
-    AstExpression* expr = nullptr;
-    Token token = context.tok();
-    size_t index = token.index;
+        /* Comparisons are chained into one expression `a < b <= c` rather than nested */
+        if (precedence == PRECEDENCE_COMPARISON) {
+            AstComparisonExpression* comparison_expr = context.arena->make<AstComparisonExpression>(
+                token.index, std::vector<Operator>(), std::vector<AstExpression*>{expr});
+            expr = comparison_expr;
 
-    if (token.type == TokenType::OPERATOR) {
-        switch (token.value.operator_type) {
-            case Operator::ADD:
-            case Operator::SUB:
-            case Operator::INCREMENT:
-            case Operator::DECREMENT:
-            case Operator::BIT_NOT:
-            case Operator::SIZEOF:
-            case Operator::ADDRESS: {
+            do {
                 context.ti++;
                 KH_PARSE_GUARD();
-
-                std::shared_ptr<AstExpression> rval(parseUnary(context));
-                expr = new AstUnaryOperation(token.index, token.value.operator_type, rval);
-            } break;
-
-            default:
-                context.ti++;
-                context.exceptions.emplace_back(
-                    "unexpected `" + encodeUtf8(strfy(token)) + "` in an expression", token);
+                comparison_expr->operations.push_back(token.operatorType());
+                comparison_expr->values.emplace_back(
+                    parseBinary(context, PRECEDENCE_COMPARISON + 1));
+                KH_PARSE_GUARD();
+                token = context.tok();
+            } while (token.type == TokenType::OPERATOR &&
+                     binary_precedences[(size_t)token.operatorType()] == PRECEDENCE_COMPARISON);
+        }
+        /* Every other binary operator is left associative */
+        else {
+            context.ti++;
+            KH_PARSE_GUARD();
+            AstExpression* rval = parseBinary(context, precedence + 1);
+            expr =
+                context.arena->make<AstBinaryOperation>(token.index, token.operatorType(), expr, rval);
         }
-    }
-    else {
-        expr = parseExponentiation(context);
     }
 end:
     return expr;
 }
 
-AstExpression* kh::parseExponentiation(KH_PARSE_CTX) {
-    static std::vector<Operator> operators = {Operator::POW};
-    RECURSIVE_DESCENT_SINGULAR_OP(parseRevUnary);
-}
-
 AstExpression* kh::parseRevUnary(KH_PARSE_CTX) {
     Token token = context.tok();
     size_t index = token.index;
+
+    /* Each of these nests the ones before it, such as in `a[0][0]` */
+    ParseNesting chain(context, 0);
     AstExpression* expr = parseOthers(context);
 
     KH_PARSE_GUARD();
     token = context.tok();
 
-    while ((token.type == TokenType::OPERATOR && token.value.operator_type == Operator::INCREMENT ||
-            token.value.operator_type == Operator::DECREMENT) ||
-           (token.type == TokenType::SYMBOL && (token.value.symbol_type == Symbol::DOT ||
-                                                token.value.symbol_type == Symbol::PARENTHESES_OPEN ||
-                                                token.value.symbol_type == Symbol::SQUARE_OPEN))) {
+    while ((token.type == TokenType::OPERATOR && (token.operatorType() == Operator::INCREMENT ||
+                                                  token.operatorType() == Operator::DECREMENT)) ||
+           (token.type == TokenType::SYMBOL && (token.symbolType() == Symbol::DOT ||
+                                                token.symbolType() == Symbol::PARENTHESES_OPEN ||
+                                                token.symbolType() == Symbol::SQUARE_OPEN))) {
         index = token.index;
+        if (chain.deeper()) {
+            goto end;
+        }
 
         /* Post-incrementation and decrementation */
         if (token.type == TokenType::OPERATOR) {
-            std::shared_ptr<AstExpression> expr_ptr(expr);
-            expr = new AstRevUnaryOperation(index, token.value.operator_type, expr_ptr);
+            expr = context.arena->make<AstRevUnaryOperation>(index, token.operatorType(), expr);
             context.ti++;
         }
         else {
-            switch (token.value.symbol_type) {
+            switch (token.symbolType()) {
                 /* Scoping expression */
                 case Symbol::DOT: {
                     std::vector<std::string> identifiers;
@@ -280,7 +266,7 @@ AstExpression* kh::parseRevUnary(KH_PARSE_CTX) {
 
                         /* Expects an identifier for which to be scoped through from the expression */
                         if (token.type == TokenType::IDENTIFIER) {
-                            identifiers.push_back(token.value.identifier);
+                            identifiers.push_back(token.identifier());
                         }
                         else {
                             context.exceptions.emplace_back("expected an identifier", token);
@@ -290,41 +276,26 @@ AstExpression* kh::parseRevUnary(KH_PARSE_CTX) {
                         token = context.tok();
 
                         /* Continues again for another scope in */
-                    } while (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::DOT);
+                    } while (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::DOT);
 
-                    std::shared_ptr<AstExpression> exprptr(expr);
-                    expr = new AstScoping(index, exprptr, identifiers);
+                    expr = context.arena->make<AstScoping>(index, expr, std::move(identifiers));
                 } break;
 
                     /* Calling expression */
                 case Symbol::PARENTHESES_OPEN: {
-                    std::shared_ptr<AstExpression> exprptr(expr);
                     /* Parses the argument(s) */
                     AstTuple* tuple = static_cast<AstTuple*>(parseTuple(context));
-                    std::vector<std::shared_ptr<AstExpression>> arguments;
-
-                    for (std::shared_ptr<AstExpression>& element : tuple->elements) {
-                        arguments.push_back(element);
-                    }
-
-                    expr = new AstCallExpression(index, exprptr, arguments);
-                    delete tuple;
+                    expr = context.arena->make<AstCallExpression>(index, expr,
+                                                                  std::move(tuple->elements));
                 } break;
 
                     /* Subscription expression */
                 case Symbol::SQUARE_OPEN: {
-                    std::shared_ptr<AstExpression> exprptr(expr);
                     /* Parses argument(s) */
                     AstTuple* tuple = static_cast<AstTuple*>(
                         parseTuple(context, Symbol::SQUARE_OPEN, Symbol::SQUARE_CLOSE));
-                    std::vector<std::shared_ptr<AstExpression>> arguments;
-
-                    for (std::shared_ptr<AstExpression>& element : tuple->elements) {
-                        arguments.push_back(element);
-                    }
-
-                    expr = new AstSubscriptExpression(index, exprptr, arguments);
-                    delete tuple;
+                    expr = context.arena->make<AstSubscriptExpression>(index, expr,
+                                                                       std::move(tuple->elements));
                 } break;
 
                 default: {
@@ -349,32 +320,35 @@ AstExpression* kh::parseOthers(KH_PARSE_CTX) {
             /* For all of these literal values be given the AST constant value instance */
 
         case TokenType::CHARACTER:
-            expr = new AstValue(token.index, token.value.character);
+            expr = context.arena->make<AstValue>(token.index, token.character());
             context.ti++;
             break;
 
         case TokenType::UINTEGER:
-            expr = new AstValue(token.index, token.value.uinteger);
+            expr = context.arena->make<AstValue>(token.index, token.uinteger());
             context.ti++;
             break;
 
         case TokenType::INTEGER:
-            expr = new AstValue(token.index, token.value.integer);
+            expr = context.arena->make<AstValue>(token.index, token.integer());
             context.ti++;
             break;
 
         case TokenType::FLOATING:
-            expr = new AstValue(token.index, token.value.floating);
+            expr = context.arena->make<AstValue>(token.index, token.floating());
             context.ti++;
             break;
 
         case TokenType::IMAGINARY:
-            expr = new AstValue(token.index, token.value.imaginary, AstValue::ValueType::IMAGINARY);
+            expr = context.arena->make<AstValue>(token.index, token.imaginary(),
+                                                 AstValue::ValueType::IMAGINARY);
             context.ti++;
             break;
 
         case TokenType::STRING:
-            expr = new AstValue(token.index, token.value.string);
+            /* Decoded straight from the source into the value */
+            expr = context.arena->make<AstValue>(token.index, std::u32string());
+            token.appendString(((AstValue*)expr)->string);
             context.ti++;
 
             KH_PARSE_GUARD();
@@ -382,7 +356,7 @@ AstExpression* kh::parseOthers(KH_PARSE_CTX) {
 
             /* Auto concatenation */
             while (token.type == TokenType::STRING) {
-                ((AstValue*)expr)->string += token.value.string;
+                token.appendString(((AstValue*)expr)->string);
                 context.ti++;
                 KH_PARSE_GUARD();
                 token = context.tok();
@@ -391,7 +365,9 @@ AstExpression* kh::parseOthers(KH_PARSE_CTX) {
             break;
 
         case TokenType::BUFFER:
-            expr = new AstValue(token.index, token.value.buffer);
+            /* Decoded straight from the source into the value */
+            expr = context.arena->make<AstValue>(token.index, std::string());
+            token.appendBuffer(((AstValue*)expr)->buffer);
             context.ti++;
 
             KH_PARSE_GUARD();
@@ -399,7 +375,7 @@ AstExpression* kh::parseOthers(KH_PARSE_CTX) {
 
             /* Auto concatenation */
             while (token.type == TokenType::BUFFER) {
-                ((AstValue*)expr)->buffer += token.value.buffer;
+                token.appendBuffer(((AstValue*)expr)->buffer);
                 context.ti++;
                 KH_PARSE_GUARD();
                 token = context.tok();
@@ -409,79 +385,52 @@ AstExpression* kh::parseOthers(KH_PARSE_CTX) {
 
         case TokenType::IDENTIFIER:
             /* Lambda expression */
-            if (token.value.identifier == "def") {
+            if (token.keyword() == Keyword::DEF) {
                 context.ti++;
                 KH_PARSE_GUARD();
+
+                /* The statements of a lambda are parsed again along with the statement it's in, so
+                 * none of them get left in the spans without being in the tree, see `reparse` */
+                ParseSpans* spans = context.spans;
+                const ParseSpans* previous_spans = context.previous_spans;
+                context.spans = nullptr;
+                context.previous_spans = nullptr;
                 AstFunction lambda = parseFunction(context, false);
+                context.spans = spans;
+                context.previous_spans = previous_spans;
 
                 if (!lambda.identifiers.empty()) {
                     context.exceptions.emplace_back(
                         "a non-lambda function cannot be defined in an expression", token);
                 }
 
-                return new AstFunction(lambda);
+                return context.arena->make<AstFunction>(std::move(lambda));
             }
             /* Variable declaration */
-            else if (token.value.identifier == "ref" || token.value.identifier == "static") {
-                AstDeclaration* declaration = new AstDeclaration(parseDeclaration(context));
-                declaration->is_static = token.value.identifier == "static";
+            else if (token.keyword() == Keyword::REF || token.keyword() == Keyword::STATIC) {
+                AstDeclaration* declaration =
+                    context.arena->make<AstDeclaration>(parseDeclaration(context));
+                declaration->is_static = token.keyword() == Keyword::STATIC;
                 return declaration;
             }
             else {
-                size_t _ti = context.ti;
-                expr = new AstIdentifiers(parseIdentifiers(context));
-
-                KH_PARSE_GUARD();
-                token = context.tok();
-
-                /* An identifier is next to another identifier `int number` */
-                if (token.type == TokenType::IDENTIFIER && token.value.identifier != "if" &&
-                    token.value.identifier != "else") {
-                    context.ti = _ti;
-                    delete expr;
-                    expr = new AstDeclaration(parseDeclaration(context));
+                AstIdentifiers identifiers = parseIdentifiers(context);
+
+                /* An identifier next to another identifier `int number`, possibly with an array
+                 * dimension in between `float[3] position`, is a variable declaration. Anything
+                 * else, such as a subscript `values[3]`, leaves the identifiers as they are */
+                if (isDeclarationAhead(context)) {
+                    expr = context.arena->make<AstDeclaration>(
+                        parseDeclaration(context, index, std::move(identifiers), 0));
                 }
-                /* An opening square parentheses next to an idenifier, possible array variable
-                 * declaration */
-                else if (token.type == TokenType::SYMBOL &&
-                         token.value.symbol_type == Symbol::SQUARE_OPEN) {
-                    size_t exception_counts = context.exceptions.size();
-
-                    parseArrayDimension(context, *static_cast<AstIdentifiers*>(expr));
-                    delete expr;
-
-                    /* If there was exceptions while parsing the array dimension type, it probably
-                     * wasn't an array variable declaration.. rather a subscript or something */
-                    if (context.exceptions.size() > exception_counts) {
-                        for (size_t i = 0; i < context.exceptions.size() - exception_counts; i++) {
-                            context.exceptions.pop_back();
-                        }
-
-                        context.ti = _ti;
-                        expr = new AstIdentifiers(parseIdentifiers(context));
-                    }
-                    else {
-                        KH_PARSE_GUARD();
-                        token = context.tok();
-
-                        /* Confirmed that it's an array declaration `float[3] position;` */
-                        if (token.type == TokenType::IDENTIFIER && token.value.identifier != "if" &&
-                            token.value.identifier != "else") {
-                            context.ti = _ti;
-                            expr = new AstDeclaration(parseDeclaration(context));
-                        }
-                        /* Probably was just a normal subscript */
-                        else {
-                            context.ti = _ti;
-                            expr = new AstIdentifiers(parseIdentifiers(context));
-                        }
-                    }
+                else {
+                    expr = context.arena->make<AstIdentifiers>(std::move(identifiers));
                 }
             }
             break;
 
         case TokenType::SYMBOL:
-            switch (token.value.symbol_type) {
+            switch (token.symbolType()) {
                 /* Parentheses/tuple expression */
                 case Symbol::PARENTHESES_OPEN:
                     expr =
@@ -529,11 +478,11 @@ AstIdentifiers kh::parseIdentifiers(KH_PARSE_CTX) {
 
     /* Expects an identifier */
     if (token.type == TokenType::IDENTIFIER) {
-        if (isReservedKeyword(token.value.identifier)) {
+        if (isReservedKeyword(token)) {
             context.exceptions.emplace_back("cannot use a reserved keyword as an identifier", token);
         }
 
-        identifiers.push_back(token.value.identifier);
+        identifiers.push_back(token.identifier());
         context.ti++;
     }
     else {
@@ -545,18 +494,18 @@ AstIdentifiers kh::parseIdentifiers(KH_PARSE_CTX) {
     token = context.tok();
 
     /* For each scope in with a dot symbol */
-    while (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::DOT) {
+    while (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::DOT) {
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
 
         /* Appends the identifier */
         if (token.type == TokenType::IDENTIFIER) {
-            if (isReservedKeyword(token.value.identifier)) {
+            if (isReservedKeyword(token)) {
                 context.exceptions.emplace_back("cannot use a reserved keyword as an identifier",
                                                 token);
             }
-            identifiers.push_back(token.value.identifier);
+            identifiers.push_back(token.identifier());
         }
         else {
             context.exceptions.emplace_back("expected an identifier after the dot", token);
@@ -571,18 +520,24 @@ AstIdentifiers kh::parseIdentifiers(KH_PARSE_CTX) {
     is_function = identifiers.size() == 1 && identifiers[0] == "func";
 
     /* Optional genericization */
-    if (token.type == TokenType::OPERATOR && token.value.operator_type == Operator::NOT) {
+    if (token.type == TokenType::OPERATOR && token.operatorType() == Operator::NOT) {
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
 
-        if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::PARENTHESES_OPEN) {
+        if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::PARENTHESES_OPEN) {
+            /* Generic arguments are nested types */
+            ParseNesting nesting(context);
+            if (nesting.tooDeep()) {
+                goto end;
+            }
+
             context.ti++;
             KH_PARSE_GUARD();
             token = context.tok();
 
             generics_refs.push_back(0);
-            while (token.type == TokenType::IDENTIFIER && token.value.identifier == "ref") {
+            while (token.type == TokenType::IDENTIFIER && token.keyword() == Keyword::REF) {
                 generics_refs.back() += 1;
                 context.ti++;
                 KH_PARSE_GUARD();
@@ -597,13 +552,13 @@ AstIdentifiers kh::parseIdentifiers(KH_PARSE_CTX) {
 
             if (is_function) {
                 if (token.type == TokenType::SYMBOL &&
-                    token.value.symbol_type == Symbol::PARENTHESES_OPEN) {
+                    token.symbolType() == Symbol::PARENTHESES_OPEN) {
                     context.ti++;
                     KH_PARSE_GUARD();
                     token = context.tok();
 
                     if (token.type == TokenType::SYMBOL &&
-                        token.value.symbol_type == Symbol::PARENTHESES_CLOSE) {
+                        token.symbolType() == Symbol::PARENTHESES_CLOSE) {
                         context.ti++;
                         goto funcFinish;
                     }
@@ -618,14 +573,14 @@ AstIdentifiers kh::parseIdentifiers(KH_PARSE_CTX) {
                 }
             }
 
-            while (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::COMMA) {
+            while (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::COMMA) {
                 context.ti++;
                 KH_PARSE_GUARD();
                 token = context.tok();
 
             forceIn:
                 generics_refs.push_back(0);
-                while (token.type == TokenType::IDENTIFIER && token.value.identifier == "ref") {
+                while (token.type == TokenType::IDENTIFIER && token.keyword() == Keyword::REF) {
                     generics_refs.back() += 1;
                     context.ti++;
                     KH_PARSE_GUARD();
@@ -641,7 +596,7 @@ AstIdentifiers kh::parseIdentifiers(KH_PARSE_CTX) {
 
             /* Expects closing parentheses */
             if (token.type == TokenType::SYMBOL &&
-                token.value.symbol_type == Symbol::PARENTHESES_CLOSE) {
+                token.symbolType() == Symbol::PARENTHESES_CLOSE) {
                 context.ti++;
 
                 if (is_function) {
@@ -650,7 +605,7 @@ AstIdentifiers kh::parseIdentifiers(KH_PARSE_CTX) {
                     token = context.tok();
 
                     if (token.type == TokenType::SYMBOL &&
-                        token.value.symbol_type == Symbol::PARENTHESES_CLOSE) {
+                        token.symbolType() == Symbol::PARENTHESES_CLOSE) {
                         context.ti++;
                     }
                     else {
@@ -663,6 +618,11 @@ AstIdentifiers kh::parseIdentifiers(KH_PARSE_CTX) {
             }
         }
         else if (token.type == TokenType::IDENTIFIER) {
+            ParseNesting nesting(context);
+            if (nesting.tooDeep()) {
+                goto end;
+            }
+
             if (is_function) {
                 context.exceptions.emplace_back(
                     "expected an opening parentheses for genericization of `func`", token);
@@ -683,7 +643,8 @@ AstIdentifiers kh::parseIdentifiers(KH_PARSE_CTX) {
         context.exceptions.emplace_back("`func` requires genericization", token);
     }
 end:
-    return {index, identifiers, generics, generics_refs, generics_array};
+    return {index, std::move(identifiers), std::move(generics), std::move(generics_refs),
+            std::move(generics_array)};
 }
 
 AstExpression* kh::parseTuple(KH_PARSE_CTX, Symbol opening, Symbol closing, bool explicit_tuple) {
@@ -692,14 +653,19 @@ AstExpression* kh::parseTuple(KH_PARSE_CTX, Symbol opening, Symbol closing, bool
     Token token = context.tok();
     size_t index = token.index;
 
+    ParseNesting nesting(context);
+    if (nesting.tooDeep()) {
+        goto end;
+    }
+
     /* Expects the opening symbol */
-    if (token.type == TokenType::SYMBOL && token.value.symbol_type == opening) {
+    if (token.type == TokenType::SYMBOL && token.symbolType() == opening) {
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
 
         /* Instant close */
-        if (token.type == TokenType::SYMBOL && token.value.symbol_type == closing) {
+        if (token.type == TokenType::SYMBOL && token.symbolType() == closing) {
             context.ti++;
             goto end;
         }
@@ -710,11 +676,11 @@ AstExpression* kh::parseTuple(KH_PARSE_CTX, Symbol opening, Symbol closing, bool
             KH_PARSE_GUARD();
             token = context.tok();
 
-            if (token.type == TokenType::SYMBOL && token.value.symbol_type == closing) {
+            if (token.type == TokenType::SYMBOL && token.symbolType() == closing) {
                 context.ti++;
                 break;
             }
-            else if (!(token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::COMMA)) {
+            else if (!(token.type == TokenType::SYMBOL && token.symbolType() == Symbol::COMMA)) {
                 context.exceptions.emplace_back(closing == Symbol::SQUARE_CLOSE
                                                     ? "expected a comma or a closing square bracket"
                                                     : "expected a comma or a closing parentheses",
@@ -728,7 +694,7 @@ AstExpression* kh::parseTuple(KH_PARSE_CTX, Symbol opening, Symbol closing, bool
             token = context.tok();
 
             /* Cases for explicit one-elemented tuples `(69420,)` */
-            if (token.type == TokenType::SYMBOL && token.value.symbol_type == closing) {
+            if (token.type == TokenType::SYMBOL && token.symbolType() == closing) {
                 context.ti++;
                 explicit_tuple = true;
                 break;
@@ -745,49 +711,38 @@ AstExpression* kh::parseTuple(KH_PARSE_CTX, Symbol opening, Symbol closing, bool
 
 end:
     if (!explicit_tuple && elements.size() == 1) {
-        for (size_t i = 1; i < elements.size(); i++) {
-            delete elements[i];
-        }
-
         return elements[0];
     }
     else {
-        std::vector<std::shared_ptr<AstExpression>> _elements;
-        _elements.reserve(elements.size());
-
-        for (AstExpression* element : elements) {
-            _elements.emplace_back(element);
-        }
-
-        return new AstTuple(index, _elements);
+        return context.arena->make<AstTuple>(index, std::move(elements));
     }
 }
 
 AstExpression* kh::parseList(KH_PARSE_CTX) {
-    Token token = context.tok();
-    size_t index = token.index;
-
-    AstTuple* tuple = (AstTuple*)parseTuple(context, Symbol::SQUARE_OPEN, Symbol::SQUARE_CLOSE, false);
-    AstList* list = new AstList(tuple->index, tuple->elements);
-    delete tuple;
-
-    return list;
+    /* Always a tuple, as a list of a single element doesn't need a trailing comma `[1]` */
+    AstTuple* tuple = (AstTuple*)parseTuple(context, Symbol::SQUARE_OPEN, Symbol::SQUARE_CLOSE, true);
+    return context.arena->make<AstList>(tuple->index, std::move(tuple->elements));
 }
 
 AstExpression* kh::parseDict(KH_PARSE_CTX) {
-    std::vector<std::shared_ptr<AstExpression>> keys;
-    std::vector<std::shared_ptr<AstExpression>> items;
+    std::vector<AstExpression*> keys;
+    std::vector<AstExpression*> items;
 
     Token token = context.tok();
     size_t index = token.index;
 
-    if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::CURLY_OPEN) {
+    ParseNesting nesting(context);
+    if (nesting.tooDeep()) {
+        goto end;
+    }
+
+    if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::CURLY_OPEN) {
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
 
         /* Instant close*/
-        if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::CURLY_CLOSE) {
+        if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::CURLY_CLOSE) {
             context.ti++;
             goto end;
         }
@@ -802,7 +757,7 @@ AstExpression* kh::parseDict(KH_PARSE_CTX) {
 
             KH_PARSE_GUARD();
             token = context.tok();
-            if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::COLON) {
+            if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::COLON) {
                 context.ti++;
                 KH_PARSE_GUARD();
             }
@@ -813,9 +768,9 @@ AstExpression* kh::parseDict(KH_PARSE_CTX) {
             items.emplace_back(parseExpression(context));
             KH_PARSE_GUARD();
             token = context.tok();
-        } while (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::COMMA);
+        } while (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::COMMA);
 
-        if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::CURLY_CLOSE) {
+        if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::CURLY_CLOSE) {
             context.ti++;
         }
         else {
@@ -828,30 +783,32 @@ AstExpression* kh::parseDict(KH_PARSE_CTX) {
                                         token);
     }
 end:
-    return new AstDict(index, keys, items);
+    return context.arena->make<AstDict>(index, std::move(keys), std::move(items));
 }
 
 std::vector<uint64_t> kh::parseArrayDimension(KH_PARSE_CTX, AstIdentifiers& type) {
     std::vector<uint64_t> dimension;
 
     Token token = context.tok();
-    size_t index = token.index;
 
-    while (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::SQUARE_OPEN) {
+    while (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::SQUARE_OPEN) {
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
 
-        if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::SQUARE_CLOSE) {
-            type = AstIdentifiers(token.index, {"list"}, {type}, {false},
+        if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::SQUARE_CLOSE) {
+            /* The element type is moved into the list type rather than copied */
+            std::vector<AstIdentifiers> generics;
+            generics.push_back(std::move(type));
+            type = AstIdentifiers(token.index, {"list"}, std::move(generics), {false},
                                   dimension.size() ? std::vector<std::vector<uint64_t>>{dimension}
                                                    : std::vector<std::vector<uint64_t>>{{}});
 
             dimension.clear();
         }
         else if (token.type == TokenType::INTEGER || token.type == TokenType::UINTEGER) {
-            dimension.push_back(token.value.uinteger);
-            if (token.value.uinteger == 0) {
+            dimension.push_back(token.uinteger());
+            if (token.uinteger() == 0) {
                 context.exceptions.emplace_back("an array could not be zero sized", token);
             }
 
@@ -859,7 +816,7 @@ std::vector<uint64_t> kh::parseArrayDimension(KH_PARSE_CTX, AstIdentifiers& type
             KH_PARSE_GUARD();
             token = context.tok();
 
-            if (!(token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::SQUARE_CLOSE)) {
+            if (!(token.type == TokenType::SYMBOL && token.symbolType() == Symbol::SQUARE_CLOSE)) {
                 context.exceptions.emplace_back("expected a closing square bracket in the array size",
                                                 token);
             }
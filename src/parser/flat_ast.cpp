@@ -0,0 +1,514 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#include <cstring>
+#include <stdexcept>
+
+#include <kithare/flat_ast.hpp>
+#include <kithare/parser.hpp>
+
+
+using namespace kh;
+
+static uint64_t doubleBits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bitsDouble(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+FlatId kh::FlatAst::push(FlatKind kind, size_t index, uint8_t op, size_t payload) {
+    if (this->nodes.size() >= FLAT_NONE) {
+        throw std::length_error("too many nodes for the 32-bit ids of a flat AST");
+    }
+
+    this->nodes.push_back({kind, op, 0, FLAT_NONE, FLAT_NONE, (uint32_t)payload, index});
+    return (FlatId)(this->nodes.size() - 1);
+}
+
+void kh::FlatAst::append(FlatId parent, FlatId& last, FlatId child) {
+    if (last == FLAT_NONE) {
+        this->nodes[parent].first_child = child;
+    }
+    else {
+        this->nodes[last].next_sibling = child;
+    }
+    last = child;
+}
+
+size_t kh::FlatAst::childCount(FlatId id) const {
+    size_t count = 0;
+    for (FlatId child = this->nodes[id].first_child; child != FLAT_NONE;
+         child = this->nodes[child].next_sibling) {
+        count++;
+    }
+    return count;
+}
+
+FlatId kh::FlatAst::addBlock(const std::vector<AstBody*>& body, size_t index) {
+    FlatId id = this->push(FlatKind::BLOCK, index);
+    FlatId last = FLAT_NONE;
+    for (const AstBody* part : body) {
+        this->append(id, last, this->add(part));
+    }
+    return id;
+}
+
+FlatId kh::FlatAst::add(const AstBody* body) {
+    if (!body) {
+        return this->push(FlatKind::NONE, 0);
+    }
+
+    FlatId id = FLAT_NONE;
+    FlatId last = FLAT_NONE;
+
+    switch (body->type) {
+        case AstBody::EXPRESSION: {
+            const AstExpression* expr = static_cast<const AstExpression*>(body);
+            id = this->push((FlatKind)expr->expression_type, expr->index);
+
+            switch (expr->expression_type) {
+                case AstExpression::IDENTIFIER: {
+                    this->nodes[id].payload = (uint32_t)this->identifiers.size();
+                    this->identifiers.push_back(*static_cast<const AstIdentifiers*>(expr));
+                } break;
+
+                case AstExpression::DECLARE: {
+                    const AstDeclaration* declaration = static_cast<const AstDeclaration*>(expr);
+                    this->nodes[id].payload = (uint32_t)this->declarations.size();
+                    this->declarations.emplace_back(declaration->index, declaration->var_type,
+                                                    declaration->var_array, declaration->var_name,
+                                                    nullptr, declaration->refs);
+                    this->declarations.back().is_public = declaration->is_public;
+                    this->declarations.back().is_static = declaration->is_static;
+
+                    if (declaration->expression) {
+                        this->append(id, last, this->add(declaration->expression));
+                    }
+                } break;
+
+                case AstExpression::FUNCTION: {
+                    const AstFunction* function = static_cast<const AstFunction*>(expr);
+                    this->nodes[id].payload = (uint32_t)this->functions.size();
+                    this->functions.emplace_back(
+                        function->index, function->identifiers, function->generic_args,
+                        function->id_array, function->return_array, function->return_type,
+                        function->return_refs, std::vector<AstDeclaration>(), std::vector<AstBody*>(),
+                        function->is_conditional);
+                    this->functions.back().is_public = function->is_public;
+                    this->functions.back().is_static = function->is_static;
+
+                    for (const AstDeclaration& argument : function->arguments) {
+                        this->append(id, last, this->add(&argument));
+                    }
+                    this->append(id, last, this->addBlock(parseLazyBody(*function), function->index));
+                } break;
+
+                case AstExpression::UNARY: {
+                    const AstUnaryOperation* unary = static_cast<const AstUnaryOperation*>(expr);
+                    this->nodes[id].op = (uint8_t)unary->operation;
+                    this->append(id, last, this->add(unary->rvalue));
+                } break;
+
+                case AstExpression::REV_UNARY: {
+                    const AstRevUnaryOperation* unary = static_cast<const AstRevUnaryOperation*>(expr);
+                    this->nodes[id].op = (uint8_t)unary->operation;
+                    this->append(id, last, this->add(unary->rvalue));
+                } break;
+
+                case AstExpression::BINARY: {
+                    const AstBinaryOperation* binary = static_cast<const AstBinaryOperation*>(expr);
+                    this->nodes[id].op = (uint8_t)binary->operation;
+                    this->append(id, last, this->add(binary->lvalue));
+                    this->append(id, last, this->add(binary->rvalue));
+                } break;
+
+                case AstExpression::TERNARY: {
+                    const AstTernaryOperation* ternary = static_cast<const AstTernaryOperation*>(expr);
+                    this->append(id, last, this->add(ternary->condition));
+                    this->append(id, last, this->add(ternary->value));
+                    this->append(id, last, this->add(ternary->otherwise));
+                } break;
+
+                case AstExpression::COMPARISON: {
+                    const AstComparisonExpression* comparison =
+                        static_cast<const AstComparisonExpression*>(expr);
+                    this->nodes[id].payload = (uint32_t)this->operators.size();
+                    this->operators.insert(this->operators.end(), comparison->operations.begin(),
+                                           comparison->operations.end());
+
+                    for (const AstExpression* value : comparison->values) {
+                        this->append(id, last, this->add(value));
+                    }
+                } break;
+
+                case AstExpression::SUBSCRIPT: {
+                    const AstSubscriptExpression* subscript =
+                        static_cast<const AstSubscriptExpression*>(expr);
+                    this->append(id, last, this->add(subscript->expression));
+                    for (const AstExpression* argument : subscript->arguments) {
+                        this->append(id, last, this->add(argument));
+                    }
+                } break;
+
+                case AstExpression::CALL: {
+                    const AstCallExpression* call = static_cast<const AstCallExpression*>(expr);
+                    this->append(id, last, this->add(call->expression));
+                    for (const AstExpression* argument : call->arguments) {
+                        this->append(id, last, this->add(argument));
+                    }
+                } break;
+
+                case AstExpression::SCOPE: {
+                    const AstScoping* scoping = static_cast<const AstScoping*>(expr);
+                    this->nodes[id].payload = (uint32_t)this->scopes.size();
+                    this->scopes.push_back(scoping->identifiers);
+                    this->append(id, last, this->add(scoping->expression));
+                } break;
+
+                case AstExpression::CONSTANT: {
+                    const AstValue* value = static_cast<const AstValue*>(expr);
+                    this->nodes[id].op = (uint8_t)value->value_type;
+
+                    switch (value->value_type) {
+                        case AstValue::CHARACTER:
+                            this->nodes[id].payload = (uint32_t)this->numbers.size();
+                            this->numbers.push_back(value->character);
+                            break;
+
+                        case AstValue::UINTEGER:
+                            this->nodes[id].payload = (uint32_t)this->numbers.size();
+                            this->numbers.push_back(value->uinteger);
+                            break;
+
+                        case AstValue::INTEGER:
+                            this->nodes[id].payload = (uint32_t)this->numbers.size();
+                            this->numbers.push_back((uint64_t)value->integer);
+                            break;
+
+                        case AstValue::FLOATING:
+                        case AstValue::IMAGINARY:
+                            this->nodes[id].payload = (uint32_t)this->numbers.size();
+                            this->numbers.push_back(doubleBits(value->floating));
+                            break;
+
+                        case AstValue::BUFFER:
+                            if (value->embedded) {
+                                this->nodes[id].flags |= FLAT_EMBEDDED;
+                                this->nodes[id].payload = (uint32_t)this->embedded.size();
+                                this->embedded.push_back(value->embedded);
+                            }
+                            else {
+                                this->nodes[id].payload = (uint32_t)this->buffers.size();
+                                this->buffers.push_back(value->buffer);
+                            }
+                            break;
+
+                        case AstValue::STRING:
+                            this->nodes[id].payload = (uint32_t)this->strings.size();
+                            this->strings.push_back(value->string);
+                            break;
+                    }
+                } break;
+
+                case AstExpression::TUPLE: {
+                    for (const AstExpression* element : static_cast<const AstTuple*>(expr)->elements) {
+                        this->append(id, last, this->add(element));
+                    }
+                } break;
+
+                case AstExpression::LIST: {
+                    for (const AstExpression* element : static_cast<const AstList*>(expr)->elements) {
+                        this->append(id, last, this->add(element));
+                    }
+                } break;
+
+                case AstExpression::DICT: {
+                    /* A key can be left without an item if the dict ended abruptly */
+                    const AstDict* dict = static_cast<const AstDict*>(expr);
+                    for (size_t i = 0; i < dict->keys.size(); i++) {
+                        this->append(id, last, this->add(dict->keys[i]));
+                        if (i < dict->items.size()) {
+                            this->append(id, last, this->add(dict->items[i]));
+                        }
+                    }
+                } break;
+
+                case AstExpression::NONE:
+                    break;
+            }
+        } break;
+
+        case AstBody::IF: {
+            const AstIf* if_ = static_cast<const AstIf*>(body);
+            id = this->push(FlatKind::IF, if_->index);
+            for (size_t i = 0; i < if_->conditions.size(); i++) {
+                this->append(id, last, this->add(if_->conditions[i]));
+                this->append(id, last, this->addBlock(if_->bodies[i], if_->index));
+            }
+            this->append(id, last, this->addBlock(if_->else_body, if_->index));
+        } break;
+
+        case AstBody::WHILE: {
+            const AstWhile* while_ = static_cast<const AstWhile*>(body);
+            id = this->push(FlatKind::WHILE, while_->index);
+            this->append(id, last, this->add(while_->condition));
+            this->append(id, last, this->addBlock(while_->body, while_->index));
+        } break;
+
+        case AstBody::DO_WHILE: {
+            const AstDoWhile* do_while = static_cast<const AstDoWhile*>(body);
+            id = this->push(FlatKind::DO_WHILE, do_while->index);
+            this->append(id, last, this->add(do_while->condition));
+            this->append(id, last, this->addBlock(do_while->body, do_while->index));
+        } break;
+
+        case AstBody::FOR: {
+            const AstFor* for_ = static_cast<const AstFor*>(body);
+            id = this->push(FlatKind::FOR, for_->index);
+            this->append(id, last, this->add(for_->initialize));
+            this->append(id, last, this->add(for_->condition));
+            this->append(id, last, this->add(for_->step));
+            this->append(id, last, this->addBlock(for_->body, for_->index));
+        } break;
+
+        case AstBody::FOREACH: {
+            const AstForEach* foreach = static_cast<const AstForEach*>(body);
+            id = this->push(FlatKind::FOREACH, foreach->index);
+            this->append(id, last, this->add(foreach->target));
+            this->append(id, last, this->add(foreach->iterator));
+            this->append(id, last, this->addBlock(foreach->body, foreach->index));
+        } break;
+
+        case AstBody::STATEMENT: {
+            const AstStatement* statement = static_cast<const AstStatement*>(body);
+            id = this->push(FlatKind::STATEMENT, statement->index, (uint8_t)statement->statement_type);
+
+            if (statement->statement_type == AstStatement::Type::RETURN) {
+                if (statement->expression) {
+                    this->append(id, last, this->add(statement->expression));
+                }
+            }
+            else {
+                this->nodes[id].payload = (uint32_t)this->numbers.size();
+                this->numbers.push_back(statement->loop_count);
+            }
+        } break;
+
+        case AstBody::NONE:
+            id = this->push(FlatKind::NONE, body->index);
+            break;
+    }
+
+    return id;
+}
+
+std::vector<AstBody*> kh::FlatAst::toBlock(FlatId id, AstArena& arena) const {
+    std::vector<AstBody*> body;
+    for (FlatId child = this->nodes[id].first_child; child != FLAT_NONE;
+         child = this->nodes[child].next_sibling) {
+        body.push_back(this->toAst(child, arena));
+    }
+    return body;
+}
+
+AstBody* kh::FlatAst::toAst(FlatId id, AstArena& arena) const {
+    const FlatNode& node = this->nodes[id];
+    FlatId child = node.first_child;
+
+    /* Takes the next child, converted */
+    auto next = [&]() {
+        AstExpression* expr = child == FLAT_NONE ? nullptr : this->toExpression(child, arena);
+        child = child == FLAT_NONE ? FLAT_NONE : this->nodes[child].next_sibling;
+        return expr;
+    };
+
+    auto rest = [&]() {
+        std::vector<AstExpression*> exprs;
+        while (child != FLAT_NONE) {
+            exprs.push_back(next());
+        }
+        return exprs;
+    };
+
+    auto block = [&]() {
+        std::vector<AstBody*> body = this->toBlock(child, arena);
+        child = this->nodes[child].next_sibling;
+        return body;
+    };
+
+    switch (node.kind) {
+        case FlatKind::NONE:
+            return nullptr;
+
+        case FlatKind::IDENTIFIER:
+            return arena.make<AstIdentifiers>(this->identifiers[node.payload]);
+
+        case FlatKind::DECLARE: {
+            AstDeclaration* declaration = arena.make<AstDeclaration>(this->declarations[node.payload]);
+            declaration->expression = next();
+            return declaration;
+        }
+
+        case FlatKind::FUNCTION: {
+            AstFunction* function = arena.make<AstFunction>(this->functions[node.payload]);
+            while (this->nodes[child].kind == FlatKind::DECLARE) {
+                const FlatNode& argument = this->nodes[child];
+                function->arguments.push_back(this->declarations[argument.payload]);
+                if (argument.first_child != FLAT_NONE) {
+                    function->arguments.back().expression =
+                        this->toExpression(argument.first_child, arena);
+                }
+                child = argument.next_sibling;
+            }
+            function->body = block();
+            return function;
+        }
+
+        case FlatKind::UNARY: {
+            AstExpression* rvalue = next();
+            return arena.make<AstUnaryOperation>(node.index, (Operator)node.op, rvalue);
+        }
+
+        case FlatKind::REV_UNARY: {
+            AstExpression* rvalue = next();
+            return arena.make<AstRevUnaryOperation>(node.index, (Operator)node.op, rvalue);
+        }
+
+        case FlatKind::BINARY: {
+            AstExpression* lvalue = next();
+            AstExpression* rvalue = next();
+            return arena.make<AstBinaryOperation>(node.index, (Operator)node.op, lvalue, rvalue);
+        }
+
+        case FlatKind::TERNARY: {
+            AstExpression* condition = next();
+            AstExpression* value = next();
+            AstExpression* otherwise = next();
+            return arena.make<AstTernaryOperation>(node.index, condition, value, otherwise);
+        }
+
+        case FlatKind::COMPARISON: {
+            std::vector<AstExpression*> values = rest();
+            std::vector<Operator> operations(this->operators.begin() + node.payload,
+                                             this->operators.begin() + node.payload + values.size() -
+                                                 1);
+            return arena.make<AstComparisonExpression>(node.index, operations, values);
+        }
+
+        case FlatKind::SUBSCRIPT: {
+            AstExpression* expression = next();
+            return arena.make<AstSubscriptExpression>(node.index, expression, rest());
+        }
+
+        case FlatKind::CALL: {
+            AstExpression* expression = next();
+            return arena.make<AstCallExpression>(node.index, expression, rest());
+        }
+
+        case FlatKind::SCOPE: {
+            AstExpression* expression = next();
+            return arena.make<AstScoping>(node.index, expression, this->scopes[node.payload]);
+        }
+
+        case FlatKind::CONSTANT:
+            switch ((AstValue::ValueType)node.op) {
+                case AstValue::CHARACTER:
+                    return arena.make<AstValue>(node.index, (char32_t)this->numbers[node.payload]);
+
+                case AstValue::UINTEGER:
+                    return arena.make<AstValue>(node.index, this->numbers[node.payload]);
+
+                case AstValue::INTEGER:
+                    return arena.make<AstValue>(node.index, (int64_t)this->numbers[node.payload]);
+
+                case AstValue::FLOATING:
+                case AstValue::IMAGINARY:
+                    return arena.make<AstValue>(node.index, bitsDouble(this->numbers[node.payload]),
+                                                (AstValue::ValueType)node.op);
+
+                case AstValue::BUFFER:
+                    if (node.flags & FLAT_EMBEDDED) {
+                        return arena.make<AstValue>(node.index, this->embedded[node.payload]);
+                    }
+                    return arena.make<AstValue>(node.index, this->buffers[node.payload]);
+
+                case AstValue::STRING:
+                    return arena.make<AstValue>(node.index, this->strings[node.payload]);
+            }
+            return nullptr;
+
+        case FlatKind::TUPLE:
+            return arena.make<AstTuple>(node.index, rest());
+
+        case FlatKind::LIST:
+            return arena.make<AstList>(node.index, rest());
+
+        case FlatKind::DICT: {
+            std::vector<AstExpression*> keys;
+            std::vector<AstExpression*> items;
+            while (child != FLAT_NONE) {
+                keys.push_back(next());
+                if (child != FLAT_NONE) {
+                    items.push_back(next());
+                }
+            }
+            return arena.make<AstDict>(node.index, keys, items);
+        }
+
+        case FlatKind::BLOCK:
+            return nullptr;
+
+        case FlatKind::IF: {
+            std::vector<AstExpression*> conditions;
+            std::vector<std::vector<AstBody*>> bodies;
+            while (this->nodes[child].next_sibling != FLAT_NONE) {
+                conditions.push_back(next());
+                bodies.push_back(block());
+            }
+            std::vector<AstBody*> else_body = block();
+            return arena.make<AstIf>(node.index, conditions, bodies, else_body);
+        }
+
+        case FlatKind::WHILE: {
+            AstExpression* condition = next();
+            return arena.make<AstWhile>(node.index, condition, block());
+        }
+
+        case FlatKind::DO_WHILE: {
+            AstExpression* condition = next();
+            return arena.make<AstDoWhile>(node.index, condition, block());
+        }
+
+        case FlatKind::FOR: {
+            AstExpression* initialize = next();
+            AstExpression* condition = next();
+            AstExpression* step = next();
+            return arena.make<AstFor>(node.index, initialize, condition, step, block());
+        }
+
+        case FlatKind::FOREACH: {
+            AstExpression* target = next();
+            AstExpression* iterator = next();
+            return arena.make<AstForEach>(node.index, target, iterator, block());
+        }
+
+        case FlatKind::STATEMENT: {
+            AstStatement::Type type = (AstStatement::Type)node.op;
+            if (type == AstStatement::Type::RETURN) {
+                return arena.make<AstStatement>(node.index, type, next());
+            }
+            return arena.make<AstStatement>(node.index, type, (size_t)this->numbers[node.payload]);
+        }
+    }
+
+    return nullptr;
+}
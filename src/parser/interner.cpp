@@ -0,0 +1,76 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#include <cstring>
+
+#include <kithare/interner.hpp>
+
+
+using namespace kh;
+
+/* Has to be kept in the same order as `kh::Keyword` */
+static const char* const keyword_names[] = {
+    "public", "private", "static", "try", "def", "class", "struct", "enum", "import", "include",
+    "if", "elif", "else", "for", "while", "do", "break", "continue", "return", "ref",
+    "as", "and", "or", "embed"};
+
+/* 32-bit FNV-1a */
+static inline uint32_t hashBytes(const char* str, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+Interner::Interner() {
+    this->slots.resize(64);
+    for (uint32_t id = 0; id < KEYWORD_COUNT; id++) {
+        this->intern(keyword_names[id], std::strlen(keyword_names[id]));
+    }
+}
+
+uint32_t Interner::intern(const char* str, size_t length) {
+    size_t mask = this->slots.size() - 1;
+    size_t slot = hashBytes(str, length) & mask;
+
+    /* Linear probing until either the identifier or an empty slot is found */
+    while (this->slots[slot]) {
+        const std::string& name = this->names[this->slots[slot] - 1];
+        if (name.size() == length && std::memcmp(name.data(), str, length) == 0) {
+            return this->slots[slot] - 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    uint32_t id = this->names.size();
+    this->names.emplace_back(str, length);
+    this->slots[slot] = id + 1;
+
+    if (this->names.size() * 2 > this->slots.size()) {
+        this->grow();
+    }
+
+    return id;
+}
+
+void Interner::grow() {
+    std::vector<uint32_t> slots(this->slots.size() * 2, 0);
+    size_t mask = slots.size() - 1;
+
+    for (uint32_t id = 0; id < this->names.size(); id++) {
+        const std::string& name = this->names[id];
+        size_t slot = hashBytes(name.data(), name.size()) & mask;
+
+        while (slots[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = id + 1;
+    }
+
+    this->slots.swap(slots);
+}
@@ -4,10 +4,11 @@
  * Copyright (C) 2021 Kithare Organization
  */
 
-#include <cwctype>
-#include <functional>
+#include <cstdlib>
+#include <thread>
 
 #include <kithare/lexer.hpp>
+#include <kithare/scan.hpp>
 #include <kithare/utf8.hpp>
 
 
@@ -18,124 +19,203 @@ std::string kh::LexException::format() const {
            std::to_string(this->column);
 }
 
-std::vector<Token> kh::lex(const std::u32string& source) {
-    std::vector<LexException> exceptions;
-    LexerContext context{source, exceptions};
-    std::vector<Token> tokens = lex(context);
+#define _S CHAR_SPACE
+#define _A CHAR_ALPHA
+#define _B (CHAR_DEC | CHAR_HEX | CHAR_OCT | CHAR_BIN)
+#define _O (CHAR_DEC | CHAR_HEX | CHAR_OCT)
+#define _D (CHAR_DEC | CHAR_HEX)
+#define _H (CHAR_ALPHA | CHAR_HEX)
+#define _N CHAR_NON_ASCII
+
+const uint8_t kh::char_classes[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, _S, _S, _S, _S, _S, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    _S, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    _B, _B, _O, _O, _O, _O, _O, _O, _D, _D, 0, 0, 0, 0, 0, 0,
+    0, _H, _H, _H, _H, _H, _H, _A, _A, _A, _A, _A, _A, _A, _A, _A,
+    _A, _A, _A, _A, _A, _A, _A, _A, _A, _A, _A, 0, 0, 0, 0, _A,
+    0, _H, _H, _H, _H, _H, _H, _A, _A, _A, _A, _A, _A, _A, _A, _A,
+    _A, _A, _A, _A, _A, _A, _A, _A, _A, _A, _A, 0, 0, 0, 0, 0,
+    _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N,
+    _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N,
+    _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N,
+    _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N,
+    _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N,
+    _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N,
+    _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N,
+    _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N, _N};
+
+#undef _S
+#undef _A
+#undef _B
+#undef _O
+#undef _D
+#undef _H
+#undef _N
+
+LexResult kh::lex(const std::string& source) {
+    LexResult result;
+    LexerContext context{source, result.exceptions};
+    result.tokens = lex(context);
+    return result;
+}
 
-    if (exceptions.empty()) {
-        return tokens;
+/* Appends a digit to an integer which is being accumulated, it's marked as overflowed once it doesn't
+ * fit in 64 bits anymore */
+static inline void appendDigit(uint64_t& number, uint32_t digit, uint32_t base, bool& is_overflowed) {
+    if (number > (UINT64_MAX - digit) / base) {
+        is_overflowed = true;
     }
     else {
-        throw exceptions;
+        number = number * base + digit;
+    }
+}
+
+/* Converts a floating point literal to the nearest double from its accumulated digits and how many of
+ * them are after the point. If the digits fit in the 53 bits of a double and there are at most 22 of
+ * them after the point, both them and the power of ten are exact doubles, so a single division rounds
+ * correctly. The rare ones that don't go through `std::strtod` on the literal */
+static double toFloating(const char* literal, size_t length, uint64_t digits, size_t fraction_digits,
+                         bool is_overflowed) {
+    static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    if (!is_overflowed && digits <= (uint64_t)1 << 53 && fraction_digits <= 22) {
+        return (double)digits / powers[fraction_digits];
     }
+    return std::strtod(std::string(literal, length).c_str(), nullptr);
 }
 
+/* Records an error at the byte index and goes on lexing in between tokens. It jumps to the end of the
+ * loop rather than throwing, so a source full of errors doesn't pay for unwinding each of them */
+#define KH_RAISE_ERROR_AT(msg, index) \
+    do {                              \
+        error_what = msg;             \
+        error_index = index;          \
+        goto error;                   \
+    } while (0)
+
 /* Helper to raise error at a file */
-#define KH_RAISE_ERROR(msg, n) throw LexException(msg, i + n)
+#define KH_RAISE_ERROR(msg, n) KH_RAISE_ERROR_AT(msg, i + (n))
+
+/* Decodes the character at the byte index into `chr`, raising an error if it's broken */
+#define DECODE_AT(chr, index, length)  \
+    do {                               \
+        chr = decodeAt(index, length); \
+        if (error_what)                \
+            goto error;                \
+    } while (0)
+
+/* Only checks that the character at the byte index isn't broken, raising an error if it is */
+#define VALIDATE_AT(index, length) \
+    do {                           \
+        decodeAt(index, length);   \
+        if (error_what)            \
+            goto error;            \
+    } while (0)
+
+/* Use this macro to export a variable hex_value from the hex digits at a given start and len
+ * relative to the file index */
+#define HANDLE_HEX_INTO_VALUE(_start, _len)                       \
+    uint32_t hex_value = 0;                                       \
+    for (size_t j = _start; j < _start + _len; j++) {             \
+        if (isHex(chAt(i + j)))                                   \
+            hex_value = (hex_value << 4) | hexValue(chAt(i + j)); \
+        else                                                      \
+            KH_RAISE_ERROR("expected a hexadecimal digit", j);    \
+    }                                                             \
+    i += _start + _len
 
-/* Use this macro to export a variable hex_str from a given start and len relative
- * to the file index */
-#define HANDLE_HEX_INTO_HEXSTR(_start, _len)                   \
-    std::string hex_str;                                       \
+/* Use this macro to skip over the hex digits of an escape at a given start and len relative to the
+ * file index, leaving the index at the last one */
+#define SKIP_HEX(_start, _len)                                 \
     for (size_t j = _start; j < _start + _len; j++) {          \
-        if (isHex(chAt(i + j)))                                \
-            hex_str += (char)chAt(i + j);                      \
-        else                                                   \
+        if (!isHex(chAt(i + j)))                               \
             KH_RAISE_ERROR("expected a hexadecimal digit", j); \
     }                                                          \
-    i += _start + _len
+    i += _start + _len - 1
 
 /* Helper macro */
-#define _PLACE_HEXSTR_AS_TYPE(_var, ttype)               \
-    if (chAt(i) == '\'') {                               \
-        _var = std::stoul(hex_str, nullptr, 16);         \
-        tokens.emplace_back(start, i + 1, ttype, value); \
-    }                                                    \
-    else                                                 \
+#define _PLACE_HEX_VALUE_AS_TYPE(push_method, ttype)        \
+    if (chAt(i) == '\'') {                                  \
+        tokens.push_method(start, i + 1, ttype, hex_value); \
+    }                                                       \
+    else                                                    \
         KH_RAISE_ERROR("expected a closing single quote", 0)
 
-/* Place a hex_str as an integer into tokens stack */
-#define PLACE_HEXSTR_AS_INT() _PLACE_HEXSTR_AS_TYPE(value.integer, TokenType::INTEGER)
+/* Place a hex_value as an integer into tokens stack */
+#define PLACE_HEX_VALUE_AS_INT() _PLACE_HEX_VALUE_AS_TYPE(pushInteger, TokenType::INTEGER)
 
-/* Place a hex_str as a character into tokens stack */
-#define PLACE_HEXSTR_AS_CHAR() _PLACE_HEXSTR_AS_TYPE(value.character, TokenType::CHARACTER)
+/* Place a hex_value as a character into tokens stack */
+#define PLACE_HEX_VALUE_AS_CHAR() _PLACE_HEX_VALUE_AS_TYPE(push, TokenType::CHARACTER)
 
 /* Helper macro */
-#define _HANDLE_ESCAPE(chr, echr, _val, _len, code) \
-    case chr:                                       \
-        _val = echr;                                \
-        code;                                       \
-        i += _len;                                  \
+#define _HANDLE_ESCAPE_1(chr, echr, push_method, _ttype, _len)       \
+    case chr:                                                        \
+        if (chAt(i + _len) != '\'')                                  \
+            KH_RAISE_ERROR("expected a closing single quote", _len); \
+        tokens.push_method(start, i + _len + 1, _ttype, echr);       \
+        i += _len;                                                   \
         break;
 
-/* Helper macro */
-#define _HANDLE_ESCAPE_1(chr, echr, _val, _ttype, _len)                         \
-    _HANDLE_ESCAPE(chr, echr, _val, _len,                                       \
-                   if (chAt(i + _len) != '\'')                                  \
-                       KH_RAISE_ERROR("expected a closing single quote", _len); \
-                   tokens.emplace_back(start, i + _len + 1, _ttype, value);)
-
 /* Use this to handle string escapes from a switch statement. This is used to handle
  * escapes into byte/unicode characters */
-#define HANDLE_ESCAPES_1(_val, _valc, _len)         \
-    _HANDLE_ESCAPE_1('0', '\0', _val, _valc, _len)  \
-    _HANDLE_ESCAPE_1('n', '\n', _val, _valc, _len)  \
-    _HANDLE_ESCAPE_1('r', '\r', _val, _valc, _len)  \
-    _HANDLE_ESCAPE_1('t', '\t', _val, _valc, _len)  \
-    _HANDLE_ESCAPE_1('v', '\v', _val, _valc, _len)  \
-    _HANDLE_ESCAPE_1('b', '\b', _val, _valc, _len)  \
-    _HANDLE_ESCAPE_1('a', '\a', _val, _valc, _len)  \
-    _HANDLE_ESCAPE_1('f', '\f', _val, _valc, _len)  \
-    _HANDLE_ESCAPE_1('\\', '\\', _val, _valc, _len) \
-    _HANDLE_ESCAPE_1('"', '\"', _val, _valc, _len)  \
-    _HANDLE_ESCAPE_1('\'', '\'', _val, _valc, _len) \
-    default:                                        \
+#define HANDLE_ESCAPES_1(push_method, _ttype, _len)         \
+    _HANDLE_ESCAPE_1('0', '\0', push_method, _ttype, _len)  \
+    _HANDLE_ESCAPE_1('n', '\n', push_method, _ttype, _len)  \
+    _HANDLE_ESCAPE_1('r', '\r', push_method, _ttype, _len)  \
+    _HANDLE_ESCAPE_1('t', '\t', push_method, _ttype, _len)  \
+    _HANDLE_ESCAPE_1('v', '\v', push_method, _ttype, _len)  \
+    _HANDLE_ESCAPE_1('b', '\b', push_method, _ttype, _len)  \
+    _HANDLE_ESCAPE_1('a', '\a', push_method, _ttype, _len)  \
+    _HANDLE_ESCAPE_1('f', '\f', push_method, _ttype, _len)  \
+    _HANDLE_ESCAPE_1('\\', '\\', push_method, _ttype, _len) \
+    _HANDLE_ESCAPE_1('"', '\"', push_method, _ttype, _len)  \
+    _HANDLE_ESCAPE_1('\'', '\'', push_method, _ttype, _len) \
+    default:                                                \
         KH_RAISE_ERROR("unknown escape character", _len - 1);
 
-/* Use this to handle string escapes from a switch statement. This is used to handle
- * escapes into byte/unicode strings */
-#define HANDLE_ESCAPES_2(code)                 \
-    _HANDLE_ESCAPE('0', '\0', value, 1, code)  \
-    _HANDLE_ESCAPE('n', '\n', value, 1, code)  \
-    _HANDLE_ESCAPE('r', '\r', value, 1, code)  \
-    _HANDLE_ESCAPE('t', '\t', value, 1, code)  \
-    _HANDLE_ESCAPE('v', '\v', value, 1, code)  \
-    _HANDLE_ESCAPE('b', '\b', value, 1, code)  \
-    _HANDLE_ESCAPE('a', '\a', value, 1, code)  \
-    _HANDLE_ESCAPE('f', '\f', value, 1, code)  \
-    _HANDLE_ESCAPE('\\', '\\', value, 1, code) \
-    _HANDLE_ESCAPE('"', '\"', value, 1, code)  \
-    _HANDLE_ESCAPE('\'', '\'', value, 1, code) \
-    default:                                   \
+/* Use this to skip over the escapes of a string or buffer from a switch statement, they're only
+ * checked while lexing */
+#define SKIP_ESCAPES() \
+    case '0':          \
+    case 'n':          \
+    case 'r':          \
+    case 't':          \
+    case 'v':          \
+    case 'b':          \
+    case 'a':          \
+    case 'f':          \
+    case '\\':         \
+    case '"':          \
+    case '\'':         \
+        i += 1;        \
+        break;         \
+    default:           \
         KH_RAISE_ERROR("unknown escape character", 1);
 
 /* Handle a simple symbol from a switch block */
-#define HANDLE_SIMPLE_SYMBOL(sym, name)                            \
-    case sym: {                                                    \
-        TokenValue val;                                            \
-        val.symbol_type = name;                                    \
-        tokens.emplace_back(start, i + 1, TokenType::SYMBOL, val); \
-    } break;
+#define HANDLE_SIMPLE_SYMBOL(sym, name)                               \
+    case sym:                                                         \
+        tokens.push(start, i + 1, TokenType::SYMBOL, (uint32_t)name); \
+        break;
 
 /* Handle a simple operator from a switch block */
-#define HANDLE_SIMPLE_OP(sym, name)                                  \
-    case sym: {                                                      \
-        TokenValue val;                                              \
-        val.operator_type = name;                                    \
-        tokens.emplace_back(start, i + 1, TokenType::OPERATOR, val); \
-    } break;
+#define HANDLE_SIMPLE_OP(sym, name)                                     \
+    case sym:                                                           \
+        tokens.push(start, i + 1, TokenType::OPERATOR, (uint32_t)name); \
+        break;
 
 /* Handle a combination of two operators as a single operator from a switch block */
-#define HANDLE_OP_COMBO(sym, name, sym2, name2)                      \
-    case sym: {                                                      \
-        TokenValue val;                                              \
-        val.operator_type = name;                                    \
-        if (chAt(i + 1) == sym2) {                                   \
-            val.operator_type = name2;                               \
-            i++;                                                     \
-        }                                                            \
-        tokens.emplace_back(start, i + 1, TokenType::OPERATOR, val); \
+#define HANDLE_OP_COMBO(sym, name, sym2, name2)                                  \
+    case sym: {                                                                  \
+        Operator operator_type = name;                                           \
+        if (chAt(i + 1) == sym2) {                                               \
+            operator_type = name2;                                               \
+            i++;                                                                 \
+        }                                                                        \
+        tokens.push(start, i + 1, TokenType::OPERATOR, (uint32_t)operator_type); \
     } break;
 
 
@@ -157,67 +237,170 @@ namespace kh {
     };
 }
 
-std::vector<Token> kh::lex(KH_LEX_CTX) {
-    TokenizeState state = TokenizeState::NONE;
-    std::vector<Token> tokens;
+TokenStream kh::lex(KH_LEX_CTX) {
+    if (context.base + context.source.size() > KH_SOURCE_MAX_SIZE) {
+        context.exceptions.emplace_back("the source is too big, it can't be any bigger than " +
+                                            std::to_string(KH_SOURCE_MAX_SIZE) + " bytes",
+                                        context.base);
+        context.exceptions.back().line = 1;
+        context.exceptions.back().column = 1;
+        return TokenStream();
+    }
+
+    if (context.ci == 0 && context.source.size() >= KH_LEX_PARALLEL_SIZE &&
+        std::thread::hardware_concurrency() > 1) {
+        return lexParallel(context, std::thread::hardware_concurrency());
+    }
+
+    TokenStream tokens;
+    tokens.reserve(context.source.size() / 4);
+    tokens.source = &context.source;
+    tokens.line_map = LineMap(context.source);
+
+    lexPart(context, tokens, (size_t)-1);
+    return tokens;
+}
+
+/* Adds an error unless there are `max_errors` of them already, the first one past the limit is
+ * replaced with a note saying so */
+static void addException(KH_LEX_CTX, const char* what, size_t index) {
+    if (!context.max_errors || context.exceptions.size() < context.max_errors) {
+        context.exceptions.emplace_back(what, index);
+    }
+    else if (context.exceptions.size() == context.max_errors) {
+        context.exceptions.emplace_back("too many errors, stopped reporting them", index);
+    }
+}
+
+/* Thrown when a token runs into the end of a source which isn't final, it never gets out of
+ * `lexPart` */
+struct LexerNeedsInput {};
 
-    size_t start = 0;
-    std::u32string temp_str;
-    std::string temp_buf;
+/* Thrown when a token looks past the end of a final source. It's the one error which may come from
+ * anywhere in the loop, but it can only happen once, right at the end */
+struct LexerHitEnd {
+    size_t index;
+};
 
-    /* Lambda function which accesses the string, and throws an error directly to the console if it
-     * had passed the length */
-    std::function<char32_t(const size_t)> chAt = [&](const size_t index) -> char32_t {
-        if (index < context.source.size()) {
-            return context.source[index];
+bool kh::lexPart(KH_LEX_CTX, TokenStream& tokens, size_t token_limit) {
+    TokenizeState state = TokenizeState::NONE;
+    const size_t first_new = tokens.size();
+    const size_t first_exception = context.exceptions.size();
+    bool needs_input = false;
+
+    size_t start = context.ci;
+    /* `LiteralFlags` of a string or buffer */
+    uint32_t literal_flags = 0;
+
+    /* Digits of a numeric literal, accumulated as they're lexed */
+    uint64_t number = 0;
+    size_t fraction_digits = 0;
+    bool is_overflowed = false;
+
+    /* The error being raised, if any */
+    const char* error_what = nullptr;
+    size_t error_index = 0;
+
+    /* Accesses the source bytes, reading right at the end gives a newline so the last token gets
+     * terminated, anything further is an unexpected end of file. It's a plain lambda rather than a
+     * `std::function` so it gets inlined into the loop */
+    const size_t size = context.source.size();
+    const char* source = context.source.data();
+
+    auto chAt = [&](const size_t index) -> char32_t {
+        if (index < size) {
+            return (uint8_t)source[index];
+        }
+        else if (!context.is_final) {
+            throw LexerNeedsInput();
         }
-        else if (index == context.source.size()) {
+        else if (index == size) {
             return '\n';
         }
         else {
-            size_t i = index;
-            KH_RAISE_ERROR("unexpected end of file", -1);
+            throw LexerHitEnd{index - 1};
+        }
+    };
+
+    /* Decodes the (possibly multi-byte) character at the byte index, plain ASCII bytes are returned
+     * as is. Only used where non-ASCII characters are meaningful, such as identifiers and strings. A
+     * broken character sets `error_what`, so it's used through `DECODE_AT` */
+    auto decodeAt = [&](const size_t index, size_t& length) -> char32_t {
+        length = 1;
+        char32_t chr = chAt(index);
+        if (chr < 128) {
+            return chr;
+        }
+
+        /* Makes sure a character split between two chunks of a streamed source isn't seen as broken */
+        if (!context.is_final) {
+            chAt(index + (chr >= 0b11110000 ? 3 : chr >= 0b11100000 ? 2 : chr >= 0b11000000 ? 1 : 0));
         }
+
+        return decodeUtf8Char(context.source, index, length, error_what, error_index);
     };
 
-    for (size_t i = 0; i <= context.source.size(); i++) {
+    size_t i;
+    for (i = context.ci; i <= size; i++) {
         try {
             switch (state) {
-                case TokenizeState::NONE:
+                case TokenizeState::NONE: {
+                    /* Only stops in between tokens, so lexing can go on from here later */
+                    if (tokens.size() >= token_limit || i >= context.end) {
+                        goto end;
+                    }
+                    if (i == size && !context.is_final) {
+                        needs_input = true;
+                        goto end;
+                    }
+
                     start = i;
-                    temp_str.clear();
-                    temp_buf.clear();
+                    size_t length = 1;
+                    char32_t chr = chAt(i);
+                    uint8_t char_class = char_classes[chr];
+
+                    /* Plain ASCII is classified straight from the table, only the non-ASCII characters
+                     * get decoded and looked up from the Unicode tables */
+                    if (char_class & CHAR_NON_ASCII) {
+                        DECODE_AT(chr, i, length);
+                        char_class = isUnicodeSpace(chr)      ? CHAR_SPACE
+                                     : isIdentifierStart(chr) ? CHAR_ALPHA
+                                                              : 0;
+                    }
 
-                    /* Skips whitespace and newlines */
-                    if (chAt(i) == '\n' || std::iswspace(chAt(i)) > 0) {
+                    /* Skips a whole run of whitespace and newlines */
+                    if (char_class & CHAR_SPACE) {
+                        i = skipSpaces(source, i + length, size) - 1;
                         continue;
                     }
 
+                    literal_flags = 0;
+                    number = 0;
+                    fraction_digits = 0;
+                    is_overflowed = false;
+
                     /* Possible identifier start */
-                    else if (std::iswalpha(chAt(i)) > 0 || chAt(i) == '_') {
+                    if (char_class & CHAR_ALPHA) {
                         /* Possible start of a byte-string/byte-string constant */
                         if (chAt(i) == 'b' || chAt(i) == 'B') {
                             /* Possible byte-char */
                             if (chAt(i + 1) == '\'') {
                                 /* Possible char-escape */
                                 if (chAt(i + 2) == '\\') {
-                                    TokenValue value;
                                     switch (chAt(i + 3)) {
                                         /* Hex character escape */
                                         case 'x':
                                         case 'X': {
-                                            HANDLE_HEX_INTO_HEXSTR(4, 2);
-                                            PLACE_HEXSTR_AS_INT();
+                                            HANDLE_HEX_INTO_VALUE(4, 2);
+                                            PLACE_HEX_VALUE_AS_INT();
                                         } break;
 
-                                            HANDLE_ESCAPES_1(value.integer, TokenType::INTEGER, 4)
+                                            HANDLE_ESCAPES_1(pushInteger, TokenType::INTEGER, 4)
                                     }
                                 }
                                 else if (chAt(i + 2) == '\'') {
                                     /* No Character inserted, like b''. Treat it like a 0 */
-                                    TokenValue value;
-                                    value.integer = 0;
-                                    tokens.emplace_back(start, i + 3, TokenType::INTEGER, value);
+                                    tokens.pushInteger(start, i + 3, TokenType::INTEGER, 0);
 
                                     i += 2;
                                 }
@@ -226,19 +409,23 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                                 }
 
                                 /* Plain byte-char without character escapes */
-                                else if (chAt(i + 3) == '\'') {
-                                    if (chAt(i + 2) > 255) {
+                                else {
+                                    size_t char_length;
+                                    char32_t byte_chr;
+                                    DECODE_AT(byte_chr, i + 2, char_length);
+
+                                    if (chAt(i + 2 + char_length) != '\'') {
+                                        KH_RAISE_ERROR("expected a closing single quote",
+                                                       2 + char_length);
+                                    }
+                                    if (byte_chr > 255) {
                                         KH_RAISE_ERROR("a non-byte sized character", 2);
                                     }
 
-                                    TokenValue value;
-                                    value.integer = chAt(i + 2);
-                                    tokens.emplace_back(start, i + 4, TokenType::INTEGER, value);
+                                    tokens.pushInteger(start, i + 3 + char_length, TokenType::INTEGER,
+                                                       byte_chr);
 
-                                    i += 3;
-                                }
-                                else {
-                                    KH_RAISE_ERROR("expected a closing single quote", 3);
+                                    i += 2 + char_length;
                                 }
                                 continue;
                             }
@@ -258,11 +445,11 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
 
                         /* If it's not a byte-string/byte-char, it's just a normal identifier */
                         state = TokenizeState::IDENTIFIER;
-                        temp_str = chAt(i);
+                        i += length - 1;
                     }
 
                     /* Starts with a decimal value, possible number constant */
-                    else if (isDec(chAt(i))) {
+                    else if (char_class & CHAR_DEC) {
                         /* Likely to use other number base */
                         if (chAt(i) == '0') {
                             /* Handles hex numbers */
@@ -305,58 +492,60 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                         }
 
                         state = TokenizeState::INTEGER;
-                        temp_str = chAt(i);
+                        number = chAt(i) - '0';
                     }
 
                     else {
                         switch (chAt(i)) {
                             /* Possible character */
                             case '\'': {
-                                TokenValue value;
                                 /* Possible char escape */
                                 if (chAt(i + 1) == '\\') {
                                     switch (chAt(i + 2)) {
                                         /* Hex escapes */
                                         case 'x':
                                         case 'X': {
-                                            HANDLE_HEX_INTO_HEXSTR(3, 2);
-                                            PLACE_HEXSTR_AS_CHAR();
+                                            HANDLE_HEX_INTO_VALUE(3, 2);
+                                            PLACE_HEX_VALUE_AS_CHAR();
                                         } break;
 
                                             /* 2 bytes unicode escape */
                                         case 'u': {
-                                            HANDLE_HEX_INTO_HEXSTR(3, 4);
-                                            PLACE_HEXSTR_AS_CHAR();
+                                            HANDLE_HEX_INTO_VALUE(3, 4);
+                                            PLACE_HEX_VALUE_AS_CHAR();
                                         } break;
 
                                             /* 4 bytes unicode escape */
                                         case 'U': {
-                                            HANDLE_HEX_INTO_HEXSTR(3, 8);
-                                            PLACE_HEXSTR_AS_CHAR();
+                                            HANDLE_HEX_INTO_VALUE(3, 8);
+                                            PLACE_HEX_VALUE_AS_CHAR();
                                         } break;
 
-                                            HANDLE_ESCAPES_1(value.character, TokenType::CHARACTER, 3);
+                                            HANDLE_ESCAPES_1(push, TokenType::CHARACTER, 3);
                                     }
                                 }
                                 else if (chAt(i + 1) == '\'') {
                                     /* No Character inserted, like ''. Treat it like a \0 */
-                                    TokenValue value;
-                                    value.character = 0;
-                                    tokens.emplace_back(start, i + 2, TokenType::CHARACTER, value);
+                                    tokens.push(start, i + 2, TokenType::CHARACTER, 0);
 
                                     i += 1;
                                 }
                                 else if (chAt(i + 1) == '\n') {
                                     KH_RAISE_ERROR("new line before character closing", 1);
                                 }
-                                else if (chAt(i + 2) == '\'') {
-                                    TokenValue value;
-                                    value.character = chAt(i + 1);
-                                    tokens.emplace_back(start, i + 3, TokenType::CHARACTER, value);
-                                    i += 2;
-                                }
                                 else {
-                                    KH_RAISE_ERROR("expected a closing single quote", 2);
+                                    size_t char_length;
+                                    char32_t character;
+                                    DECODE_AT(character, i + 1, char_length);
+
+                                    if (chAt(i + 1 + char_length) != '\'') {
+                                        KH_RAISE_ERROR("expected a closing single quote",
+                                                       1 + char_length);
+                                    }
+
+                                    tokens.push(start, i + 2 + char_length, TokenType::CHARACTER,
+                                                character);
+                                    i += 1 + char_length;
                                 }
                                 continue;
                             } break;
@@ -398,58 +587,54 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                                 /* Some operators and symbols have more complicated handling, and
                                  * those are not macro-ised */
                             case '+': {
-                                TokenValue value;
-                                value.operator_type = Operator::ADD;
+                                Operator operator_type = Operator::ADD;
 
                                 if (chAt(i + 1) == '=') {
-                                    value.operator_type = Operator::IADD;
+                                    operator_type = Operator::IADD;
                                     i++;
                                 }
                                 else if (chAt(i + 1) == '+') {
-                                    value.operator_type = Operator::INCREMENT;
+                                    operator_type = Operator::INCREMENT;
                                     i++;
                                 }
 
-                                tokens.emplace_back(start, i + 1, TokenType::OPERATOR, value);
+                                tokens.push(start, i + 1, TokenType::OPERATOR, (uint32_t)operator_type);
                             } break;
 
                             case '-': {
-                                TokenValue value;
-                                value.operator_type = Operator::SUB;
+                                Operator operator_type = Operator::SUB;
 
                                 if (chAt(i + 1) == '=') {
-                                    value.operator_type = Operator::ISUB;
+                                    operator_type = Operator::ISUB;
                                     i++;
                                 }
                                 else if (chAt(i + 1) == '-') {
-                                    value.operator_type = Operator::DECREMENT;
+                                    operator_type = Operator::DECREMENT;
                                     i++;
                                 }
 
-                                tokens.emplace_back(start, i + 1, TokenType::OPERATOR, value);
+                                tokens.push(start, i + 1, TokenType::OPERATOR, (uint32_t)operator_type);
                             } break;
 
                             case '*': {
-                                TokenValue value;
-                                value.operator_type = Operator::MUL;
+                                Operator operator_type = Operator::MUL;
 
                                 if (chAt(i + 1) == '=') {
-                                    value.operator_type = Operator::IMUL;
+                                    operator_type = Operator::IMUL;
                                     i++;
                                 }
                                 else if (chAt(i + 1) == '/') {
                                     KH_RAISE_ERROR("unexpected comment close", 0);
                                 }
 
-                                tokens.emplace_back(start, i + 1, TokenType::OPERATOR, value);
+                                tokens.push(start, i + 1, TokenType::OPERATOR, (uint32_t)operator_type);
                             } break;
 
                             case '/': {
-                                TokenValue value;
-                                value.operator_type = Operator::DIV;
+                                Operator operator_type = Operator::DIV;
 
                                 if (chAt(i + 1) == '=') {
-                                    value.operator_type = Operator::IDIV;
+                                    operator_type = Operator::IDIV;
                                     i++;
                                 }
                                 else if (chAt(i + 1) == '/') {
@@ -463,166 +648,164 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                                     continue;
                                 }
 
-                                tokens.emplace_back(start, i + 1, TokenType::OPERATOR, value);
+                                tokens.push(start, i + 1, TokenType::OPERATOR, (uint32_t)operator_type);
                             } break;
 
                             case '<': {
-                                TokenValue value;
-                                value.operator_type = Operator::LESS;
+                                Operator operator_type = Operator::LESS;
 
                                 if (chAt(i + 1) == '=') {
-                                    value.operator_type = Operator::LESS_EQUAL;
+                                    operator_type = Operator::LESS_EQUAL;
                                     i++;
                                 }
                                 else if (chAt(i + 1) == '<') {
-                                    value.operator_type = Operator::BIT_LSHIFT;
+                                    operator_type = Operator::BIT_LSHIFT;
                                     i++;
                                 }
 
-                                tokens.emplace_back(start, i + 1, TokenType::OPERATOR, value);
+                                tokens.push(start, i + 1, TokenType::OPERATOR, (uint32_t)operator_type);
                             } break;
 
                             case '>': {
-                                TokenValue value;
-                                value.operator_type = Operator::MORE;
+                                Operator operator_type = Operator::MORE;
 
                                 if (chAt(i + 1) == '=') {
-                                    value.operator_type = Operator::MORE_EQUAL;
+                                    operator_type = Operator::MORE_EQUAL;
                                     i++;
                                 }
                                 else if (chAt(i + 1) == '>') {
-                                    value.operator_type = Operator::BIT_RSHIFT;
+                                    operator_type = Operator::BIT_RSHIFT;
                                     i++;
                                 }
 
-                                tokens.emplace_back(start, i + 1, TokenType::OPERATOR, value);
+                                tokens.push(start, i + 1, TokenType::OPERATOR, (uint32_t)operator_type);
                             } break;
 
                             case '.': {
-                                TokenValue value;
-                                value.symbol_type = Symbol::DOT;
-
                                 if (isDec(chAt(i + 1))) {
                                     state = TokenizeState::FLOATING;
-                                    temp_str = U"0.";
                                     continue;
                                 }
 
-                                tokens.emplace_back(start, i + 1, TokenType::SYMBOL, value);
+                                tokens.push(start, i + 1, TokenType::SYMBOL, (uint32_t)Symbol::DOT);
                             } break;
 
                             default:
-                                KH_RAISE_ERROR("unrecognized character", 0);
+                                /* Skips the rest of the multi-byte character, so it only gets
+                                 * reported once */
+                                i += length - 1;
+                                KH_RAISE_ERROR_AT("unrecognized character", start);
                         }
                     }
                     continue;
+                }
 
                     /* Follows the identifier's characters */
-                case TokenizeState::IDENTIFIER:
+                case TokenizeState::IDENTIFIER: {
+                    /* Consumes the whole run of ASCII identifier characters at once */
+                    i = skipIdentifier(source, i, size);
+
+                    size_t length = 1;
+                    char32_t chr = chAt(i);
+                    if (chr >= 128) {
+                        DECODE_AT(chr, i, length);
+                    }
+
                     /* Checks if it's still a valid identifier character */
-                    if (std::iswalpha(chAt(i)) > 0 || isDec(chAt(i)) || chAt(i) == '_') {
-                        temp_str += chAt(i);
+                    if (chr >= 128 && isIdentifierContinue(chr)) {
+                        i += length - 1;
                     }
                     else {
-                        TokenValue value;
-                        if (temp_str == U"and") {
-                            value.operator_type = Operator::AND;
-                            tokens.emplace_back(start, i, TokenType::OPERATOR, value);
+                        /* The identifier is already UTF-8 encoded in the source, so it's interned
+                         * straight from its bytes */
+                        uint32_t id = tokens.identifiers.intern(source + start, i - start);
+
+                        if (id == (uint32_t)Keyword::AND) {
+                            tokens.push(start, i, TokenType::OPERATOR, (uint32_t)Operator::AND);
                         }
-                        else if (temp_str == U"or") {
-                            value.operator_type = Operator::OR;
-                            tokens.emplace_back(start, i, TokenType::OPERATOR, value);
+                        else if (id == (uint32_t)Keyword::OR) {
+                            tokens.push(start, i, TokenType::OPERATOR, (uint32_t)Operator::OR);
                         }
                         else {
-                            /* If it's not, reset the state and appends the concatenated identifier
-                             * characters as a token */
-                            value.identifier = encodeUtf8(temp_str);
-                            tokens.emplace_back(start, i, TokenType::IDENTIFIER, value);
+                            /* If it's not, reset the state and appends the identifier as a token */
+                            tokens.push(start, i, TokenType::IDENTIFIER, id);
                         }
 
                         state = TokenizeState::NONE;
                         i--;
                     }
                     continue;
+                }
 
                     /* Checks for an integer */
                 case TokenizeState::INTEGER:
-                    if (isDec(chAt(i))) {
-                        temp_str += chAt(i);
+                    /* Consumes the whole run of digits at once, accumulating them in place */
+                    while (isDec(chAt(i))) {
+                        appendDigit(number, chAt(i) - '0', 10, is_overflowed);
+                        i++;
                     }
-                    else if (chAt(i) == 'u' || chAt(i) == 'U') {
+
+                    if (chAt(i) == 'u' || chAt(i) == 'U') {
                         /* Is unsigned */
-                        TokenValue value;
-                        try {
-                            value.uinteger = std::stoull(encodeUtf8(temp_str));
-                        }
-                        catch (...) {
+                        if (is_overflowed) {
                             KH_RAISE_ERROR("unsigned integer too large to be interpret", 0);
                         }
-                        tokens.emplace_back(start, i + 1, TokenType::UINTEGER, value);
+                        tokens.pushInteger(start, i + 1, TokenType::UINTEGER, number);
 
                         state = TokenizeState::NONE;
                     }
                     else if (chAt(i) == 'i' || chAt(i) == 'I') {
                         /* Is imaginary */
-                        TokenValue value;
-                        try {
-                            value.imaginary = std::stoull(encodeUtf8(temp_str));
-                        }
-                        catch (...) {
+                        if (is_overflowed) {
                             KH_RAISE_ERROR("imaginary integer too large to be interpret", 0);
                         }
-                        tokens.emplace_back(start, i + 1, TokenType::IMAGINARY, value);
+                        tokens.pushFloating(start, i + 1, TokenType::IMAGINARY, (double)number);
 
                         state = TokenizeState::NONE;
                     }
                     else if (chAt(i) == '.') {
-                        /* Checks it as a floating point */
-                        temp_str += chAt(i);
+                        /* Checks it as a floating point, going on with the same digits */
                         state = TokenizeState::FLOATING;
                     }
                     else {
-                        TokenValue value;
-                        try {
-                            value.integer = std::stoll(encodeUtf8(temp_str));
-                        }
-                        catch (...) {
+                        /* Signed, so it has to fit in 63 bits */
+                        if (is_overflowed || number > (uint64_t)INT64_MAX) {
                             KH_RAISE_ERROR("integer too large to be interpret", -1);
                         }
-                        tokens.emplace_back(start, i, TokenType::INTEGER, value);
+                        tokens.pushInteger(start, i, TokenType::INTEGER, number);
 
                         state = TokenizeState::NONE;
                         i--;
                     }
                     continue;
 
-                    /* Checks floating point numbers */
+                    /* Checks floating point numbers, only the digits after the point are left */
                 case TokenizeState::FLOATING:
-                    if (isDec(chAt(i))) {
-                        temp_str += chAt(i);
+                    /* Consumes the whole run of digits at once, accumulating them in place */
+                    while (isDec(chAt(i))) {
+                        appendDigit(number, chAt(i) - '0', 10, is_overflowed);
+                        fraction_digits++;
+                        i++;
                     }
-                    else if (chAt(i) == 'i' || chAt(i) == 'I') {
-                        /* Is imaginary */
-                        if (temp_str.back() == '.') {
-                            temp_str.pop_back();
-                        }
 
-                        TokenValue value;
-                        value.imaginary = std::stod(encodeUtf8(temp_str));
-                        tokens.emplace_back(start, i + 1, TokenType::IMAGINARY, value);
+                    if (chAt(i) == 'i' || chAt(i) == 'I') {
+                        /* Is imaginary */
+                        double floating = toFloating(source + start, i - start, number,
+                                                     fraction_digits, is_overflowed);
+                        tokens.pushFloating(start, i + 1, TokenType::IMAGINARY, floating);
 
                         state = TokenizeState::NONE;
                     }
                     else {
                         /* An artifact from how integers were checked that was transferred as a floating
                          * point with an invalid character after . */
-                        if (temp_str.back() == '.') {
+                        if (fraction_digits == 0) {
                             KH_RAISE_ERROR("was expecting a digit after the decimal point", 0);
                         }
 
-                        TokenValue value;
-                        value.floating = std::stod(encodeUtf8(temp_str));
-                        tokens.emplace_back(start, i, TokenType::FLOATING, value);
+                        double floating = toFloating(source + start, i - start, number,
+                                                     fraction_digits, is_overflowed);
+                        tokens.pushFloating(start, i, TokenType::FLOATING, floating);
 
                         state = TokenizeState::NONE;
                         i--;
@@ -631,44 +814,36 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
 
                     /* Checks hex integers */
                 case TokenizeState::HEX:
-                    if (isHex(chAt(i))) {
-                        temp_str += chAt(i);
+                    /* Consumes the whole run of digits at once, accumulating them in place */
+                    while (isHex(chAt(i))) {
+                        appendDigit(number, hexValue(chAt(i)), 16, is_overflowed);
+                        i++;
                     }
-                    else if (chAt(i) == 'u' || chAt(i) == 'U') {
+
+                    if (chAt(i) == 'u' || chAt(i) == 'U') {
                         /* Is unsigned */
-                        TokenValue value;
-                        try {
-                            value.uinteger = std::stoull(encodeUtf8(temp_str), nullptr, 16);
-                        }
-                        catch (...) {
+                        if (is_overflowed) {
                             KH_RAISE_ERROR("unsigned hex integer too large to be interpret", 0);
                         }
-                        tokens.emplace_back(start, i + 1, TokenType::UINTEGER, value);
+                        tokens.pushInteger(start, i + 1, TokenType::UINTEGER, number);
 
                         state = TokenizeState::NONE;
                     }
                     else if (chAt(i) == 'i' || chAt(i) == 'I') {
                         /* Is imaginary */
-                        TokenValue value;
-                        try {
-                            value.imaginary = std::stoull(encodeUtf8(temp_str), nullptr, 16);
-                        }
-                        catch (...) {
+                        if (is_overflowed) {
                             KH_RAISE_ERROR("imaginary hex integer too large to be interpret", 0);
                         }
-                        tokens.emplace_back(start, i + 1, TokenType::IMAGINARY, value);
+                        tokens.pushFloating(start, i + 1, TokenType::IMAGINARY, (double)number);
 
                         state = TokenizeState::NONE;
                     }
                     else {
-                        TokenValue value;
-                        try {
-                            value.integer = std::stoull(encodeUtf8(temp_str), nullptr, 16);
-                        }
-                        catch (...) {
+                        /* Signed, so it has to fit in 63 bits like a decimal one */
+                        if (is_overflowed || number > (uint64_t)INT64_MAX) {
                             KH_RAISE_ERROR("hex integer too large to be interpret", -1);
                         }
-                        tokens.emplace_back(start, i, TokenType::INTEGER, value);
+                        tokens.pushInteger(start, i, TokenType::INTEGER, number);
 
                         state = TokenizeState::NONE;
                         i--;
@@ -677,44 +852,36 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
 
                     /* Checks octal integers */
                 case TokenizeState::OCTAL:
-                    if (isOct(chAt(i))) {
-                        temp_str += chAt(i);
+                    /* Consumes the whole run of digits at once, accumulating them in place */
+                    while (isOct(chAt(i))) {
+                        appendDigit(number, chAt(i) - '0', 8, is_overflowed);
+                        i++;
                     }
-                    else if (chAt(i) == 'u' || chAt(i) == 'U') {
+
+                    if (chAt(i) == 'u' || chAt(i) == 'U') {
                         /* Is unsigned */
-                        TokenValue value;
-                        try {
-                            value.uinteger = std::stoull(encodeUtf8(temp_str), nullptr, 8);
-                        }
-                        catch (...) {
+                        if (is_overflowed) {
                             KH_RAISE_ERROR("unsigned octal integer too large to be interpret", 0);
                         }
-                        tokens.emplace_back(start, i + 1, TokenType::UINTEGER, value);
+                        tokens.pushInteger(start, i + 1, TokenType::UINTEGER, number);
 
                         state = TokenizeState::NONE;
                     }
                     else if (chAt(i) == 'i' || chAt(i) == 'I') {
                         /* Is imaginary */
-                        TokenValue value;
-                        try {
-                            value.imaginary = std::stoull(encodeUtf8(temp_str), nullptr, 8);
-                        }
-                        catch (...) {
+                        if (is_overflowed) {
                             KH_RAISE_ERROR("imaginary octal integer too large to be interpret", 0);
                         }
-                        tokens.emplace_back(start, i + 1, TokenType::IMAGINARY, value);
+                        tokens.pushFloating(start, i + 1, TokenType::IMAGINARY, (double)number);
 
                         state = TokenizeState::NONE;
                     }
                     else {
-                        TokenValue value;
-                        try {
-                            value.integer = std::stoull(encodeUtf8(temp_str), nullptr, 8);
-                        }
-                        catch (...) {
+                        /* Signed, so it has to fit in 63 bits like a decimal one */
+                        if (is_overflowed || number > (uint64_t)INT64_MAX) {
                             KH_RAISE_ERROR("octal integer too large to be interpret", -1);
                         }
-                        tokens.emplace_back(start, i, TokenType::INTEGER, value);
+                        tokens.pushInteger(start, i, TokenType::INTEGER, number);
 
                         state = TokenizeState::NONE;
                         i--;
@@ -723,45 +890,36 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
 
                     /* Checks binary integers */
                 case TokenizeState::BIN:
-                    if (isBin(chAt(i))) {
-                        temp_str += chAt(i);
+                    /* Consumes the whole run of digits at once, accumulating them in place */
+                    while (isBin(chAt(i))) {
+                        appendDigit(number, chAt(i) - '0', 2, is_overflowed);
+                        i++;
                     }
 
-                    else if (chAt(i) == 'u' || chAt(i) == 'U') {
+                    if (chAt(i) == 'u' || chAt(i) == 'U') {
                         /* Is unsigned */
-                        TokenValue value;
-                        try {
-                            value.uinteger = std::stoull(encodeUtf8(temp_str), nullptr, 2);
-                        }
-                        catch (...) {
+                        if (is_overflowed) {
                             KH_RAISE_ERROR("unsigned binary integer too large to be interpret", 0);
                         }
-                        tokens.emplace_back(start, i + 1, TokenType::UINTEGER, value);
+                        tokens.pushInteger(start, i + 1, TokenType::UINTEGER, number);
 
                         state = TokenizeState::NONE;
                     }
                     else if (chAt(i) == 'i' || chAt(i) == 'I') {
                         /* Is imaginary */
-                        TokenValue value;
-                        try {
-                            value.imaginary = std::stoull(encodeUtf8(temp_str), nullptr, 2);
-                        }
-                        catch (...) {
+                        if (is_overflowed) {
                             KH_RAISE_ERROR("imaginary binary integer too large to be interpret", 0);
                         }
-                        tokens.emplace_back(start, i + 1, TokenType::IMAGINARY, value);
+                        tokens.pushFloating(start, i + 1, TokenType::IMAGINARY, (double)number);
 
                         state = TokenizeState::NONE;
                     }
                     else {
-                        TokenValue value;
-                        try {
-                            value.integer = std::stoull(encodeUtf8(temp_str), nullptr, 2);
-                        }
-                        catch (...) {
+                        /* Signed, so it has to fit in 63 bits like a decimal one */
+                        if (is_overflowed || number > (uint64_t)INT64_MAX) {
                             KH_RAISE_ERROR("binary integer too large to be interpret", -1);
                         }
-                        tokens.emplace_back(start, i, TokenType::INTEGER, value);
+                        tokens.pushInteger(start, i, TokenType::INTEGER, number);
 
                         state = TokenizeState::NONE;
                         i--;
@@ -769,13 +927,17 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                     continue;
 
                     /* Checks for a byte-string/buffer */
-                case TokenizeState::IN_BUF:
+                case TokenizeState::IN_BUF: {
+                    /* Skips the whole run of plain ASCII characters at once */
+                    size_t end = skipString(source, i, size);
+                    if (end > i) {
+                        i = end - 1;
+                        continue;
+                    }
+
                     if (chAt(i) == '"') {
                         /* End buffer */
-
-                        TokenValue value;
-                        value.buffer = temp_buf;
-                        tokens.emplace_back(start, i + 1, TokenType::BUFFER, value);
+                        tokens.push(start, i + 1, TokenType::BUFFER, literal_flags);
 
                         state = TokenizeState::NONE;
                     }
@@ -783,16 +945,15 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                         KH_RAISE_ERROR("unclosed buffer string before new line", 0);
                     }
                     else {
-                        /* Possible character escape */
+                        /* Possible character escape, it's only checked here and decoded once the
+                         * value is asked for */
                         if (chAt(i) == '\\') {
-                            uint8_t value;
+                            literal_flags |= LITERAL_ESCAPED;
                             switch (chAt(i + 1)) {
                                 /* Hex character escape */
                                 case 'x':
                                 case 'X': {
-                                    HANDLE_HEX_INTO_HEXSTR(2, 2);
-                                    temp_buf.push_back(std::stoul(hex_str, nullptr, 16));
-                                    i--;
+                                    SKIP_HEX(2, 2);
                                 } break;
 
                                 case '\n':
@@ -800,41 +961,51 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                                     break;
 
                                     /* Other character escapes */
-                                    HANDLE_ESCAPES_2(temp_buf.push_back(value));
+                                    SKIP_ESCAPES();
                             }
                         }
                         else {
-                            if (chAt(i) > 255) {
+                            size_t length;
+                            char32_t chr;
+                            DECODE_AT(chr, i, length);
+                            if (chr > 255) {
                                 KH_RAISE_ERROR("a non-byte sized character", 0);
                             }
 
-                            temp_buf.push_back(chAt(i));
+                            /* Has to be decoded into its single byte */
+                            literal_flags |= LITERAL_ESCAPED;
+                            i += length - 1;
                         }
                     }
                     continue;
+                }
 
                     /* Checks for a multiline byte-string/buffer */
-                case TokenizeState::IN_MULTILINE_BUF:
+                case TokenizeState::IN_MULTILINE_BUF: {
+                    /* Skips the whole run of plain ASCII characters at once */
+                    size_t end = skipString(source, i, size);
+                    if (end > i) {
+                        i = end - 1;
+                        continue;
+                    }
+
                     if (chAt(i) == '"' && chAt(i + 1) == '"' && chAt(i + 2) == '"') {
                         /* End buffer */
-                        TokenValue value;
-                        value.buffer = temp_buf;
-                        tokens.emplace_back(start, i + 3, TokenType::BUFFER, value);
+                        tokens.push(start, i + 3, TokenType::BUFFER, literal_flags | LITERAL_MULTILINE);
 
                         state = TokenizeState::NONE;
                         i += 2;
                     }
                     else {
-                        /* Possible character escape */
+                        /* Possible character escape, it's only checked here and decoded once the
+                         * value is asked for */
                         if (chAt(i) == '\\') {
-                            uint8_t value;
+                            literal_flags |= LITERAL_ESCAPED;
                             switch (chAt(i + 1)) {
                                 /* Hex character escape */
                                 case 'x':
                                 case 'X': {
-                                    HANDLE_HEX_INTO_HEXSTR(2, 2);
-                                    temp_buf.push_back(std::stoul(hex_str, nullptr, 16));
-                                    i--;
+                                    SKIP_HEX(2, 2);
                                 } break;
 
                                 case '\n':
@@ -842,26 +1013,37 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                                     break;
 
                                     /* Other character escapes */
-                                    HANDLE_ESCAPES_2(temp_buf.push_back(value));
+                                    SKIP_ESCAPES();
                             }
                         }
                         else {
-                            if (chAt(i) > 255) {
+                            size_t length;
+                            char32_t chr;
+                            DECODE_AT(chr, i, length);
+                            if (chr > 255) {
                                 KH_RAISE_ERROR("a non-byte sized character", 0);
                             }
 
-                            temp_buf.push_back(chAt(i));
+                            /* Has to be decoded into its single byte */
+                            literal_flags |= LITERAL_ESCAPED;
+                            i += length - 1;
                         }
                     }
                     continue;
+                }
 
                     /* Checks for a string */
-                case TokenizeState::IN_STR:
+                case TokenizeState::IN_STR: {
+                    /* Skips the whole run of plain ASCII characters at once */
+                    size_t end = skipString(source, i, size);
+                    if (end > i) {
+                        i = end - 1;
+                        continue;
+                    }
+
                     if (chAt(i) == '"') {
                         /* End string */
-                        TokenValue value;
-                        value.string = temp_str;
-                        tokens.emplace_back(start, i + 1, TokenType::STRING, value);
+                        tokens.push(start, i + 1, TokenType::STRING, literal_flags);
 
                         state = TokenizeState::NONE;
                     }
@@ -869,30 +1051,25 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                         KH_RAISE_ERROR("unclosed string before new line", 0);
                     }
                     else {
-                        /* Possible character escape */
+                        /* Possible character escape, it's only checked here and decoded once the
+                         * value is asked for */
                         if (chAt(i) == '\\') {
-                            uint8_t value;
+                            literal_flags |= LITERAL_ESCAPED;
                             switch (chAt(i + 1)) {
                                 /* Hex character escape */
                                 case 'x':
                                 case 'X': {
-                                    HANDLE_HEX_INTO_HEXSTR(2, 2);
-                                    temp_str += std::stoul(hex_str, nullptr, 16);
-                                    i--;
+                                    SKIP_HEX(2, 2);
                                 } break;
 
                                     /* 2 bytes unicode escape */
                                 case 'u': {
-                                    HANDLE_HEX_INTO_HEXSTR(2, 4);
-                                    temp_str += std::stoul(hex_str, nullptr, 16);
-                                    i--;
+                                    SKIP_HEX(2, 4);
                                 } break;
 
                                     /* 4 bytes unicode escape */
                                 case 'U': {
-                                    HANDLE_HEX_INTO_HEXSTR(2, 8);
-                                    temp_str += std::stoul(hex_str, nullptr, 16);
-                                    i--;
+                                    SKIP_HEX(2, 8);
                                 } break;
 
                                 case '\n':
@@ -900,51 +1077,54 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                                     break;
 
                                     /* Other character escapes */
-                                    HANDLE_ESCAPES_2(temp_str += value)
+                                    SKIP_ESCAPES();
                             }
                         }
                         else {
-                            temp_str += chAt(i);
+                            size_t length;
+                            VALIDATE_AT(i, length);
+                            i += length - 1;
                         }
                     }
                     continue;
+                }
 
                     /* Checks for a multiline string */
-                case TokenizeState::IN_MULTILINE_STR:
+                case TokenizeState::IN_MULTILINE_STR: {
+                    /* Skips the whole run of plain ASCII characters at once */
+                    size_t end = skipString(source, i, size);
+                    if (end > i) {
+                        i = end - 1;
+                        continue;
+                    }
+
                     if (chAt(i) == '"' && chAt(i + 1) == '"' && chAt(i + 2) == '"') {
                         /* End string */
-                        TokenValue value;
-                        value.string = temp_str;
-                        tokens.emplace_back(start, i + 3, TokenType::STRING, value);
+                        tokens.push(start, i + 3, TokenType::STRING, literal_flags | LITERAL_MULTILINE);
 
                         state = TokenizeState::NONE;
                         i += 2;
                     }
                     else {
-                        /* Possible character escape */
+                        /* Possible character escape, it's only checked here and decoded once the
+                         * value is asked for */
                         if (chAt(i) == '\\') {
-                            uint8_t value;
+                            literal_flags |= LITERAL_ESCAPED;
                             switch (chAt(i + 1)) {
                                 /* Hex character escape */
                                 case 'x':
                                 case 'X': {
-                                    HANDLE_HEX_INTO_HEXSTR(2, 2);
-                                    temp_str += std::stoul(hex_str, nullptr, 16);
-                                    i--;
+                                    SKIP_HEX(2, 2);
                                 } break;
 
                                     /* 2 bytes unicode escape */
                                 case 'u': {
-                                    HANDLE_HEX_INTO_HEXSTR(2, 4);
-                                    temp_str += std::stoul(hex_str, nullptr, 16);
-                                    i--;
+                                    SKIP_HEX(2, 4);
                                 } break;
 
                                     /* 4 bytes unicode escape */
                                 case 'U': {
-                                    HANDLE_HEX_INTO_HEXSTR(2, 8);
-                                    temp_str += std::stoul(hex_str, nullptr, 16);
-                                    i--;
+                                    SKIP_HEX(2, 8);
                                 } break;
 
                                 case '\n':
@@ -952,29 +1132,48 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                                     break;
 
                                     /* Other character escapes */
-                                    HANDLE_ESCAPES_2(temp_str += value)
+                                    SKIP_ESCAPES();
                             }
                         }
                         else {
-                            temp_str += chAt(i);
+                            size_t length;
+                            VALIDATE_AT(i, length);
+                            i += length - 1;
                         }
                     }
                     continue;
+                }
 
                     /* Passing through until the inline comment is done */
                 case TokenizeState::IN_INLINE_COMMENT:
-                    if (chAt(i) == '\n') {
-                        state = TokenizeState::NONE;
+                    i = skipLine(source, i, size);
+                    if (i == size && !context.is_final) {
+                        throw LexerNeedsInput();
                     }
+
+                    state = TokenizeState::NONE;
                     continue;
 
                     /* Passing through until the multiple line comment is closed */
                 case TokenizeState::IN_MULTIPLE_LINE_COMMENT:
-                    if (chAt(i) == '*' && chAt(i + 1) == '/') {
+                    /* Jumps from one `*` to the next until it's followed by a `/` */
+                    i = skipComment(source, i, size);
+                    while (i + 1 < size && source[i + 1] != '/') {
+                        i = skipComment(source, i + 1, size);
+                    }
+
+                    if (i + 1 < size) {
                         /* Close comment */
                         state = TokenizeState::NONE;
                         i++;
                     }
+                    else if (!context.is_final) {
+                        throw LexerNeedsInput();
+                    }
+                    else {
+                        /* Unclosed, it's reported once the end of file is reached */
+                        i = size;
+                    }
                     continue;
 
                 default:
@@ -982,38 +1181,51 @@ std::vector<Token> kh::lex(KH_LEX_CTX) {
                     KH_RAISE_ERROR("got an unknown tokenize state (u got a bug m8)", 0);
             }
         }
-        catch (const LexException& exc) {
-            context.exceptions.push_back(exc);
-            state = TokenizeState::NONE;
-            getLineColumn(context.source, exc.index, context.exceptions.back().column,
-                          context.exceptions.back().line);
+        catch (const LexerHitEnd& exc) {
+            error_what = "unexpected end of file";
+            error_index = exc.index;
+            goto error;
+        }
+        catch (const LexerNeedsInput&) {
+            /* Drops the half lexed token, it's lexed again from its start once there's more */
+            needs_input = true;
+            i = start;
+            goto end;
+        }
+        continue;
+
+    error:
+        /* Drops the broken token and goes on in between tokens, right after where the lexer was */
+        addException(context, error_what, context.base + error_index);
+        error_what = nullptr;
+        state = TokenizeState::NONE;
+
+        /* Skips the continuation bytes of a broken UTF-8 character, so they're not reported again one
+         * by one */
+        while (i + 1 < context.source.size() && (context.source[i + 1] & 0b11000000) == 0b10000000) {
+            i++;
         }
     }
     /* We were expecting to be in a tokenize state, but got EOF, so throw error.
      * This usually happens if the user has forgotten to close a multiline comment,
      * string or buffer */
     if (state != TokenizeState::NONE) {
-        context.exceptions.emplace_back("unexpected end of file", context.source.size());
+        addException(context, "unexpected end of file", context.base + context.source.size());
     }
 
-    /* Fills in the `column` and `line` number attributes of each token */
-    size_t column = 1, line = 1;
-    size_t token_index = 0;
-    for (size_t i = 0; i <= context.source.size(); i++, column++) {
-        if (token_index >= tokens.size()) {
-            break;
-        }
-        if (context.source[i] == '\n') {
-            column = 0;
-            line++;
-        }
+end:
+    context.ci = i;
 
-        if (tokens[token_index].index == i) {
-            tokens[token_index].column = column;
-            tokens[token_index].line = line;
-            token_index++;
+    if (tokens.source) {
+        tokens.line_map.resolve(context.source, context.exceptions, first_exception, context.base);
+    }
+
+    /* Tokens are lexed at offsets of the window, but hold offsets of the whole source */
+    if (context.base) {
+        for (size_t ti = first_new; ti < tokens.size(); ti++) {
+            tokens.indexes[ti] += context.base;
         }
     }
 
-    return tokens;
+    return needs_input;
 }
@@ -0,0 +1,361 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#include <algorithm>
+
+#include <kithare/lexer.hpp>
+#include <kithare/parallel.hpp>
+#include <kithare/scan.hpp>
+
+/* Chunks per thread, so threads which got the easier chunks can pick up more of them */
+#define KH_LEX_CHUNKS_PER_THREAD 4
+
+
+using namespace kh;
+
+/* Tokens and errors of lexing from `entry`, where the lexer is in between tokens, until the first
+ * point in between tokens at or after the end of the chunk, which is `exit` */
+struct ChunkRun {
+    size_t entry = (size_t)-1;
+    size_t exit = 0;
+    TokenStream tokens;
+    std::vector<LexException> exceptions;
+
+    /* A speculative run lexes until it lines up with the normal run of its chunk, the rest of it is
+     * then the tokens and errors of the normal run from these on */
+    bool is_joined = false;
+    size_t joined_ti = 0;
+    size_t joined_exception = 0;
+};
+
+/* Ways the lexer can get into a chunk, which starts at a line start */
+enum ChunkEntry { ENTRY_NORMAL, ENTRY_COMMENT, ENTRY_STRING, ENTRY_COUNT };
+
+struct Chunk {
+    size_t begin;
+    size_t end;
+    ChunkRun runs[ENTRY_COUNT];
+
+    /* Run from the real entry, if it wasn't one of the speculated ones */
+    ChunkRun fallback;
+
+    /* Line starts in the chunk */
+    std::vector<uint32_t> line_starts;
+};
+
+/* Finds a line start from `index` on which the lexer is surely in between tokens at if it wasn't in a
+ * multiple line comment or string. The line must start with something other than whitespace, so the
+ * newline before it doesn't get skipped along with it, and the newline can't be escaped, as that
+ * continues a string on the next line */
+static size_t findChunkStart(const std::string& source, size_t index) {
+    const char* str = source.data();
+    for (index = skipLine(str, index, source.size()); index + 1 < source.size();
+         index = skipLine(str, index + 1, source.size())) {
+        if ((index == 0 || str[index - 1] != '\\') &&
+            !(char_classes[(uint8_t)str[index + 1]] & CHAR_SPACE)) {
+            return index + 1;
+        }
+    }
+    return source.size();
+}
+
+/* Where a multiple line comment which is still open at `index` gets closed, if that's before `end` */
+static size_t findCommentExit(const std::string& source, size_t index, size_t end) {
+    const char* str = source.data();
+    end = std::min(end, source.size());
+    for (index = skipComment(str, index, end); index + 1 < end;
+         index = skipComment(str, index + 1, end)) {
+        if (str[index + 1] == '/') {
+            return index + 2;
+        }
+    }
+    return (size_t)-1;
+}
+
+/* Where a multiple line string or buffer which is still open at `index` gets closed, if that's before
+ * `end`. Escapes are only skipped over, a broken escape could end the string earlier, but then the
+ * speculation just doesn't match the real entry */
+static size_t findStringExit(const std::string& source, size_t index, size_t end) {
+    end = std::min(end, source.size());
+    for (; index + 2 < end; index++) {
+        if (source[index] == '\\') {
+            index++;
+        }
+        else if (source[index] == '"' && source[index + 1] == '"' && source[index + 2] == '"') {
+            return index + 3;
+        }
+    }
+    return (size_t)-1;
+}
+
+static void lexRun(const std::string& source, ChunkRun& run, size_t entry, size_t end) {
+    LexerContext context{source, run.exceptions};
+    context.ci = entry;
+    context.end = end;
+
+    run.entry = entry;
+    lexPart(context, run.tokens, (size_t)-1);
+    run.exit = context.ci;
+}
+
+/* Lexes a token at a time until the run is in between tokens right where the normal run also was,
+ * as from there on it would just be the same */
+static void lexJoiningRun(const std::string& source, ChunkRun& run, size_t entry, size_t end,
+                          const ChunkRun& normal) {
+    LexerContext context{source, run.exceptions};
+    context.ci = entry;
+    context.end = end;
+    run.entry = entry;
+
+    for (size_t ti = 0;;) {
+        size_t count = run.tokens.size();
+        lexPart(context, run.tokens, count + 1);
+        if (run.tokens.size() == count) {
+            break;
+        }
+
+        while (ti < normal.tokens.size() &&
+               normal.tokens.indexes[ti] + normal.tokens.lengths[ti] < context.ci) {
+            ti++;
+        }
+        if (ti < normal.tokens.size() &&
+            normal.tokens.indexes[ti] + normal.tokens.lengths[ti] == context.ci &&
+            isClearOfErrors(normal.exceptions, context.ci) &&
+            (run.exceptions.empty() || run.exceptions.back().index < context.ci)) {
+            run.is_joined = true;
+            run.joined_ti = ti + 1;
+            while (run.joined_exception < normal.exceptions.size() &&
+                   normal.exceptions[run.joined_exception].index < context.ci) {
+                run.joined_exception++;
+            }
+            run.exit = normal.exit;
+            return;
+        }
+    }
+
+    run.exit = context.ci;
+}
+
+static void lexChunk(const std::string& source, Chunk& chunk, bool is_first) {
+    const char* str = source.data();
+    size_t size = std::min(chunk.end, source.size());
+    for (size_t i = skipLine(str, chunk.begin, size); i < size; i = skipLine(str, i + 1, size)) {
+        chunk.line_starts.push_back(i + 1);
+    }
+
+    ChunkRun& normal = chunk.runs[ENTRY_NORMAL];
+    normal.tokens.reserve((chunk.end - chunk.begin) / 4);
+    lexRun(source, normal, chunk.begin, chunk.end);
+
+    /* The first chunk always starts in between tokens */
+    if (is_first) {
+        return;
+    }
+
+    size_t comment_exit = findCommentExit(source, chunk.begin, chunk.end);
+    if (comment_exit != (size_t)-1) {
+        lexJoiningRun(source, chunk.runs[ENTRY_COMMENT], comment_exit, chunk.end, normal);
+    }
+
+    size_t string_exit = findStringExit(source, chunk.begin, chunk.end);
+    if (string_exit != (size_t)-1) {
+        lexJoiningRun(source, chunk.runs[ENTRY_STRING], string_exit, chunk.end, normal);
+    }
+}
+
+/* A range of tokens of a run, which goes into the stitched stream */
+struct StitchPart {
+    TokenStream* tokens;
+    size_t begin;
+    size_t end;
+
+    /* Symbol ids in the stitched stream of the run's symbol ids */
+    std::vector<uint32_t>* ids;
+
+    /* Where the part goes in the stitched stream and its side tables */
+    size_t ti = 0;
+    size_t integer = 0;
+    size_t floating = 0;
+};
+
+static void stitchPart(TokenStream& stitched, StitchPart& part) {
+    TokenStream& tokens = *part.tokens;
+    size_t integer = part.integer;
+    size_t floating = part.floating;
+
+    for (size_t ti = part.begin, to = part.ti; ti < part.end; ti++, to++) {
+        TokenType type = tokens.types[ti];
+        uint32_t value = tokens.values[ti];
+
+        switch (type) {
+            case TokenType::IDENTIFIER:
+                value = (*part.ids)[value];
+                break;
+            case TokenType::UINTEGER:
+            case TokenType::INTEGER:
+                stitched.integers[integer] = tokens.integers[value];
+                value = integer++;
+                break;
+            case TokenType::FLOATING:
+            case TokenType::IMAGINARY:
+                stitched.floatings[floating] = tokens.floatings[value];
+                value = floating++;
+                break;
+            default:
+                break;
+        }
+
+        stitched.types[to] = type;
+        stitched.indexes[to] = tokens.indexes[ti];
+        stitched.lengths[to] = tokens.lengths[ti];
+        stitched.values[to] = value;
+    }
+}
+
+TokenStream kh::lexParallel(KH_LEX_CTX, size_t thread_count, size_t min_chunk_size) {
+    const std::string& source = context.source;
+    size_t chunk_count = std::min(std::max(thread_count, (size_t)1) * KH_LEX_CHUNKS_PER_THREAD,
+                                  source.size() / std::max(min_chunk_size, (size_t)1));
+    size_t chunk_size = source.size() / std::max(chunk_count, (size_t)1);
+
+    std::vector<Chunk> chunks;
+    chunks.reserve(chunk_count + 1);
+    for (size_t begin = 0; begin < source.size();) {
+        size_t end = findChunkStart(source, std::max(begin, chunk_size * (chunks.size() + 1)));
+        chunks.emplace_back();
+        chunks.back().begin = begin;
+        chunks.back().end = end;
+        begin = end;
+    }
+
+    /* The last chunk goes on past the end, so its runs finish the source off */
+    if (chunks.empty()) {
+        chunks.emplace_back();
+        chunks.back().begin = 0;
+    }
+    chunks.back().end = source.size() + 1;
+
+    runParallel(chunks.size(), thread_count,
+                [&](size_t index) { lexChunk(source, chunks[index], index == 0); });
+
+    /* Picks the run of every chunk which entered it the way the lexer really did, they're only
+     * known one after another. Chunks which a comment or a string went all the way through have
+     * already been lexed by the run of a chunk before them */
+    TokenStream stitched;
+    stitched.source = &source;
+    stitched.line_map = LineMap();
+
+    std::vector<StitchPart> parts;
+    std::vector<std::vector<uint32_t>> ids(chunks.size() * (ENTRY_COUNT + 1));
+    size_t position = 0;
+
+    for (size_t index = 0; index < chunks.size(); index++) {
+        Chunk& chunk = chunks[index];
+        stitched.line_map.line_starts.insert(stitched.line_map.line_starts.end(),
+                                             chunk.line_starts.begin(), chunk.line_starts.end());
+        if (position >= chunk.end) {
+            continue;
+        }
+
+        size_t entry = 0;
+        while (entry < ENTRY_COUNT && chunk.runs[entry].entry != position) {
+            entry++;
+        }
+
+        ChunkRun* run = entry < ENTRY_COUNT ? &chunk.runs[entry] : &chunk.fallback;
+        if (entry == ENTRY_COUNT) {
+            lexRun(source, chunk.fallback, position, chunk.end);
+        }
+
+        std::vector<uint32_t>* run_ids = &ids[index * (ENTRY_COUNT + 1) + entry];
+        parts.push_back({&run->tokens, 0, run->tokens.size(), run_ids});
+        context.exceptions.insert(context.exceptions.end(), run->exceptions.begin(),
+                                  run->exceptions.end());
+
+        if (run->is_joined) {
+            ChunkRun& normal = chunk.runs[ENTRY_NORMAL];
+            parts.push_back({&normal.tokens, run->joined_ti, normal.tokens.size(),
+                             &ids[index * (ENTRY_COUNT + 1) + ENTRY_NORMAL]});
+            context.exceptions.insert(context.exceptions.end(),
+                                      normal.exceptions.begin() + run->joined_exception,
+                                      normal.exceptions.end());
+        }
+
+        position = run->exit;
+    }
+
+    /* Identifiers get their symbol ids in the order they first show up, just like lexing serially.
+     * Inside of a whole run that's the order of its own ids, otherwise the tokens have to be gone
+     * through */
+    size_t ti = 0;
+    size_t integer = 0;
+    size_t floating = 0;
+
+    for (StitchPart& part : parts) {
+        TokenStream& tokens = *part.tokens;
+        std::vector<uint32_t>& part_ids = *part.ids;
+
+        if (part_ids.empty()) {
+            part_ids.assign(tokens.identifiers.size(), (uint32_t)-1);
+        }
+        if (part.begin == 0) {
+            for (uint32_t id = 0; id < tokens.identifiers.size(); id++) {
+                part_ids[id] = stitched.identifiers.intern(tokens.identifiers[id]);
+            }
+        }
+        else {
+            for (size_t i = part.begin; i < part.end; i++) {
+                uint32_t id = tokens.values[i];
+                if (tokens.types[i] == TokenType::IDENTIFIER && part_ids[id] == (uint32_t)-1) {
+                    part_ids[id] = stitched.identifiers.intern(tokens.identifiers[id]);
+                }
+            }
+        }
+
+        part.ti = ti;
+        part.integer = integer;
+        part.floating = floating;
+
+        ti += part.end - part.begin;
+        for (size_t i = part.begin; i < part.end; i++) {
+            switch (tokens.types[i]) {
+                case TokenType::UINTEGER:
+                case TokenType::INTEGER:
+                    integer++;
+                    break;
+                case TokenType::FLOATING:
+                case TokenType::IMAGINARY:
+                    floating++;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    stitched.types.resize(ti);
+    stitched.indexes.resize(ti);
+    stitched.lengths.resize(ti);
+    stitched.values.resize(ti);
+    stitched.integers.resize(integer);
+    stitched.floatings.resize(floating);
+
+    runParallel(parts.size(), thread_count,
+                [&](size_t index) { stitchPart(stitched, parts[index]); });
+
+    /* The chunks can't tell how many errors the ones before them raised, so the limit is applied
+     * once they're stitched, the same way `lexPart` does */
+    if (context.max_errors && context.exceptions.size() > context.max_errors) {
+        size_t index = context.exceptions[context.max_errors].index;
+        context.exceptions.erase(context.exceptions.begin() + context.max_errors,
+                                 context.exceptions.end());
+        context.exceptions.emplace_back("too many errors, stopped reporting them", index);
+    }
+    stitched.line_map.resolve(source, context.exceptions);
+
+    context.ci = position;
+    return stitched;
+}
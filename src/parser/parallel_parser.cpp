@@ -0,0 +1,177 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#include <algorithm>
+#include <iterator>
+
+#include <kithare/parallel.hpp>
+#include <kithare/parser.hpp>
+
+/* Chunks per thread, so threads which got the easier chunks can pick up more of them */
+#define KH_PARSE_CHUNKS_PER_THREAD 4
+
+
+using namespace kh;
+
+/* Top level declarations parsed from the token `begin` on, up until the first one which starts at or
+ * after `end`. That's the token `stop`, which is past `end` if a declaration ran over it */
+struct ParseChunk {
+    size_t begin;
+    size_t end;
+    size_t stop = 0;
+    AstModule ast{{}, {}, {}, {}, {}};
+    std::vector<ParseException> exceptions;
+};
+
+/* Checks if a top level declaration could start at the token `ti` when it's outside of any brackets,
+ * which is after a `;` or a `}` and with a keyword which only starts declarations */
+static bool isChunkStart(const TokenStream& tokens, size_t ti) {
+    if (ti == 0 || tokens.types[ti] != TokenType::IDENTIFIER ||
+        tokens.types[ti - 1] != TokenType::SYMBOL) {
+        return false;
+    }
+
+    Symbol previous = tokens[ti - 1].symbolType();
+    if (previous != Symbol::SEMICOLON && previous != Symbol::CURLY_CLOSE) {
+        return false;
+    }
+
+    switch (tokens[ti].keyword()) {
+        case Keyword::DEF:
+        case Keyword::TRY:
+        case Keyword::CLASS:
+        case Keyword::STRUCT:
+        case Keyword::ENUM:
+        case Keyword::IMPORT:
+        case Keyword::INCLUDE:
+        case Keyword::PUBLIC:
+        case Keyword::PRIVATE:
+        case Keyword::STATIC:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/* Moves the declarations and the exceptions of a chunk to the end of the module's */
+template <typename T>
+static void appendMoved(std::vector<T>& to, std::vector<T>& from) {
+    to.insert(to.end(), std::make_move_iterator(from.begin()), std::make_move_iterator(from.end()));
+    from.clear();
+}
+
+AstModule kh::parseParallel(KH_PARSE_CTX, size_t thread_count, size_t min_chunk_size) {
+    const TokenStream& tokens = context.tokens;
+    thread_count = std::max(thread_count, (size_t)1);
+    size_t chunk_count = std::min(thread_count * KH_PARSE_CHUNKS_PER_THREAD,
+                                  tokens.size() / std::max(min_chunk_size, (size_t)1));
+    size_t chunk_size = tokens.size() / std::max(chunk_count, (size_t)1);
+
+    /* Brackets are only counted, a stray closing one can't make it go below the top level */
+    std::vector<ParseChunk> chunks(1);
+    chunks.back().begin = 0;
+    size_t depth = 0;
+
+    for (size_t ti = 0; ti < tokens.size(); ti++) {
+        if (tokens.types[ti] == TokenType::SYMBOL) {
+            switch (tokens[ti].symbolType()) {
+                case Symbol::PARENTHESES_OPEN:
+                case Symbol::SQUARE_OPEN:
+                case Symbol::CURLY_OPEN:
+                    depth++;
+                    break;
+
+                case Symbol::PARENTHESES_CLOSE:
+                case Symbol::SQUARE_CLOSE:
+                case Symbol::CURLY_CLOSE:
+                    depth -= depth > 0;
+                    break;
+
+                default:
+                    break;
+            }
+        }
+        else if (depth == 0 && ti >= chunk_size * chunks.size() && isChunkStart(tokens, ti)) {
+            chunks.back().end = ti;
+            chunks.emplace_back();
+            chunks.back().begin = ti;
+        }
+    }
+    chunks.back().end = (size_t)-1;
+
+    /* Made before the chunks are parsed, as the bodies they skip point to it */
+    AstModule ast({}, {}, {}, {}, {});
+    if (context.skeleton) {
+        context.lazy_source = ast.arena.make<LazyBodySource>(context.tokens, context.directory);
+        context.lazy_source->max_depth = context.max_depth;
+        context.lazy_source->max_errors = context.max_errors;
+        ast.lazy_source = context.lazy_source;
+    }
+
+    runParallel(chunks.size(), thread_count, [&](size_t index) {
+        ParseChunk& chunk = chunks[index];
+        ParserContext chunk_context{tokens, chunk.exceptions};
+        chunk_context.arena = &chunk.ast.arena;
+        chunk_context.directory = context.directory;
+        chunk_context.max_depth = context.max_depth;
+        chunk_context.max_errors = context.max_errors;
+        chunk_context.lazy_source = context.lazy_source;
+        chunk_context.ti = chunk.begin;
+
+        parseTopScope(chunk_context, chunk.ast, chunk.end);
+        chunk.stop = chunk_context.ti;
+    });
+
+    /* Takes the chunks one after another from where the one before stopped. If that's not where
+     * the next one begins, it's parsed serially until it stops where another chunk begins */
+    context.exceptions.clear();
+    context.resolved_exceptions = 0;
+    context.is_stopped = false;
+
+    context.arena = &ast.arena;
+    context.ti = 0;
+
+    for (size_t index = 0; index < chunks.size(); index++) {
+        /* The chunks after the one which ran out of errors are dropped */
+        if (context.stopAtErrorLimit()) {
+            break;
+        }
+
+        ParseChunk& chunk = chunks[index];
+        if (chunk.begin < context.ti) {
+            continue;
+        }
+
+        if (chunk.begin == context.ti) {
+            appendMoved(ast.imports, chunk.ast.imports);
+            appendMoved(ast.functions, chunk.ast.functions);
+            appendMoved(ast.user_types, chunk.ast.user_types);
+            appendMoved(ast.enums, chunk.ast.enums);
+            appendMoved(ast.variables, chunk.ast.variables);
+            appendMoved(context.exceptions, chunk.exceptions);
+            ast.arena.adopt(std::move(chunk.ast.arena));
+            context.ti = chunk.stop;
+        }
+        else {
+            parseTopScope(context, ast, chunk.begin);
+            index--;
+        }
+    }
+
+    /* The last chunk which was taken could have stopped in the middle of the ones it ran over */
+    parseTopScope(context, ast);
+
+    context.finishExceptions();
+    context.arena = nullptr;
+    context.lazy_source = nullptr;
+
+    /* The context can parse again afterwards */
+    if (context.is_stopped) {
+        context.end_ti = (size_t)-1;
+    }
+    return ast;
+}
@@ -4,6 +4,9 @@
  * Copyright (C) 2021 Kithare Organization
  */
 
+#include <algorithm>
+#include <thread>
+
 #include <kithare/parser.hpp>
 #include <kithare/utf8.hpp>
 
@@ -11,11 +14,21 @@
 using namespace kh;
 
 std::string kh::ParseException::format() const {
-    return this->what + " at line " + std::to_string(this->token.line) + " column " +
-           std::to_string(this->token.column);
+    return this->what + " at line " + std::to_string(this->line) + " column " +
+           std::to_string(this->column);
+}
+
+void kh::ParserContext::resolveExceptions() {
+    for (; this->resolved_exceptions < this->exceptions.size(); this->resolved_exceptions++) {
+        ParseException& exc = this->exceptions[this->resolved_exceptions];
+        if (exc.line == 0) {
+            this->tokens.line_map.getLineColumn(*this->tokens.source, exc.index, exc.column, exc.line,
+                                                this->tokens.source_offset);
+        }
+    }
 }
 
-AstModule kh::parse(const std::vector<Token>& tokens) {
+AstModule kh::parse(const TokenStream& tokens) {
     std::vector<ParseException> exceptions;
     ParserContext context{tokens, exceptions};
     AstModule ast = parseWhole(context);
@@ -28,17 +41,293 @@ AstModule kh::parse(const std::vector<Token>& tokens) {
     }
 }
 
+bool kh::ParserContext::stopAtErrorLimit() {
+    if (this->incremental || !this->max_errors || this->exceptions.size() < this->max_errors) {
+        return false;
+    }
+
+    this->is_stopped = true;
+    this->end_ti = this->ti;
+    return true;
+}
+
+void kh::ParserContext::finishExceptions() {
+    this->exceptions.erase(std::unique(this->exceptions.begin(), this->exceptions.end(),
+                                       [](const ParseException& a, const ParseException& b) {
+                                           return a.index == b.index;
+                                       }),
+                           this->exceptions.end());
+
+    /* The ones past the limit were raised while unwinding, or by parallel chunks which couldn't tell
+     * how many the chunks before them raised */
+    if (this->is_stopped ||
+        (!this->incremental && this->max_errors && this->exceptions.size() > this->max_errors)) {
+        if (this->exceptions.size() > this->max_errors) {
+            this->exceptions.erase(this->exceptions.begin() + this->max_errors, this->exceptions.end());
+        }
+
+        ParseException note = this->exceptions.back();
+        note.what = "too many errors, stopped parsing";
+        this->exceptions.push_back(std::move(note));
+    }
+
+    this->resolved_exceptions = 0;
+    this->resolveExceptions();
+}
+
+bool kh::ParseNesting::tooDeep() {
+    if (this->context.depth <= this->context.max_depth) {
+        return false;
+    }
+
+    this->skip(false);
+    return true;
+}
+
+bool kh::ParseNesting::deeper() {
+    this->levels++;
+    this->context.depth++;
+    if (this->context.depth < this->context.max_depth) {
+        return false;
+    }
+
+    this->skip(true);
+    return true;
+}
+
+void kh::ParseNesting::skip(bool is_rest) {
+    this->context.exceptions.emplace_back("nested too deeply, nothing can be nested more than " +
+                                              std::to_string(this->context.max_depth) +
+                                              " levels deep",
+                                          this->context.tok());
+    skipNested(this->context, is_rest);
+}
+
+void kh::skipNested(KH_PARSE_CTX, bool is_rest) {
+    size_t depth = 0;
+    size_t begin = context.ti;
+    bool is_bracketed = false;
+
+    while (!context.eof()) {
+        Token token = context.tok();
+
+        if (token.type == TokenType::SYMBOL) {
+            switch (token.symbolType()) {
+                case Symbol::PARENTHESES_OPEN:
+                case Symbol::SQUARE_OPEN:
+                case Symbol::CURLY_OPEN:
+                    is_bracketed = is_bracketed || (context.ti == begin && !is_rest);
+
+                    /* A return type is followed by the body */
+                    if (!depth && !is_bracketed && token.symbolType() == Symbol::CURLY_OPEN) {
+                        return;
+                    }
+                    depth++;
+                    break;
+
+                case Symbol::PARENTHESES_CLOSE:
+                case Symbol::SQUARE_CLOSE:
+                case Symbol::CURLY_CLOSE:
+                    if (!depth) {
+                        return;
+                    }
+                    depth--;
+                    if (!depth && is_bracketed) {
+                        context.ti++;
+                        return;
+                    }
+                    break;
+
+                case Symbol::SEMICOLON:
+                case Symbol::COMMA:
+                    if (!depth) {
+                        return;
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+        context.ti++;
+    }
+}
+
+/* Keywords which only start a top level declaration, or a statement in a body. `if` and `def` aren't
+ * among the ones in a body, as they can be in the middle of an expression there */
+static bool isSyncKeyword(Keyword keyword, bool is_top_scope) {
+    switch (keyword) {
+        case Keyword::PUBLIC:
+        case Keyword::PRIVATE:
+        case Keyword::STATIC:
+        case Keyword::TRY:
+        case Keyword::DEF:
+        case Keyword::CLASS:
+        case Keyword::STRUCT:
+        case Keyword::ENUM:
+        case Keyword::IMPORT:
+        case Keyword::INCLUDE:
+            return is_top_scope;
+
+        case Keyword::FOR:
+        case Keyword::WHILE:
+        case Keyword::DO:
+        case Keyword::BREAK:
+        case Keyword::CONTINUE:
+        case Keyword::RETURN:
+            return !is_top_scope;
+
+        default:
+            return false;
+    }
+}
+
+void kh::synchronize(KH_PARSE_CTX, size_t begin, bool is_top_scope) {
+    if (context.ti > begin && context.ti - 1 - context.tokens.base < context.tokens.size()) {
+        Token previous = context.tokens[context.ti - 1 - context.tokens.base];
+        if (previous.type == TokenType::SYMBOL && (previous.symbolType() == Symbol::SEMICOLON ||
+                                                   previous.symbolType() == Symbol::CURLY_CLOSE)) {
+            return;
+        }
+    }
+
+    /* Only curly brackets are counted, a `;` can't be in any other brackets unless it's in curly
+     * ones too */
+    size_t depth = 0;
+
+    while (!context.eof()) {
+        Token token = context.tok();
+
+        if (token.type == TokenType::SYMBOL) {
+            switch (token.symbolType()) {
+                case Symbol::CURLY_OPEN:
+                    depth++;
+                    break;
+
+                /* A stray one at the top scope is skipped along */
+                case Symbol::CURLY_CLOSE:
+                    if (!depth) {
+                        context.ti += is_top_scope;
+                        return;
+                    }
+                    depth--;
+                    break;
+
+                case Symbol::SEMICOLON:
+                    if (!depth) {
+                        context.ti++;
+                        return;
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+        else if (!depth && token.type == TokenType::IDENTIFIER &&
+                 isSyncKeyword(token.keyword(), is_top_scope)) {
+            return;
+        }
+        context.ti++;
+    }
+}
+
 AstModule kh::parseWhole(KH_PARSE_CTX) {
+    if (!context.stream && !context.incremental && context.tokens.size() >= KH_PARSE_PARALLEL_SIZE &&
+        std::thread::hardware_concurrency() > 1) {
+        return parseParallel(context, std::thread::hardware_concurrency());
+    }
+
     context.exceptions.clear();
+    context.resolved_exceptions = 0;
+    context.is_stopped = false;
+
+    /* The module owns all of the nodes parsed into it */
+    AstModule ast({}, {}, {}, {}, {});
+    context.arena = &ast.arena;
+    context.ti = 0;
+
+    if (context.incremental && !context.stream) {
+        ast.spans = std::make_shared<ParseSpans>();
+        context.spans = ast.spans.get();
+    }
+    else if (context.skeleton && !context.stream) {
+        context.lazy_source = ast.arena.make<LazyBodySource>(context.tokens, context.directory);
+        context.lazy_source->max_depth = context.max_depth;
+        context.lazy_source->max_errors = context.max_errors;
+        ast.lazy_source = context.lazy_source;
+    }
 
-    std::vector<AstImport> imports;
-    std::vector<AstFunction> functions;
-    std::vector<AstUserType> user_types;
-    std::vector<AstEnumType> enums;
-    std::vector<AstDeclaration> variables;
+    parseTopScope(context, ast);
 
-    for (context.ti = 0; context.ti < context.tokens.size(); /* Nothing */) {
+    if (context.spans) {
+        context.spans->exceptions = context.exceptions;
+    }
+
+    context.finishExceptions();
+    context.arena = nullptr;
+    context.lazy_source = nullptr;
+    context.spans = nullptr;
+
+    /* The context can parse again afterwards */
+    if (context.is_stopped) {
+        context.end_ti = (size_t)-1;
+    }
+    return ast;
+}
+
+/* Tells which of the module's declarations a top level declaration was added to, from how many of
+ * each there were before it */
+static ParseSpan::Kind addedKind(const AstModule& ast, const size_t (&counts)[5]) {
+    if (ast.imports.size() != counts[0]) {
+        return ParseSpan::Kind::IMPORT;
+    }
+    if (ast.functions.size() != counts[1]) {
+        return ParseSpan::Kind::FUNCTION;
+    }
+    if (ast.user_types.size() != counts[2]) {
+        return ParseSpan::Kind::USER_TYPE;
+    }
+    if (ast.enums.size() != counts[3]) {
+        return ParseSpan::Kind::ENUM;
+    }
+    if (ast.variables.size() != counts[4]) {
+        return ParseSpan::Kind::VARIABLE;
+    }
+    return ParseSpan::Kind::NONE;
+}
+
+void kh::parseTopScope(KH_PARSE_CTX, AstModule& ast, size_t end_ti) {
+    std::vector<AstImport>& imports = ast.imports;
+    std::vector<AstFunction>& functions = ast.functions;
+    std::vector<AstUserType>& user_types = ast.user_types;
+    std::vector<AstEnumType>& enums = ast.enums;
+    std::vector<AstDeclaration>& variables = ast.variables;
+
+    /* How many declarations the module had before the one whose span is being recorded */
+    size_t counts[5] = {};
+    bool is_recording = false;
+
+    while (!context.eof() && context.ti < end_ti) {
+        if (context.stopAtErrorLimit()) {
+            break;
+        }
+
+        /* Nothing backtracks into the previous top level declarations */
+        context.release();
         Token token = context.tok();
+        size_t begin = context.ti;
+        size_t exceptions_begin = context.exceptions.size();
+
+        if (context.spans) {
+            context.spans->declarations.emplace_back(context.ti, context.exceptions.size());
+            counts[0] = imports.size();
+            counts[1] = functions.size();
+            counts[2] = user_types.size();
+            counts[3] = enums.size();
+            counts[4] = variables.size();
+            is_recording = true;
+        }
 
         bool is_public, is_static;
         parseAccessAttribs(context, is_public, is_static);
@@ -47,125 +336,146 @@ AstModule kh::parseWhole(KH_PARSE_CTX) {
 
         switch (token.type) {
             case TokenType::IDENTIFIER: {
-                const std::string& identifier = token.value.identifier;
+                Keyword keyword = token.keyword();
 
-                /* Function declaration identifier keyword */
-                if (identifier == "def" || identifier == "try") {
-                    /* Skips initial keyword */
+                /* `embed` is only a keyword when a file path follows it, otherwise it's a type name */
+                if (keyword == Keyword::EMBED) {
                     context.ti++;
-                    KH_PARSE_GUARD();
+                    if (!context.eof() && context.tok().type == TokenType::STRING) {
+                        variables.push_back(parseEmbed(context));
 
-                    /* Case for conditional functions */
-                    bool conditional = false;
-                    if (identifier == "try") {
-                        conditional = true;
-                        token = context.tok();
-                        if (token.type == TokenType::IDENTIFIER && token.value.identifier == "def") {
-                            context.ti++;
-                            KH_PARSE_GUARD();
-                        }
-                        else {
-                            context.exceptions.emplace_back(
-                                "expected `def` after `try` at the top scope", token);
+                        variables.back().is_public = is_public;
+                        if (is_static) {
+                            context.exceptions.emplace_back("an embed cannot be static", token);
                         }
+                        break;
                     }
+                    context.ti--;
+                }
 
-                    KH_PARSE_GUARD();
-                    /* Parses return type, name, arguments, and body */
-                    functions.push_back(parseFunction(context, conditional));
+                switch (keyword) {
+                    /* Function declaration identifier keyword */
+                    case Keyword::DEF:
+                    case Keyword::TRY: {
+                        /* Skips initial keyword */
+                        context.ti++;
+                        KH_PARSE_GUARD();
 
-                    functions.back().is_public = is_public;
-                    functions.back().is_static = is_static;
+                        /* Case for conditional functions */
+                        bool conditional = false;
+                        if (keyword == Keyword::TRY) {
+                            conditional = true;
+                            token = context.tok();
+                            if (token.type == TokenType::IDENTIFIER &&
+                                token.keyword() == Keyword::DEF) {
+                                context.ti++;
+                                KH_PARSE_GUARD();
+                            }
+                            else {
+                                context.exceptions.emplace_back(
+                                    "expected `def` after `try` at the top scope", token);
+                            }
+                        }
 
-                    if (functions.back().identifiers.empty()) {
-                        context.exceptions.emplace_back(
-                            "a lambda function cannot be declared at the top scope", token);
-                    }
+                        KH_PARSE_GUARD();
+                        /* Parses return type, name, arguments, and body */
+                        functions.push_back(parseFunction(context, conditional));
 
-                    if (is_static && functions.back().identifiers.size() == 1) {
-                        context.exceptions.emplace_back("a top scope function cannot be static", token);
-                    }
-                }
-                /* Parses class declaration */
-                else if (identifier == "class") {
-                    context.ti++;
-                    KH_PARSE_GUARD();
-                    user_types.push_back(parseUserType(context, true));
+                        functions.back().is_public = is_public;
+                        functions.back().is_static = is_static;
 
-                    user_types.back().is_public = is_public;
-                    if (is_static) {
-                        context.exceptions.emplace_back("a class cannot be static", token);
-                    }
-                }
-                /* Parses struct declaration */
-                else if (identifier == "struct") {
-                    context.ti++;
-                    KH_PARSE_GUARD();
-                    user_types.push_back(parseUserType(context, false));
+                        if (functions.back().identifiers.empty()) {
+                            context.exceptions.emplace_back(
+                                "a lambda function cannot be declared at the top scope", token);
+                        }
 
-                    user_types.back().is_public = is_public;
-                    if (is_static) {
-                        context.exceptions.emplace_back("a struct cannot be static", token);
-                    }
-                }
-                /* Parses enum declaration */
-                else if (identifier == "enum") {
-                    context.ti++;
-                    KH_PARSE_GUARD();
-                    enums.push_back(parseEnum(context));
+                        if (is_static && functions.back().identifiers.size() == 1) {
+                            context.exceptions.emplace_back("a top scope function cannot be static",
+                                                            token);
+                        }
+                    } break;
+                    /* Parses class declaration */
+                    case Keyword::CLASS: {
+                        context.ti++;
+                        KH_PARSE_GUARD();
+                        user_types.push_back(parseUserType(context, true));
 
-                    enums.back().is_public = is_public;
-                    if (is_static) {
-                        context.exceptions.emplace_back("an enum cannot be static", token);
-                    }
-                }
-                /* Parses import statement */
-                else if (identifier == "import") {
-                    context.ti++;
-                    KH_PARSE_GUARD();
-                    imports.push_back(parseImport(context, false)); /* is_include = false */
+                        user_types.back().is_public = is_public;
+                        if (is_static) {
+                            context.exceptions.emplace_back("a class cannot be static", token);
+                        }
+                    } break;
+                    /* Parses struct declaration */
+                    case Keyword::STRUCT: {
+                        context.ti++;
+                        KH_PARSE_GUARD();
+                        user_types.push_back(parseUserType(context, false));
 
-                    imports.back().is_public = is_public;
-                    if (is_static) {
-                        context.exceptions.emplace_back("an import cannot be static", token);
-                    }
-                }
-                /* Parses include statement */
-                else if (identifier == "include") {
-                    context.ti++;
-                    KH_PARSE_GUARD();
-                    imports.push_back(parseImport(context, true)); /* is_include = true */
+                        user_types.back().is_public = is_public;
+                        if (is_static) {
+                            context.exceptions.emplace_back("a struct cannot be static", token);
+                        }
+                    } break;
+                    /* Parses enum declaration */
+                    case Keyword::ENUM: {
+                        context.ti++;
+                        KH_PARSE_GUARD();
+                        enums.push_back(parseEnum(context));
 
-                    imports.back().is_public = is_public;
-                    if (is_static) {
-                        context.exceptions.emplace_back("an include cannot be static", token);
-                    }
-                }
-                /* If it was none of those above, it's probably a variable declaration */
-                else {
-                    /* Parses the variable's return type, name, and assignment value */
-                    variables.push_back(parseDeclaration(context));
+                        enums.back().is_public = is_public;
+                        if (is_static) {
+                            context.exceptions.emplace_back("an enum cannot be static", token);
+                        }
+                    } break;
+                    /* Parses import statement */
+                    case Keyword::IMPORT: {
+                        context.ti++;
+                        KH_PARSE_GUARD();
+                        imports.push_back(parseImport(context, false)); /* is_include = false */
 
-                    /* Makes sure it ends with a semicolon */
-                    KH_PARSE_GUARD();
-                    token = context.tok();
-                    if (token.type == TokenType::SYMBOL &&
-                        token.value.symbol_type == Symbol::SEMICOLON) {
+                        imports.back().is_public = is_public;
+                        if (is_static) {
+                            context.exceptions.emplace_back("an import cannot be static", token);
+                        }
+                    } break;
+                    /* Parses include statement */
+                    case Keyword::INCLUDE: {
                         context.ti++;
-                    }
-                    else {
-                        context.exceptions.emplace_back(
-                            "expected a semicolon after a variable declaration", token);
-                    }
+                        KH_PARSE_GUARD();
+                        imports.push_back(parseImport(context, true)); /* is_include = true */
 
-                    if (is_static) {
-                        context.exceptions.emplace_back("a top scope variable cannot be static", token);
-                    }
+                        imports.back().is_public = is_public;
+                        if (is_static) {
+                            context.exceptions.emplace_back("an include cannot be static", token);
+                        }
+                    } break;
+                    /* If it was none of those above, it's probably a variable declaration */
+                    default: {
+                        /* Parses the variable's return type, name, and assignment value */
+                        variables.push_back(parseDeclaration(context));
+
+                        /* Makes sure it ends with a semicolon */
+                        KH_PARSE_GUARD();
+                        token = context.tok();
+                        if (token.type == TokenType::SYMBOL &&
+                            token.symbolType() == Symbol::SEMICOLON) {
+                            context.ti++;
+                        }
+                        else {
+                            context.exceptions.emplace_back(
+                                "expected a semicolon after a variable declaration", token);
+                        }
+
+                        if (is_static) {
+                            context.exceptions.emplace_back("a top scope variable cannot be static",
+                                                            token);
+                        }
+                    } break;
                 }
             } break;
 
             case TokenType::SYMBOL:
-                if (token.value.symbol_type == Symbol::SEMICOLON) {
+                if (token.symbolType() == Symbol::SEMICOLON) {
                     context.ti++;
                 }
                 else {
@@ -182,30 +492,27 @@ AstModule kh::parseWhole(KH_PARSE_CTX) {
                 context.exceptions.emplace_back(
                     "unexpected `" + encodeUtf8(strfy(token)) + "` while parsing the top scope", token);
         }
-    }
 
-end:
-    /* Removes exceptions that's got duplicate errors at the same index */
-    if (context.exceptions.size() > 1) {
-        size_t last_index = -1;
-        ParseException* last_element = nullptr;
-
-        std::vector<ParseException> cleaned_exceptions;
-        cleaned_exceptions.reserve(context.exceptions.size());
-
-        for (ParseException& exc : context.exceptions) {
-            if (last_element == nullptr || last_index != exc.token.index ||
-                last_element->what != exc.what) {
-                cleaned_exceptions.push_back(exc);
-            }
-            last_index = exc.token.index;
-            last_element = &exc;
+        if (context.exceptions.size() > exceptions_begin) {
+            synchronize(context, begin, true);
         }
 
-        context.exceptions = cleaned_exceptions;
+        if (is_recording) {
+            ParseSpan& span = context.spans->declarations.back();
+            span.end = context.ti;
+            span.exceptions_end = context.exceptions.size();
+            span.kind = addedKind(ast, counts);
+            is_recording = false;
+        }
     }
 
-    return {imports, functions, user_types, enums, variables};
+end:
+    /* A declaration which ran into the end of the file still tells what it was added as */
+    if (is_recording) {
+        ParseSpan& span = context.spans->declarations.back();
+        span.exceptions_end = context.exceptions.size();
+        span.kind = addedKind(ast, counts);
+    }
 }
 
 void kh::parseAccessAttribs(KH_PARSE_CTX, bool& is_public, bool& is_static) {
@@ -219,41 +526,42 @@ void kh::parseAccessAttribs(KH_PARSE_CTX, bool& is_public, bool& is_static) {
     /* It parses these kinds of access types: `[static | private/public] int x = 3` */
     Token token = context.tok();
     while (token.type == TokenType::IDENTIFIER) {
-        if (token.value.identifier == "public") {
-            is_public = true;
+        switch (token.keyword()) {
+            case Keyword::PUBLIC: {
+                is_public = true;
 
-            if (specified_public) {
-                context.exceptions.emplace_back("`public` was already specified", token);
-            }
-            if (specified_private) {
-                context.exceptions.emplace_back("`private` was already specified", token);
-            }
+                if (specified_public) {
+                    context.exceptions.emplace_back("`public` was already specified", token);
+                }
+                if (specified_private) {
+                    context.exceptions.emplace_back("`private` was already specified", token);
+                }
 
-            specified_public = true;
-        }
-        else if (token.value.identifier == "private") {
-            is_public = false;
+                specified_public = true;
+            } break;
+            case Keyword::PRIVATE: {
+                is_public = false;
 
-            if (specified_public) {
-                context.exceptions.emplace_back("`public` was already specified", token);
-            }
-            if (specified_private) {
-                context.exceptions.emplace_back("`private` was already specified", token);
-            }
+                if (specified_public) {
+                    context.exceptions.emplace_back("`public` was already specified", token);
+                }
+                if (specified_private) {
+                    context.exceptions.emplace_back("`private` was already specified", token);
+                }
 
-            specified_private = true;
-        }
-        else if (token.value.identifier == "static") {
-            is_static = true;
+                specified_private = true;
+            } break;
+            case Keyword::STATIC: {
+                is_static = true;
 
-            if (specified_static) {
-                context.exceptions.emplace_back("`static` was already specified", token);
-            }
+                if (specified_static) {
+                    context.exceptions.emplace_back("`static` was already specified", token);
+                }
 
-            specified_static = true;
-        }
-        else {
-            break;
+                specified_static = true;
+            } break;
+            default:
+                goto end;
         }
 
         context.ti++;
@@ -275,7 +583,7 @@ AstImport kh::parseImport(KH_PARSE_CTX, bool is_include) {
     std::string type = is_include ? "include" : "import";
 
     /* Check if an import/include is relative */
-    if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::DOT) {
+    if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::DOT) {
         is_relative = true;
         context.ti++;
         KH_PARSE_GUARD();
@@ -285,11 +593,11 @@ AstImport kh::parseImport(KH_PARSE_CTX, bool is_include) {
     /* Making sure that it starts with an identifier (an import/include statement must has at least
      * one identifier to be imported) */
     if (token.type == TokenType::IDENTIFIER) {
-        if (isReservedKeyword(token.value.identifier)) {
+        if (isReservedKeyword(token)) {
             context.exceptions.emplace_back("was trying to " + type + " a reserved keyword", token);
         }
 
-        path.push_back(token.value.identifier);
+        path.push_back(token.identifier());
         context.ti++;
     }
     else {
@@ -302,17 +610,17 @@ AstImport kh::parseImport(KH_PARSE_CTX, bool is_include) {
     token = context.tok();
 
     /* Parses each identifier after a dot `import a.b.c.d ...` */
-    while (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::DOT) {
+    while (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::DOT) {
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
 
         /* Appends the identifier */
         if (token.type == TokenType::IDENTIFIER) {
-            if (isReservedKeyword(token.value.identifier)) {
+            if (isReservedKeyword(token)) {
                 context.exceptions.emplace_back("was trying to " + type + " a reserved keyword", token);
             }
-            path.push_back(token.value.identifier);
+            path.push_back(token.identifier());
             context.ti++;
             KH_PARSE_GUARD();
             token = context.tok();
@@ -325,18 +633,18 @@ AstImport kh::parseImport(KH_PARSE_CTX, bool is_include) {
     }
 
     /* An optional `as` for changing the namespace name in import statements */
-    if (!is_include && token.type == TokenType::IDENTIFIER && token.value.identifier == "as") {
+    if (!is_include && token.type == TokenType::IDENTIFIER && token.keyword() == Keyword::AS) {
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
 
         /* Gets the set namespace identifier */
         if (token.type == TokenType::IDENTIFIER) {
-            if (isReservedKeyword(token.value.identifier)) {
+            if (isReservedKeyword(token)) {
                 context.exceptions.emplace_back(
                     "could not use a reserved keyword as the alias of the import", token);
             }
-            identifier = token.value.identifier;
+            identifier = token.identifier();
         }
         else {
             context.exceptions.emplace_back(
@@ -349,31 +657,94 @@ AstImport kh::parseImport(KH_PARSE_CTX, bool is_include) {
     }
 
     /* Ensure that it ends with a semicolon */
-    if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::SEMICOLON) {
+    if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::SEMICOLON) {
         context.ti++;
     }
     else {
         context.exceptions.emplace_back("expected a semicolon after the " + type + " statement", token);
     }
 end:
-    return {index, path, is_include, is_relative,
-            path.empty() ? "" : (identifier.empty() ? path.back() : identifier)};
+    if (identifier.empty() && !path.empty()) {
+        identifier = path.back();
+    }
+    return {index, std::move(path), is_include, is_relative, std::move(identifier)};
+}
+
+AstDeclaration kh::parseEmbed(KH_PARSE_CTX) {
+    AstExpression* expression = nullptr;
+    std::string identifier;
+    Token token = context.tok();
+    size_t index = token.index;
+
+    /* The file is mapped in rather than lexed as a literal, so its size doesn't matter */
+    std::u32string path = token.string();
+    try {
+        expression = context.arena->make<AstValue>(
+            index, std::make_shared<MappedFile>(resolvePath(context.directory, path)));
+    }
+    catch (FileError&) {
+        context.exceptions.emplace_back("unable to embed the file `" + encodeUtf8(path) + "`", token);
+    }
+
+    context.ti++;
+    KH_PARSE_GUARD();
+    token = context.tok();
+
+    /* The name of the buffer constant which the file gets embedded as */
+    if (token.type == TokenType::IDENTIFIER && token.keyword() == Keyword::AS) {
+        context.ti++;
+        KH_PARSE_GUARD();
+        token = context.tok();
+
+        if (token.type == TokenType::IDENTIFIER) {
+            if (isReservedKeyword(token)) {
+                context.exceptions.emplace_back(
+                    "could not use a reserved keyword as the name of the embedded file", token);
+            }
+            identifier = token.identifier();
+        }
+        else {
+            context.exceptions.emplace_back(
+                "expected an identifier after the `as` keyword in the embed statement", token);
+        }
+
+        context.ti++;
+        KH_PARSE_GUARD();
+        token = context.tok();
+    }
+    else {
+        context.exceptions.emplace_back("expected `as` and a name after the path of the embedded file",
+                                        token);
+    }
+
+    /* Ensure that it ends with a semicolon */
+    if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::SEMICOLON) {
+        context.ti++;
+    }
+    else {
+        context.exceptions.emplace_back("expected a semicolon after the embed statement", token);
+    }
+end:
+    return {index, {index, {"buffer"}, {}, {}, {}}, {}, std::move(identifier), expression, 0};
 }
 
 AstFunction kh::parseFunction(KH_PARSE_CTX, bool is_conditional) {
     std::vector<std::string> identifiers;
     std::vector<std::string> generic_args;
     std::vector<uint64_t> id_array;
-    AstIdentifiers return_type{0, {}, {}, {}, {}};
     std::vector<uint64_t> return_array = {};
     size_t return_refs = 0;
     std::vector<AstDeclaration> arguments;
-    std::vector<std::shared_ptr<AstBody>> body;
+    std::vector<AstBody*> body;
+    LazyBody* lazy_body = nullptr;
 
     Token token = context.tok();
     size_t index = token.index;
 
-    if (!(token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::PARENTHESES_OPEN)) {
+    /* Where the function is, until there's a return type */
+    AstIdentifiers return_type{index, {}, {}, {}, {}};
+
+    if (!(token.type == TokenType::SYMBOL && token.symbolType() == Symbol::PARENTHESES_OPEN)) {
         /* Parses the function's identifiers and generic args */
         parseTopScopeIdentifiersAndGenericArgs(context, identifiers, generic_args);
         KH_PARSE_GUARD();
@@ -381,17 +752,17 @@ AstFunction kh::parseFunction(KH_PARSE_CTX, bool is_conditional) {
 
         /* Array dimension method extension/overloading/overriding specifier `def float[3].add(float[3]
          * other) {}` */
-        while (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::SQUARE_OPEN) {
+        while (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::SQUARE_OPEN) {
             context.ti++;
             KH_PARSE_GUARD();
             token = context.tok();
 
             if (token.type == TokenType::INTEGER || token.type == TokenType::UINTEGER) {
-                if (token.value.uinteger == 0) {
+                if (token.uinteger() == 0) {
                     context.exceptions.emplace_back("an array could not be zero sized", token);
                 }
 
-                id_array.push_back(token.value.uinteger);
+                id_array.push_back(token.uinteger());
                 context.ti++;
                 KH_PARSE_GUARD();
                 token = context.tok();
@@ -399,7 +770,7 @@ AstFunction kh::parseFunction(KH_PARSE_CTX, bool is_conditional) {
             else {
                 context.exceptions.emplace_back("expected an integer for the array size", token);
             }
-            if (!(token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::SQUARE_CLOSE)) {
+            if (!(token.type == TokenType::SYMBOL && token.symbolType() == Symbol::SQUARE_CLOSE)) {
                 context.exceptions.emplace_back("expected a closing square bracket", token);
             }
             context.ti++;
@@ -410,13 +781,13 @@ AstFunction kh::parseFunction(KH_PARSE_CTX, bool is_conditional) {
         /* Extra identifier `def something!int.extraIdentifier() {}` */
         KH_PARSE_GUARD();
         token = context.tok();
-        if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::DOT) {
+        if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::DOT) {
             context.ti++;
             KH_PARSE_GUARD();
             token = context.tok();
 
             if (token.type == TokenType::IDENTIFIER) {
-                identifiers.push_back(token.value.identifier);
+                identifiers.push_back(token.identifier());
                 context.ti++;
             }
             else {
@@ -428,7 +799,7 @@ AstFunction kh::parseFunction(KH_PARSE_CTX, bool is_conditional) {
         /* Ensures it has an opening parentheses */
         KH_PARSE_GUARD();
         token = context.tok();
-        if (!(token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::PARENTHESES_OPEN)) {
+        if (!(token.type == TokenType::SYMBOL && token.symbolType() == Symbol::PARENTHESES_OPEN)) {
             context.exceptions.emplace_back(
                 "expected an opening parentheses of the argument(s) in the function declaration",
                 token);
@@ -442,7 +813,7 @@ AstFunction kh::parseFunction(KH_PARSE_CTX, bool is_conditional) {
 
     /* Loops until it reaches a closing parentheses */
     while (true) {
-        if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::PARENTHESES_CLOSE) {
+        if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::PARENTHESES_CLOSE) {
             break;
         }
         /* Parses the argument */
@@ -453,13 +824,13 @@ AstFunction kh::parseFunction(KH_PARSE_CTX, bool is_conditional) {
 
         if (token.type == TokenType::SYMBOL) {
             /* Continues on parsing an argument if there's a comma */
-            if (token.value.symbol_type == Symbol::COMMA) {
+            if (token.symbolType() == Symbol::COMMA) {
                 context.ti++;
                 KH_PARSE_GUARD();
                 continue;
             }
             /* Stops parsing arguments */
-            else if (token.value.symbol_type == Symbol::PARENTHESES_CLOSE) {
+            else if (token.symbolType() == Symbol::PARENTHESES_CLOSE) {
                 break;
             }
             else {
@@ -482,18 +853,18 @@ AstFunction kh::parseFunction(KH_PARSE_CTX, bool is_conditional) {
     token = context.tok();
 
     /* Specifying return type `def function() -> int {}` */
-    if (token.type == TokenType::OPERATOR && token.value.operator_type == Operator::SUB) {
+    if (token.type == TokenType::OPERATOR && token.operatorType() == Operator::SUB) {
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
 
-        if (token.type == TokenType::OPERATOR && token.value.operator_type == Operator::MORE) {
+        if (token.type == TokenType::OPERATOR && token.operatorType() == Operator::MORE) {
             context.ti++;
             KH_PARSE_GUARD();
             token = context.tok();
 
             /* Checks if the return type is a `ref`erence type */
-            while (token.type == TokenType::IDENTIFIER && token.value.identifier == "ref") {
+            while (token.type == TokenType::IDENTIFIER && token.keyword() == Keyword::REF) {
                 return_refs += 1;
                 context.ti++;
                 KH_PARSE_GUARD();
@@ -505,7 +876,7 @@ AstFunction kh::parseFunction(KH_PARSE_CTX, bool is_conditional) {
             token = context.tok();
 
             /* Array return type */
-            if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::SQUARE_OPEN) {
+            if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::SQUARE_OPEN) {
                 return_array = parseArrayDimension(context, return_type);
             }
         }
@@ -519,37 +890,102 @@ AstFunction kh::parseFunction(KH_PARSE_CTX, bool is_conditional) {
         return_type = AstIdentifiers(token.index, {"void"}, {}, {}, {});
     }
 
+    /* Skips over the function's body in skeleton mode, up to the matching closing curly bracket.
+     * Without an opening one, it's left for `parseBody` to report */
+    token = context.tok();
+    if (context.lazy_source && token.type == TokenType::SYMBOL &&
+        token.symbolType() == Symbol::CURLY_OPEN) {
+        size_t begin = context.ti;
+        size_t depth = 0;
+
+        while (!context.eof()) {
+            token = context.tok();
+            context.ti++;
+
+            if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::CURLY_OPEN) {
+                depth++;
+            }
+            else if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::CURLY_CLOSE &&
+                     --depth == 0) {
+                break;
+            }
+        }
+
+        lazy_body = context.arena->make<LazyBody>(context.lazy_source, begin, context.ti);
+    }
     /* Parses the function's body */
-    body = parseBody(context);
+    else {
+        body = parseBody(context);
+    }
 end:
-    return {index,       identifiers, generic_args, id_array, return_array,
-            return_type, return_refs, arguments,    body,     is_conditional};
+    AstFunction function(index, std::move(identifiers), std::move(generic_args), std::move(id_array),
+                         std::move(return_array), std::move(return_type), return_refs,
+                         std::move(arguments), std::move(body), is_conditional);
+    function.lazy_body = lazy_body;
+    return function;
+}
+
+const std::vector<AstBody*>& kh::parseLazyBody(const AstFunction& function) {
+    LazyBody* lazy_body = function.lazy_body;
+    if (!lazy_body) {
+        return function.body;
+    }
+
+    std::call_once(lazy_body->parsed, [lazy_body]() {
+        LazyBodySource& source = *lazy_body->source;
+
+        /* Parsed on its own arena, so only the merging into the module's has to be guarded */
+        AstArena arena;
+        std::vector<ParseException> exceptions;
+        ParserContext context{source.tokens, exceptions};
+        context.arena = &arena;
+        context.directory = source.directory;
+        context.max_depth = source.max_depth;
+        context.max_errors = source.max_errors;
+        context.ti = lazy_body->begin;
+        context.end_ti = lazy_body->end;
+
+        lazy_body->body = parseBody(context);
+        context.finishExceptions();
+
+        std::lock_guard<std::mutex> lock(source.mutex);
+        source.arena.adopt(std::move(arena));
+        source.exceptions.insert(source.exceptions.end(), exceptions.begin(), exceptions.end());
+    });
+
+    return lazy_body->body;
 }
 
 AstDeclaration kh::parseDeclaration(KH_PARSE_CTX) {
-    AstIdentifiers var_type{0, {}, {}, {}, {}};
-    std::vector<uint64_t> var_array = {};
-    std::string var_name;
-    std::shared_ptr<AstExpression> expression = nullptr;
     size_t refs = 0;
 
     Token token = context.tok();
     size_t index = token.index;
 
     /* Checks if the variable type is a `ref`erence type */
-    while (token.type == TokenType::IDENTIFIER && token.value.identifier == "ref") {
+    while (token.type == TokenType::IDENTIFIER && token.keyword() == Keyword::REF) {
         refs += 1;
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
     }
 
-    /* Parses the variable's type */
-    var_type = parseIdentifiers(context);
+    /* Parses the variable's type, then the rest of the declaration */
+    return parseDeclaration(context, index, parseIdentifiers(context), refs);
+
+end:
+    return {index, {index, {}, {}, {}, {}}, {}, "", nullptr, refs};
+}
+
+AstDeclaration kh::parseDeclaration(KH_PARSE_CTX, size_t index, AstIdentifiers var_type, size_t refs) {
+    std::vector<uint64_t> var_array = {};
+    std::string var_name;
+    AstExpression* expression = nullptr;
+
+    Token token = context.tok();
 
     /* Possible array type `float[3] var;` */
     KH_PARSE_GUARD();
-    token = context.tok();
     var_array = parseArrayDimension(context, var_type);
 
     /* Gets the variable's name */
@@ -561,35 +997,35 @@ AstDeclaration kh::parseDeclaration(KH_PARSE_CTX) {
         goto end;
     }
 
-    if (isReservedKeyword(token.value.identifier)) {
+    if (isReservedKeyword(token)) {
         context.exceptions.emplace_back("cannot use a reserved keyword as a variable name", token);
     }
 
-    var_name = token.value.identifier;
+    var_name = token.identifier();
     context.ti++;
     KH_PARSE_GUARD();
     token = context.tok();
 
     /* The case where: `SomeClass x(1, 2, 3)` */
-    if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::PARENTHESES_OPEN) {
-        expression.reset(parseTuple(context));
+    if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::PARENTHESES_OPEN) {
+        expression = parseTuple(context);
     }
     /* The case where: `int x = 3` */
-    else if (token.type == TokenType::OPERATOR && token.value.operator_type == Operator::ASSIGN) {
+    else if (token.type == TokenType::OPERATOR && token.operatorType() == Operator::ASSIGN) {
         context.ti++;
         KH_PARSE_GUARD();
-        expression.reset(parseExpression(context));
+        expression = parseExpression(context);
     }
     else {
         goto end;
     }
 end:
-    return {index, var_type, var_array, var_name, expression, refs};
+    return {index, std::move(var_type), std::move(var_array), std::move(var_name), expression, refs};
 }
 
 AstUserType kh::parseUserType(KH_PARSE_CTX, bool is_class) {
     std::vector<std::string> identifiers;
-    std::shared_ptr<AstIdentifiers> base;
+    AstIdentifiers* base = nullptr;
     std::vector<std::string> generic_args;
     std::vector<AstDeclaration> members;
     std::vector<AstFunction> methods;
@@ -605,17 +1041,17 @@ AstUserType kh::parseUserType(KH_PARSE_CTX, bool is_class) {
     token = context.tok();
 
     /* Optional inheriting */
-    if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::PARENTHESES_OPEN) {
+    if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::PARENTHESES_OPEN) {
         context.ti++;
         KH_PARSE_GUARD();
 
         /* Parses base class' identifier */
-        base.reset(new AstIdentifiers(parseIdentifiers(context)));
+        base = context.arena->make<AstIdentifiers>(parseIdentifiers(context));
         KH_PARSE_GUARD();
         token = context.tok();
 
         /* Expects a closing parentheses */
-        if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::PARENTHESES_CLOSE) {
+        if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::PARENTHESES_CLOSE) {
             context.ti++;
         }
         else {
@@ -630,7 +1066,7 @@ AstUserType kh::parseUserType(KH_PARSE_CTX, bool is_class) {
     token = context.tok();
 
     /* Parses the body */
-    if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::CURLY_OPEN) {
+    if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::CURLY_OPEN) {
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
@@ -647,8 +1083,8 @@ AstUserType kh::parseUserType(KH_PARSE_CTX, bool is_class) {
             switch (token.type) {
                 case TokenType::IDENTIFIER: {
                     /* Methods */
-                    if (token.value.identifier == "def" || token.value.identifier == "try") {
-                        bool conditional = token.value.identifier == "try";
+                    if (token.keyword() == Keyword::DEF || token.keyword() == Keyword::TRY) {
+                        bool conditional = token.keyword() == Keyword::TRY;
 
                         context.ti++;
                         KH_PARSE_GUARD();
@@ -657,7 +1093,7 @@ AstUserType kh::parseUserType(KH_PARSE_CTX, bool is_class) {
                         if (conditional) {
                             token = context.tok();
                             if (token.type == TokenType::IDENTIFIER &&
-                                token.value.identifier == "def") {
+                                token.keyword() == Keyword::DEF) {
                                 context.ti++;
                                 KH_PARSE_GUARD();
                             }
@@ -693,7 +1129,7 @@ AstUserType kh::parseUserType(KH_PARSE_CTX, bool is_class) {
                         token = context.tok();
                         /* Expects semicolon */
                         if (token.type == TokenType::SYMBOL &&
-                            token.value.symbol_type == Symbol::SEMICOLON) {
+                            token.symbolType() == Symbol::SEMICOLON) {
                             context.ti++;
                         }
                         else {
@@ -710,7 +1146,7 @@ AstUserType kh::parseUserType(KH_PARSE_CTX, bool is_class) {
                 } break;
 
                 case TokenType::SYMBOL: {
-                    switch (token.value.symbol_type) {
+                    switch (token.symbolType()) {
                         /* Placeholder "does nothing" semicolon */
                         case Symbol::SEMICOLON: {
                             context.ti++;
@@ -744,7 +1180,8 @@ AstUserType kh::parseUserType(KH_PARSE_CTX, bool is_class) {
             "expected an opening curly bracket for the " + type_name + " body", token);
     }
 end:
-    return {index, identifiers, base, generic_args, members, methods, is_class};
+    return {index,           std::move(identifiers), base, std::move(generic_args),
+            std::move(members), std::move(methods),     is_class};
 }
 
 AstEnumType kh::parseEnum(KH_PARSE_CTX) {
@@ -769,7 +1206,7 @@ AstEnumType kh::parseEnum(KH_PARSE_CTX) {
     token = context.tok();
 
     /* Opens with a curly bracket */
-    if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::CURLY_OPEN) {
+    if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::CURLY_OPEN) {
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
@@ -777,13 +1214,13 @@ AstEnumType kh::parseEnum(KH_PARSE_CTX) {
         /* Parses the enum content */
         while (true) {
             /* Stops parsing enum body */
-            if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::CURLY_CLOSE) {
+            if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::CURLY_CLOSE) {
                 context.ti++;
                 break;
             }
             /* Appends member */
             else if (token.type == TokenType::IDENTIFIER) {
-                members.push_back(token.value.identifier);
+                members.push_back(token.identifier());
             }
             else {
                 context.exceptions.emplace_back(
@@ -800,7 +1237,7 @@ AstEnumType kh::parseEnum(KH_PARSE_CTX) {
             token = context.tok();
 
             /* Checks if there's an assignment operation on an enum member */
-            if (token.type == TokenType::OPERATOR && token.value.operator_type == Operator::ASSIGN) {
+            if (token.type == TokenType::OPERATOR && token.operatorType() == Operator::ASSIGN) {
                 context.ti++;
                 KH_PARSE_GUARD();
                 token = context.tok();
@@ -808,8 +1245,8 @@ AstEnumType kh::parseEnum(KH_PARSE_CTX) {
                 /* Ensures there's an integer constant */
                 if (token.type == TokenType::INTEGER || token.type == TokenType::UINTEGER) {
                     /* Don't worry about this line as it's a union */
-                    values.push_back(token.value.uinteger);
-                    counter = token.value.uinteger + 1;
+                    values.push_back(token.uinteger());
+                    counter = token.uinteger() + 1;
 
                     context.ti++;
                     KH_PARSE_GUARD();
@@ -846,12 +1283,12 @@ AstEnumType kh::parseEnum(KH_PARSE_CTX) {
             }
 
             /* Stops parsing enum body */
-            if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::CURLY_CLOSE) {
+            if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::CURLY_CLOSE) {
                 context.ti++;
                 break;
             }
             /* Ensures a comma after an enum member */
-            else if (!(token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::COMMA)) {
+            else if (!(token.type == TokenType::SYMBOL && token.symbolType() == Symbol::COMMA)) {
                 context.exceptions.emplace_back("expected a closing curly bracket or a comma "
                                                 "after an enum member in the enum body",
                                                 token);
@@ -866,15 +1303,27 @@ AstEnumType kh::parseEnum(KH_PARSE_CTX) {
                                         token);
     }
 end:
-    return {index, identifiers, members, values};
+    return {index, std::move(identifiers), std::move(members), std::move(values)};
 }
 
-std::vector<std::shared_ptr<AstBody>> kh::parseBody(KH_PARSE_CTX, size_t loop_count) {
-    std::vector<std::shared_ptr<AstBody>> body;
+std::vector<AstBody*> kh::parseBody(KH_PARSE_CTX, size_t loop_count) {
+    std::vector<AstBody*> body;
+    ParseNesting nesting(context);
+    if (nesting.tooDeep()) {
+        return body;
+    }
+
     Token token = context.tok();
 
+    /* Only the statements right in the body of a function get their spans recorded and reused, a
+     * function is the only thing whose body is parsed outside of any loop or `if`. Lambdas don't
+     * have spans, see `parseOthers` */
+    ParseSpans* spans = loop_count ? nullptr : context.spans;
+    size_t span = 0;
+    size_t statement_count = 0;
+
     /* Expects an opening curly bracket */
-    if (!(token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::CURLY_OPEN)) {
+    if (!(token.type == TokenType::SYMBOL && token.symbolType() == Symbol::CURLY_OPEN)) {
         context.exceptions.emplace_back("expected an opening curly bracket", token);
         goto end;
     }
@@ -883,246 +1332,269 @@ std::vector<std::shared_ptr<AstBody>> kh::parseBody(KH_PARSE_CTX, size_t loop_co
 
     /* Parses the body */
     while (true) {
+        if (context.stopAtErrorLimit()) {
+            goto end;
+        }
+
         KH_PARSE_GUARD();
+        if (context.previous_spans && !loop_count && reuseStatement(context, body)) {
+            continue;
+        }
+
         token = context.tok();
         size_t index = token.index;
+        size_t begin = context.ti;
+        size_t exceptions_begin = context.exceptions.size();
+
+        if (spans) {
+            span = spans->statements.size();
+            spans->statements.emplace_back(context.ti, context.exceptions.size());
+            statement_count = body.size();
+        }
 
         switch (token.type) {
             case TokenType::IDENTIFIER: {
-                if (token.value.identifier == "if") {
-                    std::vector<std::shared_ptr<AstExpression>> conditions;
-                    std::vector<std::vector<std::shared_ptr<AstBody>>> bodies;
-                    std::vector<std::shared_ptr<AstBody>> else_body;
+                switch (token.keyword()) {
+                    case Keyword::IF: {
+                        std::vector<AstExpression*> conditions;
+                        std::vector<std::vector<AstBody*>> bodies;
+                        std::vector<AstBody*> else_body;
+
+                        do {
+                            /* Parses the expression and if body */
+                            context.ti++;
+                            token = context.tok();
+                            KH_PARSE_GUARD();
+                            conditions.emplace_back(parseExpression(context));
+                            KH_PARSE_GUARD();
+                            bodies.emplace_back(parseBody(context, loop_count + 1));
+                            KH_PARSE_GUARD();
+                            token = context.tok();
 
-                    do {
-                        /* Parses the expression and if body */
-                        context.ti++;
-                        token = context.tok();
-                        KH_PARSE_GUARD();
-                        conditions.emplace_back(parseExpression(context));
-                        KH_PARSE_GUARD();
-                        bodies.emplace_back(parseBody(context, loop_count + 1));
-                        KH_PARSE_GUARD();
-                        token = context.tok();
+                            /* Recontinues if there's an else if (`elif`) clause */
+                        } while (token.type == TokenType::IDENTIFIER &&
+                                 token.keyword() == Keyword::ELIF);
 
-                        /* Recontinues if there's an else if (`elif`) clause */
-                    } while (token.type == TokenType::IDENTIFIER && token.value.identifier == "elif");
+                        /* Parses the body if there's an `else` clause */
+                        if (token.type == TokenType::IDENTIFIER && token.keyword() == Keyword::ELSE) {
+                            context.ti++;
+                            KH_PARSE_GUARD();
+                            else_body = parseBody(context, loop_count + 1);
+                        }
 
-                    /* Parses the body if there's an `else` clause */
-                    if (token.type == TokenType::IDENTIFIER && token.value.identifier == "else") {
+                        body.emplace_back(
+                            context.arena->make<AstIf>(index, std::move(conditions), std::move(bodies),
+                                                       std::move(else_body)));
+                    } break;
+                    /* While statement */
+                    case Keyword::WHILE: {
                         context.ti++;
                         KH_PARSE_GUARD();
-                        else_body = parseBody(context, loop_count + 1);
-                    }
-
-                    body.emplace_back(new AstIf(index, conditions, bodies, else_body));
-                }
-                /* While statement */
-                else if (token.value.identifier == "while") {
-                    context.ti++;
-                    KH_PARSE_GUARD();
-
-                    /* Parses the expression and body */
-                    std::shared_ptr<AstExpression> condition(parseExpression(context));
-                    std::vector<std::shared_ptr<AstBody>> while_body =
-                        parseBody(context, loop_count + 1);
-
-                    body.emplace_back(new AstWhile(index, condition, while_body));
-                }
-                /* Do while statement */
-                else if (token.value.identifier == "do") {
-                    context.ti++;
-                    KH_PARSE_GUARD();
-
-                    /* Parses the body */
-                    std::vector<std::shared_ptr<AstBody>> do_while_body =
-                        parseBody(context, loop_count + 1);
-                    std::shared_ptr<AstExpression> condition;
 
-                    KH_PARSE_GUARD();
-                    token = context.tok();
+                        /* Parses the expression and body */
+                        AstExpression* condition = parseExpression(context);
+                        std::vector<AstBody*> while_body = parseBody(context, loop_count + 1);
 
-                    /* Expects `while` and then parses the condition expression */
-                    if (token.type == TokenType::IDENTIFIER && token.value.identifier == "while") {
+                        body.emplace_back(
+                            context.arena->make<AstWhile>(index, condition, std::move(while_body)));
+                    } break;
+                    /* Do while statement */
+                    case Keyword::DO: {
                         context.ti++;
-                        condition.reset(parseExpression(context));
-                    }
-                    else
-                        context.exceptions.emplace_back("expected `while` after the `do {...}`", token);
-
-                    KH_PARSE_GUARD();
-                    token = context.tok();
+                        KH_PARSE_GUARD();
 
-                    /* Expects a semicolon */
-                    if (token.type == TokenType::SYMBOL &&
-                        token.value.symbol_type == Symbol::SEMICOLON) {
-                        context.ti++;
-                    }
-                    else
-                        context.exceptions.emplace_back(
-                            "expected a semicolon after `do {...} while ...`", token);
+                        /* Parses the body */
+                        std::vector<AstBody*> do_while_body = parseBody(context, loop_count + 1);
+                        AstExpression* condition = nullptr;
 
-                    body.emplace_back(new AstDoWhile(index, condition, do_while_body));
-                }
-                /* For statement */
-                else if (token.value.identifier == "for") {
-                    context.ti++;
-                    KH_PARSE_GUARD();
+                        KH_PARSE_GUARD();
+                        token = context.tok();
 
-                    std::shared_ptr<AstExpression> target_or_initializer(parseExpression(context));
+                        /* Expects `while` and then parses the condition expression */
+                        if (token.type == TokenType::IDENTIFIER && token.keyword() == Keyword::WHILE) {
+                            context.ti++;
+                            condition = parseExpression(context);
+                        }
+                        else
+                            context.exceptions.emplace_back("expected `while` after the `do {...}`",
+                                                            token);
 
-                    KH_PARSE_GUARD();
-                    token = context.tok();
-                    if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::COLON) {
-                        context.ti++;
                         KH_PARSE_GUARD();
                         token = context.tok();
 
-                        std::shared_ptr<AstExpression> iterator(parseExpression(context));
-                        KH_PARSE_GUARD();
-                        std::vector<std::shared_ptr<AstBody>> foreach_body =
-                            parseBody(context, loop_count + 1);
+                        /* Expects a semicolon */
+                        if (token.type == TokenType::SYMBOL &&
+                            token.symbolType() == Symbol::SEMICOLON) {
+                            context.ti++;
+                        }
+                        else
+                            context.exceptions.emplace_back(
+                                "expected a semicolon after `do {...} while ...`", token);
 
                         body.emplace_back(
-                            new AstForEach(index, target_or_initializer, iterator, foreach_body));
-                    }
-                    else if (token.type == TokenType::SYMBOL &&
-                             token.value.symbol_type == Symbol::COMMA) {
+                            context.arena->make<AstDoWhile>(index, condition,
+                                                            std::move(do_while_body)));
+                    } break;
+                    /* For statement */
+                    case Keyword::FOR: {
                         context.ti++;
                         KH_PARSE_GUARD();
-                        std::shared_ptr<AstExpression> condition(parseExpression(context));
+
+                        AstExpression* target_or_initializer = parseExpression(context);
+
                         KH_PARSE_GUARD();
                         token = context.tok();
-
-                        if (token.type == TokenType::SYMBOL &&
-                            token.value.symbol_type == Symbol::COMMA) {
+                        if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::COLON) {
                             context.ti++;
                             KH_PARSE_GUARD();
+                            token = context.tok();
+
+                            AstExpression* iterator = parseExpression(context);
+                            KH_PARSE_GUARD();
+                            std::vector<AstBody*> foreach_body = parseBody(context, loop_count + 1);
+
+                            body.emplace_back(context.arena->make<AstForEach>(
+                                index, target_or_initializer, iterator, std::move(foreach_body)));
                         }
-                        else {
-                            context.exceptions.emplace_back("expected a comma after `for ..., ...`",
-                                                            token);
-                        }
-                        std::shared_ptr<AstExpression> step(parseExpression(context));
-                        KH_PARSE_GUARD();
-                        std::vector<std::shared_ptr<AstBody>> for_body =
-                            parseBody(context, loop_count + 1);
+                        else if (token.type == TokenType::SYMBOL &&
+                                 token.symbolType() == Symbol::COMMA) {
+                            context.ti++;
+                            KH_PARSE_GUARD();
+                            AstExpression* condition = parseExpression(context);
+                            KH_PARSE_GUARD();
+                            token = context.tok();
 
-                        body.emplace_back(
-                            new AstFor(index, target_or_initializer, condition, step, for_body));
-                    }
-                    else {
-                        context.exceptions.emplace_back(
-                            "expected a colon or a comma after the `for` target/initializer", token);
-                    }
-                }
-                /* `continue` statement */
-                else if (token.value.identifier == "continue") {
-                    context.ti++;
-                    KH_PARSE_GUARD();
-                    token = context.tok();
+                            if (token.type == TokenType::SYMBOL &&
+                                token.symbolType() == Symbol::COMMA) {
+                                context.ti++;
+                                KH_PARSE_GUARD();
+                            }
+                            else {
+                                context.exceptions.emplace_back("expected a comma after `for ..., ...`",
+                                                                token);
+                            }
+                            AstExpression* step = parseExpression(context);
+                            KH_PARSE_GUARD();
+                            std::vector<AstBody*> for_body = parseBody(context, loop_count + 1);
 
-                    if (!loop_count) {
-                        context.exceptions.emplace_back(
-                            "`continue` cannot be used outside of while or for loops", token);
-                    }
-                    size_t loop_breaks = 0;
-                    /* Continuing multiple loops `continue 4;` */
-                    if (token.type == TokenType::UINTEGER || token.type == TokenType::INTEGER) {
-                        if (token.value.uinteger >= loop_count) {
+                            body.emplace_back(context.arena->make<AstFor>(
+                                index, target_or_initializer, condition, step, std::move(for_body)));
+                        }
+                        else {
                             context.exceptions.emplace_back(
-                                "trying to `continue` an invalid amount of loops", token);
+                                "expected a colon or a comma after the `for` target/initializer",
+                                token);
                         }
-                        loop_breaks = token.value.uinteger;
+                    } break;
+                    /* `continue` statement */
+                    case Keyword::CONTINUE: {
                         context.ti++;
                         KH_PARSE_GUARD();
                         token = context.tok();
-                    }
 
-                    /* Expects semicolon */
-                    if (token.type == TokenType::SYMBOL &&
-                        token.value.symbol_type == Symbol::SEMICOLON) {
-                        context.ti++;
-                    }
-                    else {
-                        context.exceptions.emplace_back(
-                            "expected a semicolon or an integer after `continue`", token);
-                    }
-                    body.emplace_back(
-                        new AstStatement(index, AstStatement::Type::CONTINUE, loop_breaks));
-                }
-                /* `break` statement */
-                else if (token.value.identifier == "break") {
-                    context.ti++;
-                    KH_PARSE_GUARD();
-                    token = context.tok();
+                        if (!loop_count) {
+                            context.exceptions.emplace_back(
+                                "`continue` cannot be used outside of while or for loops", token);
+                        }
+                        size_t loop_breaks = 0;
+                        /* Continuing multiple loops `continue 4;` */
+                        if (token.type == TokenType::UINTEGER || token.type == TokenType::INTEGER) {
+                            if (token.uinteger() >= loop_count) {
+                                context.exceptions.emplace_back(
+                                    "trying to `continue` an invalid amount of loops", token);
+                            }
+                            loop_breaks = token.uinteger();
+                            context.ti++;
+                            KH_PARSE_GUARD();
+                            token = context.tok();
+                        }
 
-                    if (!loop_count) {
-                        context.exceptions.emplace_back(
-                            "`break` cannot be used outside of while or for loops", token);
-                    }
-                    size_t loop_breaks = 0;
-                    /* Breaking multiple loops `break 2;` */
-                    if (token.type == TokenType::UINTEGER || token.type == TokenType::INTEGER) {
-                        if (token.value.uinteger >= loop_count) {
+                        /* Expects semicolon */
+                        if (token.type == TokenType::SYMBOL &&
+                            token.symbolType() == Symbol::SEMICOLON) {
+                            context.ti++;
+                        }
+                        else {
                             context.exceptions.emplace_back(
-                                "trying to `break` an invalid amount of loops", token);
+                                "expected a semicolon or an integer after `continue`", token);
                         }
-                        loop_breaks = token.value.uinteger;
+                        body.emplace_back(context.arena->make<AstStatement>(
+                            index, AstStatement::Type::CONTINUE, loop_breaks));
+                    } break;
+                    /* `break` statement */
+                    case Keyword::BREAK: {
                         context.ti++;
                         KH_PARSE_GUARD();
                         token = context.tok();
-                    }
 
-                    /* Expects semicolon */
-                    if (token.type == TokenType::SYMBOL &&
-                        token.value.symbol_type == Symbol::SEMICOLON) {
-                        context.ti++;
-                    }
-                    else {
-                        context.exceptions.emplace_back(
-                            "expected a semicolon or an integer after `break`", token);
-                    }
-                    body.emplace_back(new AstStatement(index, AstStatement::Type::BREAK, loop_breaks));
-                }
-                /* `return` statement */
-                else if (token.value.identifier == "return") {
-                    context.ti++;
-                    KH_PARSE_GUARD();
-                    token = context.tok();
-
-                    std::shared_ptr<AstExpression> expression((AstExpression*)nullptr);
+                        if (!loop_count) {
+                            context.exceptions.emplace_back(
+                                "`break` cannot be used outside of while or for loops", token);
+                        }
+                        size_t loop_breaks = 0;
+                        /* Breaking multiple loops `break 2;` */
+                        if (token.type == TokenType::UINTEGER || token.type == TokenType::INTEGER) {
+                            if (token.uinteger() >= loop_count) {
+                                context.exceptions.emplace_back(
+                                    "trying to `break` an invalid amount of loops", token);
+                            }
+                            loop_breaks = token.uinteger();
+                            context.ti++;
+                            KH_PARSE_GUARD();
+                            token = context.tok();
+                        }
 
-                    /* No expression given */
-                    if (token.type == TokenType::SYMBOL &&
-                        token.value.symbol_type == Symbol::SEMICOLON) {
+                        /* Expects semicolon */
+                        if (token.type == TokenType::SYMBOL &&
+                            token.symbolType() == Symbol::SEMICOLON) {
+                            context.ti++;
+                        }
+                        else {
+                            context.exceptions.emplace_back(
+                                "expected a semicolon or an integer after `break`", token);
+                        }
+                        body.emplace_back(context.arena->make<AstStatement>(
+                            index, AstStatement::Type::BREAK, loop_breaks));
+                    } break;
+                    /* `return` statement */
+                    case Keyword::RETURN: {
                         context.ti++;
-                    } /* If there's a provided return value expression */
-                    else {
-                        expression.reset(parseExpression(context));
                         KH_PARSE_GUARD();
                         token = context.tok();
 
-                        /* Expects semicolon */
+                        AstExpression* expression = nullptr;
+
+                        /* No expression given */
                         if (token.type == TokenType::SYMBOL &&
-                            token.value.symbol_type == Symbol::SEMICOLON) {
+                            token.symbolType() == Symbol::SEMICOLON) {
                             context.ti++;
-                        }
+                        } /* If there's a provided return value expression */
                         else {
-                            context.exceptions.emplace_back("expected a semicolon after `return ...`",
-                                                            token);
+                            expression = parseExpression(context);
+                            KH_PARSE_GUARD();
+                            token = context.tok();
+
+                            /* Expects semicolon */
+                            if (token.type == TokenType::SYMBOL &&
+                                token.symbolType() == Symbol::SEMICOLON) {
+                                context.ti++;
+                            }
+                            else {
+                                context.exceptions.emplace_back(
+                                    "expected a semicolon after `return ...`", token);
+                            }
                         }
-                    }
 
-                    body.emplace_back(new AstStatement(index, AstStatement::Type::RETURN, expression));
-                }
-                else {
-                    goto parse_expr;
+                        body.emplace_back(context.arena->make<AstStatement>(
+                            index, AstStatement::Type::RETURN, expression));
+                    } break;
+                    default:
+                        goto parse_expr;
                 }
             } break;
 
             case TokenType::SYMBOL:
-                switch (token.value.symbol_type) {
+                switch (token.symbolType()) {
                     /* Placeholder semicolon */
                     case Symbol::SEMICOLON: {
                         context.ti++;
@@ -1130,6 +1602,9 @@ std::vector<std::shared_ptr<AstBody>> kh::parseBody(KH_PARSE_CTX, size_t loop_co
 
                         /* Ends body */
                     case Symbol::CURLY_CLOSE: {
+                        if (spans) {
+                            spans->statements.pop_back();
+                        }
                         context.ti++;
                         goto end;
                     } break;
@@ -1142,12 +1617,12 @@ std::vector<std::shared_ptr<AstBody>> kh::parseBody(KH_PARSE_CTX, size_t loop_co
             default:
             parse_expr : {
                 /* If it isn't any of the statements above, it's probably an expression */
-                std::shared_ptr<AstExpression> expr(parseExpression(context));
+                AstExpression* expr = parseExpression(context);
                 KH_PARSE_GUARD();
                 token = context.tok();
 
                 /* Expects a semicolon */
-                if (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::SEMICOLON) {
+                if (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::SEMICOLON) {
                     context.ti++;
                 }
                 else {
@@ -1157,6 +1632,19 @@ std::vector<std::shared_ptr<AstBody>> kh::parseBody(KH_PARSE_CTX, size_t loop_co
                 body.emplace_back(expr);
             }
         }
+
+        if (context.exceptions.size() > exceptions_begin) {
+            synchronize(context, begin, false);
+        }
+
+        if (spans) {
+            spans->statements[span].end = context.ti;
+            spans->statements[span].exceptions_end = context.exceptions.size();
+            if (body.size() != statement_count) {
+                spans->statements[span].kind = ParseSpan::Kind::STATEMENT;
+                spans->statements[span].statement = body.back();
+            }
+        }
     }
 end:
     return body;
@@ -1175,11 +1663,11 @@ void kh::parseTopScopeIdentifiersAndGenericArgs(KH_PARSE_CTX, std::vector<std::s
 
     forceIn:
         if (token.type == TokenType::IDENTIFIER) {
-            if (isReservedKeyword(token.value.identifier)) {
+            if (isReservedKeyword(token)) {
                 context.exceptions.emplace_back("cannot use a reserved keyword as an identifier",
                                                 token);
             }
-            identifiers.push_back(token.value.identifier);
+            identifiers.push_back(token.identifier());
             context.ti++;
         }
         else {
@@ -1187,26 +1675,26 @@ void kh::parseTopScopeIdentifiersAndGenericArgs(KH_PARSE_CTX, std::vector<std::s
         }
         KH_PARSE_GUARD();
         token = context.tok();
-    } while (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::DOT);
+    } while (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::DOT);
 
     /* Generic arguments */
-    if (token.type == TokenType::OPERATOR && token.value.operator_type == Operator::NOT) {
+    if (token.type == TokenType::OPERATOR && token.operatorType() == Operator::NOT) {
         context.ti++;
         KH_PARSE_GUARD();
         token = context.tok();
 
         /* a.b.c!T */
         if (token.type == TokenType::IDENTIFIER) {
-            if (isReservedKeyword(token.value.identifier)) {
+            if (isReservedKeyword(token)) {
                 context.exceptions.emplace_back(
                     "cannot use a reserved keyword as an identifier of a generic argument", token);
             }
-            generic_args.push_back(token.value.identifier);
+            generic_args.push_back(token.identifier());
             context.ti++;
         }
         /* a.b.c!(A, B) */
         else if (token.type == TokenType::SYMBOL &&
-                 token.value.symbol_type == Symbol::PARENTHESES_OPEN) {
+                 token.symbolType() == Symbol::PARENTHESES_OPEN) {
             context.ti++;
             KH_PARSE_GUARD();
             token = context.tok();
@@ -1219,12 +1707,12 @@ void kh::parseTopScopeIdentifiersAndGenericArgs(KH_PARSE_CTX, std::vector<std::s
 
             forceInGenericArgs:
                 if (token.type == TokenType::IDENTIFIER) {
-                    if (isReservedKeyword(token.value.identifier)) {
+                    if (isReservedKeyword(token)) {
                         context.exceptions.emplace_back(
                             "cannot use a reserved keyword as an identifier of a generic argument",
                             token);
                     }
-                    generic_args.push_back(token.value.identifier);
+                    generic_args.push_back(token.identifier());
                     context.ti++;
                 }
                 else {
@@ -1233,10 +1721,10 @@ void kh::parseTopScopeIdentifiersAndGenericArgs(KH_PARSE_CTX, std::vector<std::s
                 }
                 KH_PARSE_GUARD();
                 token = context.tok();
-            } while (token.type == TokenType::SYMBOL && token.value.symbol_type == Symbol::COMMA);
+            } while (token.type == TokenType::SYMBOL && token.symbolType() == Symbol::COMMA);
 
             if (token.type == TokenType::SYMBOL &&
-                token.value.symbol_type == Symbol::PARENTHESES_CLOSE) {
+                token.symbolType() == Symbol::PARENTHESES_CLOSE) {
                 context.ti++;
             }
             else {
@@ -0,0 +1,137 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#include <algorithm>
+
+#include <kithare/lexer.hpp>
+
+
+using namespace kh;
+
+bool kh::isClearOfErrors(const std::vector<LexException>& exceptions, size_t index) {
+    for (const LexException& exc : exceptions) {
+        if (exc.index >= index && exc.index < index + KH_LEX_LOOKAHEAD) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TokenEdit kh::relex(std::string& source, TokenStream& tokens, std::vector<LexException>& exceptions,
+                    const SourceEdit& edit) {
+    const size_t edit_end = edit.index + edit.removed;
+    const size_t inserted_end = edit.index + edit.inserted.size();
+    const ptrdiff_t shift = (ptrdiff_t)edit.inserted.size() - (ptrdiff_t)edit.removed;
+
+    /* Tokens which end far enough before the edit couldn't have been changed by it. The lexer is
+     * always in between tokens at the end of a token, so lexing restarts at the end of the last one */
+    size_t kept = 0;
+    size_t high = tokens.size();
+    while (kept < high) {
+        size_t middle = (kept + high) / 2;
+        if (tokens.indexes[middle] + tokens.lengths[middle] + KH_LEX_LOOKAHEAD <= edit.index) {
+            kept = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    while (kept && !isClearOfErrors(exceptions, tokens.indexes[kept - 1] + tokens.lengths[kept - 1])) {
+        kept--;
+    }
+    size_t restart = kept ? tokens.indexes[kept - 1] + tokens.lengths[kept - 1] : 0;
+
+    source.replace(edit.index, edit.removed, edit.inserted);
+    tokens.source = &source;
+
+    /* Lines starting up to the edit stay, the ones starting after it are moved */
+    std::vector<uint32_t>& line_starts = tokens.line_map.line_starts;
+    std::vector<uint32_t> moved_lines(
+        std::upper_bound(line_starts.begin(), line_starts.end(), edit_end), line_starts.end());
+    line_starts.erase(std::upper_bound(line_starts.begin(), line_starts.end(), edit.index),
+                      line_starts.end());
+
+    for (size_t i = 0; i < edit.inserted.size(); i++) {
+        if (edit.inserted[i] == '\n') {
+            line_starts.push_back(edit.index + i + 1);
+        }
+    }
+    for (uint32_t line_start : moved_lines) {
+        line_starts.push_back(line_start + shift);
+    }
+
+    /* The new tokens are lexed on their own and spliced in once it's known how many old ones they
+     * replace, sharing the identifiers and lines of the old ones */
+    TokenStream relexed;
+    relexed.source = &source;
+    relexed.identifiers = std::move(tokens.identifiers);
+    relexed.line_map = std::move(tokens.line_map);
+
+    std::vector<LexException> relexed_exceptions;
+    LexerContext context{source, relexed_exceptions};
+    context.ci = restart;
+
+    /* Lexes a token at a time, until one ends past the edit right where an old token ended. Both
+     * lexers were in between tokens there and the rest of the source is the same, so the rest of the
+     * old tokens would come out again. This is also what makes an opened or closed multiple line
+     * string or comment lex on until the old tokens really match up again, rather than stopping at
+     * the first token which only looks the same */
+    bool is_synced = false;
+    size_t synced_ti = tokens.size();
+    size_t synced_end = 0;
+
+    for (size_t ti = kept; !is_synced;) {
+        size_t count = relexed.size();
+        lexPart(context, relexed, count + 1);
+        if (relexed.size() == count) {
+            break;
+        }
+        if (context.ci < inserted_end) {
+            continue;
+        }
+
+        size_t old_end = context.ci - shift;
+        while (ti < tokens.size() && tokens.indexes[ti] + tokens.lengths[ti] < old_end) {
+            ti++;
+        }
+        if (ti < tokens.size() && tokens.indexes[ti] + tokens.lengths[ti] == old_end &&
+            isClearOfErrors(exceptions, old_end) &&
+            (relexed_exceptions.empty() || relexed_exceptions.back().index < context.ci)) {
+            is_synced = true;
+            synced_ti = ti + 1;
+            synced_end = old_end;
+        }
+    }
+
+    TokenEdit token_edit{kept, synced_ti - kept, relexed.size(), shift};
+
+    tokens.identifiers = std::move(relexed.identifiers);
+    tokens.line_map = std::move(relexed.line_map);
+    tokens.splice(kept, synced_ti, relexed, shift);
+
+    std::vector<LexException> updated_exceptions;
+    for (const LexException& exc : exceptions) {
+        if (exc.index < restart) {
+            updated_exceptions.push_back(exc);
+        }
+    }
+    updated_exceptions.insert(updated_exceptions.end(), relexed_exceptions.begin(),
+                              relexed_exceptions.end());
+
+    if (is_synced) {
+        size_t first_moved = updated_exceptions.size();
+        for (const LexException& exc : exceptions) {
+            if (exc.index >= synced_end) {
+                updated_exceptions.push_back(exc);
+                updated_exceptions.back().index += shift;
+            }
+        }
+        tokens.line_map.resolve(source, updated_exceptions, first_moved);
+    }
+
+    exceptions = std::move(updated_exceptions);
+    return token_edit;
+}
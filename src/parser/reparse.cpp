@@ -0,0 +1,456 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#include <algorithm>
+#include <iterator>
+
+#include <kithare/parser.hpp>
+
+
+using namespace kh;
+
+static void moveOffsets(AstBody* body, ptrdiff_t shift);
+
+template <typename T>
+static void moveOffsets(const std::vector<T*>& bodies, ptrdiff_t shift) {
+    for (T* body : bodies) {
+        moveOffsets(body, shift);
+    }
+}
+
+static void moveOffsets(AstIdentifiers& identifiers, ptrdiff_t shift) {
+    identifiers.index += shift;
+    for (AstIdentifiers& generic : identifiers.generics) {
+        moveOffsets(generic, shift);
+    }
+}
+
+static void moveOffsets(AstDeclaration& declaration, ptrdiff_t shift) {
+    declaration.index += shift;
+    moveOffsets(declaration.var_type, shift);
+    moveOffsets(declaration.expression, shift);
+}
+
+static void moveOffsets(AstFunction& function, ptrdiff_t shift) {
+    function.index += shift;
+    moveOffsets(function.return_type, shift);
+    for (AstDeclaration& argument : function.arguments) {
+        moveOffsets(argument, shift);
+    }
+    moveOffsets(function.body, shift);
+}
+
+static void moveOffsets(AstImport& import, ptrdiff_t shift) {
+    import.index += shift;
+}
+
+static void moveOffsets(AstUserType& user_type, ptrdiff_t shift) {
+    user_type.index += shift;
+    if (user_type.base) {
+        moveOffsets(*user_type.base, shift);
+    }
+    for (AstDeclaration& member : user_type.members) {
+        moveOffsets(member, shift);
+    }
+    for (AstFunction& method : user_type.methods) {
+        moveOffsets(method, shift);
+    }
+}
+
+static void moveOffsets(AstEnumType& enum_type, ptrdiff_t shift) {
+    enum_type.index += shift;
+}
+
+/* Moves the byte offsets of a tree, everything under it included, by `shift` */
+static void moveOffsets(AstBody* body, ptrdiff_t shift) {
+    if (!body) {
+        return;
+    }
+    body->index += shift;
+
+    switch (body->type) {
+        case AstBody::EXPRESSION: {
+            AstExpression* expr = static_cast<AstExpression*>(body);
+
+            switch (expr->expression_type) {
+                case AstExpression::IDENTIFIER: {
+                    for (AstIdentifiers& generic : static_cast<AstIdentifiers*>(expr)->generics) {
+                        moveOffsets(generic, shift);
+                    }
+                } break;
+
+                case AstExpression::DECLARE: {
+                    AstDeclaration* declaration = static_cast<AstDeclaration*>(expr);
+                    moveOffsets(declaration->var_type, shift);
+                    moveOffsets(declaration->expression, shift);
+                } break;
+
+                case AstExpression::FUNCTION: {
+                    AstFunction* function = static_cast<AstFunction*>(expr);
+                    moveOffsets(function->return_type, shift);
+                    for (AstDeclaration& argument : function->arguments) {
+                        moveOffsets(argument, shift);
+                    }
+                    moveOffsets(function->body, shift);
+                } break;
+
+                case AstExpression::UNARY:
+                    moveOffsets(static_cast<AstUnaryOperation*>(expr)->rvalue, shift);
+                    break;
+
+                case AstExpression::REV_UNARY:
+                    moveOffsets(static_cast<AstRevUnaryOperation*>(expr)->rvalue, shift);
+                    break;
+
+                case AstExpression::BINARY: {
+                    AstBinaryOperation* binary = static_cast<AstBinaryOperation*>(expr);
+                    moveOffsets(binary->lvalue, shift);
+                    moveOffsets(binary->rvalue, shift);
+                } break;
+
+                case AstExpression::TERNARY: {
+                    AstTernaryOperation* ternary = static_cast<AstTernaryOperation*>(expr);
+                    moveOffsets(ternary->condition, shift);
+                    moveOffsets(ternary->value, shift);
+                    moveOffsets(ternary->otherwise, shift);
+                } break;
+
+                case AstExpression::COMPARISON:
+                    moveOffsets(static_cast<AstComparisonExpression*>(expr)->values, shift);
+                    break;
+
+                case AstExpression::SUBSCRIPT: {
+                    AstSubscriptExpression* subscript = static_cast<AstSubscriptExpression*>(expr);
+                    moveOffsets(subscript->expression, shift);
+                    moveOffsets(subscript->arguments, shift);
+                } break;
+
+                case AstExpression::CALL: {
+                    AstCallExpression* call = static_cast<AstCallExpression*>(expr);
+                    moveOffsets(call->expression, shift);
+                    moveOffsets(call->arguments, shift);
+                } break;
+
+                case AstExpression::SCOPE:
+                    moveOffsets(static_cast<AstScoping*>(expr)->expression, shift);
+                    break;
+
+                case AstExpression::TUPLE:
+                    moveOffsets(static_cast<AstTuple*>(expr)->elements, shift);
+                    break;
+
+                case AstExpression::LIST:
+                    moveOffsets(static_cast<AstList*>(expr)->elements, shift);
+                    break;
+
+                case AstExpression::DICT: {
+                    AstDict* dict = static_cast<AstDict*>(expr);
+                    moveOffsets(dict->keys, shift);
+                    moveOffsets(dict->items, shift);
+                } break;
+
+                case AstExpression::CONSTANT:
+                case AstExpression::NONE:
+                    break;
+            }
+        } break;
+
+        case AstBody::IF: {
+            AstIf* if_ = static_cast<AstIf*>(body);
+            moveOffsets(if_->conditions, shift);
+            for (std::vector<AstBody*>& if_body : if_->bodies) {
+                moveOffsets(if_body, shift);
+            }
+            moveOffsets(if_->else_body, shift);
+        } break;
+
+        case AstBody::WHILE: {
+            AstWhile* while_ = static_cast<AstWhile*>(body);
+            moveOffsets(while_->condition, shift);
+            moveOffsets(while_->body, shift);
+        } break;
+
+        case AstBody::DO_WHILE: {
+            AstDoWhile* do_while = static_cast<AstDoWhile*>(body);
+            moveOffsets(do_while->condition, shift);
+            moveOffsets(do_while->body, shift);
+        } break;
+
+        case AstBody::FOR: {
+            AstFor* for_ = static_cast<AstFor*>(body);
+            moveOffsets(for_->initialize, shift);
+            moveOffsets(for_->condition, shift);
+            moveOffsets(for_->step, shift);
+            moveOffsets(for_->body, shift);
+        } break;
+
+        case AstBody::FOREACH: {
+            AstForEach* foreach = static_cast<AstForEach*>(body);
+            moveOffsets(foreach->target, shift);
+            moveOffsets(foreach->iterator, shift);
+            moveOffsets(foreach->body, shift);
+        } break;
+
+        case AstBody::STATEMENT:
+            moveOffsets(static_cast<AstStatement*>(body)->expression, shift);
+            break;
+
+        case AstBody::NONE:
+            break;
+    }
+}
+
+/* Appends the exceptions from `begin` up to `end` of the previous parse, moved by `shift` bytes.
+ * Their lines and columns are looked up again, as the lines before them could have changed */
+static void appendExceptions(KH_PARSE_CTX, const std::vector<ParseException>& exceptions, size_t begin,
+                             size_t end, ptrdiff_t shift) {
+    for (size_t i = begin; i < end; i++) {
+        context.exceptions.push_back(exceptions[i]);
+
+        ParseException& exc = context.exceptions.back();
+        exc.index += shift;
+        exc.line = 0;
+        exc.column = 0;
+    }
+}
+
+/* Finds the span which started at the token `ti`, they're sorted by where they start */
+static std::vector<ParseSpan>::const_iterator findSpan(const std::vector<ParseSpan>& spans, size_t ti) {
+    auto found = std::lower_bound(spans.begin(), spans.end(), ti,
+                                  [](const ParseSpan& span, size_t ti) { return span.begin < ti; });
+    return found != spans.end() && found->begin == ti ? found : spans.end();
+}
+
+/* Replaces `removed` spans from `begin` on with the `inserted` ones, and moves the spans after them
+ * by `token_shift` tokens and `exception_shift` exceptions. `offset_shift` bytes are added to what
+ * their offsets are still to be moved by */
+static void spliceSpans(std::vector<ParseSpan>& spans, size_t begin, size_t removed,
+                        std::vector<ParseSpan>& inserted, ptrdiff_t token_shift,
+                        ptrdiff_t exception_shift, ptrdiff_t offset_shift) {
+    if (removed == inserted.size()) {
+        std::copy(inserted.begin(), inserted.end(), spans.begin() + begin);
+    }
+    else {
+        spans.erase(spans.begin() + begin, spans.begin() + begin + removed);
+        spans.insert(spans.begin() + begin, inserted.begin(), inserted.end());
+    }
+
+    for (size_t i = begin + inserted.size(); i < spans.size(); i++) {
+        ParseSpan& span = spans[i];
+        span.begin += token_shift;
+        if (span.end != (size_t)-1) {
+            span.end += token_shift;
+        }
+        span.exceptions_begin += exception_shift;
+        span.exceptions_end += exception_shift;
+        span.shift += offset_shift;
+    }
+}
+
+/* Replaces `removed` declarations of a module from `begin` on with the `inserted` ones. The offsets of
+ * the declarations after them are left to `settleOffsets` */
+template <typename T>
+static void spliceDeclarations(std::vector<T>& declarations, size_t begin, size_t removed,
+                               std::vector<T>& inserted) {
+    if (removed == inserted.size()) {
+        std::move(inserted.begin(), inserted.end(), declarations.begin() + begin);
+    }
+    else {
+        declarations.erase(declarations.begin() + begin, declarations.begin() + begin + removed);
+        declarations.insert(declarations.begin() + begin, std::make_move_iterator(inserted.begin()),
+                            std::make_move_iterator(inserted.end()));
+    }
+}
+
+bool kh::reuseStatement(KH_PARSE_CTX, std::vector<AstBody*>& body) {
+    const ParseSpans& previous = *context.previous_spans;
+    const TokenEdit& edit = context.previous_edit;
+
+    /* A statement before the edit is the same if it also stopped before it, one after the edit
+     * always is, but moved along with its tokens */
+    bool is_moved = context.ti >= edit.index + edit.inserted;
+    if (!is_moved && context.ti >= edit.index) {
+        return false;
+    }
+
+    ptrdiff_t token_shift = is_moved ? (ptrdiff_t)edit.inserted - (ptrdiff_t)edit.removed : 0;
+    ptrdiff_t shift = is_moved ? edit.shift : 0;
+
+    auto found = findSpan(previous.statements, context.ti - token_shift);
+    if (found == previous.statements.end() || found->end == (size_t)-1 ||
+        (!is_moved && found->end >= edit.index)) {
+        return false;
+    }
+
+    /* Its offsets are also still to be moved by as much as the declaration it was in */
+    auto declaration = std::upper_bound(
+        previous.declarations.begin(), previous.declarations.end(), found->begin,
+        [](size_t ti, const ParseSpan& span) { return ti < span.begin; });
+    ptrdiff_t offset_shift =
+        shift + (declaration != previous.declarations.begin() ? std::prev(declaration)->shift : 0);
+
+    /* Its span is kept for the next reparse, moved along with its tokens and exceptions */
+    if (context.spans) {
+        context.spans->statements.push_back(*found);
+
+        ParseSpan& taken = context.spans->statements.back();
+        taken.begin += token_shift;
+        taken.end += token_shift;
+        taken.exceptions_begin = context.exceptions.size();
+        taken.exceptions_end =
+            context.exceptions.size() + (found->exceptions_end - found->exceptions_begin);
+    }
+
+    appendExceptions(context, previous.exceptions, found->exceptions_begin, found->exceptions_end,
+                     shift);
+
+    if (found->kind == ParseSpan::Kind::STATEMENT) {
+        if (offset_shift) {
+            moveOffsets(found->statement, offset_shift);
+        }
+        body.push_back(found->statement);
+    }
+
+    context.ti = found->end + token_shift;
+    return true;
+}
+
+AstModule kh::reparse(KH_PARSE_CTX, AstModule old, const TokenEdit& edit) {
+    if (!old.spans) {
+        bool is_incremental = context.incremental;
+        context.incremental = true;
+        AstModule ast = parseWhole(context);
+        context.incremental = is_incremental;
+        return ast;
+    }
+
+    ParseSpans& spans = *old.spans;
+    std::vector<ParseSpan>& declarations = spans.declarations;
+    ptrdiff_t token_shift = (ptrdiff_t)edit.inserted - (ptrdiff_t)edit.removed;
+
+    /* The declarations which stopped before the edit are kept as they are, parsing starts again
+     * right after them */
+    size_t kept = std::partition_point(declarations.begin(), declarations.end(),
+                                       [&](const ParseSpan& span) { return span.end < edit.index; }) -
+                  declarations.begin();
+    size_t restart = kept ? declarations[kept - 1].end : 0;
+
+    context.exceptions.clear();
+    context.resolved_exceptions = 0;
+    appendExceptions(context, spans.exceptions, 0,
+                     kept < declarations.size() ? declarations[kept].exceptions_begin
+                                                : spans.exceptions.size(),
+                     0);
+
+    ParseSpans reparsed;
+    AstModule parsed({}, {}, {}, {}, {});
+    context.arena = &old.arena;
+    context.spans = &reparsed;
+    context.previous_spans = &spans;
+    context.previous_edit = edit;
+    context.ti = restart;
+
+    /* Parses a declaration at a time, until one starts after the edit where one of the previous ones
+     * started. The tokens from there on are the same, so the declarations would come out the same */
+    size_t synced = declarations.size();
+    while (!context.eof()) {
+        if (context.ti >= edit.index + edit.inserted) {
+            auto found = findSpan(declarations, context.ti - token_shift);
+            if (found != declarations.end()) {
+                synced = found - declarations.begin();
+                break;
+            }
+        }
+        parseTopScope(context, parsed, context.ti + 1);
+    }
+
+    context.arena = nullptr;
+    context.spans = nullptr;
+    context.previous_spans = nullptr;
+
+    /* Counts the declarations of each kind which are kept and which were parsed again */
+    size_t kept_counts[7] = {};
+    size_t replaced_counts[7] = {};
+    for (size_t i = 0; i < synced; i++) {
+        (i < kept ? kept_counts : replaced_counts)[(size_t)declarations[i].kind]++;
+    }
+
+    spliceDeclarations(old.imports, kept_counts[(size_t)ParseSpan::Kind::IMPORT],
+                       replaced_counts[(size_t)ParseSpan::Kind::IMPORT], parsed.imports);
+    spliceDeclarations(old.functions, kept_counts[(size_t)ParseSpan::Kind::FUNCTION],
+                       replaced_counts[(size_t)ParseSpan::Kind::FUNCTION], parsed.functions);
+    spliceDeclarations(old.user_types, kept_counts[(size_t)ParseSpan::Kind::USER_TYPE],
+                       replaced_counts[(size_t)ParseSpan::Kind::USER_TYPE], parsed.user_types);
+    spliceDeclarations(old.enums, kept_counts[(size_t)ParseSpan::Kind::ENUM],
+                       replaced_counts[(size_t)ParseSpan::Kind::ENUM], parsed.enums);
+    spliceDeclarations(old.variables, kept_counts[(size_t)ParseSpan::Kind::VARIABLE],
+                       replaced_counts[(size_t)ParseSpan::Kind::VARIABLE], parsed.variables);
+
+    /* The exceptions of the declarations after the ones parsed again follow theirs */
+    ptrdiff_t exception_shift = 0;
+    if (synced < declarations.size()) {
+        exception_shift =
+            (ptrdiff_t)context.exceptions.size() - (ptrdiff_t)declarations[synced].exceptions_begin;
+        appendExceptions(context, spans.exceptions, declarations[synced].exceptions_begin,
+                         spans.exceptions.size(), edit.shift);
+    }
+
+    /* The statements which were parsed again, or taken over, are the ones in between */
+    auto first_statement = std::lower_bound(
+        spans.statements.begin(), spans.statements.end(), restart,
+        [](const ParseSpan& span, size_t ti) { return span.begin < ti; });
+    auto last_statement =
+        synced < declarations.size()
+            ? std::lower_bound(first_statement, spans.statements.end(), declarations[synced].begin,
+                               [](const ParseSpan& span, size_t ti) { return span.begin < ti; })
+            : spans.statements.end();
+
+    spliceSpans(spans.statements, first_statement - spans.statements.begin(),
+                last_statement - first_statement, reparsed.statements, token_shift, exception_shift, 0);
+    spliceSpans(declarations, kept, synced - kept, reparsed.declarations, token_shift,
+                exception_shift, edit.shift);
+
+    spans.exceptions = context.exceptions;
+    context.finishExceptions();
+    return old;
+}
+
+void kh::settleOffsets(AstModule& module_ast) {
+    if (!module_ast.spans) {
+        return;
+    }
+
+    /* The declarations of each kind are in the order of their spans */
+    size_t counts[7] = {};
+    for (ParseSpan& span : module_ast.spans->declarations) {
+        size_t index = counts[(size_t)span.kind]++;
+        if (!span.shift) {
+            continue;
+        }
+
+        switch (span.kind) {
+            case ParseSpan::Kind::IMPORT:
+                moveOffsets(module_ast.imports[index], span.shift);
+                break;
+            case ParseSpan::Kind::FUNCTION:
+                moveOffsets(module_ast.functions[index], span.shift);
+                break;
+            case ParseSpan::Kind::USER_TYPE:
+                moveOffsets(module_ast.user_types[index], span.shift);
+                break;
+            case ParseSpan::Kind::ENUM:
+                moveOffsets(module_ast.enums[index], span.shift);
+                break;
+            case ParseSpan::Kind::VARIABLE:
+                moveOffsets(module_ast.variables[index], span.shift);
+                break;
+            case ParseSpan::Kind::NONE:
+            case ParseSpan::Kind::STATEMENT:
+                break;
+        }
+        span.shift = 0;
+    }
+}
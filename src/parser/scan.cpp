@@ -0,0 +1,257 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#include <cstdint>
+
+#include <kithare/lexer.hpp>
+#include <kithare/scan.hpp>
+
+#ifdef KH_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef KH_SCAN_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* GCC and Clang only allow AVX2 intrinsics in functions that are marked for it, so the rest of the
+ * program can still run on CPUs without AVX2 */
+#if defined(__GNUC__)
+#define KH_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define KH_TARGET_AVX2
+#endif
+
+
+using namespace kh;
+
+static size_t scalarSpaces(const char* str, size_t index, size_t size) {
+    while (index < size && (char_classes[(uint8_t)str[index]] & CHAR_SPACE)) {
+        index++;
+    }
+    return index;
+}
+
+static size_t scalarIdentifier(const char* str, size_t index, size_t size) {
+    while (index < size && (char_classes[(uint8_t)str[index]] & (CHAR_ALPHA | CHAR_DEC))) {
+        index++;
+    }
+    return index;
+}
+
+static size_t scalarLine(const char* str, size_t index, size_t size) {
+    while (index < size && str[index] != '\n') {
+        index++;
+    }
+    return index;
+}
+
+static size_t scalarComment(const char* str, size_t index, size_t size) {
+    while (index < size && str[index] != '*') {
+        index++;
+    }
+    return index;
+}
+
+static size_t scalarString(const char* str, size_t index, size_t size) {
+    while (index < size && str[index] != '"' && str[index] != '\\' && str[index] != '\n' &&
+           (uint8_t)str[index] < 128) {
+        index++;
+    }
+    return index;
+}
+
+static const SkipRoutines scalar_routines = {scalarSpaces, scalarIdentifier, scalarLine, scalarComment,
+                                             scalarString};
+
+#if defined(KH_SCAN_SSE2) || defined(KH_SCAN_AVX2)
+static inline uint32_t countTrailingZeros(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+#ifdef KH_SCAN_SSE2
+/* Defines an SSE2 skip routine, `stop` is an expression of `chunk` which sets every byte lane it
+ * should stop at. The tail which doesn't fill a whole vector is left for the scalar routine */
+#define KH_SSE2_SKIP(name, scalar, stop)                                    \
+    static size_t name(const char* str, size_t index, size_t size) {        \
+        for (; index + 16 <= size; index += 16) {                           \
+            __m128i chunk = _mm_loadu_si128((const __m128i*)(str + index)); \
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(stop);              \
+            if (mask) {                                                     \
+                return index + countTrailingZeros(mask);                    \
+            }                                                               \
+        }                                                                   \
+        return scalar(str, index, size);                                    \
+    }
+
+/* Sets the lanes of ASCII bytes between `low` and `high`, bytes above 127 are negative as signed so
+ * they're never in range */
+static inline __m128i sse2InRange(__m128i chunk, char low, char high) {
+    return _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8(low - 1)),
+                         _mm_cmplt_epi8(chunk, _mm_set1_epi8(high + 1)));
+}
+
+static inline __m128i sse2Equals(__m128i chunk, char chr) {
+    return _mm_cmpeq_epi8(chunk, _mm_set1_epi8(chr));
+}
+
+static inline __m128i sse2Not(__m128i chunk) {
+    return _mm_xor_si128(chunk, _mm_set1_epi8(-1));
+}
+
+static inline __m128i sse2IsSpace(__m128i chunk) {
+    return _mm_or_si128(sse2InRange(chunk, '\t', '\r'), sse2Equals(chunk, ' '));
+}
+
+static inline __m128i sse2IsIdentifier(__m128i chunk) {
+    /* Setting the 0x20 bit maps uppercase letters to lowercase ones */
+    __m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+    return _mm_or_si128(_mm_or_si128(sse2InRange(lower, 'a', 'z'), sse2InRange(chunk, '0', '9')),
+                        sse2Equals(chunk, '_'));
+}
+
+static inline __m128i sse2IsStringStop(__m128i chunk) {
+    return _mm_or_si128(_mm_or_si128(sse2Equals(chunk, '"'), sse2Equals(chunk, '\\')),
+                        _mm_or_si128(sse2Equals(chunk, '\n'), chunk));
+}
+
+KH_SSE2_SKIP(sse2Spaces, scalarSpaces, sse2Not(sse2IsSpace(chunk)))
+KH_SSE2_SKIP(sse2Identifier, scalarIdentifier, sse2Not(sse2IsIdentifier(chunk)))
+KH_SSE2_SKIP(sse2Line, scalarLine, sse2Equals(chunk, '\n'))
+KH_SSE2_SKIP(sse2Comment, scalarComment, sse2Equals(chunk, '*'))
+KH_SSE2_SKIP(sse2String, scalarString, sse2IsStringStop(chunk))
+
+static const SkipRoutines sse2_routines = {sse2Spaces, sse2Identifier, sse2Line, sse2Comment,
+                                           sse2String};
+#endif
+
+#ifdef KH_SCAN_AVX2
+/* Same as `KH_SSE2_SKIP`, but 32 bytes at a time */
+#define KH_AVX2_SKIP(name, scalar, stop)                                            \
+    KH_TARGET_AVX2 static size_t name(const char* str, size_t index, size_t size) { \
+        for (; index + 32 <= size; index += 32) {                                   \
+            __m256i chunk = _mm256_loadu_si256((const __m256i*)(str + index));      \
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(stop);                   \
+            if (mask) {                                                             \
+                return index + countTrailingZeros(mask);                            \
+            }                                                                       \
+        }                                                                           \
+        return scalar(str, index, size);                                            \
+    }
+
+KH_TARGET_AVX2 static inline __m256i avx2InRange(__m256i chunk, char low, char high) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(chunk, _mm256_set1_epi8(low - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), chunk));
+}
+
+KH_TARGET_AVX2 static inline __m256i avx2Equals(__m256i chunk, char chr) {
+    return _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(chr));
+}
+
+KH_TARGET_AVX2 static inline __m256i avx2Not(__m256i chunk) {
+    return _mm256_xor_si256(chunk, _mm256_set1_epi8(-1));
+}
+
+KH_TARGET_AVX2 static inline __m256i avx2IsSpace(__m256i chunk) {
+    return _mm256_or_si256(avx2InRange(chunk, '\t', '\r'), avx2Equals(chunk, ' '));
+}
+
+KH_TARGET_AVX2 static inline __m256i avx2IsIdentifier(__m256i chunk) {
+    __m256i lower = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(
+        _mm256_or_si256(avx2InRange(lower, 'a', 'z'), avx2InRange(chunk, '0', '9')),
+        avx2Equals(chunk, '_'));
+}
+
+KH_TARGET_AVX2 static inline __m256i avx2IsStringStop(__m256i chunk) {
+    return _mm256_or_si256(_mm256_or_si256(avx2Equals(chunk, '"'), avx2Equals(chunk, '\\')),
+                           _mm256_or_si256(avx2Equals(chunk, '\n'), chunk));
+}
+
+KH_AVX2_SKIP(avx2Spaces, scalarSpaces, avx2Not(avx2IsSpace(chunk)))
+KH_AVX2_SKIP(avx2Identifier, scalarIdentifier, avx2Not(avx2IsIdentifier(chunk)))
+KH_AVX2_SKIP(avx2Line, scalarLine, avx2Equals(chunk, '\n'))
+KH_AVX2_SKIP(avx2Comment, scalarComment, avx2Equals(chunk, '*'))
+KH_AVX2_SKIP(avx2String, scalarString, avx2IsStringStop(chunk))
+
+static const SkipRoutines avx2_routines = {avx2Spaces, avx2Identifier, avx2Line, avx2Comment,
+                                           avx2String};
+
+static bool cpuHasAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+
+    /* The OS also has to be saving the YMM registers on context switches */
+    __cpuid(info, 1);
+    bool has_osxsave = (info[2] & (1 << 27)) != 0;
+    if (!has_osxsave || (_xgetbv(0) & 0b110) != 0b110) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static const SkipRoutines* routinesOf(SimdLevel level) {
+    switch (level) {
+#ifdef KH_SCAN_AVX2
+        case SimdLevel::AVX2:
+            return &avx2_routines;
+#endif
+#ifdef KH_SCAN_SSE2
+        case SimdLevel::SSE2:
+            return &sse2_routines;
+#endif
+        default:
+            return &scalar_routines;
+    }
+}
+
+static SimdLevel simd_level = detectSimdLevel();
+const SkipRoutines* kh::skip_routines = routinesOf(simd_level);
+
+SimdLevel kh::detectSimdLevel() {
+#ifdef KH_SCAN_AVX2
+    if (cpuHasAvx2()) {
+        return SimdLevel::AVX2;
+    }
+#endif
+#ifdef KH_SCAN_SSE2
+    return SimdLevel::SSE2;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+SimdLevel kh::getSimdLevel() {
+    return simd_level;
+}
+
+void kh::setSimdLevel(SimdLevel level) {
+    SimdLevel supported = detectSimdLevel();
+    simd_level = (int)level > (int)supported ? supported : level;
+    skip_routines = routinesOf(simd_level);
+}
@@ -0,0 +1,112 @@
+/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+#include <algorithm>
+
+#include <kithare/lexer.hpp>
+
+
+using namespace kh;
+
+kh::StreamLexer::StreamLexer(std::FILE* _file, std::vector<LexException>& _exceptions,
+                             size_t _lookahead, size_t _chunk_size)
+    : exceptions(_exceptions), file(_file), lookahead(_lookahead), chunk_size(_chunk_size) {
+    this->tokens.source = &this->buffer;
+}
+
+bool kh::StreamLexer::pull(size_t ti) {
+    while (ti >= this->tokens.base + this->tokens.size()) {
+        if (this->is_done) {
+            return false;
+        }
+
+        LexerContext context{this->buffer, this->exceptions};
+        context.ci = this->resume - this->offset;
+        context.base = this->offset;
+        context.is_final = this->is_eof;
+        context.max_errors = this->max_errors;
+
+        bool needs_input =
+            lexPart(context, this->tokens, ti - this->tokens.base + 1 + this->lookahead);
+        this->resume = this->offset + context.ci;
+
+        if (needs_input) {
+            this->read();
+        }
+        else if (context.ci > this->buffer.size()) {
+            this->is_done = true;
+        }
+    }
+
+    return true;
+}
+
+void kh::StreamLexer::release(size_t ti) {
+    if (this->tokens.empty()) {
+        return;
+    }
+
+    /* The last token is always kept, so there's one to report an unexpected end of file at */
+    size_t count = std::min(ti - this->tokens.base, this->tokens.size() - 1);
+
+    /* Dropping tokens moves the rest of the window, so it's only done once there's at least as much
+     * to drop as there is to move */
+    if (count < this->lookahead || count < this->tokens.size() - count) {
+        return;
+    }
+
+    this->tokens.dropFront(count);
+    this->trim();
+}
+
+void kh::StreamLexer::read() {
+    this->trim();
+
+    /* A token which is longer than a chunk gets read in growing chunks, so it isn't lexed over from
+     * its start again for every chunk */
+    size_t size = this->buffer.size();
+    size_t count = std::max(this->chunk_size, size);
+
+    this->buffer.resize(size + count);
+    count = std::fread(&this->buffer[size], 1, count, this->file);
+    this->buffer.resize(size + count);
+
+    if (count == 0) {
+        this->is_eof = true;
+    }
+
+    /* The rest of a source which is too big is cut off, as its offsets wouldn't fit */
+    bool is_too_big = this->offset + this->buffer.size() > KH_SOURCE_MAX_SIZE;
+    if (is_too_big) {
+        this->buffer.resize(KH_SOURCE_MAX_SIZE - this->offset);
+        this->is_eof = true;
+    }
+    this->tokens.line_map.extend(this->buffer, size, this->offset);
+
+    if (is_too_big) {
+        this->exceptions.emplace_back("the source is too big, it can't be any bigger than " +
+                                          std::to_string(KH_SOURCE_MAX_SIZE) + " bytes",
+                                      KH_SOURCE_MAX_SIZE);
+        LexException& exc = this->exceptions.back();
+        this->tokens.line_map.getLineColumn(this->buffer, exc.index, exc.column, exc.line,
+                                            this->offset);
+    }
+}
+
+void kh::StreamLexer::trim() {
+    /* Keeps the source from the first token still in the window, so its column can be counted */
+    size_t keep = this->resume;
+    if (!this->tokens.empty()) {
+        keep = std::min(keep, (size_t)this->tokens.indexes[0]);
+    }
+
+    if (keep > this->offset) {
+        this->tokens.line_map.trim(this->buffer, keep, this->offset);
+        this->buffer.erase(0, keep - this->offset);
+        this->offset = keep;
+        this->tokens.source_offset = keep;
+    }
+}
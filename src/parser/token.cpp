@@ -4,6 +4,10 @@
  * Copyright (C) 2021 Kithare Organization
  */
 
+#include <algorithm>
+
+#include <kithare/lexer.hpp>
+#include <kithare/scan.hpp>
 #include <kithare/string.hpp>
 #include <kithare/token.hpp>
 #include <kithare/utf8.hpp>
@@ -11,10 +15,335 @@
 
 using namespace kh;
 
-Token::Token() : column(0), line(0), index(0), length(0), type(), value() {}
+LineMap::LineMap() : line_starts{0} {}
+
+LineMap::LineMap(const std::string& source) : line_starts{0} {
+    this->extend(source, 0);
+}
+
+size_t LineMap::line(size_t index) const {
+    /* The amount of lines which start at or before the index */
+    return this->first_line - 1 +
+           (std::upper_bound(this->line_starts.begin(), this->line_starts.end(), index) -
+            this->line_starts.begin());
+}
+
+size_t LineMap::column(const std::string& source, size_t index, size_t offset) const {
+    size_t line_index = this->line(index) - this->first_line;
+    size_t column = line_index == 0 ? this->first_column - 1 : 0;
+    return column + this->countColumns(source, this->line_starts[line_index], index + 1, offset);
+}
+
+size_t LineMap::countColumns(const std::string& source, size_t from, size_t to,
+                             size_t offset) const {
+    size_t columns = 0;
+    for (size_t i = from; i < to; i++) {
+        /* Continuation bytes of an UTF-8 character don't count as a column, positions past the end
+         * of the source do */
+        if (i - offset >= source.size() || (source[i - offset] & 0b11000000) != 0b10000000) {
+            columns++;
+        }
+    }
+    return columns;
+}
+
+void LineMap::getLineColumn(const std::string& source, size_t index, size_t& column, size_t& line,
+                            size_t offset) const {
+    line = this->line(index);
+    column = this->column(source, index, offset);
+}
+
+void LineMap::extend(const std::string& source, size_t from, size_t offset) {
+    const char* str = source.data();
+    for (size_t i = skipLine(str, from, source.size()); i < source.size();
+         i = skipLine(str, i + 1, source.size())) {
+        this->line_starts.push_back(offset + i + 1);
+    }
+}
+
+void LineMap::trim(const std::string& source, size_t index, size_t offset) {
+    size_t column = this->column(source, index, offset);
+    size_t line_index = this->line(index) - this->first_line;
+
+    /* The line of `index` becomes the first one, starting right at `index` with its column */
+    this->line_starts.erase(this->line_starts.begin(), this->line_starts.begin() + line_index);
+    this->line_starts[0] = index;
+    this->first_line += line_index;
+    this->first_column = column;
+}
+
+Token::Token()
+    : stream(nullptr), ti(0), type(TokenType::IDENTIFIER), index(0), length(0), value(0) {}
+
+Token::Token(const TokenStream& _stream, size_t _ti)
+    : stream(&_stream), ti(_ti), type(_stream.types[_ti]), index(_stream.indexes[_ti]),
+      length(_stream.lengths[_ti]), value(_stream.values[_ti]) {}
+
+Token TokenStream::operator[](size_t ti) const {
+    return Token(*this, ti);
+}
+
+Token TokenStream::back() const {
+    return Token(*this, this->size() - 1);
+}
+
+void TokenStream::reserve(size_t count) {
+    this->types.reserve(count);
+    this->indexes.reserve(count);
+    this->lengths.reserve(count);
+    this->values.reserve(count);
+}
+
+void TokenStream::push(size_t index, size_t end, TokenType type, uint32_t value) {
+    this->types.push_back(type);
+    this->indexes.push_back(index);
+    this->lengths.push_back(end - index);
+    this->values.push_back(value);
+}
+
+void TokenStream::pushInteger(size_t index, size_t end, TokenType type, uint64_t integer) {
+    this->push(index, end, type, this->integers.size());
+    this->integers.push_back(integer);
+}
+
+void TokenStream::pushFloating(size_t index, size_t end, TokenType type, double floating) {
+    this->push(index, end, type, this->floatings.size());
+    this->floatings.push_back(floating);
+}
+
+/* Decodes the escape right after a backslash at `str`, which the lexer has already made sure is a
+ * valid one, into `value`. Returns how many bytes it takes after the backslash. Escaped newlines
+ * have no value, so they're left to the caller */
+static size_t decodeEscape(const char* str, uint32_t& value) {
+    size_t digits = 0;
+    switch (str[0]) {
+        case 'x':
+        case 'X':
+            digits = 2;
+            break;
+        case 'u':
+            digits = 4;
+            break;
+        case 'U':
+            digits = 8;
+            break;
+
+        case '0':
+            value = '\0';
+            return 1;
+        case 'n':
+            value = '\n';
+            return 1;
+        case 'r':
+            value = '\r';
+            return 1;
+        case 't':
+            value = '\t';
+            return 1;
+        case 'v':
+            value = '\v';
+            return 1;
+        case 'b':
+            value = '\b';
+            return 1;
+        case 'a':
+            value = '\a';
+            return 1;
+        case 'f':
+            value = '\f';
+            return 1;
+
+        /* `\\`, `\"` and `\'` */
+        default:
+            value = (uint8_t)str[0];
+            return 1;
+    }
+
+    value = 0;
+    for (size_t i = 1; i <= digits; i++) {
+        value = (value << 4) | hexValue((uint8_t)str[i]);
+    }
+    return digits + 1;
+}
+
+void Token::appendString(std::u32string& str) const {
+    const std::string& source = *this->stream->source;
+    size_t i = this->contentIndex() - this->stream->source_offset;
+    size_t end = i + this->contentLength();
+
+    while (i < end) {
+        /* Copies the whole run of plain ASCII characters at once */
+        size_t run = i;
+        while (run < end && (uint8_t)source[run] < 128 && source[run] != '\\') {
+            run++;
+        }
+        str.append(source.begin() + i, source.begin() + run);
+        i = run;
+
+        if (i == end) {
+            break;
+        }
+        else if (source[i] == '\\') {
+            /* An escaped newline just continues the string on the next line */
+            uint32_t value;
+            if (source[i + 1] == '\n') {
+                i += 2;
+            }
+            else {
+                i += decodeEscape(&source[i + 1], value) + 1;
+                str += value;
+            }
+        }
+        else {
+            size_t length;
+            str += decodeUtf8Char(source, i, length);
+            i += length;
+        }
+    }
+}
+
+void Token::appendBuffer(std::string& buffer) const {
+    const std::string& source = *this->stream->source;
+    size_t i = this->contentIndex() - this->stream->source_offset;
+    size_t end = i + this->contentLength();
+
+    /* Nothing to decode, so it's the bytes of the source as they are */
+    if (!this->hasEscapes()) {
+        buffer.append(source, i, end - i);
+        return;
+    }
+
+    while (i < end) {
+        if (source[i] == '\\') {
+            /* An escaped newline just continues the buffer on the next line */
+            uint32_t value;
+            if (source[i + 1] == '\n') {
+                i += 2;
+            }
+            else {
+                i += decodeEscape(&source[i + 1], value) + 1;
+                buffer += (char)value;
+            }
+        }
+        else {
+            /* Non-ASCII characters are at most a byte in size, the lexer makes sure of that */
+            size_t length;
+            buffer += (char)decodeUtf8Char(source, i, length);
+            i += length;
+        }
+    }
+}
+
+/* Amounts of literal payloads a range of tokens has in every side table. Payloads are pushed in the
+ * same order as their tokens, so a range of tokens owns a range of every side table */
+struct PayloadCounts {
+    size_t integers = 0;
+    size_t floatings = 0;
+
+    size_t* of(TokenType type) {
+        switch (type) {
+            case TokenType::UINTEGER:
+            case TokenType::INTEGER:
+                return &this->integers;
+            case TokenType::FLOATING:
+            case TokenType::IMAGINARY:
+                return &this->floatings;
+            default:
+                return nullptr;
+        }
+    }
+
+    PayloadCounts() {}
+
+    PayloadCounts(const TokenStream& tokens, size_t begin, size_t end) {
+        for (size_t ti = begin; ti < end; ti++) {
+            size_t* count = this->of(tokens.types[ti]);
+            if (count) {
+                (*count)++;
+            }
+        }
+    }
+};
+
+/* Replaces the items [begin, end) of a vector with the ones of `with`, only moving the rest once */
+template <typename T>
+static void replaceRange(std::vector<T>& vector, size_t begin, size_t end, std::vector<T>& with) {
+    size_t overlap = std::min(end - begin, with.size());
+    std::move(with.begin(), with.begin() + overlap, vector.begin() + begin);
 
-Token::Token(size_t _index, size_t _end, TokenType _type, const TokenValue& _value)
-    : column(0), line(0), index(_index), length(_end - index), type(_type), value(_value) {}
+    if (overlap < end - begin) {
+        vector.erase(vector.begin() + begin + overlap, vector.begin() + end);
+    }
+    else {
+        vector.insert(vector.begin() + end, std::make_move_iterator(with.begin() + overlap),
+                      std::make_move_iterator(with.end()));
+    }
+}
+
+void TokenStream::dropFront(size_t count) {
+    /* The dropped tokens own a prefix of every side table, the rest of the tokens just have their
+     * payload indexes shifted down */
+    PayloadCounts dropped(*this, 0, count);
+
+    this->types.erase(this->types.begin(), this->types.begin() + count);
+    this->indexes.erase(this->indexes.begin(), this->indexes.begin() + count);
+    this->lengths.erase(this->lengths.begin(), this->lengths.begin() + count);
+    this->values.erase(this->values.begin(), this->values.begin() + count);
+
+    this->integers.erase(this->integers.begin(), this->integers.begin() + dropped.integers);
+    this->floatings.erase(this->floatings.begin(), this->floatings.begin() + dropped.floatings);
+
+    for (size_t ti = 0; ti < this->size(); ti++) {
+        size_t* payload_count = dropped.of(this->types[ti]);
+        if (payload_count) {
+            this->values[ti] -= *payload_count;
+        }
+    }
+
+    this->base += count;
+}
+
+void TokenStream::splice(size_t begin, size_t end, TokenStream& other, ptrdiff_t shift) {
+    PayloadCounts removed(*this, begin, end);
+    PayloadCounts inserted(other, 0, other.size());
+
+    /* Where the payloads of the replaced tokens start in every side table, which is where the first
+     * payload of each table from `begin` on is */
+    PayloadCounts offsets;
+    offsets.integers = this->integers.size();
+    offsets.floatings = this->floatings.size();
+    for (size_t ti = this->size(); ti > begin; ti--) {
+        size_t* offset = offsets.of(this->types[ti - 1]);
+        if (offset) {
+            *offset = this->values[ti - 1];
+        }
+    }
+
+    for (size_t ti = end; ti < this->size(); ti++) {
+        this->indexes[ti] += shift;
+
+        TokenType type = this->types[ti];
+        if (removed.of(type)) {
+            this->values[ti] = this->values[ti] - *removed.of(type) + *inserted.of(type);
+        }
+    }
+    for (size_t ti = 0; ti < other.size(); ti++) {
+        size_t* offset = offsets.of(other.types[ti]);
+        if (offset) {
+            other.values[ti] += *offset;
+        }
+    }
+
+    replaceRange(this->types, begin, end, other.types);
+    replaceRange(this->indexes, begin, end, other.indexes);
+    replaceRange(this->lengths, begin, end, other.lengths);
+    replaceRange(this->values, begin, end, other.values);
+
+    replaceRange(this->integers, offsets.integers, offsets.integers + removed.integers,
+                 other.integers);
+    replaceRange(this->floatings, offsets.floatings, offsets.floatings + removed.floatings,
+                 other.floatings);
+}
 
 std::u32string kh::strfy(const Token& token, bool show_token_type) {
     std::u32string str;
@@ -24,36 +353,36 @@ std::u32string kh::strfy(const Token& token, bool show_token_type) {
 
     switch (token.type) {
         case TokenType::IDENTIFIER:
-            str += decodeUtf8(token.value.identifier);
+            str += decodeUtf8(token.identifier());
             break;
         case TokenType::OPERATOR:
-            str += strfy(token.value.operator_type);
+            str += strfy(token.operatorType());
             break;
         case TokenType::SYMBOL:
-            str += strfy(token.value.symbol_type);
+            str += strfy(token.symbolType());
             break;
 
         case TokenType::CHARACTER:
-            str += strfy(token.value.character);
+            str += strfy(token.character());
             break;
         case TokenType::STRING:
-            str += quote(token.value.string);
+            str += quote(token.string());
             break;
         case TokenType::BUFFER:
-            str += quote(token.value.buffer);
+            str += quote(token.buffer());
             break;
 
         case TokenType::UINTEGER:
-            str += strfy(token.value.uinteger);
+            str += strfy(token.uinteger());
             break;
         case TokenType::INTEGER:
-            str += strfy(token.value.integer);
+            str += strfy(token.integer());
             break;
         case TokenType::FLOATING:
-            str += strfy(token.value.floating);
+            str += strfy(token.floating());
             break;
         case TokenType::IMAGINARY:
-            str += strfy(token.value.imaginary) + U"i";
+            str += strfy(token.imaginary()) + U"i";
             break;
 
         default:
@@ -4,7 +4,10 @@
  * Copyright (C) 2021 Kithare Organization
  */
 
+#include <cstdio>
+
 #include <kithare/lexer.hpp>
+#include <kithare/scan.hpp>
 #include <kithare/test.hpp>
 
 
@@ -14,14 +17,14 @@ static std::vector<std::string>* errors_ptr;
 
 static void lexerTypeTest() {
     std::vector<LexException> lex_exceptions;
-    LexerContext lexer_context{U"import std;                            \n"
-                               U"def main() {                           \n"
-                               U"    // Inline comments                 \n"
-                               U"    float number = 6.9;                \n"
-                               U"    std.print(\"Hello, world!\");      \n"
-                               U"}                                      \n",
+    LexerContext lexer_context{"import std;                            \n"
+                               "def main() {                           \n"
+                               "    // Inline comments                 \n"
+                               "    float number = 6.9;                \n"
+                               "    std.print(\"Hello, world!\");      \n"
+                               "}                                      \n",
                                lex_exceptions};
-    std::vector<Token> tokens = lex(lexer_context);
+    TokenStream tokens = lex(lexer_context);
 
     KH_TEST_ASSERT(lex_exceptions.empty());
     KH_TEST_ASSERT(tokens.size() == 21);
@@ -53,116 +56,699 @@ error:
 
 static void lexerNumeralTest() {
     std::vector<LexException> lex_exceptions;
-    LexerContext lexer_context{U"0 1 2 8 9  " /* Single digit decimal integers */
-                               U"00 10 29U  " /* Multi-digit + Unsigned */
-                               U"0.1 0.2    " /* Floating point */
-                               U"11.1 .123  " /* Several other cases */
-                               U"0xFFF 0x1  " /* Hexadecimal */
-                               U"0o77 0o11  " /* Octal */
-                               U"0b111 0b01 " /* Binary */
-                               U"4i 2i 5.6i " /* Imaginary */,
+    LexerContext lexer_context{"0 1 2 8 9  " /* Single digit decimal integers */
+                               "00 10 29U  " /* Multi-digit + Unsigned */
+                               "0.1 0.2    " /* Floating point */
+                               "11.1 .123  " /* Several other cases */
+                               "0xFFF 0x1  " /* Hexadecimal */
+                               "0o77 0o11  " /* Octal */
+                               "0b111 0b01 " /* Binary */
+                               "4i 2i 5.6i " /* Imaginary */,
                                lex_exceptions};
-    std::vector<Token> tokens = lex(lexer_context);
+    TokenStream tokens = lex(lexer_context);
 
     KH_TEST_ASSERT(lex_exceptions.empty());
     KH_TEST_ASSERT(tokens.size() == 21);
     KH_TEST_ASSERT(tokens[0].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[0].value.integer == 0);
+    KH_TEST_ASSERT(tokens[0].integer() == 0);
     KH_TEST_ASSERT(tokens[1].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[1].value.integer == 1);
+    KH_TEST_ASSERT(tokens[1].integer() == 1);
     KH_TEST_ASSERT(tokens[2].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[2].value.integer == 2);
+    KH_TEST_ASSERT(tokens[2].integer() == 2);
     KH_TEST_ASSERT(tokens[3].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[3].value.integer == 8);
+    KH_TEST_ASSERT(tokens[3].integer() == 8);
     KH_TEST_ASSERT(tokens[4].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[4].value.integer == 9);
+    KH_TEST_ASSERT(tokens[4].integer() == 9);
     KH_TEST_ASSERT(tokens[5].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[5].value.integer == 0);
+    KH_TEST_ASSERT(tokens[5].integer() == 0);
     KH_TEST_ASSERT(tokens[6].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[6].value.integer == 10);
+    KH_TEST_ASSERT(tokens[6].integer() == 10);
     KH_TEST_ASSERT(tokens[7].type == TokenType::UINTEGER);
-    KH_TEST_ASSERT(tokens[7].value.uinteger == 29);
+    KH_TEST_ASSERT(tokens[7].uinteger() == 29);
     KH_TEST_ASSERT(tokens[8].type == TokenType::FLOATING);
-    KH_TEST_ASSERT(tokens[8].value.floating == 0.1);
+    KH_TEST_ASSERT(tokens[8].floating() == 0.1);
     KH_TEST_ASSERT(tokens[9].type == TokenType::FLOATING);
-    KH_TEST_ASSERT(tokens[9].value.floating == 0.2);
+    KH_TEST_ASSERT(tokens[9].floating() == 0.2);
     KH_TEST_ASSERT(tokens[10].type == TokenType::FLOATING);
-    KH_TEST_ASSERT(tokens[10].value.floating == 11.1);
+    KH_TEST_ASSERT(tokens[10].floating() == 11.1);
     KH_TEST_ASSERT(tokens[11].type == TokenType::FLOATING);
-    KH_TEST_ASSERT(tokens[11].value.floating == 0.123);
+    KH_TEST_ASSERT(tokens[11].floating() == 0.123);
     KH_TEST_ASSERT(tokens[12].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[12].value.integer == 4095);
+    KH_TEST_ASSERT(tokens[12].integer() == 4095);
     KH_TEST_ASSERT(tokens[13].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[13].value.integer == 1);
+    KH_TEST_ASSERT(tokens[13].integer() == 1);
     KH_TEST_ASSERT(tokens[14].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[14].value.integer == 63);
+    KH_TEST_ASSERT(tokens[14].integer() == 63);
     KH_TEST_ASSERT(tokens[15].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[15].value.integer == 9);
+    KH_TEST_ASSERT(tokens[15].integer() == 9);
     KH_TEST_ASSERT(tokens[16].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[16].value.integer == 7);
+    KH_TEST_ASSERT(tokens[16].integer() == 7);
     KH_TEST_ASSERT(tokens[17].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[17].value.integer == 1);
+    KH_TEST_ASSERT(tokens[17].integer() == 1);
     KH_TEST_ASSERT(tokens[18].type == TokenType::IMAGINARY);
-    KH_TEST_ASSERT(tokens[18].value.imaginary == 4.0);
+    KH_TEST_ASSERT(tokens[18].imaginary() == 4.0);
     KH_TEST_ASSERT(tokens[19].type == TokenType::IMAGINARY);
-    KH_TEST_ASSERT(tokens[19].value.imaginary == 2.0);
+    KH_TEST_ASSERT(tokens[19].imaginary() == 2.0);
     KH_TEST_ASSERT(tokens[20].type == TokenType::IMAGINARY);
-    KH_TEST_ASSERT(tokens[20].value.imaginary == 5.6);
+    KH_TEST_ASSERT(tokens[20].imaginary() == 5.6);
     return;
 error:
     errors_ptr->back() += "lexerNumeralTest";
 }
 
+static void lexerNumeralLimitTest() {
+    std::vector<LexException> lex_exceptions;
+    LexerContext lexer_context{"9223372036854775807 9223372036854775808 "   /* Signed 64-bit limit */
+                               "18446744073709551615u 18446744073709551616u " /* Unsigned limit */
+                               "0xFFFFFFFFFFFFFFFFu 0x10000000000000000u "    /* Hexadecimal limit */
+                               "0.30000000000000004 123456789012345678901.5 " /* Exact rounding */
+                               "0.000000000000000000000000001 9007199254740993.0 "
+                               "0x7FFFFFFFFFFFFFFF 0x8000000000000000 " /* Signed limit of each base */
+                               "0o777777777777777777777 0o1000000000000000000000 "
+                               "0b111111111111111111111111111111111111111111111111111111111111111 "
+                               "0b1000000000000000000000000000000000000000000000000000000000000000 ",
+                               lex_exceptions};
+    TokenStream tokens = lex(lexer_context);
+
+    KH_TEST_ASSERT(lex_exceptions.size() == 6);
+    KH_TEST_ASSERT(lex_exceptions[0].what == "integer too large to be interpret");
+    KH_TEST_ASSERT(lex_exceptions[0].index == 38);
+    KH_TEST_ASSERT(lex_exceptions[1].what == "unsigned integer too large to be interpret");
+    KH_TEST_ASSERT(lex_exceptions[2].what == "unsigned hex integer too large to be interpret");
+    KH_TEST_ASSERT(lex_exceptions[3].what == "hex integer too large to be interpret");
+    KH_TEST_ASSERT(lex_exceptions[4].what == "octal integer too large to be interpret");
+    KH_TEST_ASSERT(lex_exceptions[5].what == "binary integer too large to be interpret");
+
+    KH_TEST_ASSERT(tokens.size() == 10);
+    KH_TEST_ASSERT(tokens[0].integer() == INT64_MAX);
+    KH_TEST_ASSERT(tokens[1].uinteger() == UINT64_MAX);
+    KH_TEST_ASSERT(tokens[2].uinteger() == UINT64_MAX);
+    KH_TEST_ASSERT(tokens[3].floating() == 0.30000000000000004);
+    KH_TEST_ASSERT(tokens[4].floating() == 123456789012345678901.5);
+    KH_TEST_ASSERT(tokens[5].floating() == 0.000000000000000000000000001);
+    KH_TEST_ASSERT(tokens[6].floating() == 9007199254740993.0);
+    for (size_t i = 7; i < 10; i++) {
+        KH_TEST_ASSERT(tokens[i].type == TokenType::INTEGER);
+        KH_TEST_ASSERT(tokens[i].integer() == INT64_MAX);
+    }
+    return;
+error:
+    errors_ptr->back() += "lexerNumeralLimitTest";
+}
+
 static void lexerStringTest() {
     std::vector<LexException> lex_exceptions;
     LexerContext lexer_context{
-        U"\"AB\\x42\\x88\\u1234\\u9876\\v\\U00001234\\U00010000\\\"\\n\"" /* Escape tests */
-        U"b'' '' b\"aFd\\x87\\x90\\xff\" 'K' b'\\b' b'\\x34''\\U0001AF21' '\\r' "
-        U"\"Hello, world!\" "  /* String */
-        U"b\"Hello, world!\" " /* Buffer / byte-string */
-        U"\"\"\"Hello,\n"
-        U"world!\"\"\" " /* Multiline string */
-        U"b\"\"\"Hello,\n"
-        U"world!\"\"\" " /* Multiline buffer */,
+        "\"AB\\x42\\x88\\u1234\\u9876\\v\\U00001234\\U00010000\\\"\\n\"" /* Escape tests */
+        "b'' '' b\"aFd\\x87\\x90\\xff\" 'K' b'\\b' b'\\x34''\\U0001AF21' '\\r' "
+        "\"Hello, world!\" "  /* String */
+        "b\"Hello, world!\" " /* Buffer / byte-string */
+        "\"\"\"Hello,\n"
+        "world!\"\"\" " /* Multiline string */
+        "b\"\"\"Hello,\n"
+        "world!\"\"\" " /* Multiline buffer */,
         lex_exceptions};
-    std::vector<Token> tokens = lex(lexer_context);
+    TokenStream tokens = lex(lexer_context);
 
     KH_TEST_ASSERT(lex_exceptions.empty());
     KH_TEST_ASSERT(tokens.size() == 13);
     KH_TEST_ASSERT(tokens[0].type == TokenType::STRING);
-    KH_TEST_ASSERT(tokens[0].value.string == U"AB\x42\x88\u1234\u9876\v\U00001234\U00010000\"\n");
+    KH_TEST_ASSERT(tokens[0].string() == U"AB\x42\x88\u1234\u9876\v\U00001234\U00010000\"\n");
     KH_TEST_ASSERT(tokens[1].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[1].value.integer == '\0');
+    KH_TEST_ASSERT(tokens[1].integer() == '\0');
     KH_TEST_ASSERT(tokens[2].type == TokenType::CHARACTER);
-    KH_TEST_ASSERT(tokens[2].value.character == U'\0');
+    KH_TEST_ASSERT(tokens[2].character() == U'\0');
     KH_TEST_ASSERT(tokens[3].type == TokenType::BUFFER);
-    KH_TEST_ASSERT(tokens[3].value.buffer == "aFd\x87\x90\xff");
+    KH_TEST_ASSERT(tokens[3].buffer() == "aFd\x87\x90\xff");
     KH_TEST_ASSERT(tokens[4].type == TokenType::CHARACTER);
-    KH_TEST_ASSERT(tokens[4].value.character == U'K');
+    KH_TEST_ASSERT(tokens[4].character() == U'K');
     KH_TEST_ASSERT(tokens[5].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[5].value.integer == '\b');
+    KH_TEST_ASSERT(tokens[5].integer() == '\b');
     KH_TEST_ASSERT(tokens[6].type == TokenType::INTEGER);
-    KH_TEST_ASSERT(tokens[6].value.integer == '\x34');
+    KH_TEST_ASSERT(tokens[6].integer() == '\x34');
     KH_TEST_ASSERT(tokens[7].type == TokenType::CHARACTER);
-    KH_TEST_ASSERT(tokens[7].value.character == U'\U0001AF21');
+    KH_TEST_ASSERT(tokens[7].character() == U'\U0001AF21');
     KH_TEST_ASSERT(tokens[8].type == TokenType::CHARACTER);
-    KH_TEST_ASSERT(tokens[8].value.character == U'\r');
+    KH_TEST_ASSERT(tokens[8].character() == U'\r');
     KH_TEST_ASSERT(tokens[9].type == TokenType::STRING);
-    KH_TEST_ASSERT(tokens[9].value.string == U"Hello, world!");
+    KH_TEST_ASSERT(tokens[9].string() == U"Hello, world!");
     KH_TEST_ASSERT(tokens[10].type == TokenType::BUFFER);
-    KH_TEST_ASSERT(tokens[10].value.buffer == "Hello, world!");
+    KH_TEST_ASSERT(tokens[10].buffer() == "Hello, world!");
     KH_TEST_ASSERT(tokens[11].type == TokenType::STRING);
-    KH_TEST_ASSERT(tokens[11].value.string == U"Hello,\nworld!");
+    KH_TEST_ASSERT(tokens[11].string() == U"Hello,\nworld!");
     KH_TEST_ASSERT(tokens[12].type == TokenType::BUFFER);
-    KH_TEST_ASSERT(tokens[12].value.buffer == "Hello,\nworld!");
+    KH_TEST_ASSERT(tokens[12].buffer() == "Hello,\nworld!");
     return;
 error:
     errors_ptr->back() += "lexerStringTest";
 }
 
+static void lexerXidTest() {
+    /* Letters of any script can start an identifier, combining marks and the middle dot can only
+     * continue one. No-break spaces are whitespace */
+    std::string source = u8"caf\u00e9 = \u03a9mega\u00b7x\u00a0+ e\u0301\u0661 \U00020000";
+    LexResult result = lex(source);
+
+    KH_TEST_ASSERT(result.ok());
+    KH_TEST_ASSERT(result.tokens.size() == 6);
+    KH_TEST_ASSERT(result.tokens[0].identifier() == u8"caf\u00e9");
+    KH_TEST_ASSERT(result.tokens[2].identifier() == u8"\u03a9mega\u00b7x");
+    KH_TEST_ASSERT(result.tokens[3].type == TokenType::OPERATOR);
+    KH_TEST_ASSERT(result.tokens[4].identifier() == u8"e\u0301\u0661");
+    KH_TEST_ASSERT(result.tokens[5].identifier() == u8"\U00020000");
+
+    {
+        const std::string broken_sources[] = {u8"\u00b7x", u8"\u0301", u8"x\U0001F600"};
+        for (const std::string& broken_source : broken_sources) {
+            KH_TEST_ASSERT(!lex(broken_source).ok());
+        }
+    }
+
+    KH_TEST_ASSERT(isIdentifierStart(U'\u0436'));
+    KH_TEST_ASSERT(!isIdentifierStart(U'\u0661'));
+    KH_TEST_ASSERT(isIdentifierContinue(U'\u0661'));
+    KH_TEST_ASSERT(!isIdentifierContinue(U'\u2028'));
+    KH_TEST_ASSERT(!isIdentifierContinue(0x110000));
+    return;
+error:
+    errors_ptr->back() += "lexerXidTest";
+}
+
+static void lexerLiteralSpanTest() {
+    std::vector<LexException> lex_exceptions;
+    LexerContext lexer_context{"\"plain\" \"esc\\tape\" \"\"\"multi\nline\"\"\" \"con\\\ntinued\" "
+                               "b\"raw\" b\"\\xff\" b\"\"\"blob\"\"\"",
+                               lex_exceptions};
+    TokenStream tokens = lex(lexer_context);
+
+    KH_TEST_ASSERT(lex_exceptions.empty());
+    KH_TEST_ASSERT(tokens.size() == 7);
+
+    /* Contents without escapes are left as they are in the source */
+    KH_TEST_ASSERT(!tokens[0].hasEscapes());
+    KH_TEST_ASSERT(tokens[0].contentIndex() == 1);
+    KH_TEST_ASSERT(tokens[0].contentLength() == 5);
+    KH_TEST_ASSERT(tokens[0].string() == U"plain");
+    KH_TEST_ASSERT(tokens[1].hasEscapes());
+    KH_TEST_ASSERT(tokens[1].string() == U"esc\tape");
+    KH_TEST_ASSERT(!tokens[2].hasEscapes());
+    KH_TEST_ASSERT(tokens[2].contentLength() == 10);
+    KH_TEST_ASSERT(tokens[2].string() == U"multi\nline");
+    KH_TEST_ASSERT(tokens[3].string() == U"continued");
+
+    KH_TEST_ASSERT(!tokens[4].hasEscapes());
+    KH_TEST_ASSERT(tokens[4].contentIndex() == tokens[4].index + 2);
+    KH_TEST_ASSERT(tokens[4].buffer() == "raw");
+    KH_TEST_ASSERT(tokens[5].hasEscapes());
+    KH_TEST_ASSERT(tokens[5].buffer() == "\xff");
+    KH_TEST_ASSERT(!tokens[6].hasEscapes());
+    KH_TEST_ASSERT(tokens[6].buffer() == "blob");
+
+    /* Concatenated literals are decoded onto the same string */
+    {
+        std::u32string str;
+        tokens[0].appendString(str);
+        tokens[1].appendString(str);
+        KH_TEST_ASSERT(str == U"plainesc\tape");
+    }
+    return;
+error:
+    errors_ptr->back() += "lexerLiteralSpanTest";
+}
+
+static void lexerUtf8Test() {
+    std::vector<LexException> lex_exceptions;
+    LexerContext lexer_context{u8"pi = \"\u00e9t\u00e9 \U0001F600\"; '\u0436' b'\u00ff'",
+                               lex_exceptions};
+    TokenStream tokens = lex(lexer_context);
+
+    KH_TEST_ASSERT(lex_exceptions.empty());
+    KH_TEST_ASSERT(tokens.size() == 6);
+    KH_TEST_ASSERT(tokens[2].type == TokenType::STRING);
+    KH_TEST_ASSERT(tokens[2].string() == U"\u00e9t\u00e9 \U0001F600");
+    KH_TEST_ASSERT(tokens[2].index == 5);
+    KH_TEST_ASSERT(tokens[2].length == 12);
+    KH_TEST_ASSERT(tokens[3].index == 17);
+    KH_TEST_ASSERT(tokens[3].column() == 13);
+    KH_TEST_ASSERT(tokens[4].type == TokenType::CHARACTER);
+    KH_TEST_ASSERT(tokens[4].character() == U'\u0436');
+    KH_TEST_ASSERT(tokens[4].length == 4);
+    KH_TEST_ASSERT(tokens[5].type == TokenType::INTEGER);
+    KH_TEST_ASSERT(tokens[5].integer() == 0xff);
+    return;
+error:
+    errors_ptr->back() += "lexerUtf8Test";
+}
+
+static void lexerErrorTest() {
+    /* Every error drops the broken token and lexing goes on right after it */
+    std::string source = "a = 0b2 + 1;\nb = '\\q';\nc = \"\\xZ1\" d\n\xff e @ f\n\"open";
+    LexResult result = lex(source);
+    const char* expected[] = {"expected a binary digit at",     "unknown escape character",
+                              "unrecognized character",         "expected a closing single quote",
+                              "expected a hexadecimal digit",   "unclosed string before new line",
+                              "invalid start byte",             "unclosed string before new line"};
+    const size_t expected_lines[] = {1, 2, 2, 2, 3, 3, 4, 5};
+
+    KH_TEST_ASSERT(!result.ok());
+    KH_TEST_ASSERT(result.exceptions.size() == 8);
+    for (size_t i = 0; i < result.exceptions.size(); i++) {
+        KH_TEST_ASSERT(result.exceptions[i].what == expected[i]);
+        KH_TEST_ASSERT(result.exceptions[i].line == expected_lines[i]);
+    }
+
+    KH_TEST_ASSERT(result.tokens.size() == 16);
+    KH_TEST_ASSERT(result.tokens[2].identifier() == "b2");
+    KH_TEST_ASSERT(result.tokens[13].identifier() == "e");
+    KH_TEST_ASSERT(result.tokens[15].identifier() == "f");
+    KH_TEST_ASSERT(result.tokens[15].column() == 7);
+
+    {
+        std::string valid_source = "x = 1;";
+        KH_TEST_ASSERT(lex(valid_source).ok());
+
+        /* Offsets past 32 bits aren't lexed */
+        std::vector<LexException> exceptions;
+        LexerContext context{valid_source, exceptions};
+        context.base = KH_SOURCE_MAX_SIZE - 2;
+        KH_TEST_ASSERT(lex(context).empty());
+        KH_TEST_ASSERT(exceptions.size() == 1);
+        KH_TEST_ASSERT(exceptions[0].what.find("too big") != std::string::npos);
+    }
+
+    /* Past the limit, errors are left out for a note, but lexing goes on the same in parallel */
+    {
+        std::string many_source;
+        for (size_t i = 0; i < 1000; i++) {
+            many_source += "$ ";
+        }
+        many_source += "\nx";
+
+        for (size_t thread_count = 0; thread_count < 3; thread_count++) {
+            std::vector<LexException> exceptions;
+            LexerContext context{many_source, exceptions};
+            context.max_errors = 10;
+            TokenStream tokens =
+                thread_count ? lexParallel(context, thread_count, 64) : lex(context);
+
+            KH_TEST_ASSERT(exceptions.size() == 11);
+            KH_TEST_ASSERT(exceptions[9].what == "unrecognized character");
+            KH_TEST_ASSERT(exceptions[9].column == 19);
+            KH_TEST_ASSERT(exceptions[10].what == "too many errors, stopped reporting them");
+            KH_TEST_ASSERT(exceptions[10].column == 21);
+            KH_TEST_ASSERT(tokens.size() == 1);
+            KH_TEST_ASSERT(tokens[0].identifier() == "x");
+        }
+    }
+    return;
+error:
+    errors_ptr->back() += "lexerErrorTest";
+}
+
+static void lexerTokenStreamTest() {
+    std::vector<LexException> lex_exceptions;
+    LexerContext lexer_context{"x = y + 1.5 * (z - 2);", lex_exceptions};
+    TokenStream tokens = lex(lexer_context);
+
+    KH_TEST_ASSERT(lex_exceptions.empty());
+    KH_TEST_ASSERT(tokens.size() == 12);
+
+    /* Only the identifiers and numeric literals take up a slot in the side tables */
+    KH_TEST_ASSERT(tokens.identifiers.size() == KEYWORD_COUNT + 3);
+    KH_TEST_ASSERT(tokens.floatings.size() == 1);
+    KH_TEST_ASSERT(tokens.integers.size() == 1);
+
+    KH_TEST_ASSERT(tokens[2].identifier() == "y");
+    KH_TEST_ASSERT(tokens[4].floating() == 1.5);
+    KH_TEST_ASSERT(tokens[6].symbolType() == Symbol::PARENTHESES_OPEN);
+    KH_TEST_ASSERT(tokens[9].uinteger() == 2);
+    KH_TEST_ASSERT(tokens.back().symbolType() == Symbol::SEMICOLON);
+    KH_TEST_ASSERT(tokens.back().index == 21);
+    return;
+error:
+    errors_ptr->back() += "lexerTokenStreamTest";
+}
+
+static void lexerInternTest() {
+    std::vector<LexException> lex_exceptions;
+    LexerContext lexer_context{"def x() { return x or y and x; } ifx", lex_exceptions};
+    TokenStream tokens = lex(lexer_context);
+
+    KH_TEST_ASSERT(lex_exceptions.empty());
+    KH_TEST_ASSERT(tokens.size() == 14);
+
+    /* Keywords have fixed ids */
+    KH_TEST_ASSERT(tokens[0].type == TokenType::IDENTIFIER);
+    KH_TEST_ASSERT(tokens[0].keyword() == Keyword::DEF);
+    KH_TEST_ASSERT(tokens[5].keyword() == Keyword::RETURN);
+    KH_TEST_ASSERT(isReservedKeyword(tokens[5]));
+
+    /* `and` and `or` are still lexed as operators */
+    KH_TEST_ASSERT(tokens[7].type == TokenType::OPERATOR);
+    KH_TEST_ASSERT(tokens[7].operatorType() == Operator::OR);
+    KH_TEST_ASSERT(tokens[9].operatorType() == Operator::AND);
+
+    /* The same identifier always gets the same id */
+    KH_TEST_ASSERT(tokens[1].value == tokens[6].value && tokens[6].value == tokens[10].value);
+    KH_TEST_ASSERT(tokens[1].value != tokens[8].value);
+    KH_TEST_ASSERT(tokens[1].identifier() == "x");
+    KH_TEST_ASSERT(!isReservedKeyword(tokens[1]));
+    KH_TEST_ASSERT(tokens[13].identifier() == "ifx");
+    KH_TEST_ASSERT(tokens.identifiers.size() == KEYWORD_COUNT + 3);
+    return;
+error:
+    errors_ptr->back() += "lexerInternTest";
+}
+
+static void lexerLineMapTest() {
+    std::vector<LexException> lex_exceptions;
+    LexerContext lexer_context{u8"a\n"
+                               u8"  bb $\n"
+                               u8"\n"
+                               u8"\"\u00e9\" c $ \"unclosed\n"
+                               u8"d",
+                               lex_exceptions};
+    TokenStream tokens = lex(lexer_context);
+
+    KH_TEST_ASSERT(tokens.line_map.line_starts.size() == 5);
+    KH_TEST_ASSERT(tokens.size() == 5);
+    KH_TEST_ASSERT(tokens[0].line() == 1 && tokens[0].column() == 1);
+    KH_TEST_ASSERT(tokens[1].line() == 2 && tokens[1].column() == 3);
+    KH_TEST_ASSERT(tokens[2].line() == 4 && tokens[2].column() == 1);
+    KH_TEST_ASSERT(tokens[4].line() == 5 && tokens[4].column() == 1);
+
+    /* Columns count characters, so the 2 bytes `\u00e9` only counts once */
+    KH_TEST_ASSERT(tokens[3].line() == 4 && tokens[3].column() == 5);
+    KH_TEST_ASSERT(lex_exceptions.size() == 3);
+    KH_TEST_ASSERT(lex_exceptions[0].line == 2 && lex_exceptions[0].column == 6);
+    KH_TEST_ASSERT(lex_exceptions[1].line == 4 && lex_exceptions[1].column == 7);
+    KH_TEST_ASSERT(lex_exceptions[2].line == 4 && lex_exceptions[2].column == 18);
+    return;
+error:
+    errors_ptr->back() += "lexerLineMapTest";
+}
+
+static bool sameTokens(const TokenStream& a, const TokenStream& b) {
+    if (a.types != b.types || a.indexes != b.indexes || a.lengths != b.lengths ||
+        a.values != b.values) {
+        return false;
+    }
+
+    for (size_t ti = 0; ti < a.size(); ti++) {
+        if (strfy(a[ti], true) != strfy(b[ti], true)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void lexerSimdTest() {
+    SimdLevel original_level = getSimdLevel();
+    const SimdLevel levels[] = {SimdLevel::SSE2, SimdLevel::AVX2};
+
+    /* Every routine has to stop at the same byte as the scalar one, for every byte value at every
+     * position around the 16 and 32 bytes vector boundaries */
+    {
+        const char* fillers[] = {"                                    "
+                                 "                                    ",
+                                 "abcdefghijklmnopqrstuvwxyzABCDEFGHIJ"
+                                 "KLMNOPQRSTUVWXYZ_0123456789abcdefghij",
+                                 "plain string body without any stoppi"
+                                 "ng characters in it at all, for 72"};
+        for (const char* filler : fillers) {
+            std::string str = filler;
+
+            for (size_t position = 0; position < str.size(); position++) {
+                for (int byte = 0; byte < 256; byte++) {
+                    std::string probe = str;
+                    probe[position] = (char)byte;
+
+                    for (size_t start = 0; start < 3; start++) {
+                        size_t results[3][5];
+                        for (size_t level = 0; level < 3; level++) {
+                            setSimdLevel(level == 0 ? SimdLevel::SCALAR : levels[level - 1]);
+                            results[level][0] = skipSpaces(probe.data(), start, probe.size());
+                            results[level][1] = skipIdentifier(probe.data(), start, probe.size());
+                            results[level][2] = skipLine(probe.data(), start, probe.size());
+                            results[level][3] = skipComment(probe.data(), start, probe.size());
+                            results[level][4] = skipString(probe.data(), start, probe.size());
+                        }
+
+                        for (size_t routine = 0; routine < 5; routine++) {
+                            KH_TEST_ASSERT(results[0][routine] == results[1][routine]);
+                            KH_TEST_ASSERT(results[0][routine] == results[2][routine]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /* Lexing with any of the levels has to give the exact same tokens and errors */
+    {
+        const char* pieces[] = {"identifier ",
+                                "a_much_longer_identifier_which_spans_over_one_vector_width_123 ",
+                                "                                        ",
+                                "\t\n\r\n\v\f",
+                                "// an inline comment which goes on for quite a while ** / \n",
+                                "/* a * multiple * line\n comment which **is** long enough */",
+                                "\"a string with \\t escapes \\x41 and \u00e9 characters in it\" ",
+                                "b\"a buffer which has to be copied over in bulk\\n\" ",
+                                "\"\"\"multiline\n strings \"quoted\" inside\"\"\" ",
+                                "0x1F 12.5 3i 0b101u ",
+                                "x += y * (z - 1); ",
+                                "\"unclosed string\n",
+                                "$ "};
+        const size_t piece_count = sizeof(pieces) / sizeof(pieces[0]);
+
+        /* A simple deterministic LCG picks the pieces, so the sources are different every round but
+         * the same every run */
+        uint32_t seed = 12345;
+        for (size_t round = 0; round < 100; round++) {
+            std::string source;
+            for (size_t piece = 0; piece < 20; piece++) {
+                seed = seed * 1103515245 + 12345;
+                source += pieces[(seed >> 16) % piece_count];
+            }
+
+            setSimdLevel(SimdLevel::SCALAR);
+            std::vector<LexException> scalar_exceptions;
+            LexerContext scalar_context{source, scalar_exceptions};
+            TokenStream scalar_tokens = lex(scalar_context);
+
+            for (SimdLevel level : levels) {
+                setSimdLevel(level);
+                std::vector<LexException> lex_exceptions;
+                LexerContext lexer_context{source, lex_exceptions};
+                TokenStream tokens = lex(lexer_context);
+
+                KH_TEST_ASSERT(sameTokens(scalar_tokens, tokens));
+                KH_TEST_ASSERT(scalar_exceptions.size() == lex_exceptions.size());
+                for (size_t i = 0; i < lex_exceptions.size(); i++) {
+                    KH_TEST_ASSERT(scalar_exceptions[i].index == lex_exceptions[i].index);
+                    KH_TEST_ASSERT(scalar_exceptions[i].what == lex_exceptions[i].what);
+                }
+            }
+        }
+    }
+
+    setSimdLevel(original_level);
+    return;
+error:
+    setSimdLevel(original_level);
+    errors_ptr->back() += "lexerSimdTest";
+}
+
+static void lexerStreamTest() {
+    std::string source = "import std; // A comment\n"
+                         "def main() -> int {\n"
+                         "    float number = 6.9 + 0xFF + 3i + 0b101u;\n"
+                         u8"    std.print(\"h\\u00E9llo \u00E9\u20AC\U0001F600 \\\"world\\\"\");\n"
+                         u8"    x = \"\"\"multiple\n line\"\"\" + b\"buf\\x01\" + b'a' + '\u00E9';\n"
+                         "    /* A multiple\n line comment **/ y = z $ w;\n"
+                         "    s = \"unclosed\n"
+                         "}\n"
+                         "/* Unclosed comment";
+
+    std::vector<LexException> lex_exceptions;
+    LexerContext lexer_context{source, lex_exceptions};
+    TokenStream tokens = lex(lexer_context);
+    KH_TEST_ASSERT(lex_exceptions.size() == 3);
+
+    /* Every chunk size splits the source somewhere else, inside of multi-byte characters, strings
+     * and comments */
+    for (size_t chunk_size = 1; chunk_size < 40; chunk_size++) {
+        for (size_t lookahead : {1, 16}) {
+            std::FILE* file = std::tmpfile();
+            KH_TEST_ASSERT(file);
+            std::fwrite(source.data(), 1, source.size(), file);
+            std::rewind(file);
+
+            std::vector<LexException> stream_exceptions;
+            StreamLexer stream(file, stream_exceptions, lookahead, chunk_size);
+
+            size_t ti = 0;
+            bool is_same = true;
+            for (; stream.pull(ti); ti++) {
+                Token token = stream.tokens[ti - stream.tokens.base];
+                is_same = is_same && ti < tokens.size() && token.type == tokens[ti].type &&
+                          token.index == tokens[ti].index && token.length == tokens[ti].length &&
+                          strfy(token, true) == strfy(tokens[ti], true) &&
+                          token.line() == tokens[ti].line() && token.column() == tokens[ti].column();
+
+                /* Only a bounded window is held */
+                stream.release(ti);
+                is_same = is_same && stream.tokens.size() <= 2 * lookahead + 2;
+            }
+            std::fclose(file);
+
+            KH_TEST_ASSERT(is_same);
+            KH_TEST_ASSERT(ti == tokens.size());
+            KH_TEST_ASSERT(stream_exceptions.size() == lex_exceptions.size());
+            for (size_t i = 0; i < lex_exceptions.size(); i++) {
+                KH_TEST_ASSERT(stream_exceptions[i].what == lex_exceptions[i].what);
+                KH_TEST_ASSERT(stream_exceptions[i].index == lex_exceptions[i].index);
+                KH_TEST_ASSERT(stream_exceptions[i].line == lex_exceptions[i].line);
+                KH_TEST_ASSERT(stream_exceptions[i].column == lex_exceptions[i].column);
+            }
+        }
+    }
+    return;
+error:
+    errors_ptr->back() += "lexerStreamTest";
+}
+
+static void lexerRelexTest() {
+    const char* pieces[] = {"identifier ", "x += y * (z - 1); ", "\t\n  ", "// inline comment\n",
+                            "/* multiple\n line comment */", "\"a \\t string\" ", "b\"buf\" ",
+                            "\"\"\"multiline\n string\"\"\" ", "0x1F 12.5 3i 0b101u ", "'c' b'\\n' ",
+                            "\"unclosed string\n", "$ "};
+    const char* insertions[] = {"", "x", " ", "\n", "/*", "*/", "\"\"\"", "\"", "+", "=", "12",
+                                ".", "b'", "//", "\\", "'"};
+    const size_t piece_count = sizeof(pieces) / sizeof(pieces[0]);
+    const size_t insertion_count = sizeof(insertions) / sizeof(insertions[0]);
+
+    /* Edits are applied one after another on the same tokens, which have to always match lexing
+     * the whole edited source again */
+    uint32_t seed = 54321;
+    auto random = [&](size_t range) -> size_t {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % range;
+    };
+
+    for (size_t round = 0; round < 20; round++) {
+        std::string source;
+        for (size_t piece = 0; piece < 30; piece++) {
+            source += pieces[random(piece_count)];
+        }
+
+        std::vector<LexException> exceptions;
+        LexerContext lexer_context{source, exceptions};
+        TokenStream tokens = lex(lexer_context);
+
+        for (size_t edit_count = 0; edit_count < 50; edit_count++) {
+            SourceEdit edit;
+            edit.index = random(source.size() + 1);
+            edit.removed = std::min(random(6), source.size() - edit.index);
+            edit.inserted = insertions[random(insertion_count)];
+            relex(source, tokens, exceptions, edit);
+
+            std::vector<LexException> expected_exceptions;
+            LexerContext expected_context{source, expected_exceptions};
+            TokenStream expected = lex(expected_context);
+
+            KH_TEST_ASSERT(tokens.types == expected.types);
+            KH_TEST_ASSERT(tokens.indexes == expected.indexes);
+            KH_TEST_ASSERT(tokens.lengths == expected.lengths);
+            KH_TEST_ASSERT(tokens.line_map.line_starts == expected.line_map.line_starts);
+            for (size_t ti = 0; ti < tokens.size(); ti++) {
+                KH_TEST_ASSERT(strfy(tokens[ti], true) == strfy(expected[ti], true));
+                KH_TEST_ASSERT(tokens[ti].column() == expected[ti].column());
+            }
+
+            KH_TEST_ASSERT(exceptions.size() == expected_exceptions.size());
+            for (size_t i = 0; i < exceptions.size(); i++) {
+                KH_TEST_ASSERT(exceptions[i].what == expected_exceptions[i].what);
+                KH_TEST_ASSERT(exceptions[i].index == expected_exceptions[i].index);
+                KH_TEST_ASSERT(exceptions[i].line == expected_exceptions[i].line);
+                KH_TEST_ASSERT(exceptions[i].column == expected_exceptions[i].column);
+            }
+        }
+    }
+    return;
+error:
+    errors_ptr->back() += "lexerRelexTest";
+}
+
+static void lexerParallelTest() {
+    /* Lines inside of the multiple line strings and comments look like code, so lexing a chunk from
+     * them as if it's in between tokens goes wrong and has to be thrown away */
+    const char* pieces[] = {"identifier\n", "x += y * (z - 1);\n", "\t\n  ", "// inline comment\n",
+                            "/* multiple\nline = \"comment\n*/", "\"a \\t string\"\n", "b\"buf\"\n",
+                            "\"\"\"multiline\nstring /*\n\"\"\"\n", "b\"\"\"\nx \\\"\"\"\n\"\"\"\n",
+                            "0x1F 12.5 3i 0b101u\n", "'c' b'\\n'\n", "\"unclosed string\n",
+                            "\"continued \\\nstring\"\n", "$\n", "0b12\n"};
+    const size_t piece_count = sizeof(pieces) / sizeof(pieces[0]);
+
+    uint32_t seed = 12345;
+    auto random = [&](size_t range) -> size_t {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % range;
+    };
+
+    for (size_t round = 0; round < 20; round++) {
+        std::string source;
+        for (size_t piece = 0; piece < 200; piece++) {
+            source += pieces[random(piece_count)];
+        }
+
+        std::vector<LexException> expected_exceptions;
+        LexerContext expected_context{source, expected_exceptions};
+        TokenStream expected = lex(expected_context);
+
+        for (size_t thread_count = 1; thread_count <= 4; thread_count++) {
+            std::vector<LexException> exceptions;
+            LexerContext lexer_context{source, exceptions};
+            TokenStream tokens = lexParallel(lexer_context, thread_count, 1 + random(64));
+
+            KH_TEST_ASSERT(tokens.types == expected.types);
+            KH_TEST_ASSERT(tokens.indexes == expected.indexes);
+            KH_TEST_ASSERT(tokens.lengths == expected.lengths);
+            KH_TEST_ASSERT(tokens.values == expected.values);
+            KH_TEST_ASSERT(tokens.line_map.line_starts == expected.line_map.line_starts);
+            for (size_t ti = 0; ti < tokens.size(); ti++) {
+                KH_TEST_ASSERT(strfy(tokens[ti], true) == strfy(expected[ti], true));
+            }
+
+            KH_TEST_ASSERT(exceptions.size() == expected_exceptions.size());
+            for (size_t i = 0; i < exceptions.size(); i++) {
+                KH_TEST_ASSERT(exceptions[i].what == expected_exceptions[i].what);
+                KH_TEST_ASSERT(exceptions[i].index == expected_exceptions[i].index);
+                KH_TEST_ASSERT(exceptions[i].line == expected_exceptions[i].line);
+                KH_TEST_ASSERT(exceptions[i].column == expected_exceptions[i].column);
+            }
+        }
+    }
+    return;
+error:
+    errors_ptr->back() += "lexerParallelTest";
+}
+
 void kh_test::lexerTest(std::vector<std::string>& errors) {
     errors_ptr = &errors;
     lexerTypeTest();
     lexerNumeralTest();
+    lexerNumeralLimitTest();
     lexerStringTest();
+    lexerLiteralSpanTest();
+    lexerUtf8Test();
+    lexerXidTest();
+    lexerErrorTest();
+    lexerTokenStreamTest();
+    lexerInternTest();
+    lexerLineMapTest();
+    lexerSimdTest();
+    lexerStreamTest();
+    lexerRelexTest();
+    lexerParallelTest();
 }
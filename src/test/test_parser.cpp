@@ -4,6 +4,13 @@
  * Copyright (C) 2021 Kithare Organization
  */
 
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+#include <kithare/flat_ast.hpp>
 #include <kithare/lexer.hpp>
 #include <kithare/parser.hpp>
 #include <kithare/test.hpp>
@@ -13,14 +20,74 @@ using namespace kh;
 
 static std::vector<std::string>* errors_ptr;
 
+#ifdef KH_COUNT_ALLOCATIONS
+/* Counts the allocations made while `count_allocations` is set, otherwise these only forward to the
+ * C allocator like the default ones do. They replace the global ones in the whole binary, the CLI
+ * included, so they're only built along with the tests which check the counts, with
+ * `python3 build.py -DKH_COUNT_ALLOCATIONS`. The parser allocates from several threads at once, hence
+ * the atomics */
+static std::atomic<bool> count_allocations{false};
+static std::atomic<size_t> allocation_count{0};
+
+void* operator new(size_t size) {
+    if (count_allocations.load(std::memory_order_relaxed)) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+static void startCounting() {
+    allocation_count = 0;
+    count_allocations = true;
+}
+
+static size_t stopCounting() {
+    count_allocations = false;
+    return allocation_count;
+}
+#else
+/* Nothing is counted, so every count is zero. The tests which are only about the counts are left
+ * out */
+static void startCounting() {}
+
+static size_t stopCounting() {
+    return 0;
+}
+#endif
+
 static void parserImportTest() {
     std::vector<LexException> lex_exceptions;
-    LexerContext lexer_context{U"import stuff;          \n"
-                               U"import stuff as other; \n"
-                               U"import stuff.other;    \n"
-                               U"include this;          \n",
+    LexerContext lexer_context{"import stuff;          \n"
+                               "import stuff as other; \n"
+                               "import stuff.other;    \n"
+                               "include this;          \n",
                                lex_exceptions};
-    std::vector<Token> tokens = lex(lexer_context);
+    TokenStream tokens = lex(lexer_context);
     std::vector<ParseException> parse_exceptions;
     ParserContext parser_context{tokens, parse_exceptions};
     AstModule ast = parseWhole(parser_context);
@@ -40,7 +107,799 @@ error:
     errors_ptr->back() += "parserImportTest";
 }
 
+static AstExpression* parseExpressionSource(const std::string& source, AstArena& arena,
+                                           size_t& exception_count) {
+    LexResult result = lex(source);
+    std::vector<ParseException> parse_exceptions;
+    ParserContext parser_context{result.tokens, parse_exceptions};
+    parser_context.arena = &arena;
+    AstExpression* expr = parseExpression(parser_context);
+    exception_count = result.exceptions.size() + parse_exceptions.size();
+    return expr;
+}
+
+static void parserExpressionTest() {
+    AstArena arena;
+    size_t exception_count;
+
+    /* Assignments take on everything else, comparisons are chained */
+    {
+        auto expr = parseExpressionSource("a = b if c < d <= e else f or g;", arena, exception_count);
+        KH_TEST_ASSERT(exception_count == 0);
+        KH_TEST_ASSERT(expr->expression_type == AstExpression::BINARY);
+
+        auto assign = static_cast<AstBinaryOperation*>(expr);
+        KH_TEST_ASSERT(assign->operation == Operator::ASSIGN);
+        KH_TEST_ASSERT(assign->rvalue->expression_type == AstExpression::TERNARY);
+
+        auto ternary = static_cast<AstTernaryOperation*>(assign->rvalue);
+        KH_TEST_ASSERT(ternary->condition->expression_type == AstExpression::COMPARISON);
+        KH_TEST_ASSERT(ternary->otherwise->expression_type == AstExpression::BINARY);
+
+        auto comparison = static_cast<AstComparisonExpression*>(ternary->condition);
+        KH_TEST_ASSERT(comparison->operations.size() == 2);
+        KH_TEST_ASSERT(comparison->values.size() == 3);
+    }
+
+    /* Left associativity, and `-` taking on the exponentiation */
+    {
+        auto expr = parseExpressionSource("-a ^ b - c - d;", arena, exception_count);
+        KH_TEST_ASSERT(exception_count == 0);
+
+        auto outer = static_cast<AstBinaryOperation*>(expr);
+        KH_TEST_ASSERT(outer->operation == Operator::SUB);
+        KH_TEST_ASSERT(outer->lvalue->expression_type == AstExpression::BINARY);
+
+        auto inner = static_cast<AstBinaryOperation*>(outer->lvalue);
+        KH_TEST_ASSERT(inner->operation == Operator::SUB);
+        KH_TEST_ASSERT(inner->lvalue->expression_type == AstExpression::UNARY);
+
+        auto negation = static_cast<AstUnaryOperation*>(inner->lvalue);
+        KH_TEST_ASSERT(negation->rvalue->expression_type == AstExpression::BINARY);
+        KH_TEST_ASSERT(static_cast<AstBinaryOperation*>(negation->rvalue)->operation ==
+                       Operator::POW);
+    }
+
+    /* `!` takes on the comparison but not the `and`, `&` binds tighter than `|` */
+    {
+        auto expr = parseExpressionSource("!a & b | c == d and e;", arena, exception_count);
+        KH_TEST_ASSERT(exception_count == 0);
+
+        auto conjunction = static_cast<AstBinaryOperation*>(expr);
+        KH_TEST_ASSERT(conjunction->operation == Operator::AND);
+        KH_TEST_ASSERT(conjunction->lvalue->expression_type == AstExpression::UNARY);
+
+        auto negation = static_cast<AstUnaryOperation*>(conjunction->lvalue);
+        KH_TEST_ASSERT(negation->operation == Operator::NOT);
+        KH_TEST_ASSERT(negation->rvalue->expression_type == AstExpression::COMPARISON);
+
+        auto comparison = static_cast<AstComparisonExpression*>(negation->rvalue);
+        auto bit_or = static_cast<AstBinaryOperation*>(comparison->values[0]);
+        KH_TEST_ASSERT(bit_or->operation == Operator::BIT_OR);
+        KH_TEST_ASSERT(static_cast<AstBinaryOperation*>(bit_or->lvalue)->operation ==
+                       Operator::BIT_AND);
+    }
+
+    /* A list of a single element */
+    {
+        auto expr = parseExpressionSource("[1];", arena, exception_count);
+        KH_TEST_ASSERT(exception_count == 0);
+        KH_TEST_ASSERT(expr->expression_type == AstExpression::LIST);
+    }
+
+    /* Array types are told apart from subscripts by what follows them */
+    {
+        auto expr = parseExpressionSource("Foo.Bar[2][] matrix = a;", arena, exception_count);
+        KH_TEST_ASSERT(exception_count == 0);
+        KH_TEST_ASSERT(expr->expression_type == AstExpression::DECLARE);
+
+        auto declaration = static_cast<AstDeclaration*>(expr);
+        KH_TEST_ASSERT(declaration->var_name == "matrix");
+        KH_TEST_ASSERT(declaration->var_type.identifiers == std::vector<std::string>{"list"});
+        KH_TEST_ASSERT(declaration->expression != nullptr);
+
+        expr = parseExpressionSource("values[2][3] = a;", arena, exception_count);
+        KH_TEST_ASSERT(exception_count == 0);
+        KH_TEST_ASSERT(expr->expression_type == AstExpression::BINARY);
+        KH_TEST_ASSERT(static_cast<AstBinaryOperation*>(expr)->lvalue->expression_type ==
+                       AstExpression::SUBSCRIPT);
+
+        /* Only the zero size is reported, nothing from trying it as a subscript first */
+        parseExpressionSource("int[0] zero;", arena, exception_count);
+        KH_TEST_ASSERT(exception_count == 1);
+    }
+
+    /* Prefix operators can't be on the right side of an exponentiation */
+    parseExpressionSource("a ^ -b;", arena, exception_count);
+    KH_TEST_ASSERT(exception_count != 0);
+    return;
+error:
+    errors_ptr->back() += "parserExpressionTest";
+}
+
+static void parserEmbedTest() {
+    /* Has bytes which would have to be escaped in a buffer literal */
+    std::string blob("\0\x01\xff\"\"\"\\blob\n", 11);
+    std::FILE* file = std::fopen("kh_embed_test.bin", "wb");
+    KH_TEST_ASSERT(file);
+    std::fwrite(blob.data(), 1, blob.size(), file);
+    std::fclose(file);
+
+    {
+        std::vector<LexException> lex_exceptions;
+        LexerContext lexer_context{"embed \"kh_embed_test.bin\" as blob;\n"
+                                   "private embed \"kh_missing_file.bin\" as missing;\n"
+                                   "embed not_embedded = embed();\n",
+                                   lex_exceptions};
+        TokenStream tokens = lex(lexer_context);
+        std::vector<ParseException> parse_exceptions;
+        ParserContext parser_context{tokens, parse_exceptions};
+        AstModule ast = parseWhole(parser_context);
+        std::remove("kh_embed_test.bin");
+
+        KH_TEST_ASSERT(lex_exceptions.empty());
+        KH_TEST_ASSERT(parse_exceptions.size() == 1);
+        KH_TEST_ASSERT(parse_exceptions[0].what == "unable to embed the file `kh_missing_file.bin`");
+        KH_TEST_ASSERT(ast.variables.size() == 3);
+
+        const AstDeclaration& embedded = ast.variables[0];
+        KH_TEST_ASSERT(embedded.var_name == "blob");
+        KH_TEST_ASSERT(embedded.var_type.identifiers == std::vector<std::string>{"buffer"});
+        KH_TEST_ASSERT(embedded.expression);
+
+        const AstValue* value = (const AstValue*)embedded.expression;
+        KH_TEST_ASSERT(value->value_type == AstValue::BUFFER);
+        KH_TEST_ASSERT(value->embedded);
+        KH_TEST_ASSERT(std::string(value->bufferData(), value->bufferSize()) == blob);
+
+        KH_TEST_ASSERT(ast.variables[1].var_name == "missing");
+        KH_TEST_ASSERT(!ast.variables[1].is_public);
+        KH_TEST_ASSERT(!ast.variables[1].expression);
+
+        /* Without a path, `embed` is just a name */
+        KH_TEST_ASSERT(ast.variables[2].var_name == "not_embedded");
+        KH_TEST_ASSERT(ast.variables[2].var_type.identifiers == std::vector<std::string>{"embed"});
+    }
+    return;
+error:
+    std::remove("kh_embed_test.bin");
+    errors_ptr->back() += "parserEmbedTest";
+}
+
+#ifdef KH_COUNT_ALLOCATIONS
+/* Counts the allocations of parsing an already lexed source */
+static size_t countParseAllocations(const std::string& source) {
+    LexResult result = lex(source);
+    std::vector<ParseException> parse_exceptions;
+    ParserContext parser_context{result.tokens, parse_exceptions};
+
+    startCounting();
+    AstModule ast = parseWhole(parser_context);
+    return stopCounting();
+}
+
+static void parserAllocationTest() {
+    /* Consuming a token on its own doesn't allocate, so twice as many tokens don't make any more
+     * allocations. Only the function with the body does */
+    std::string short_source, long_source;
+    for (size_t i = 0; i < 1000; i++) {
+        short_source += "; ";
+        long_source += "; ;";
+    }
+    short_source += "def f() {";
+    long_source += "def f() {";
+    for (size_t i = 0; i < 1000; i++) {
+        short_source += "; ";
+        long_source += "; ;";
+    }
+    short_source += "}";
+    long_source += "}";
+
+    KH_TEST_ASSERT(countParseAllocations(short_source) == countParseAllocations(long_source));
+    KH_TEST_ASSERT(countParseAllocations("; ; ;") == 0);
+    return;
+error:
+    errors_ptr->back() += "parserAllocationTest";
+}
+
+static void parserMoveTest() {
+    /* Subtrees are moved into their parents instead of being copied on the way up. Parsing still
+     * has to grow the vectors, but a module with thousands of functions costs less allocations to
+     * parse than copying its functions twice */
+    std::string source;
+    for (size_t i = 0; i < 2000; i++) {
+        source += "def f" + std::to_string(i) +
+                  "!(T)(int a, float[2] b, list!(T) c) -> int { a = b; return c[a]; }\n";
+    }
+
+    LexResult result = lex(source);
+    std::vector<ParseException> parse_exceptions;
+    ParserContext parser_context{result.tokens, parse_exceptions};
+
+    startCounting();
+    AstModule ast = parseWhole(parser_context);
+    size_t parse_count = stopCounting();
+
+    startCounting();
+    std::vector<AstFunction> copy = ast.functions;
+    size_t copy_count = stopCounting();
+
+    KH_TEST_ASSERT(result.ok());
+    KH_TEST_ASSERT(parse_exceptions.empty());
+    KH_TEST_ASSERT(ast.functions.size() == 2000);
+    KH_TEST_ASSERT(parse_count < 2 * copy_count);
+    return;
+error:
+    stopCounting();
+    errors_ptr->back() += "parserMoveTest";
+}
+#endif
+
+/* Parses a source both serially and in parallel chunks of a few tokens, which have to come out the
+ * same, down to the exceptions */
+static bool parsesSameInParallel(const std::string& source) {
+    LexResult result = lex(source);
+
+    std::vector<ParseException> serial_exceptions;
+    ParserContext serial_context{result.tokens, serial_exceptions};
+    AstModule serial = parseWhole(serial_context);
+
+    std::vector<ParseException> parallel_exceptions;
+    ParserContext parallel_context{result.tokens, parallel_exceptions};
+    AstModule parallel = parseParallel(parallel_context, 4, 8);
+
+    if (strfy(serial) != strfy(parallel) || serial_exceptions.size() != parallel_exceptions.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < serial_exceptions.size(); i++) {
+        if (serial_exceptions[i].format() != parallel_exceptions[i].format() ||
+            serial_exceptions[i].index != parallel_exceptions[i].index) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void parserParallelTest() {
+    std::string source = "import stuff;\n";
+    for (size_t i = 0; i < 50; i++) {
+        std::string n = std::to_string(i);
+        source += "def f" + n + "(int a) -> int { if a { return a[" + n + "]; } return 0; }\n"
+                  "public class C" + n + " { int x; def m() { x = def () { return 1; }; } }\n"
+                  "enum E" + n + " { A, B }\n"
+                  "float[3] v" + n + " = [1, 2, 3];\n";
+    }
+
+    /* Broken code is put in between these, at line starts */
+    size_t third = source.find('\n', source.size() / 3) + 1;
+    size_t half = source.find('\n', source.size() / 2) + 1;
+    std::string first = source.substr(0, third), second = source.substr(third, half - third),
+                last = source.substr(half);
+
+    KH_TEST_ASSERT(parsesSameInParallel(source));
+
+    /* A function which isn't closed makes the chunks after it one, up to a stray `}` if there's one */
+    KH_TEST_ASSERT(parsesSameInParallel(first + "def broken() {\n" + second + last));
+    KH_TEST_ASSERT(parsesSameInParallel(first + "def broken() {\n" + second + "}\n" + last));
+
+    /* After a stray `]`, chunks start at the inner functions while they're still in the body of the
+     * outer one, which is longer than a chunk. Such a chunk is skipped, the one before runs over its
+     * start and stops where no chunk starts */
+    {
+        std::string broken = "def broken() { x = a];";
+        for (size_t i = 0; i < 60; i++) {
+            broken += " def inner() {}";
+        }
+        broken += " y; }\n";
+        KH_TEST_ASSERT(parsesSameInParallel(first + broken + second + last));
+    }
+    KH_TEST_ASSERT(parsesSameInParallel(first + second + "int x = (;\n" + last));
+    KH_TEST_ASSERT(parsesSameInParallel(first + second + "}}) def;\n" + last));
+    KH_TEST_ASSERT(parsesSameInParallel(""));
+    return;
+error:
+    errors_ptr->back() += "parserParallelTest";
+}
+
+static void parserSkeletonTest() {
+    std::string source = "def f(int a) -> int { if a { return {1: 2}[a]; } return 0; }\n"
+                         "class C { int x; def m() { x = def () { return 1; }; } }\n"
+                         "int v = def (int b) { return b; }(1);\n"
+                         "def broken() { x = ; }\n";
+    LexResult result = lex(source);
+
+    std::vector<ParseException> full_exceptions;
+    ParserContext full_context{result.tokens, full_exceptions};
+    AstModule full = parseWhole(full_context);
+
+    std::vector<ParseException> parse_exceptions;
+    ParserContext parser_context{result.tokens, parse_exceptions};
+    parser_context.skeleton = true;
+    AstModule ast = parseWhole(parser_context);
+
+    /* Nothing in the bodies is parsed, or reported yet */
+    KH_TEST_ASSERT(!full_exceptions.empty());
+    KH_TEST_ASSERT(parse_exceptions.empty());
+    KH_TEST_ASSERT(ast.functions.size() == 2);
+    KH_TEST_ASSERT(ast.functions[0].lazy_body != nullptr && ast.functions[0].body.empty());
+    KH_TEST_ASSERT(ast.user_types[0].methods[0].lazy_body != nullptr);
+
+    /* Bodies needed by many threads at once are parsed once, the same as parsing them right away */
+    {
+        std::vector<const std::vector<AstBody*>*> bodies(4);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < bodies.size(); i++) {
+            threads.emplace_back(
+                [&ast, &bodies, i]() { bodies[i] = &parseLazyBody(ast.functions[0]); });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        KH_TEST_ASSERT(bodies[0] == &ast.functions[0].lazy_body->body);
+        KH_TEST_ASSERT(bodies[1] == bodies[0] && bodies[2] == bodies[0] && bodies[3] == bodies[0]);
+    }
+    KH_TEST_ASSERT(strfy(ast) == strfy(full));
+    KH_TEST_ASSERT(ast.lazy_source->exceptions.size() == full_exceptions.size());
+
+    /* A broken body is only parsed up to where its curly brackets were matched */
+    {
+        std::string broken_source = "def a() { f(; }\ndef b() { g; }\n";
+        LexResult broken = lex(broken_source);
+        std::vector<ParseException> exceptions;
+        ParserContext context{broken.tokens, exceptions};
+        context.skeleton = true;
+        AstModule skeleton = parseWhole(context);
+
+        KH_TEST_ASSERT(skeleton.functions.size() == 2);
+        parseLazyBody(skeleton.functions[0]);
+        KH_TEST_ASSERT(!skeleton.lazy_source->exceptions.empty());
+        for (const ParseException& exc : skeleton.lazy_source->exceptions) {
+            KH_TEST_ASSERT(exc.index < skeleton.functions[1].index);
+        }
+        KH_TEST_ASSERT(parseLazyBody(skeleton.functions[1]).size() == 1);
+    }
+
+#ifdef KH_COUNT_ALLOCATIONS
+    /* Skipping a longer body doesn't allocate any more */
+    {
+        std::string short_source = "def f() {", long_source = "def f() {";
+        for (size_t i = 0; i < 1000; i++) {
+            short_source += "a = b;";
+            long_source += "if a { a = [b, c]; } a = b;";
+        }
+        short_source += "}";
+        long_source += "}";
+
+        size_t counts[2];
+        std::string* sources[2] = {&short_source, &long_source};
+        for (size_t i = 0; i < 2; i++) {
+            LexResult lexed = lex(*sources[i]);
+            std::vector<ParseException> exceptions;
+            ParserContext context{lexed.tokens, exceptions};
+            context.skeleton = true;
+
+            startCounting();
+            AstModule skeleton = parseWhole(context);
+            counts[i] = stopCounting();
+        }
+        KH_TEST_ASSERT(counts[0] == counts[1]);
+    }
+#endif
+    return;
+error:
+    errors_ptr->back() += "parserSkeletonTest";
+}
+
+static void parserFlatAstTest() {
+    std::string source = "def f(int a, float b = 1.5) -> int {\n"
+                         "    x = [1, 2][0] + (a, b).c(3) * -d++;\n"
+                         "    if a < b <= 3 { return; } elif b { break; } else { return 'c'; }\n"
+                         "    while x { continue; }\n"
+                         "    do { y = {1: 2, 3: 4}; } while z;\n"
+                         "    for i, i < 10, i += 1 { a = b if c else d; }\n"
+                         "    for e : items { s = \"string\" \"concatenated\"; }\n"
+                         "    l = def (int q) { return q ^ 2; };\n"
+                         "    ref int r = a;\n"
+                         "    g = !h & i | j == k and l;\n"
+                         "}\n"
+                         "def g() { h = 2i + 0x10 - 3.25 - b\"bytes\"; }\n";
+
+    LexResult result = lex(source);
+    std::vector<ParseException> parse_exceptions;
+    ParserContext parser_context{result.tokens, parse_exceptions};
+    AstModule ast = parseWhole(parser_context);
+
+    AstArena arena;
+    size_t exception_count;
+
+    KH_TEST_ASSERT(result.ok());
+    KH_TEST_ASSERT(parse_exceptions.empty());
+    KH_TEST_ASSERT(ast.functions.size() == 2);
+
+    /* Converting back gives the same tree */
+    {
+        FlatAst flat;
+        for (const AstFunction& function : ast.functions) {
+            FlatId id = flat.add(&function);
+            KH_TEST_ASSERT(flat.nodes[id].kind == FlatKind::FUNCTION);
+            KH_TEST_ASSERT(strfy(*flat.toAst(id, arena)) == strfy(function));
+        }
+    }
+
+    /* Nodes are laid out in the order they're visited */
+    {
+        FlatAst flat;
+        FlatId id = flat.add(parseExpressionSource("a + b * 2;", arena, exception_count));
+        KH_TEST_ASSERT(exception_count == 0);
+        KH_TEST_ASSERT(id == 0);
+        KH_TEST_ASSERT(flat.nodes.size() == 5);
+        KH_TEST_ASSERT(flat.nodes[0].kind == FlatKind::BINARY);
+        KH_TEST_ASSERT((Operator)flat.nodes[0].op == Operator::ADD);
+        KH_TEST_ASSERT(flat.childCount(0) == 2);
+        KH_TEST_ASSERT(flat.child(0, 0) == 1 && flat.child(0, 1) == 2);
+        KH_TEST_ASSERT(flat.nodes[2].kind == FlatKind::BINARY);
+        KH_TEST_ASSERT(flat.child(2, 0) == 3 && flat.child(2, 1) == 4);
+        KH_TEST_ASSERT(flat.nodes[4].kind == FlatKind::CONSTANT);
+        KH_TEST_ASSERT(flat.numbers[flat.nodes[4].payload] == 2);
+        KH_TEST_ASSERT(flat.child(0, 2) == FLAT_NONE);
+    }
+    return;
+error:
+    errors_ptr->back() += "parserFlatAstTest";
+}
+
+static void parserStreamTest() {
+    std::string source = "import std;\n"
+                         "class Point {\n"
+                         "    float x, y;\n"
+                         "    def length() -> float { return (x ^ 2 + y ^ 2) ^ 0.5; }\n"
+                         "}\n"
+                         "def main() {\n"
+                         "    Point p = Point(3.0, 4.0);\n"
+                         "    if p.length() == 5.0 { std.print(\"ok\"); }\n"
+                         "    else { std.print(\"not ok\"); }\n"
+                         "}\n"
+                         "enum Color { RED, GREEN, BLUE }\n"
+                         "int broken = ;\n"
+                         "def missingEnd() { return";
+
+    std::vector<LexException> lex_exceptions;
+    LexerContext lexer_context{source, lex_exceptions};
+    TokenStream tokens = lex(lexer_context);
+    std::vector<ParseException> parse_exceptions;
+    ParserContext parser_context{tokens, parse_exceptions};
+    AstModule ast = parseWhole(parser_context);
+
+    KH_TEST_ASSERT(lex_exceptions.empty());
+    KH_TEST_ASSERT(!parse_exceptions.empty());
+
+    /* Parsing pulled tokens has to come up with the same AST and errors, however small the chunks
+     * and the lookahead are */
+    for (size_t chunk_size : {1, 7, 64}) {
+        std::FILE* file = std::tmpfile();
+        KH_TEST_ASSERT(file);
+        std::fwrite(source.data(), 1, source.size(), file);
+        std::rewind(file);
+
+        std::vector<LexException> stream_lex_exceptions;
+        std::vector<ParseException> stream_parse_exceptions;
+        StreamLexer stream(file, stream_lex_exceptions, 1, chunk_size);
+        ParserContext stream_context{stream.tokens, stream_parse_exceptions};
+        stream_context.stream = &stream;
+        AstModule stream_ast = parseWhole(stream_context);
+        std::fclose(file);
+
+        KH_TEST_ASSERT(stream_lex_exceptions.empty());
+        KH_TEST_ASSERT(strfy(stream_ast) == strfy(ast));
+        KH_TEST_ASSERT(stream_parse_exceptions.size() == parse_exceptions.size());
+        for (size_t i = 0; i < parse_exceptions.size(); i++) {
+            KH_TEST_ASSERT(stream_parse_exceptions[i].what == parse_exceptions[i].what);
+            KH_TEST_ASSERT(stream_parse_exceptions[i].index == parse_exceptions[i].index);
+            KH_TEST_ASSERT(stream_parse_exceptions[i].line == parse_exceptions[i].line);
+            KH_TEST_ASSERT(stream_parse_exceptions[i].column == parse_exceptions[i].column);
+        }
+    }
+    return;
+error:
+    errors_ptr->back() += "parserStreamTest";
+}
+
+/* Collects the byte offsets of every node of a module, which `strfy` leaves out */
+static std::vector<size_t> moduleOffsets(const AstModule& ast) {
+    FlatAst flat;
+    std::vector<size_t> offsets;
+
+    for (const AstImport& import : ast.imports) {
+        offsets.push_back(import.index);
+    }
+    for (const AstFunction& function : ast.functions) {
+        flat.add(&function);
+    }
+    for (const AstUserType& user_type : ast.user_types) {
+        offsets.push_back(user_type.index);
+        for (const AstDeclaration& member : user_type.members) {
+            flat.add(&member);
+        }
+        for (const AstFunction& method : user_type.methods) {
+            flat.add(&method);
+        }
+    }
+    for (const AstEnumType& enum_type : ast.enums) {
+        offsets.push_back(enum_type.index);
+    }
+    for (const AstDeclaration& variable : ast.variables) {
+        flat.add(&variable);
+    }
+
+    for (const FlatNode& node : flat.nodes) {
+        offsets.push_back(node.index);
+    }
+    return offsets;
+}
+
+static void parserReparseTest() {
+    const char* pieces[] = {"import stuff;\n", "def f(int a) -> int {\n", "    return a;\n",
+                            "    if a { b = [1, 2]; }\n", "    x = def () { return 1; };\n", "}\n",
+                            "class C { int x; def m() { x = 1; } }\n", "enum E { A, B }\n",
+                            "int v = (1 + 2) * 3;\n", "int broken = ;\n", "def g() { f(; }\n"};
+    const size_t piece_count = sizeof(pieces) / sizeof(pieces[0]);
+    const char* insertions[] = {"", " ", "\n", "x", "1", ";", "{", "}", "(", ")", "def h() {}\n",
+                                "y = 2;\n", "class"};
+    const size_t insertion_count = sizeof(insertions) / sizeof(insertions[0]);
+
+    /* Edits are applied one after another, each reparse has to match parsing the whole edited source
+     * again, down to the offsets and the exceptions. The offsets are only settled after some of the
+     * edits, so what's left to move them by adds up over many reparses */
+    uint32_t seed = 12345;
+    auto random = [&](size_t range) -> size_t {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % range;
+    };
+
+    for (size_t round = 0; round < 20; round++) {
+        std::string source;
+        for (size_t piece = 0; piece < 40; piece++) {
+            source += pieces[random(piece_count)];
+        }
+
+        std::vector<LexException> lex_exceptions;
+        LexerContext lexer_context{source, lex_exceptions};
+        TokenStream tokens = lex(lexer_context);
+
+        std::vector<ParseException> exceptions;
+        ParserContext context{tokens, exceptions};
+        context.incremental = true;
+        AstModule ast = parseWhole(context);
+        KH_TEST_ASSERT(ast.spans != nullptr);
+
+        for (size_t edit_count = 0; edit_count < 30; edit_count++) {
+            SourceEdit edit;
+            edit.index = random(source.size() + 1);
+            edit.removed = std::min(random(4), source.size() - edit.index);
+            edit.inserted = insertions[random(insertion_count)];
+            TokenEdit token_edit = relex(source, tokens, lex_exceptions, edit);
+            ast = reparse(context, std::move(ast), token_edit);
+
+            LexResult result = lex(source);
+            std::vector<ParseException> expected_exceptions;
+            ParserContext expected_context{result.tokens, expected_exceptions};
+            AstModule expected = parseWhole(expected_context);
+
+            KH_TEST_ASSERT(strfy(ast) == strfy(expected));
+            if (random(3) == 0) {
+                settleOffsets(ast);
+                KH_TEST_ASSERT(moduleOffsets(ast) == moduleOffsets(expected));
+            }
+            KH_TEST_ASSERT(exceptions.size() == expected_exceptions.size());
+            for (size_t i = 0; i < exceptions.size(); i++) {
+                KH_TEST_ASSERT(exceptions[i].what == expected_exceptions[i].what);
+                KH_TEST_ASSERT(exceptions[i].index == expected_exceptions[i].index);
+                KH_TEST_ASSERT(exceptions[i].line == expected_exceptions[i].line);
+                KH_TEST_ASSERT(exceptions[i].column == expected_exceptions[i].column);
+            }
+        }
+    }
+    return;
+error:
+    errors_ptr->back() += "parserReparseTest";
+}
+
+/* Makes a function whose first statement is `prefix`, `depth` levels of `open`, `middle`, as many
+ * levels of `close` and then `suffix`. The second statement is `y = 2;` */
+static std::string nestedSource(const std::string& prefix, const std::string& open,
+                                const std::string& middle, const std::string& close,
+                                const std::string& suffix, size_t depth) {
+    std::string source = "def f() { " + prefix;
+    for (size_t i = 0; i < depth; i++) {
+        source += open;
+    }
+    source += middle;
+    for (size_t i = 0; i < depth; i++) {
+        source += close;
+    }
+    return source + suffix + " y = 2; }\n";
+}
+
+static void parserNestingTest() {
+    /* The prefix, each level's opening, the middle, each level's closing and the suffix. Types are
+     * nested in generic arguments. Chains of operators, calls and subscripts nest without brackets */
+    const char* constructs[][5] = {{"x = ", "(", "1", ")", ";"},
+                                   {"x = ", "[", "1", "]", ";"},
+                                   {"x = ", "{1: ", "2", "}", ";"},
+                                   {"x = ", "-", "1", "", ";"},
+                                   {"", "if a { ", "b;", " }", ""},
+                                   {"x = ", "def () { ", "", " };", ""},
+                                   {"", "a!(", "int", ")", " v;"},
+                                   {"x = ", "a!", "b", "", ";"},
+                                   {"x = ", "1 + ", "1", "", ";"},
+                                   {"x = ", "2 ^ ", "2", "", ";"},
+                                   {"", "a = ", "a", "", ";"},
+                                   {"x = ", "1 if a else ", "1", "", ";"},
+                                   {"x = a", "[0]", "", "", ";"},
+                                   {"x = a", "(1)", "", "", ";"},
+                                   {"x = a", "++", "", "", ";"}};
+
+    for (size_t i = 0; i < sizeof(constructs) / sizeof(constructs[0]); i++) {
+        std::string prefix = constructs[i][0], open = constructs[i][1], middle = constructs[i][2],
+                    close = constructs[i][3], suffix = constructs[i][4];
+
+        /* Deep enough to overflow the stack, if it were parsed by recursing through every level.
+         * Everything past the limit is skipped, so nesting it twice as deep doesn't allocate any
+         * more */
+        size_t counts[2];
+        for (size_t j = 0; j < 2; j++) {
+            std::string source =
+                nestedSource(prefix, open, middle, close, suffix, 100000 * (j + 1));
+
+            LexResult result = lex(source);
+            std::vector<ParseException> exceptions;
+            ParserContext context{result.tokens, exceptions};
+
+            startCounting();
+            AstModule ast = parseWhole(context);
+            counts[j] = stopCounting();
+
+            KH_TEST_ASSERT(result.ok());
+            KH_TEST_ASSERT(exceptions.size() == 1);
+            KH_TEST_ASSERT(exceptions[0].what.find("nested too deeply") != std::string::npos);
+
+            /* The statement after it is still parsed */
+            KH_TEST_ASSERT(ast.functions.size() == 1);
+            KH_TEST_ASSERT(!ast.functions[0].body.empty());
+            KH_TEST_ASSERT(ast.functions[0].body.back()->index == source.find("y = 2;") + 2);
+        }
+        KH_TEST_ASSERT(counts[0] == counts[1]);
+
+        /* Nesting up to the limit is fine, which can be set lower */
+        {
+            std::string source = nestedSource(prefix, open, middle, close, suffix, 100);
+
+            LexResult result = lex(source);
+            std::vector<ParseException> exceptions;
+            ParserContext context{result.tokens, exceptions};
+            parseWhole(context);
+            KH_TEST_ASSERT(exceptions.empty());
+
+            context.max_depth = 50;
+            parseWhole(context);
+            KH_TEST_ASSERT(exceptions.size() == 1);
+        }
+    }
+
+    /* A return type is skipped up until the body */
+    {
+        std::string source = "def f() -> ";
+        for (size_t i = 0; i < 200000; i++) {
+            source += "a!";
+        }
+        source += "b { y = 2; }\n";
+
+        LexResult result = lex(source);
+        std::vector<ParseException> exceptions;
+        ParserContext context{result.tokens, exceptions};
+        AstModule ast = parseWhole(context);
+
+        KH_TEST_ASSERT(exceptions.size() == 1);
+        KH_TEST_ASSERT(exceptions[0].what.find("nested too deeply") != std::string::npos);
+        KH_TEST_ASSERT(ast.functions.size() == 1);
+        KH_TEST_ASSERT(ast.functions[0].body.size() == 1);
+    }
+    return;
+error:
+    stopCounting();
+    errors_ptr->back() += "parserNestingTest";
+}
+
+static void parserRecoveryTest() {
+    /* A mistake is reported once rather than for every token after it in the same statement or
+     * declaration, and what follows is still parsed */
+    {
+        std::string source = "def f() {\n    x = 1 2 3 4 5;\n    y = 2;\n}\n"
+                             "int v = 1 2 3;\n@ @ @ @\ndef g() {}\n";
+        LexResult result = lex(source);
+        std::vector<ParseException> exceptions;
+        ParserContext context{result.tokens, exceptions};
+        AstModule ast = parseWhole(context);
+
+        KH_TEST_ASSERT(exceptions.size() == 3);
+        KH_TEST_ASSERT(exceptions[0].line == 2);
+        KH_TEST_ASSERT(exceptions[1].line == 5);
+        KH_TEST_ASSERT(exceptions[2].line == 6);
+
+        KH_TEST_ASSERT(ast.functions.size() == 2);
+        KH_TEST_ASSERT(ast.functions[0].body.size() == 2);
+        KH_TEST_ASSERT(ast.variables.size() == 1);
+    }
+
+    /* The parse stops once it runs out of errors */
+    {
+        std::string source;
+        for (size_t i = 0; i < 1000; i++) {
+            source += "def f" + std::to_string(i) + "() { x = 1 2; }\n";
+        }
+
+        LexResult result = lex(source);
+        std::vector<ParseException> exceptions;
+        ParserContext context{result.tokens, exceptions};
+        context.max_errors = 10;
+        AstModule ast = parseWhole(context);
+
+        KH_TEST_ASSERT(exceptions.size() == 11);
+        KH_TEST_ASSERT(exceptions.back().what == "too many errors, stopped parsing");
+        KH_TEST_ASSERT(ast.functions.size() == 10);
+
+        context.max_errors = 0;
+        ast = parseWhole(context);
+        KH_TEST_ASSERT(exceptions.size() == 1000);
+        KH_TEST_ASSERT(ast.functions.size() == 1000);
+    }
+
+    /* Garbage only raises an exception here and there, as it's mostly skipped through */
+    {
+        const char* pieces[] = {"(", ")", "{", "}", "[", "]", ";", ",", "x",
+                                "1", "+", "=", ".", "!", "def", "if", "class"};
+        size_t piece_count = sizeof(pieces) / sizeof(pieces[0]);
+
+        uint32_t seed = 12345;
+        std::string source;
+        for (size_t i = 0; i < 200000; i++) {
+            seed = seed * 1103515245 + 12345;
+            source += pieces[(seed >> 16) % piece_count];
+            source += ' ';
+        }
+
+        LexResult result = lex(source);
+        std::vector<ParseException> exceptions;
+        ParserContext context{result.tokens, exceptions};
+        context.max_errors = 0;
+        parseWhole(context);
+        KH_TEST_ASSERT(exceptions.size() < result.tokens.size() / 50);
+
+        context.max_errors = KH_PARSE_MAX_ERRORS;
+        parseWhole(context);
+        KH_TEST_ASSERT(exceptions.size() <= KH_PARSE_MAX_ERRORS + 1);
+        KH_TEST_ASSERT(exceptions.back().what == "too many errors, stopped parsing");
+    }
+    return;
+error:
+    errors_ptr->back() += "parserRecoveryTest";
+}
+
 void kh_test::parserTest(std::vector<std::string>& errors) {
     errors_ptr = &errors;
     parserImportTest();
+    parserExpressionTest();
+    parserEmbedTest();
+#ifdef KH_COUNT_ALLOCATIONS
+    parserAllocationTest();
+    parserMoveTest();
+#endif
+    parserParallelTest();
+    parserSkeletonTest();
+    parserFlatAstTest();
+    parserStreamTest();
+    parserReparseTest();
+    parserNestingTest();
+    parserRecoveryTest();
 }
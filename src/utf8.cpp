@@ -97,3 +97,61 @@ std::u32string kh::decodeUtf8(const std::string& str) {
 
     return str32;
 }
+
+char32_t kh::decodeUtf8Char(const std::string& str, size_t index, size_t& length) {
+    const char* error = nullptr;
+    size_t error_index;
+    char32_t chr = decodeUtf8Char(str, index, length, error, error_index);
+
+    if (error) {
+        throw Utf8DecodingException(error, error_index);
+    }
+    return chr;
+}
+
+char32_t kh::decodeUtf8Char(const std::string& str, size_t index, size_t& length, const char*& error,
+                            size_t& error_index) {
+    uint8_t chr = str[index];
+    uint32_t temp;
+
+    if (chr < 128) {
+        length = 1;
+        return chr;
+    }
+    else if ((chr & 0b11100000) == 0b11000000) {
+        temp = chr & 0b00011111;
+        length = 2;
+    }
+    else if ((chr & 0b11110000) == 0b11100000) {
+        temp = chr & 0b00001111;
+        length = 3;
+    }
+    else if ((chr & 0b11111000) == 0b11110000) {
+        temp = chr & 0b00000111;
+        length = 4;
+    }
+    else {
+        error = "invalid start byte";
+        error_index = index;
+        return 0;
+    }
+
+    for (size_t i = index + 1; i < index + length; i++) {
+        if (i >= str.size()) {
+            error = "expected continuation byte but hit end of file";
+            error_index = i - 1;
+            return 0;
+        }
+
+        chr = str[i];
+        if ((chr & 0b11000000) != 0b10000000) {
+            error = "expected continuation byte";
+            error_index = i;
+            return 0;
+        }
+
+        temp = (temp << 6) + (chr & 0b00111111);
+    }
+
+    return temp;
+}
@@ -0,0 +1,118 @@
+"""
+This file is a part of the Kithare programming language source code.
+The source code for Kithare programming language is distributed under the MIT
+license.
+Copyright (C) 2021 Kithare Organization
+
+xidtables.py
+Generates 'src/parser/xid.cpp', the lookup tables of the Unicode XID_Start and
+XID_Continue properties which the lexer classifies identifier characters with.
+
+The properties are taken from the Unicode database Python was built with, as
+Python identifiers are defined by the same properties. Run this file with
+'python3 xidtables.py' after updating Python to pick up a newer Unicode version.
+
+Code points are split into blocks of 256. Every block of both properties is a
+256-bit bitmap, and the identical bitmaps are only stored once. So a lookup is
+an index into the first level for the block, and then a bit test in the second.
+"""
+
+import unicodedata
+from pathlib import Path
+
+BLOCK_SIZE = 256
+BLOCK_COUNT = 0x110000 // BLOCK_SIZE
+OUTPUT_PATH = Path(__file__).parent / "src" / "parser" / "xid.cpp"
+
+HEADER = """/*
+ * This file is a part of the Kithare programming language source code.
+ * The source code for Kithare programming language is distributed under the MIT license.
+ * Copyright (C) 2021 Kithare Organization
+ */
+
+/* Generated by xidtables.py from Unicode {version}, don't edit this by hand */
+
+#include <kithare/lexer.hpp>
+
+
+"""
+
+
+def is_xid_start(chr_):
+    """
+    Whether a character can start an identifier
+    """
+    return chr_.isidentifier()
+
+
+def is_xid_continue(chr_):
+    """
+    Whether a character can follow the start of an identifier
+    """
+    return ("a" + chr_).isidentifier()
+
+
+def make_blocks(predicate, bitmaps, bitmap_ids):
+    """
+    Splits a property into blocks, adding the bitmaps not seen before, and
+    returns the bitmap index of every block
+    """
+    blocks = []
+    for block in range(BLOCK_COUNT):
+        words = []
+        for word in range(BLOCK_SIZE // 32):
+            bits = 0
+            for bit in range(32):
+                if predicate(chr(block * BLOCK_SIZE + word * 32 + bit)):
+                    bits |= 1 << bit
+            words.append(bits)
+
+        words = tuple(words)
+        if words not in bitmap_ids:
+            bitmap_ids[words] = len(bitmaps)
+            bitmaps.append(words)
+        blocks.append(bitmap_ids[words])
+    return blocks
+
+
+def format_array(values, width, indent=4):
+    """
+    Formats values into lines which fit into the 104 column limit
+    """
+    lines = []
+    per_line = (104 - indent) // (width + 2)
+    for i in range(0, len(values), per_line):
+        line = ", ".join(f"{value:>{width}}" for value in values[i : i + per_line])
+        lines.append(" " * indent + line + ",")
+    return "\n".join(lines)
+
+
+def main():
+    """
+    Writes the tables
+    """
+    bitmaps = []
+    bitmap_ids = {}
+
+    start_blocks = make_blocks(is_xid_start, bitmaps, bitmap_ids)
+    continue_blocks = make_blocks(is_xid_continue, bitmaps, bitmap_ids)
+
+    if len(bitmaps) > 256:
+        raise ValueError("The bitmaps don't fit into 8-bit indexes anymore")
+
+    source = HEADER.format(version=unicodedata.unidata_version)
+    source += "const uint8_t kh::xid_start_blocks[XID_BLOCK_COUNT] = {\n"
+    source += format_array(start_blocks, 3) + "\n};\n\n"
+    source += "const uint8_t kh::xid_continue_blocks[XID_BLOCK_COUNT] = {\n"
+    source += format_array(continue_blocks, 3) + "\n};\n\n"
+    source += "const uint32_t kh::xid_bitmaps[][8] = {\n"
+    for words in bitmaps:
+        source += "    {" + ", ".join(f"0x{word:08X}" for word in words) + "},\n"
+    source += "};\n"
+
+    with open(OUTPUT_PATH, "w", encoding="utf-8", newline="\n") as f:
+        f.write(source)
+
+
+if __name__ == "__main__":
+    main()